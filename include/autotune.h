@@ -0,0 +1,66 @@
+//
+// --autotune: 短い試行を繰り返して producer 数とバッチの大きさを山登りで決める
+//
+
+#ifndef AUTOTUNE_H
+#define AUTOTUNE_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "pg_ingest.h"
+
+#define AUTOTUNE_MAX_PHASES 10      // 試行回数の上限 (最初の設定の測定を含む)
+#define AUTOTUNE_MIN_GAIN 0.05      // 最良より この割合以上速くなければ改善とみなさない
+#define AUTOTUNE_PHASE_MESHES 1024  // 1回の試行で取得する最小のメッシュ数
+#define AUTOTUNE_BUSY_RATIO 0.5     // キューの埋まり具合か書き込み待ちがこれを超えたら書き込み側が詰まっているとみなす
+#define DEFAULT_TUNING_FILE "mobaku_tuning.env"
+
+typedef struct {
+    int num_producers;
+    int batch_meshes;
+    size_t queue_depth;
+} TuningConfig;
+
+// 1回の試行の測定値
+typedef struct {
+    double rows_per_sec;    // 取得して書き込んだ (メッシュ x 時刻) の数 / 秒
+    double queue_occupancy; // データキューの平均の埋まり具合 (0〜1)
+    size_t queue_peak;      // データキューに同時に積まれていた最大の行列数
+    double writer_stall;    // ステージングが I/O スレッドの空きを待った時間の割合 (0〜1)
+} TuningSample;
+
+typedef enum {
+    AUTOTUNE_PRODUCERS = 0,
+    AUTOTUNE_BATCH,
+    AUTOTUNE_DONE,
+} AutotuneKnob;
+
+// 1つの値ずつ 2 倍/半分に動かし、速くなる間は同じ向きに進める (座標ごとの山登り)
+typedef struct {
+    TuningConfig current;   // 次に測る設定
+    TuningConfig best;
+    TuningSample best_sample;
+    AutotuneKnob knob;
+    int direction;          // +1 なら増やす、-1 なら減らす
+    bool improved;          // いまの knob で一度でも改善したか
+    bool reversed;          // いまの knob で逆向きを試したか
+    int max_producers;
+    int batch_align;        // バッチの大きさはこの倍数
+    int max_batch;
+    int phases;             // 測定済みの試行数
+} Autotuner;
+
+void init_autotuner(Autotuner *t, const TuningConfig *initial, int max_producers, int batch_align, int max_batch);
+
+// current を測った結果を渡す。次に測る設定を current に置いて true を返す。
+// 探索が終わったら false を返し、best (queue_depth を含む) が結果になる
+bool autotune_step(Autotuner *t, const TuningSample *s);
+
+// 結果を .env の形式で書き出す。MOBAKU_TUNING_FILE で指定すると次回以降の実行で読み込まれる。
+// 成功したら 0、失敗したら -1
+int write_tuning_file(const char *path, const TuningConfig *config, IngestScan scan);
+
+void print_tuning_sample(int phase, const TuningConfig *config, const TuningSample *s);
+
+#endif //AUTOTUNE_H
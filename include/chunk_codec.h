@@ -0,0 +1,60 @@
+//
+// population_data のフィルタ構成と、producer 側で HDF5 のフィルタと同じ形式にチャンクを圧縮する処理
+//
+
+#ifndef CHUNK_CODEC_H
+#define CHUNK_CODEC_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+// DEFLATE と DELTA_BITPACK は producer で圧縮できる。それ以外は HDF5 の書き込み時にフィルタが掛かる
+typedef enum {
+    CHUNK_CODEC_NONE = 0,           // 無圧縮
+    CHUNK_CODEC_DEFLATE,            // H5Z_FILTER_SHUFFLE → H5Z_FILTER_DEFLATE
+    CHUNK_CODEC_SCALEOFFSET,        // H5Z_FILTER_SCALEOFFSET (整数、ビット数はチャンクごとに自動)
+    CHUNK_CODEC_SCALEOFFSET_DEFLATE,    // H5Z_FILTER_SCALEOFFSET → H5Z_FILTER_DEFLATE
+    CHUNK_CODEC_ZSTD,               // H5Z_FILTER_SHUFFLE → 登録済みの zstd フィルタ (HDF5_PLUGIN_PATH から読み込む)
+    CHUNK_CODEC_DELTA_BITPACK,      // H5Z_FILTER_DELTA_BITPACK (時間方向の差分 + ビットパック、レベルは差分の回数)
+} ChunkCodec;
+
+#define DEFAULT_CHUNK_DEFLATE_LEVEL 4
+#define DEFAULT_CHUNK_ZSTD_LEVEL 3
+#define MAX_CHUNK_ZSTD_LEVEL 22
+
+// HDF Group に登録されている zstd フィルタの ID (cd_values[0] が圧縮レベル)
+#define H5Z_FILTER_ZSTD 32015
+
+// "none" / "deflate" / "scaleoffset" / "scaleoffset-deflate" / "zstd" / "delta-bitpack" をパースする。
+// NULL や空文字列は CHUNK_CODEC_NONE、不明な値は -1
+int parse_chunk_codec(const char *name);
+
+const char* chunk_codec_name(ChunkCodec codec);
+
+// producer で encode_chunk できるか
+bool chunk_codec_in_producer(ChunkCodec codec);
+
+// 圧縮レベルを取るか、取るならその既定値と範囲。取らなければ false
+bool chunk_codec_level_range(ChunkCodec codec, int *default_level, int *min_level, int *max_level);
+
+// nbytes のチャンクを圧縮したときの最大サイズ
+size_t chunk_codec_bound(ChunkCodec codec, size_t nbytes);
+
+// src (nbytes) がすべて 0 か。0 だけのチャンクは書かずに fill value のまま残す
+bool chunk_is_zero(const void *src, size_t nbytes);
+
+// src (nbytes, 要素サイズ elem_size、1行 row_elems 要素) を codec で圧縮し out に書く。
+// deflate は byte shuffle してから、delta-bitpack は1行前との差分を level 回取ってから詰める。
+// chunk_codec_in_producer でない codec は -1
+// 出力は HDF5 のフィルタを通したチャンクと同じで、H5Dwrite_chunk に filter mask 0 で渡せる。
+// scratch は nbytes 以上、out は chunk_codec_bound 以上の大きさであること。成功したら 0、失敗したら -1
+int encode_chunk(ChunkCodec codec, int level, const void *src, size_t nbytes, size_t elem_size, size_t row_elems,
+                 void *scratch, void *out, size_t *out_size);
+
+// encode_chunk (または HDF5 の同じフィルタ) の出力 src (size バイト) を展開し、out に nbytes ちょうどを書く。
+// H5Dread_chunk で読んだチャンクを HDF5 を通さずに展開するのに使う。
+// chunk_codec_in_producer でない codec は -1。scratch は nbytes 以上。成功したら 0、失敗したら -1
+int decode_chunk(ChunkCodec codec, const void *src, size_t size, size_t elem_size, void *scratch, void *out,
+                 size_t nbytes);
+
+#endif //CHUNK_CODEC_H
@@ -0,0 +1,47 @@
+//
+// メッシュ x 時刻チャンクの統計 (mesh_summary.h の chunk の区間) を索引にした、しきい値と上位 K 件の検索
+//
+// 区間に丸ごと入るチャンクの区間の統計から下限を、かかるすべての区間の統計から上限を作り (値は負でない)、
+// 索引だけで決まらない列についてだけ区間の端の population を読んで正確な値を出す。
+// 端は高々 2 つなので、読むのは決まらなかった列の端のチャンクだけになる
+//
+
+#ifndef CHUNK_INDEX_H
+#define CHUNK_INDEX_H
+
+#include <stdint.h>
+
+#include <hdf5.h>
+
+#include "population_reader.h"
+
+typedef enum {
+    CHUNK_QUERY_MAX = 0,    // 時間ごとの値の最大
+    CHUNK_QUERY_SUM,        // 時間ごとの値の合計
+} ChunkQueryStat;
+
+typedef struct {
+    hsize_t column;
+    int64_t value;
+} ChunkQueryHit;
+
+typedef struct {
+    uint64_t index_values;  // 読んだ索引の要素数
+    uint64_t values_read;   // 端を確かめるために展開した population の要素数
+    uint64_t scan_values;   // 全メッシュを population_data から読んだときに展開する要素数
+    hsize_t resolved;       // 索引だけでは決まらなかった列数
+} ChunkQueryCost;
+
+const char* chunk_query_stat_name(ChunkQueryStat stat);
+
+// 時刻 [t0, t1) の stat が threshold を超える列を昇順に *columns (呼び出し側で free) に入れ、その数を返す。
+// t1 は SUMMARY_ROWS_ATTR 以下であること。cost が NULL でなければ読んだ量を入れる。失敗したら -1
+long long chunk_index_above(PopulationReader *r, ChunkQueryStat stat, hsize_t t0, hsize_t t1, int64_t threshold,
+                            hsize_t **columns, ChunkQueryCost *cost);
+
+// 時刻 [t0, t1) の stat の大きい順に k 列を hits に入れ、その数を返す。同じ値なら列の小さい方を先にする。
+// t1 は SUMMARY_ROWS_ATTR 以下であること。cost が NULL でなければ読んだ量を入れる。失敗したら -1
+long long chunk_index_top_k(PopulationReader *r, ChunkQueryStat stat, hsize_t t0, hsize_t t1, size_t k,
+                            ChunkQueryHit *hits, ChunkQueryCost *cost);
+
+#endif //CHUNK_INDEX_H
@@ -0,0 +1,59 @@
+//
+// sysfs から CPU トポロジーを読み、スレッドの配置を決める
+//
+
+#ifndef CPU_TOPOLOGY_H
+#define CPU_TOPOLOGY_H
+
+#include <sched.h>    // cpu_set_t (利用側で _GNU_SOURCE を定義しておくこと)
+
+#define SYSFS_ROOT "/sys"
+
+typedef struct {
+    int cpu;
+    int core;       // (physical_package_id, core_id) ごとの物理コアの通し番号
+    int node;       // NUMA ノード。不明なら 0
+    int smt_rank;   // 同じ物理コアの中での順番。0 が最初の論理 CPU
+} CpuInfo;
+
+typedef struct {
+    CpuInfo *cpus;  // 使ってよい CPU を番号順に
+    int num_cpus;
+    int num_cores;
+    int num_nodes;  // ノード番号の最大値 + 1
+} CpuTopology;
+
+typedef struct {
+    int writer_cpu;     // HDF5 に書き込む consumer
+    int writer_node;
+    int meshlist_cpu;   // meshlist_producer (ほとんど待っているだけなので writer の SMT sibling に置く)
+    int *producer_cpus;
+    int num_producers;
+} ThreadPlacement;
+
+// "0-3,8,10-11" 形式の CPU リストを set に追加する。成功したら 0、形式が不正なら -1
+int parse_cpulist(const char *text, cpu_set_t *set);
+
+// sysfs_root 以下 (通常は SYSFS_ROOT) を読み、allowed に含まれる CPU のトポロジーを返す。
+// allowed が NULL なら sched_getaffinity の結果を使う。成功したら 0、失敗したら -1
+int load_cpu_topology(const char *sysfs_root, const cpu_set_t *allowed, CpuTopology *topo);
+
+void free_cpu_topology(CpuTopology *topo);
+
+// num_shards 個のプロセスで分け合うときに shard 番目が使う CPU。
+// 物理コアを交互に割り当て、コアが足りなければ論理 CPU、それも足りなければ全 CPU を返す
+void shard_cpu_set(const CpuTopology *topo, int shard, int num_shards, cpu_set_t *set);
+
+// path (まだなければその親ディレクトリ) があるブロックデバイスの NUMA ノード。分からなければ -1
+int path_numa_node(const char *sysfs_root, const char *path);
+
+// writer を writer_node (-1 なら最初の CPU のノード) の物理コアに置き、
+// producer はそれ以外の物理コアにノードを交互にたどって割り当て、足りなければ SMT sibling、さらに先頭から繰り返す。
+// 成功したら 0、失敗したら -1
+int plan_thread_placement(const CpuTopology *topo, int writer_node, int num_producers, ThreadPlacement *placement);
+
+void free_thread_placement(ThreadPlacement *placement);
+
+void print_thread_placement(const CpuTopology *topo, const ThreadPlacement *placement);
+
+#endif //CPU_TOPOLOGY_H
@@ -0,0 +1,64 @@
+//
+// 時系列向けの差分 + ビットパックの圧縮と、それを使う HDF5 フィルタ
+//
+// チャンクの int32 を1行 (stride 個) 前の値との差分 (order 2 なら差分の差分) にし、zigzag で符号を外してから
+// 512 個ずつのブロックを必要なビット数に詰める。ブロックは 16 レーン x 32 段の縦並びで、レーン i の値は
+// i % 16 番目、32 段分を各レーンの 32bit 語に順に詰める。メッシュ方向のチャンク幅が 16 ならレーンが
+// そのままメッシュになり、1 ブロックは 1 メッシュあたり 32 時間分になる。
+// この並びなら AVX-512 は1命令で 16 レーン、AVX2 は 8 レーンずつ2回、スカラーは1レーンずつ同じ形式を読み書きできる。
+//
+
+#ifndef DELTA_BITPACK_H
+#define DELTA_BITPACK_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <hdf5.h>
+
+// 256〜511 は HDF Group が私的な利用に空けている範囲
+#define H5Z_FILTER_DELTA_BITPACK 307
+
+#define DELTA_BITPACK_LANES 16
+#define DELTA_BITPACK_DEPTH 32
+#define DELTA_BITPACK_BLOCK (DELTA_BITPACK_LANES * DELTA_BITPACK_DEPTH)
+#define DELTA_BITPACK_HEADER 16
+
+#define DEFAULT_DELTA_BITPACK_ORDER 1
+#define MAX_DELTA_BITPACK_ORDER 2
+
+typedef enum {
+    DELTA_BITPACK_ISA_AUTO = 0,     // CPU が対応する一番速いもの
+    DELTA_BITPACK_ISA_SCALAR,
+    DELTA_BITPACK_ISA_AVX2,
+    DELTA_BITPACK_ISA_AVX512,
+} DeltaBitpackIsa;
+
+// 使うカーネルを固定する (テストとベンチ用)。CPU が対応していなければ -1
+int delta_bitpack_use_isa(DeltaBitpackIsa isa);
+
+// いま使われているカーネル
+DeltaBitpackIsa delta_bitpack_active_isa(void);
+
+const char* delta_bitpack_isa_name(DeltaBitpackIsa isa);
+
+// nbytes の入力を圧縮したときの最大サイズ
+size_t delta_bitpack_bound(size_t nbytes);
+
+// src の int32 (nbytes / 4 個) を stride 個前の値との差分を order 回取ってから詰め、out に書く。
+// out は delta_bitpack_bound 以上の大きさであること。成功したら 0、失敗したら -1
+int delta_bitpack_encode(const void *src, size_t nbytes, size_t stride, int order, void *out, size_t *out_size);
+
+// encode した size バイトを展開したときのバイト数。形式が壊れていれば 0
+size_t delta_bitpack_decoded_size(const void *src, size_t size);
+
+// encode した src を dst (dst_size 以上の大きさ) に展開する。成功したら 0、失敗したら -1
+int delta_bitpack_decode(const void *src, size_t size, void *dst, size_t dst_size);
+
+// HDF5 のフィルタクラス。cd_values は {order, 1行の要素数} で、後者は set_local がチャンク形状から入れる
+extern const H5Z_class2_t H5Z_DELTA_BITPACK[1];
+
+// このプロセスの HDF5 にフィルタを登録する。登録済みなら何もしない
+herr_t register_delta_bitpack_filter(void);
+
+#endif //DELTA_BITPACK_H
@@ -0,0 +1,21 @@
+//
+// population_data から作る写しと集計 (build_snapshot / build_rollups / build_summaries) に共通する main の流れ
+//
+
+#ifndef DERIVED_BUILD_H
+#define DERIVED_BUILD_H
+
+#include <hdf5.h>
+
+// population_data の先頭 rows 行から作る。成功したら 0、失敗したら -1
+typedef int (*DerivedBuildFn)(hid_t file_id, hsize_t rows, int num_workers);
+
+// 作り終えたファイルについて報告する。seconds は build にかかった時間
+typedef void (*DerivedReportFn)(hid_t file_id, double seconds);
+
+// 引数 "<hdf5_file> [workers]" のファイルを開き、LAST_INGESTED_HOUR_ATTR の時刻までの行で build を呼ぶ。
+// 属性がなければ (記録導入前のファイル) 時間軸の全体を使い、属性が -1 (取り込みが失敗したファイル) なら作らない。
+// main の戻り値 (成功したら 0、失敗したら 1) を返す
+int run_derived_build(int argc, char *argv[], DerivedBuildFn build, DerivedReportFn report);
+
+#endif //DERIVED_BUILD_H
@@ -6,27 +6,94 @@
 #define FIFIOQ_H
 
 #include <stdlib.h>
-#include <pthread.h>
-#include <semaphore.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <stdalign.h>
+#include <stdbool.h>
 
+// init_queue で使う既定の容量
 #define QUEUE_SIZE 1024
 
+// 空き/埋まりを待つときに futex で眠る前に回すスピン回数
+#define QUEUE_SPIN_LIMIT 1024
+
+#define QUEUE_CACHELINE 64
+
 typedef struct {
-    void *queue[QUEUE_SIZE];
-    int head;
-    int tail;
-    int count;
-    pthread_mutex_t mutex;
-    sem_t full;
-    sem_t empty;
+    atomic_size_t sequence;
+    void *data;
+} FIFOQueueCell;
+
+// 有界の lock-free MPMC リングバッファ (各セルの sequence で所有権を受け渡す方式)。
+// 満杯/空のときはしばらくスピンしてから futex で待つ
+typedef struct {
+    FIFOQueueCell *cells;
+    size_t mask;        // 容量 - 1 (容量は2のべき乗)
+    int spin_limit;     // CPU が1つならスピンしても相手は進まないので 0
+    alignas(QUEUE_CACHELINE) atomic_size_t tail;    // 次に書き込む位置
+    alignas(QUEUE_CACHELINE) atomic_size_t head;    // 次に読み出す位置
+    alignas(QUEUE_CACHELINE) _Atomic uint32_t items_event;  // 要素が増えるたびに進む futex ワード
+    atomic_int items_waiters;
+    alignas(QUEUE_CACHELINE) _Atomic uint32_t space_event;  // 空きが増えるたびに進む futex ワード
+    atomic_int space_waiters;
 } FIFOQueue;
 
 
+// 容量 QUEUE_SIZE で初期化する
 void init_queue(FIFOQueue *q);
 
+// 容量を指定して初期化する (2のべき乗に切り上げる)。成功したら 0、失敗したら -1
+int init_queue_with_capacity(FIFOQueue *q, size_t capacity);
+
+void destroy_queue(FIFOQueue *q);
+
+size_t queue_capacity(const FIFOQueue *q);
+
+// 積まれている要素数のおおよその値 (他のスレッドが操作中なら前後する)
+size_t queue_length(const FIFOQueue *q);
+
+// 満杯なら空くまで待つ
 void enqueue(FIFOQueue *q, void *data);
 
+// 空なら要素が来るまで待つ
 void *dequeue(FIFOQueue *q);
 
+// 待たずに試す。成功したら true
+bool try_enqueue(FIFOQueue *q, void *data);
+
+bool try_dequeue(FIFOQueue *q, void **data);
+
+// items の n 個をこの順に積む。空きが足りなければ全部積めるまで待つ
+void enqueue_batch(FIFOQueue *q, void *const *items, size_t n);
+
+// 少なくとも1個取り出せるまで待ち、その時点で取り出せるだけ (最大 max 個) を items に入れる。
+// 取り出した個数を返す
+size_t dequeue_batch(FIFOQueue *q, void **items, size_t max);
+
+
+// キューに積まれている (および producer が作成中の) データのバイト数の上限。
+// 上限を超える分は空くまで待たせ、待った時間を記録する
+typedef struct {
+    size_t limit;           // 0 なら無制限
+    atomic_size_t in_flight;
+    atomic_size_t peak;
+    _Atomic uint32_t event; // 解放のたびに進む futex ワード
+    atomic_int waiters;
+    _Atomic uint64_t stall_ns;
+    _Atomic uint64_t stalls;
+} ByteBudget;
+
+void init_byte_budget(ByteBudget *b, size_t limit);
+
+// bytes を確保できるまで待ち、待った時間 (ns) を返す。
+// limit を超える要求は他に何も確保されていなければ通す
+uint64_t byte_budget_acquire(ByteBudget *b, size_t bytes);
+
+void byte_budget_release(ByteBudget *b, size_t bytes);
+
+// 既定のメモリ予算 (物理メモリの半分)
+size_t default_memory_budget(void);
+
 
 #endif //FIFIOQ_H
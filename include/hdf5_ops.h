@@ -4,6 +4,8 @@
 #include "hdf5.h"
 #include <pthread.h>
 
+#include "pg_ingest.h"
+
 typedef struct {
     hid_t file_id;
     hid_t dataset_id;
@@ -15,4 +17,105 @@ hdf5_thread_safe_t* hdf5_create(const char* filename, const char* dataset_name,
 void hdf5_write(hdf5_thread_safe_t* hdf5, const void* data, hsize_t offset, hsize_t count);
 void hdf5_close(hdf5_thread_safe_t* hdf5);
 
+// 時刻 x メッシュの2次元データセットに行列を書き込む。
+// m->columns が NULL なら column_offset から連続する列、そうでなければ m->columns の各列に書き込む
+// 行は m->time_start から書き込み、データセットの時間軸を超える行は書かない
+herr_t write_pqdata_matrix(hid_t dataset_id, const PQdataMatrix *m, hsize_t column_offset);
+
+// 行列の書き込み内容。HDF5 を呼ばずに作れるので、書き込み中の I/O スレッドと並行して用意できる
+typedef struct {
+    PQdataMatrix *m;
+    bool chunked;           // chunk_order の行列を write_pqdata_matrix_chunks で書く
+    hsize_t rows;           // データセットの時間軸に収まる行数。0 なら書くものはない
+    int num_runs;
+    hsize_t (*runs)[2];     // 連続する列ごとの {データセット上の先頭列, 列数}
+} PQdataWrite;
+
+// m をデータセット (時間軸 dataset_rows 行) に書く内容を w に用意する。
+// m->columns が NULL なら column_offset からの連続した列に書く。成功したら 0、失敗したら -1
+int plan_pqdata_write(PQdataWrite *w, PQdataMatrix *m, hsize_t column_offset, hsize_t dataset_rows);
+
+// w を書く。time_chunk と mesh_chunk がデータセットのチャンク形状なら、値がすべて 0 で
+// まだ確保されていないチャンクには書かずに fill value のまま残す (0 ならすべて書く)
+herr_t execute_pqdata_write(hid_t dataset_id, const PQdataWrite *w, hsize_t time_chunk, hsize_t mesh_chunk);
+
+// runs と行列を解放する
+void free_pqdata_write(PQdataWrite *w);
+
+// chunk_order の行列を H5Dwrite_chunk でチャンクごとに書き込む。filtered があればそれを書く。
+// データセットは H5T_NATIVE_INT・チャンク形状 time_chunk x mesh_chunk で、
+// フィルタは filtered を作ったものと同じ (filtered がなければフィルタなし) であること。
+// すべて 0 のチャンクは、既に確保されているときだけ 0 で上書きする
+herr_t write_pqdata_matrix_chunks(hid_t dataset_id, const PQdataMatrix *m, hsize_t time_chunk, hsize_t mesh_chunk);
+
+// 最後に取り込んだ時刻インデックス (REFERENCE_MOBAKU_DATETIME からの時間数) を保持するファイル属性
+#define LAST_INGESTED_HOUR_ATTR "last_ingested_hour"
+
+// データセット作成プロパティに codec のフィルタを付ける (level は codec が圧縮レベルを取るときだけ使う)。
+// フィルタが使えなければ -1
+int set_population_filters(hid_t plist_id, ChunkCodec codec, int level);
+
+// 時間軸が H5S_UNLIMITED の rows x cols のチャンク化データセットを作る (fill value 0)。
+// codec のフィルタを付ける
+hid_t create_population_dataset(hid_t file_id, const char *name, hsize_t rows, hsize_t cols,
+                                hsize_t time_chunk, hsize_t mesh_chunk, ChunkCodec codec, int level);
+
+// --shards で列範囲ごとに書き込むファイルの名前。path が .h5 で終わればその前に -shardNN を入れる
+void shard_file_path(char *buf, size_t size, const char *path, int shard);
+
+// 各シャードファイルの name (時間軸が H5S_UNLIMITED、列数 shard_cols[k]) を列方向に並べた仮想データセットを作る。
+// シャードファイルは file_id と同じディレクトリに置き、basename で参照する (ディレクトリごと移動できる)
+hid_t create_virtual_population_dataset(hid_t file_id, const char *name, hsize_t rows,
+                                        const char *const *shard_paths, const hsize_t *shard_cols, int num_shards);
+
+// データセットのフィルタ構成を ChunkCodec として読む。どれにも当てはまらなければ -1。
+// 仮想データセット (--shards でまとめたもの) なら先頭の対応先のデータセットの構成を読む
+int get_population_codec(hid_t dataset_id, ChunkCodec *codec, int *level);
+
+// 既存のデータセットに書き足すとき、producer の圧縮設定をデータセットのフィルタに合わせる
+void match_ingest_compression(hid_t dataset_id, IngestOptions *opts);
+
+// 時間軸を rows 行まで伸ばす。既に rows 行以上あれば何もしない
+herr_t extend_time_axis(hid_t dataset_id, hsize_t rows);
+
+// 属性がなければ -1
+int read_last_ingested_hour(hid_t file_id);
+
+// LAST_INGESTED_HOUR_ATTR を last_hour に読む。属性がなければ 1、読めなければ -1、読めたら 0。
+// 属性が -1 なのは、どの時刻も埋まらないうちに取り込みが失敗したファイル
+int get_last_ingested_hour(hid_t file_id, int *last_hour);
+
+herr_t write_last_ingested_hour(hid_t file_id, int last_hour);
+
+// 書き込みが完了したメッシュバッチを記録するデータセット (バッチごとに 1byte, 1=完了)
+#define COMPLETED_BATCHES_DATASET "completed_batches"
+
+typedef struct {
+    hid_t file_id;
+    hid_t dataset_id;
+    int num_batches;
+    uint8_t *completed;     // ファイルに記録済み、または記録待ちのバッチ
+    int *pending;           // 次の flush で記録するバッチ番号
+    int num_pending;
+} BatchCheckpoint;
+
+// バッチの分け方 (scan と batch_size) を属性に持つ完了記録を作る
+BatchCheckpoint* create_batch_checkpoint(hid_t file_id, int num_batches, int scan, int batch_size);
+
+// 既存の完了記録を開く。データセットがないか、バッチの分け方が異なれば NULL
+BatchCheckpoint* open_batch_checkpoint(hid_t file_id, int num_batches, int scan, int batch_size);
+
+// 完了記録がない (記録導入前のファイル) か、全バッチが完了していれば true
+bool is_batch_checkpoint_complete(hid_t file_id);
+
+void mark_batch_completed(BatchCheckpoint *cp, int batch_index);
+
+// 書き込み済みのデータを H5Fflush で永続化してから記録待ちのバッチを書き込み、もう一度 flush する。
+// 記録が先に残ってデータが失われることはない
+herr_t flush_batch_checkpoint(BatchCheckpoint *cp);
+
+int count_completed_batches(const BatchCheckpoint *cp);
+
+void close_batch_checkpoint(BatchCheckpoint *cp);
+
 #endif // HDF5_OPS_H
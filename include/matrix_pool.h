@@ -0,0 +1,50 @@
+//
+// producer ごとに PQdataMatrix のデータ領域を使い回すプール
+//
+
+#ifndef MATRIX_POOL_H
+#define MATRIX_POOL_H
+
+#include <stddef.h>
+#include <stdatomic.h>
+
+#include "fifioq.h"
+
+#define MATRIX_POOL_ALIGN (2 * 1024 * 1024)   // transparent hugepage の大きさ
+#define MATRIX_POOL_PREFILL 2                 // producer が開始時に用意しておくバッファ数
+#define MATRIX_POOL_MAX_CACHED 8              // producer ごとに保持しておく返却済みバッファの上限
+#define MATRIX_POOL_BUDGET_SHARE 2            // メモリ予算のうちプールが保持してよいのは 1/この値 まで
+
+// 同じ大きさのバッファだけを扱う。バッファは 2MiB 境界に揃えた mmap 領域で、MADV_HUGEPAGE を付ける。
+// 最初にページに触れたスレッドの NUMA ノードに割り当てられるので、
+// 持ち主の producer スレッド上で matrix_pool_get / matrix_pool_reserve を呼ぶこと。
+// matrix_pool_put は他のスレッド (consumer) から呼んでよい
+typedef struct {
+    size_t buffer_bytes;    // 利用者が使える大きさ
+    size_t mapped_bytes;    // MATRIX_POOL_ALIGN に切り上げた大きさ
+    size_t max_cached;      // 0 なら返却されたバッファを保持せずにすぐ munmap する
+    FIFOQueue free_list;    // 返却されたバッファ。溢れた分は munmap する
+    atomic_size_t mapped;   // これまでに mmap したバッファ数
+    atomic_size_t reused;   // free_list から取り出した回数
+} MatrixPool;
+
+// 返却されたバッファを max_cached 個 (2 のべき乗に切り上げ) まで保持する。失敗したら NULL
+MatrixPool *create_matrix_pool(size_t buffer_bytes, size_t max_cached);
+
+// メモリ予算 budget (0 なら無制限) のもとで producer ごとのプールが保持してよいバッファ数を返す。
+// 保持されたバッファは行列の予算に数えられないので、全プールで保持しうるバイト数
+// (予算の 1/MATRIX_POOL_BUDGET_SHARE まで) を *pooled_bytes に入れる。呼び出し側は予算からこの分を引くこと
+size_t matrix_pool_cached_for_budget(size_t budget, int num_producers, size_t buffer_bytes, size_t *pooled_bytes);
+
+// 全ページに触れたバッファを n 個 (max_cached まで) 用意して free_list に入れる。成功したら 0、失敗したら -1
+int matrix_pool_reserve(MatrixPool *pool, size_t n);
+
+// buffer_bytes のバッファを返す (中身は不定)。失敗したら NULL
+void *matrix_pool_get(MatrixPool *pool);
+
+void matrix_pool_put(MatrixPool *pool, void *buffer);
+
+// 返却済みのバッファをすべて解放する。貸し出し中のバッファが残っていないこと
+void destroy_matrix_pool(MatrixPool *pool);
+
+#endif //MATRIX_POOL_H
@@ -0,0 +1,125 @@
+//
+// 取り込み中に producer が行列から計算する、メッシュごとの日・月・年・チャンクの集計
+//
+// 行列がキャッシュに載っているうちにロールアップのカーネルで列ごとにまとめて行列と一緒に渡し、
+// consumer の I/O スレッドが population_data と同じ列の並びで ROLLUP_GROUP の mesh のデータセットに書く。
+//   mesh_<period>_sum     時間ごとの値の合計 (int64)
+//   mesh_<period>_min     0 でない値の最小。なければ 0 (int32)
+//   mesh_<period>_max     最大 (int32)
+//   mesh_<period>_count   0 でない値の時間数 (int32)
+// period は day / month / year / chunk。day から year の sum と max はロールアップのピラミッドの mesh の段そのもので、
+// rollup_aggregate はこれを読み、build_rollups は SUMMARY_ROWS_ATTR までの mesh の段を作り直さない。
+// chunk は population_data の時刻方向のチャンクと同じ SUMMARY_CHUNK_HOURS ごとに区切る (chunk_index.h の索引)。
+// 集計を作らずに取り込んだファイルには build_mesh_summaries で後から作れる
+//
+
+#ifndef MESH_SUMMARY_H
+#define MESH_SUMMARY_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <stdbool.h>
+
+#include <hdf5.h>
+
+#include "rollup.h"
+
+// ROLLUP_GROUP の属性。mesh の集計を全列で作り終えた population_data の行数 (ROLLUP_ROWS_ATTR とは別に持つ)。
+// 追記の途中で止まったファイルでは 0 で、その後の追記では集計を続けない
+#define SUMMARY_ROWS_ATTR "summary_rows"
+
+// chunk の区間の時間数。create_hdf5_database_from_pg の population_data の時刻方向のチャンク (365 日) と同じ
+#define SUMMARY_CHUNK_HOURS (24 * 365)
+
+typedef enum {
+    SUMMARY_PERIOD_DAY = 0,
+    SUMMARY_PERIOD_MONTH,
+    SUMMARY_PERIOD_YEAR,
+    SUMMARY_PERIOD_CHUNK,
+    NUM_SUMMARY_PERIODS,
+} SummaryPeriod;
+
+typedef enum {
+    SUMMARY_STAT_SUM = 0,
+    SUMMARY_STAT_MIN,
+    SUMMARY_STAT_MAX,
+    SUMMARY_STAT_COUNT,
+    NUM_SUMMARY_STATS,
+} SummaryStat;
+
+typedef struct {
+    int cols;
+    int time_start;                         // 集計した行列の先頭行の時刻インデックス
+    hsize_t first[NUM_SUMMARY_PERIODS];     // 先頭の区間 (2016-01-01 からの通し番号)
+    hsize_t count[NUM_SUMMARY_PERIODS];
+    // count x cols (行優先)
+    int64_t *sum[NUM_SUMMARY_PERIODS];
+    int32_t *min[NUM_SUMMARY_PERIODS];
+    int32_t *max[NUM_SUMMARY_PERIODS];
+    int32_t *hours[NUM_SUMMARY_PERIODS];    // <period>_count の値
+    size_t bytes;
+} MeshSummary;
+
+// time_start から rows 行 x cols 列の行列の集計が使うバイト数 (データキューの予算に数える)
+size_t mesh_summary_bytes(int rows, int cols, int time_start);
+
+// rows x cols の data (行の間隔は stride 要素、先頭行が時刻 time_start) を集計する。値は負でないこと。失敗したら NULL
+MeshSummary* compute_mesh_summary(const int *data, size_t stride, int rows, int cols, int time_start);
+
+void free_mesh_summary(MeshSummary *s);
+
+const char* summary_period_name(SummaryPeriod period);
+
+const char* summary_stat_name(SummaryStat stat);
+
+// 区間 bucket (2016-01-01 00:00 からの通し番号) の最初の時刻インデックス
+hsize_t summary_bucket_start(SummaryPeriod period, hsize_t bucket);
+
+// 時刻インデックス hour を含む区間
+hsize_t summary_bucket_of(SummaryPeriod period, hsize_t hour);
+
+// "rollup/mesh_<period>_<stat>" を buf に書く
+void mesh_summary_dataset_name(char *buf, size_t size, SummaryPeriod period, SummaryStat stat);
+
+// 属性がなければ 0
+hsize_t read_summary_rows(hid_t file_id);
+
+// ROLLUP_GROUP に集計のデータセット (build_rollups だけでは作られない min と count) があれば true
+bool has_mesh_summaries(hid_t file_id);
+
+// population_data の from 行目から後を書き直す前に呼ぶ。SUMMARY_ROWS_ATTR が from より大きければ from に下げる。
+// 集計がなければ何もしない。成功したら 0、失敗したら -1
+herr_t lower_summary_rows(hid_t file_id, hsize_t from);
+
+typedef struct {
+    hid_t group_id;
+    hid_t dataset_id[NUM_SUMMARY_PERIODS][NUM_SUMMARY_STATS];
+    hsize_t rows;               // 書き込み先の population_data の行数
+    int merge_before;           // この時刻より前から始まる区間は既存の値と合わせる (追記の開始時刻)
+} SummaryDatasets;
+
+// population_data (rows 行 x cols 列) の集計を書くデータセットを用意する。
+// time_start が 0 なら作るか開き、そうでなければ追記なので SUMMARY_ROWS_ATTR が time_start と同じときだけ開く。
+// どちらも時間軸を rows 行分まで伸ばし、書き終えるまで SUMMARY_ROWS_ATTR を 0 にしておく。
+// 成功したら 0、追記できる集計がなければ 1、失敗したら -1
+int open_summary_datasets(SummaryDatasets *d, hid_t file_id, hsize_t rows, hsize_t cols, hsize_t mesh_chunk,
+                          int time_start);
+
+// s を runs (連続する列ごとの {データセット上の先頭列, 列数}、s の列の順) の列に書く。
+// 追記の開始時刻をまたぐ区間は書いてある値と合わせる (s を書き換える)
+herr_t write_mesh_summary(SummaryDatasets *d, MeshSummary *s, const hsize_t (*runs)[2], int num_runs);
+
+// summary_rows が 0 より大きければ SUMMARY_ROWS_ATTR に書いてから閉じる
+herr_t close_summary_datasets(SummaryDatasets *d, hsize_t summary_rows);
+
+// population_data の先頭 rows 行の集計を、SUMMARY_ROWS_ATTR の時刻から先だけスラブ単位で読んで作る。
+// 途中で止まった追記の後や集計がなければ最初から作る。num_workers は展開のスレッド数 (0 以下ならオンラインの CPU 数)。
+// 成功したら 0、失敗したら -1
+int build_mesh_summaries(hid_t file_id, hsize_t rows, int num_workers);
+
+// period の区間 [first, first + count) の column 列目の stat を out に読む
+herr_t read_mesh_summary(hid_t file_id, SummaryPeriod period, SummaryStat stat, hsize_t column, hsize_t first,
+                         hsize_t count, int64_t *out);
+
+#endif //MESH_SUMMARY_H
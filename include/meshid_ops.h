@@ -66,4 +66,8 @@ void printProgressBar(int now, int all);
 
 int* get_all_meshes_in_1st_mesh(int meshid_1, int NUM_MESHES);
 
+// mesh_ids (n 個) のうち、グローバルの meshid_list にある (人口のある) メッシュだけを順序を保って前に詰め、その数を返す。
+// hash は prepare_search で作ったもの
+int keep_populated_meshes(cmph_t *hash, int *mesh_ids, int n);
+
 #endif //MESHID_OPS_H
@@ -0,0 +1,192 @@
+//
+// PostgreSQL から population データを取得して PQdataMatrix に展開する処理
+//
+
+#ifndef PG_INGEST_H
+#define PG_INGEST_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <libpq-fe.h>
+#include <cmph.h>
+
+#include "fifioq.h"
+#include "chunk_codec.h"
+#include "matrix_pool.h"
+#include "mesh_summary.h"
+
+typedef struct {
+    int rows;
+    int cols;
+    int *data;
+    uint32_t meshid_start;
+    int *columns;       // 各列の書き込み先 (昇順)。NULL なら meshid_start の位置から連続
+    int time_start;     // 先頭行の時刻インデックス (データセット上の書き込み開始行)
+    int last_time_index;    // 書き込まれた値の最大の時刻インデックス。値がなければ -1
+    int batch_index;    // 元になったメッシュリストの通し番号
+    bool chunk_order;   // true なら data は行優先ではなく、データセットのチャンク単位で順に並んでいる
+    unsigned char *filtered;    // producer で圧縮済みのチャンクを順に詰めたもの。NULL でなければ data は NULL
+    size_t *filtered_sizes;     // filtered の各チャンクのバイト数。0 ならすべて 0 のチャンク (filtered に含まない)
+    ByteBudget *budget;         // NULL でなければ解放時に budget_bytes を返す
+    size_t budget_bytes;
+    MatrixPool *pool;           // NULL でなければ data はこのプールのバッファで、解放時にプールへ返す
+    MeshSummary *summary;       // NULL でなければ producer が計算した日と月の集計
+} PQdataMatrix;
+
+typedef struct {
+    int meshid_number;
+    uint32_t *meshid_list;
+    int *columns;       // 各メッシュの書き込み先の列 (昇順)。NULL なら連続
+    bool key_range;     // true なら ANY($1) ではなく mesh_id の最小値〜最大値の範囲で取得する
+    int batch_index;    // meshlist_producer が積む順の通し番号 (中断からの再開に使う)
+} MeshidList;
+
+// producer の取得方式
+typedef enum {
+    INGEST_MODE_EXEC = 0,   // PQexecPrepared で結果全体を PGresult に読み込む (従来方式)
+    INGEST_MODE_COPY,       // COPY (...) TO STDOUT (FORMAT binary) を受信しながら展開する
+    INGEST_MODE_ROWS,       // 単一行/チャンクモードで少しずつ受信して展開する
+} IngestMode;
+
+// メッシュリストの分け方
+typedef enum {
+    INGEST_SCAN_LIST = 0,   // list_meshes 件ずつ mesh_id = ANY($1) で取得する (従来方式)
+    INGEST_SCAN_RANGE,      // mesh_id の値で連続する範囲に分け、BETWEEN で並び替えずに取得する
+} IngestScan;
+
+#define DEFAULT_INGEST_CHUNK_ROWS 8192
+#define DEFAULT_INGEST_RANGE_MESHES 256
+#define DEFAULT_INGEST_LIST_MESHES 16
+#define DEFAULT_INGEST_PRODUCERS 32
+#define MAX_INGEST_PRODUCERS 256
+// パイプラインの深さの上限。接続はブロッキングのままなので、送信済みで結果を読んでいないクエリが
+// ソケットのバッファに収まる数に抑える (これを超えるとサーバとクライアントが互いの受信を待って止まる)
+#define MAX_INGEST_PIPELINE_DEPTH 32
+
+typedef struct {
+    IngestMode mode;
+    int chunk_rows;     // INGEST_MODE_ROWS で一度に受け取る最大行数 (libpq 17 以降のみ有効)
+    int pipeline_depth; // 1接続で同時に送信しておくクエリ数 (MAX_INGEST_PIPELINE_DEPTH まで)。1ならパイプラインモードを使わない
+    IngestScan scan;
+    int range_meshes;   // INGEST_SCAN_RANGE で1つの範囲に含めるメッシュ数
+    char **tables;      // 取得元テーブル。各メッシュリストは全テーブルに問い合わせて同じ行列に展開する
+    int num_tables;
+    char *source_parent;    // 設定されていれば配下のテーブルを pg_inherits から探す
+    int time_start;     // この時刻インデックス以降の行だけを取得する (追記用)。0 なら全期間
+    bool direct_chunk;  // チャンク境界に揃ったバッチを作り、H5Dwrite_chunk で書き込む
+    ChunkCodec compression; // NONE 以外なら producer がチャンクを圧縮する (direct_chunk が必要)
+    int compression_level;
+    size_t memory_budget;   // データキュー上の行列 (producer が作成中のものを含む) のバイト数の上限。0 なら無制限
+    int num_producers;  // population_producer スレッド数
+    int list_meshes;    // INGEST_SCAN_LIST で1回に問い合わせるメッシュ数
+    size_t queue_depth; // データキューの容量。0 なら memory_budget から決める
+    bool summaries;     // producer が行列ごとに日と月の集計を計算して渡す
+} IngestOptions;
+
+typedef struct {
+    FIFOQueue *DataQueue;
+    FIFOQueue * MeshlistQueue;
+    const char * conninfo;
+    const IngestOptions *options;
+    int rows;           // 1メッシュあたりの時系列長
+    int time_chunk;     // 0 より大きければ、揃ったバッチをこのチャンク形状の順に並べ替えてから積む
+    int mesh_chunk;
+    ByteBudget *budget; // NULL でなければ行列を確保する前にバイト数を予約する
+    uint64_t stall_ns;  // budget の空きを待った合計時間
+    MatrixPool *pool;   // NULL でなければ行列のデータ領域をここから取る (この producer 専用)
+    atomic_int *dropped_batches;    // NULL でなければ取得できずに捨てたバッチ数を足す (全 producer で共有)
+    bool reached_end;   // MeshlistQueue の終端 (NULL) を受け取って終了した
+    bool failed;        // 接続できなかったか接続が切れて途中で終了した
+} ProducerObject;
+
+// int4[] パラメータのバイナリ表現を組み立てる再利用バッファ
+typedef struct {
+    char *data;
+    size_t capacity;
+    int length;
+} Int4ArrayParam;
+
+// values を int4[] のバイナリ送信形式 (paramFormats=1) で param に書き込む。
+// バッファは必要に応じて拡張され、次回以降も使い回される。成功したら 0、失敗したら -1
+int encode_int4_array_param(Int4ArrayParam *param, const uint32_t *values, int n);
+
+void free_int4_array_param(Int4ArrayParam *param);
+
+// "exec" / "copy" / "rows" をパースする。NULL や空文字列は INGEST_MODE_EXEC、不明な値は -1
+int parse_ingest_mode(const char *name);
+
+const char* ingest_mode_name(IngestMode mode);
+
+// "list" / "range" をパースする。NULL や空文字列は INGEST_SCAN_LIST、不明な値は -1
+int parse_ingest_scan(const char *name);
+
+// MOBAKU_INGEST_* 環境変数から設定を読み込む。成功したらtrue、失敗したらfalseを返す。
+bool load_ingest_options(IngestOptions *opts);
+
+// 1バッチのメッシュ数 (scan に応じて list_meshes か range_meshes)
+int ingest_batch_meshes(const IngestOptions *opts);
+
+void free_ingest_options(IngestOptions *opts);
+
+// 取得元テーブルを確定する。source_parent があれば配下のテーブルを列挙し、
+// なければ設定された名前を正規化する。テーブル数を返す。失敗したら -1
+int resolve_source_tables(const char *conninfo, IngestOptions *opts);
+
+// 全取得元テーブルの datetime の最大値を時刻インデックスで返す。
+// データがなければ -1、失敗したら -2
+int query_latest_time_index(const char *conninfo, const IngestOptions *opts);
+
+// rows x cols をゼロ初期化して確保する。失敗時は NULL
+PQdataMatrix* alloc_pqdata_matrix(int rows, int cols, uint32_t meshid_start);
+
+// alloc_pqdata_matrix と同じだが、データ領域を pool から取り、使う rows x cols の範囲だけゼロにする。
+// pool のバッファに収まらない大きさなら通常の確保にする
+PQdataMatrix* alloc_pooled_pqdata_matrix(MatrixPool *pool, int rows, int cols, uint32_t meshid_start);
+
+// start から n 個連続する列番号の配列 (MeshidList.columns 用)
+int* alloc_column_range(int start, int n);
+
+// 書き込み先が time_chunk x mesh_chunk のチャンクちょうどに分割できるか
+bool pqdata_matrix_chunk_aligned(const PQdataMatrix *m, int time_chunk, int mesh_chunk);
+
+// チャンクちょうどに分割できる行列なら、data をチャンクごとに (時刻チャンク, 列チャンクの順で)
+// 連続する並びに変えて chunk_order を立てる。揃っていなければ何もしない。失敗したら -1
+int layout_chunk_order(PQdataMatrix *m, int time_chunk, int mesh_chunk);
+
+// chunk_order の行列の各チャンクを codec で圧縮して filtered に移し、data を解放する。
+// chunk_order でないか codec が NONE なら何もしない。失敗したら -1
+int compress_pqdata_chunks(PQdataMatrix *m, int time_chunk, int mesh_chunk, ChunkCodec codec, int level);
+
+// データ解放関数
+void free_pqdata_matrix(void *data);
+
+void free_meshid_list(void *data);
+
+// 取得方式に必要な prepared statement を作成する。成功したら 0、失敗したら -1
+int prepare_population_query(PGconn *conn, const IngestOptions *opts);
+
+// meshid_list に含まれるメッシュの全時系列を取得して m に書き込む。
+// m は呼び出し側でゼロ初期化しておくこと。成功したら 0、失敗したら -1
+int fetch_population_matrix(PGconn *conn, const IngestOptions *opts, const MeshidList *meshid_list,
+                            Int4ArrayParam *param, cmph_t *local_hash, PQdataMatrix *m);
+
+// meshes (書き込み先の列順) を mesh_id の値で range_meshes 件ずつの範囲に分けて積む。
+// completed が NULL でなければ completed[バッチ番号] が立っている範囲は飛ばす。
+// 積んだバッチ数を返す。失敗したら -1
+int enqueue_range_batches(FIFOQueue *meshid_queue, const uint32_t *meshes, int num_meshes, int range_meshes,
+                          const uint8_t *completed);
+
+// MeshlistQueue からメッシュリストを取り出し、取得した行列を DataQueue に積むスレッド。
+// 終了時に DataQueue へ NULL を1つ積む
+void *population_producer(void *arg);
+
+// 全 producer の終了後に呼ぶ。終端を受け取らずに終了した producer の分だけ MeshlistQueue に残った
+// メッシュリストと NULL を取り除き、meshlist_producer が積み終えられるようにする。
+// 途中で終了した (failed の) producer の数を返す
+int drain_meshlist_queue(FIFOQueue *meshlist_queue, const ProducerObject *producers, int num_producers);
+
+// producer が budget の空きを待った時間と、予算に対して最大どれだけ積まれたかを表示する
+void report_backpressure(const ByteBudget *budget, const ProducerObject *producers, int num_producers);
+
+#endif //PG_INGEST_H
@@ -0,0 +1,53 @@
+//
+// population_data と population_snapshot のうち、展開する量の少ない方から読む読み出し API
+//
+
+#ifndef POPULATION_READER_H
+#define POPULATION_READER_H
+
+#include <stdint.h>
+
+#include <hdf5.h>
+
+typedef enum {
+    POPULATION_LAYOUT_SERIES = 0,   // population_data (メッシュごとの長い時系列向け)
+    POPULATION_LAYOUT_SNAPSHOT,     // population_snapshot (ある時刻の多くのメッシュ向け)
+} PopulationLayout;
+
+typedef struct {
+    hid_t file_id;
+    hid_t dataset_id[2];        // PopulationLayout ごと。population_snapshot がなければ H5I_INVALID_HID
+    hsize_t chunk[2][2];        // PopulationLayout ごとのチャンク形状 (チャンク化されていなければ 1 x 1)
+    hsize_t rows;
+    hsize_t cols;
+    hsize_t snapshot_rows;      // population_snapshot が population_data と一致している行数
+    uint32_t (*id_to_col)[2];   // {メッシュID, 列} をメッシュID の昇順に
+    size_t num_ids;
+} PopulationReader;
+
+// 読み出し専用で開く。失敗したら NULL
+PopulationReader* open_population_reader(const char *path);
+
+void close_population_reader(PopulationReader *r);
+
+// meshid_list から列を引く。なければ -1
+long long population_reader_column(const PopulationReader *r, uint32_t meshid);
+
+// 時刻 [t0, t0 + hours) の列 cols (昇順、ncols 個) を layout から読むときに展開する要素数。
+// その layout では読めなければ UINT64_MAX
+uint64_t population_read_cost(const PopulationReader *r, PopulationLayout layout, hsize_t t0, hsize_t hours,
+                              const hsize_t *cols, int ncols);
+
+// 展開する要素数の少ない方。同じなら POPULATION_LAYOUT_SERIES
+PopulationLayout choose_population_layout(const PopulationReader *r, hsize_t t0, hsize_t hours, const hsize_t *cols,
+                                          int ncols);
+
+// 時刻 [t0, t0 + hours) の列 cols (昇順、ncols 個) を out (hours x ncols、行優先) に読む。
+// used が NULL でなければ読んだ layout を入れる
+herr_t read_population(PopulationReader *r, hsize_t t0, hsize_t hours, const hsize_t *cols, int ncols, int *out,
+                       PopulationLayout *used);
+
+// 時刻 hour の全メッシュを out (cols 個) に読む
+herr_t read_population_snapshot(PopulationReader *r, hsize_t hour, int *out, PopulationLayout *used);
+
+#endif //POPULATION_READER_H
@@ -0,0 +1,66 @@
+//
+// population_data を 時刻 x メッシュ のスラブ単位で読む
+//
+// 生のチャンクの読み出しは呼び出したスレッドだけが行い (HDF5 はスレッドセーフではない)、展開をワーカースレッドに分ける。
+// population_snapshot やロールアップのように、population_data 全体を順に読み直す処理で使う
+//
+
+#ifndef POPULATION_SLAB_H
+#define POPULATION_SLAB_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include <hdf5.h>
+
+#include "chunk_codec.h"
+
+// ワーカーの引数の先頭に置く
+typedef struct {
+    int id;
+    int num_workers;
+    int status;     // 失敗したら 0 以外にする
+} SlabWorker;
+
+// workers (worker_size バイトずつ num_workers 個、それぞれ SlabWorker で始まる) ごとに fn をスレッドで走らせて待つ。
+// すべて成功したら 0、スレッドを作れないかどれかが失敗したら -1
+int run_slab_workers(void *workers, size_t worker_size, int num_workers, void *(*fn)(void *));
+
+typedef struct SlabDecoder SlabDecoder;
+
+typedef struct {
+    hid_t dataset_id;
+    ChunkCodec codec;
+    bool raw_chunks;        // 生のチャンクを読んでワーカーで展開する
+    hsize_t rows;           // 読む行数 (population_data の行数以下)
+    hsize_t cols;
+    hsize_t chunk[2];       // チャンク形状。チャンク化されていなければ 0 x 0
+    hsize_t slab_rows;
+    hsize_t slab_cols;
+    int *data;              // slab_rows x slab_cols (行優先)。右端のスラブで足りない列は 0
+    hsize_t height;         // 最後に読んだ行数と列数
+    hsize_t width;
+    // いまのスラブが覆う元のチャンク。大きさが 0 なら書かれていないので 0 で埋める
+    int num_src;
+    int max_src;
+    unsigned char **src_raw;
+    size_t *src_size;
+    size_t *src_capacity;
+    int num_workers;
+    SlabDecoder *decoders;
+} PopulationSlab;
+
+// population_data の先頭 rows 行を読む。
+// slab_rows が population_data の時刻方向のチャンクの高さと同じで、slab_cols がメッシュ方向のチャンク幅の倍数で、
+// 圧縮を HDF5 を通さずに展開できれば生のチャンクを num_workers 個のスレッドで展開する。
+// そうでなければ HDF5 のフィルタで読む。num_workers が 0 以下ならオンラインの CPU 数。成功したら 0、失敗したら -1
+int open_population_slab(PopulationSlab *s, hid_t dataset_id, hsize_t rows, hsize_t slab_rows, hsize_t slab_cols,
+                         int num_workers);
+
+// [t_begin, t_begin + slab_rows) x [c_begin, c_begin + slab_cols) を rows 行と population_data の端で切って data に読む。
+// t_begin は slab_rows の、c_begin は slab_cols の倍数。成功したら 0、失敗したら -1
+int read_population_slab(PopulationSlab *s, hsize_t t_begin, hsize_t c_begin);
+
+void close_population_slab(PopulationSlab *s);
+
+#endif //POPULATION_SLAB_H
@@ -0,0 +1,124 @@
+//
+// population_data を日・月・年と 3次・2次・1次メッシュにまとめた集計 (ロールアップ) のピラミッド
+//
+// ROLLUP_GROUP の下に、集計単位ごとの 時間区間 x 区域 のデータセットを置く。
+//   <area>_hour_sum              区域の時間ごとの合計 (int32)。area が mesh なら population_data そのもの
+//   <area>_<period>_sum          区域の時間ごとの合計を区間で足したもの (int64)
+//   <area>_<period>_max          区域の時間ごとの合計の区間での最大 (int32)
+//   <area>_ids                   区域のコード (3次メッシュなら8桁) を昇順に (uint32)。mesh の列は meshid_list
+// area は mesh / mesh3 / mesh2 / mesh1、period は day / month / year。区間は日本時間で区切る。
+// mesh の段には取り込み時の集計 (mesh_summary.h) が min / count / チャンクの区間と合わせて書くこともある。
+// 平均は sum を区間の時間数で割ったもの。区間の時間数は rollup_bucket_start と ROLLUP_ROWS_ATTR から決まる
+//
+
+#ifndef ROLLUP_H
+#define ROLLUP_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <hdf5.h>
+
+#define ROLLUP_GROUP "rollup"
+
+// ROLLUP_GROUP の属性。集計し終えた population_data の行数で、これより後の時間は古いか空
+#define ROLLUP_ROWS_ATTR "rollup_rows"
+
+typedef enum {
+    ROLLUP_AREA_MESH = 0,   // population_data の列 (1/2 地域メッシュ)
+    ROLLUP_AREA_MESH3,      // メッシュID / 10
+    ROLLUP_AREA_MESH2,      // メッシュID / 1000
+    ROLLUP_AREA_MESH1,      // メッシュID / 100000
+    NUM_ROLLUP_AREAS,
+} RollupArea;
+
+typedef enum {
+    ROLLUP_PERIOD_HOUR = 0,
+    ROLLUP_PERIOD_DAY,
+    ROLLUP_PERIOD_MONTH,
+    ROLLUP_PERIOD_YEAR,
+    NUM_ROLLUP_PERIODS,
+} RollupPeriod;
+
+typedef enum {
+    ROLLUP_STAT_SUM = 0,
+    ROLLUP_STAT_MAX,
+} RollupStat;
+
+typedef enum {
+    ROLLUP_ISA_AUTO = 0,    // CPU が対応する一番速いもの
+    ROLLUP_ISA_SCALAR,
+    ROLLUP_ISA_AVX2,
+    ROLLUP_ISA_AVX512,
+} RollupIsa;
+
+// 使うカーネルを固定する (テストとベンチ用)。CPU が対応していなければ -1
+int rollup_use_isa(RollupIsa isa);
+
+RollupIsa rollup_active_isa(void);
+
+const char* rollup_isa_name(RollupIsa isa);
+
+// src の nrows 行 (行の間隔は stride 要素) を列ごとに足した値と最大を sum と max (width 個) に書く。nrows が 0 なら 0
+void rollup_reduce_rows(const int32_t *src, size_t stride, size_t nrows, size_t width, int64_t *sum, int32_t *max);
+
+// rollup_reduce_rows に加えて、0 でない値の最小 (なければ 0) と個数を min と count に書く。
+// 最大は 0 から始めるので値は負でないこと
+void rollup_reduce_stats(const int32_t *src, size_t stride, size_t nrows, size_t width, int64_t *sum, int32_t *min,
+                         int32_t *max, int32_t *count);
+
+// rollup_reduce_rows の結果 nrows 行をさらにまとめる
+void rollup_reduce_sums(const int64_t *sum_src, const int32_t *max_src, size_t stride, size_t nrows, size_t width,
+                        int64_t *sum, int32_t *max);
+
+const char* rollup_area_name(RollupArea area);
+
+const char* rollup_period_name(RollupPeriod period);
+
+// 区域のコードにするためにメッシュIDを割る数
+uint32_t rollup_area_divisor(RollupArea area);
+
+// 区間 bucket (2016-01-01 00:00 からの通し番号) の最初の時刻インデックス
+hsize_t rollup_bucket_start(RollupPeriod period, hsize_t bucket);
+
+// 時刻インデックス hour を含む区間
+hsize_t rollup_bucket_of(RollupPeriod period, hsize_t hour);
+
+// "rollup/<area>_<period>_<stat>" を buf に書く
+void rollup_dataset_name(char *buf, size_t size, RollupArea area, RollupPeriod period, RollupStat stat);
+
+// 属性がなければ 0
+hsize_t read_rollup_rows(hid_t file_id);
+
+// population_data の from 行目から後を書き直す前に呼ぶ。ROLLUP_ROWS_ATTR が from より大きければ from に下げ、
+// 次の build_rollups でそこから集計し直させる。ロールアップがなければ何もしない。成功したら 0、失敗したら -1
+herr_t lower_rollup_rows(hid_t file_id, hsize_t from);
+
+// population_data の先頭 rows 行を集計する。ロールアップがあれば ROLLUP_ROWS_ATTR の行を含む
+// population_data のスラブ (時刻方向のチャンクの高さを 24 時間に切り上げた行数) から先だけを集計し直す。
+// population_data を読んで時間と日の集計を num_workers 個のスレッドで並べて行い、月と年は日から組み立てる。
+// 取り込み時の集計が rows 行まであれば mesh の段は作らない。meshid_list が昇順であること。成功したら 0、失敗したら -1
+int build_rollups(hid_t file_id, hsize_t rows, int num_workers);
+
+// area の区域のコード (mesh ならメッシュID) の番号。なければ -1
+long long rollup_region(hid_t file_id, RollupArea area, uint32_t code);
+
+// period の区間 [first, first + count) の region 番目の区域の stat を out に読む。
+// period が hour で area が mesh なら population_data から読む。hour の max は sum と同じ
+herr_t read_rollup(hid_t file_id, RollupArea area, RollupPeriod period, RollupStat stat, hsize_t region, hsize_t first,
+                   hsize_t count, int64_t *out);
+
+typedef struct {
+    int64_t sum;        // 区域の時間ごとの合計を足したもの
+    int64_t max;        // 区域の時間ごとの合計の最大
+    hsize_t hours;      // 集計した時間数。平均は sum / hours
+    int reads[NUM_ROLLUP_PERIODS];  // 集計単位ごとの読み出し回数
+} RollupValue;
+
+// 時刻 [t0, t1) の region 番目の区域を、区間に丸ごと入る一番粗い集計から順に組み立てる。
+// 粗い区間に入らない端だけを細かい集計で補うので、読み出しは高々 2 x 集計単位の数 - 1 回。
+// t1 は ROLLUP_ROWS_ATTR 以下 (mesh なら取り込み時の集計の SUMMARY_ROWS_ATTR 以下でもよい) であること。
+// 成功したら 0、失敗したら -1
+int rollup_aggregate(hid_t file_id, RollupArea area, hsize_t region, hsize_t t0, hsize_t t1, RollupValue *out);
+
+#endif //ROLLUP_H
@@ -0,0 +1,32 @@
+//
+// 全メッシュのある時刻を読む問い合わせ向けに、population_data を時刻方向に細かいチャンクで写したデータセット
+//
+
+#ifndef SNAPSHOT_DATASET_H
+#define SNAPSHOT_DATASET_H
+
+#include <hdf5.h>
+
+// population_data と同じ 時刻 x メッシュ の並びで、チャンクだけが 24 時間 x 4096 メッシュ
+#define SNAPSHOT_DATASET "population_snapshot"
+#define SNAPSHOT_TIME_CHUNK 24
+#define SNAPSHOT_MESH_CHUNK 4096
+
+// population_data から写し終えた行数を持つ population_snapshot の属性。これより後の行は古いか空
+#define SNAPSHOT_ROWS_ATTR "snapshot_rows"
+
+// 属性がなければ 0
+hsize_t read_snapshot_rows(hid_t snapshot_id);
+
+// population_data の from 行目から後を書き直す前に呼ぶ。SNAPSHOT_ROWS_ATTR が from より大きければ from に下げ、
+// 次の build_snapshot_dataset でそこから写し直させる。population_snapshot がなければ何もしない。成功したら 0、失敗したら -1
+herr_t lower_snapshot_rows(hid_t file_id, hsize_t from);
+
+// population_data の先頭 rows 行を population_snapshot に写す。なければ population_data と同じ圧縮で作り、
+// あれば SNAPSHOT_ROWS_ATTR より後の行だけを写し直す。
+// population_data の圧縮を HDF5 を通さずに展開・圧縮できれば、生のチャンクを読み書きし、展開と圧縮は
+// num_workers 個のスレッドで並べて行う。そうでなければ HDF5 のフィルタで1スレッドで写す。
+// メモリは population_data の時刻方向のチャンク x SNAPSHOT_MESH_CHUNK 列の約2倍を使う。成功したら 0、失敗したら -1
+int build_snapshot_dataset(hid_t file_id, hsize_t rows, int num_workers);
+
+#endif //SNAPSHOT_DATASET_H
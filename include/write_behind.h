@@ -0,0 +1,55 @@
+//
+// consumer の書き込みを、書き込み内容を用意するステージングと HDF5 を呼ぶ I/O スレッドに分ける
+//
+
+#ifndef WRITE_BEHIND_H
+#define WRITE_BEHIND_H
+
+#include <stdint.h>
+#include <pthread.h>
+
+#include "hdf5_ops.h"
+#include "mesh_summary.h"
+
+// ステージング済みで I/O スレッドの書き込みを待てる数
+#define WRITE_BEHIND_DEPTH 4
+
+typedef struct {
+    FIFOQueue staged;       // PQdataWrite*。NULL で終了
+    pthread_t thread;
+    hid_t file_id;
+    hid_t dataset_id;
+    hsize_t time_chunk;
+    hsize_t mesh_chunk;
+    BatchCheckpoint *checkpoint;    // NULL でなければ書けたバッチを記録し、checkpoint_interval_sec ごとに flush する
+    int checkpoint_interval_sec;
+    SummaryDatasets *summaries;     // NULL でなければ行列と一緒に渡された集計を書く
+    int max_hour;           // last_ingested_hour に含める時刻の上限 (データセットの最終行)
+    int last_ingested_hour; // finish_write_behind の後に読む。失敗したバッチがあれば開始時の値のまま
+    int initial_hour;       // 開始時の last_ingested_hour
+    int written_hour;       // 書けたバッチの最終時刻の最大値
+    size_t writes;
+    size_t failures;
+    uint64_t io_ns;         // HDF5 の書き込みと flush にかかった時間
+    uint64_t idle_ns;       // I/O スレッドがステージングを待った時間
+    uint64_t submit_wait_ns;    // ステージング側が I/O の空きを待った時間
+} WriteBehind;
+
+uint64_t monotonic_ns(void);
+
+// I/O スレッドを writer_cpu (負なら指定なし) で起動する。
+// 以降 finish_write_behind までは、この HDF5 ファイルを I/O スレッド以外から触らないこと。成功したら 0、失敗したら -1
+int start_write_behind(WriteBehind *wb, hid_t file_id, hid_t dataset_id, hsize_t time_chunk, hsize_t mesh_chunk,
+                       BatchCheckpoint *checkpoint, int checkpoint_interval_sec, SummaryDatasets *summaries,
+                       int last_ingested_hour, int writer_cpu);
+
+// malloc した w を渡す。書き込み後に I/O スレッドが行列ごと解放する。I/O が詰まっていれば待つ
+void submit_pqdata_write(WriteBehind *wb, PQdataWrite *w);
+
+// 残りを書き終えるまで待ち、I/O スレッドを終了する
+void finish_write_behind(WriteBehind *wb);
+
+// staging_ns はステージング側の処理時間、producer_wait_ns は producer からのデータを待った時間
+void report_write_behind(const WriteBehind *wb, uint64_t staging_ns, uint64_t producer_wait_ns);
+
+#endif //WRITE_BEHIND_H
@@ -0,0 +1,121 @@
+//
+// --autotune: 短い試行を繰り返して producer 数とバッチの大きさを山登りで決める
+//
+
+#include "autotune.h"
+
+#include <stdio.h>
+#include <time.h>
+
+void init_autotuner(Autotuner *t, const TuningConfig *initial, int max_producers, int batch_align, int max_batch) {
+    t->current = *initial;
+    t->best = *initial;
+    t->best_sample = (TuningSample){0};
+    t->knob = AUTOTUNE_PRODUCERS;
+    t->direction = 1;
+    t->improved = false;
+    t->reversed = false;
+    t->max_producers = max_producers;
+    t->batch_align = batch_align > 0 ? batch_align : 1;
+    t->max_batch = max_batch > t->batch_align ? max_batch : t->batch_align;
+    t->phases = 0;
+}
+
+static int clamp_int(int v, int lo, int hi) {
+    return v < lo ? lo : (v > hi ? hi : v);
+}
+
+// 書き込み側が詰まっているなら producer やバッチを増やしても待つだけなので、減らす方から試す
+static int initial_direction(const TuningSample *s) {
+    bool writer_bound = s->queue_occupancy > AUTOTUNE_BUSY_RATIO || s->writer_stall > AUTOTUNE_BUSY_RATIO;
+    return writer_bound ? -1 : 1;
+}
+
+// best からいまの knob を direction に1段動かした設定。範囲の端で動かせなければ false
+static bool propose(const Autotuner *t, TuningConfig *next) {
+    *next = t->best;
+    if (t->knob == AUTOTUNE_PRODUCERS) {
+        int n = t->direction > 0 ? t->best.num_producers * 2 : t->best.num_producers / 2;
+        n = clamp_int(n, 1, t->max_producers);
+        next->num_producers = n;
+        return n != t->best.num_producers;
+    }
+    int b = t->direction > 0 ? t->best.batch_meshes * 2 : t->best.batch_meshes / 2;
+    b = clamp_int(b / t->batch_align * t->batch_align, t->batch_align, t->max_batch / t->batch_align * t->batch_align);
+    next->batch_meshes = b;
+    return b != t->best.batch_meshes;
+}
+
+// 改善しなかったときの次の手: まだ改善も逆向きも試していなければ逆向き、そうでなければ次の knob
+static void advance(Autotuner *t) {
+    if (!t->improved && !t->reversed) {
+        t->direction = -t->direction;
+        t->reversed = true;
+        return;
+    }
+    t->knob++;
+    t->improved = false;
+    t->reversed = false;
+    t->direction = initial_direction(&t->best_sample);
+}
+
+bool autotune_step(Autotuner *t, const TuningSample *s) {
+    t->phases++;
+    if (t->phases == 1) {
+        t->best = t->current;
+        t->best_sample = *s;
+        t->direction = initial_direction(s);
+    } else if (s->rows_per_sec > t->best_sample.rows_per_sec * (1.0 + AUTOTUNE_MIN_GAIN)) {
+        t->best = t->current;
+        t->best_sample = *s;
+        t->improved = true;
+    } else {
+        advance(t);
+    }
+
+    while (t->knob != AUTOTUNE_DONE && t->phases < AUTOTUNE_MAX_PHASES) {
+        TuningConfig next;
+        if (propose(t, &next)) {
+            t->current = next;
+            return true;
+        }
+        advance(t);
+    }
+
+    // キューは最良の試行で同時に積まれた数の倍まであれば足りる。終端の NULL の分も残す
+    size_t depth = t->best_sample.queue_peak * 2;
+    if (depth < (size_t)t->best.num_producers * 2) {
+        depth = (size_t)t->best.num_producers * 2;
+    }
+    t->best.queue_depth = depth;
+    t->knob = AUTOTUNE_DONE;
+    t->current = t->best;
+    return false;
+}
+
+int write_tuning_file(const char *path, const TuningConfig *config, IngestScan scan) {
+    FILE *fp = fopen(path, "w");
+    if (fp == NULL) {
+        perror("fopen failed for tuning file");
+        return -1;
+    }
+    char stamp[64];
+    time_t now = time(NULL);
+    strftime(stamp, sizeof(stamp), "%Y-%m-%d %H:%M:%S", localtime(&now));
+    fprintf(fp, "# written by --autotune at %s\n", stamp);
+    fprintf(fp, "MOBAKU_PRODUCERS=%d\n", config->num_producers);
+    fprintf(fp, "%s=%d\n", scan == INGEST_SCAN_RANGE ? "MOBAKU_INGEST_RANGE_MESHES" : "MOBAKU_INGEST_LIST_MESHES",
+            config->batch_meshes);
+    fprintf(fp, "MOBAKU_QUEUE_DEPTH=%zu\n", config->queue_depth);
+    if (fclose(fp) != 0) {
+        perror("fclose failed for tuning file");
+        return -1;
+    }
+    return 0;
+}
+
+void print_tuning_sample(int phase, const TuningConfig *config, const TuningSample *s) {
+    printf("Autotune phase %d: %d producers, %d meshes per batch: %.0f rows/s, queue %.0f%% full (peak %zu), "
+           "writer stalled %.0f%%\n", phase, config->num_producers, config->batch_meshes, s->rows_per_sec,
+           s->queue_occupancy * 100.0, s->queue_peak, s->writer_stall * 100.0);
+}
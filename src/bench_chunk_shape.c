@@ -0,0 +1,584 @@
+//
+// 既存の HDF5 ファイルの population_data の一部をいくつかのチャンク形状で書き直し、
+// 読み出しのワークロードを再生して、読んだバイト数・触れたチャンク数・時間を比べる
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <hdf5.h>
+
+#include "chunk_codec.h"
+#include "delta_bitpack.h"
+#include "hdf5_ops.h"
+#include "write_behind.h"
+
+#define BENCH_DEFAULT_MESHES 4096
+#define BENCH_DEFAULT_HOURS 8760
+#define BENCH_MAX_SHAPES 16
+#define BENCH_MAX_LABELS 32
+#define BENCH_LABEL_LEN 32
+
+// 指定がなければファイル自身の形状にこれらを加えて比べる。どれも 1 チャンク 0.5MiB 前後
+#define BENCH_DEFAULT_SHAPES "8760x16,720x256,168x1024,24x4096"
+
+// 形状を変えても同じ読み出しを再生できるように、@N の開始列はこの種から決める
+#define BENCH_SEED 12345u
+
+typedef struct {
+    hsize_t time_chunk;
+    hsize_t mesh_chunk;
+} ChunkShape;
+
+// サンプル上の1回の読み出し
+typedef struct {
+    int label;
+    hsize_t t0;         // 両端を含む
+    hsize_t t1;
+    int num_cols;
+    hsize_t *cols;      // サンプル内の列 (昇順、重複なし)
+} ShapeRead;
+
+typedef struct {
+    char labels[BENCH_MAX_LABELS][BENCH_LABEL_LEN];
+    int num_labels;
+    ShapeRead *reads;
+    int num_reads;
+    int capacity;
+    int remapped;       // サンプルの外を指していたので中に写した読み出しの数
+} Workload;
+
+// サンプルにする範囲と、メッシュIDから元のファイルの列を引く表
+typedef struct {
+    hsize_t rows;
+    hsize_t cols;
+    hsize_t col_begin;          // 元のファイルでのサンプルの先頭列
+    hsize_t file_cols;
+    uint32_t (*id_to_col)[2];   // {メッシュID, 列} をメッシュID の昇順に
+    size_t num_ids;
+} SampleMap;
+
+static int parse_shapes(const char *arg, ChunkShape *shapes, int num_shapes) {
+    char *copy = strdup(arg);
+    char *save = NULL;
+    for (char *tok = strtok_r(copy, ",", &save); tok != NULL; tok = strtok_r(NULL, ",", &save)) {
+        unsigned long long t, m;
+        char x;
+        if (sscanf(tok, "%llu%c%llu", &t, &x, &m) != 3 || x != 'x' || t == 0 || m == 0) {
+            fprintf(stderr, "Invalid chunk shape (expected HOURSxMESHES): %s\n", tok);
+            free(copy);
+            return -1;
+        }
+        bool duplicate = false;
+        for (int i = 0; i < num_shapes; ++i) {
+            duplicate |= shapes[i].time_chunk == t && shapes[i].mesh_chunk == m;
+        }
+        if (!duplicate && num_shapes < BENCH_MAX_SHAPES) {
+            shapes[num_shapes++] = (ChunkShape){t, m};
+        }
+    }
+    free(copy);
+    return num_shapes;
+}
+
+static int compare_id_col(const void *a, const void *b) {
+    uint32_t x = ((const uint32_t *)a)[0];
+    uint32_t y = ((const uint32_t *)b)[0];
+    return (x > y) - (x < y);
+}
+
+static int compare_hsize(const void *a, const void *b) {
+    hsize_t x = *(const hsize_t *)a;
+    hsize_t y = *(const hsize_t *)b;
+    return (x > y) - (x < y);
+}
+
+// ファイルの meshid_list から {メッシュID, 列} の表を作る。なければ空のまま
+static void load_mesh_columns(hid_t file_id, SampleMap *map) {
+    map->id_to_col = NULL;
+    map->num_ids = 0;
+    if (H5Lexists(file_id, "meshid_list", H5P_DEFAULT) <= 0) {
+        return;
+    }
+    hid_t dataset_id = H5Dopen(file_id, "meshid_list", H5P_DEFAULT);
+    hid_t space_id = H5Dget_space(dataset_id);
+    hsize_t n = (hsize_t)H5Sget_simple_extent_npoints(space_id);
+    H5Sclose(space_id);
+    uint32_t *ids = (uint32_t *)malloc(sizeof(uint32_t) * n);
+    map->id_to_col = (uint32_t (*)[2])malloc(sizeof(uint32_t[2]) * n);
+    if (ids != NULL && map->id_to_col != NULL &&
+        H5Dread(dataset_id, H5T_NATIVE_UINT32, H5S_ALL, H5S_ALL, H5P_DEFAULT, ids) >= 0) {
+        for (hsize_t i = 0; i < n; ++i) {
+            map->id_to_col[i][0] = ids[i];
+            map->id_to_col[i][1] = (uint32_t)i;
+        }
+        map->num_ids = n;
+        qsort(map->id_to_col, n, sizeof(uint32_t[2]), compare_id_col);
+    }
+    free(ids);
+    H5Dclose(dataset_id);
+}
+
+static long long mesh_column(const SampleMap *map, uint32_t meshid) {
+    uint32_t key[2] = {meshid, 0};
+    uint32_t *hit = (uint32_t *)bsearch(key, map->id_to_col, map->num_ids, sizeof(uint32_t[2]), compare_id_col);
+    return hit != NULL ? (long long)hit[1] : -1;
+}
+
+static int find_label(Workload *w, const char *label) {
+    for (int i = 0; i < w->num_labels; ++i) {
+        if (strcmp(w->labels[i], label) == 0) {
+            return i;
+        }
+    }
+    if (w->num_labels == BENCH_MAX_LABELS) {
+        return -1;
+    }
+    snprintf(w->labels[w->num_labels], BENCH_LABEL_LEN, "%s", label);
+    return w->num_labels++;
+}
+
+// "*"、"a"、"a-b" (時刻インデックス、両端を含む)
+static bool parse_hours(const char *spec, hsize_t file_rows, hsize_t *t0, hsize_t *t1) {
+    if (strcmp(spec, "*") == 0) {
+        *t0 = 0;
+        *t1 = file_rows - 1;
+        return true;
+    }
+    unsigned long long a, b;
+    int n = sscanf(spec, "%llu-%llu", &a, &b);
+    if (n == 1) {
+        b = a;
+    }
+    if (n < 1 || a > b || b >= file_rows) {
+        return false;
+    }
+    *t0 = a;
+    *t1 = b;
+    return true;
+}
+
+// 元のファイルの列と時刻をサンプルの中に写す。写したら true
+static bool map_into_sample(const SampleMap *map, long long *col, hsize_t *t0, hsize_t *t1) {
+    bool moved = false;
+    long long rel = *col - (long long)map->col_begin;
+    if (rel < 0 || rel >= (long long)map->cols) {
+        rel = (rel % (long long)map->cols + (long long)map->cols) % (long long)map->cols;
+        moved = true;
+    }
+    *col = rel;
+    if (*t1 >= map->rows) {
+        hsize_t len = *t1 - *t0 + 1;
+        if (len >= map->rows) {
+            *t0 = 0;
+            *t1 = map->rows - 1;
+        } else {
+            // 長さを保ったまま同じ時間帯 (時刻の剰余) に寄せる
+            *t0 %= map->rows;
+            if (*t0 + len > map->rows) {
+                *t0 = map->rows - len;
+            }
+            *t1 = *t0 + len - 1;
+        }
+        moved = true;
+    }
+    return moved;
+}
+
+static void add_read(Workload *w, const ShapeRead *r) {
+    if (w->num_reads == w->capacity) {
+        w->capacity = w->capacity > 0 ? w->capacity * 2 : 64;
+        w->reads = (ShapeRead *)realloc(w->reads, sizeof(ShapeRead) * w->capacity);
+    }
+    w->reads[w->num_reads++] = *r;
+}
+
+// 1行1回の読み出し: <ラベル> <メッシュ> <時刻>
+//   メッシュ: "*" はサンプルの全列、"@N" は連続する N 列 (開始位置は読み出しごとに変わる)、
+//             "id,id,..." はメッシュID
+//   時刻: "*"、"a"、"a-b" (REFERENCE_MOBAKU_DATETIME からの時間数)
+// '#' から行末まではコメント。成功したら 0、失敗したら -1
+static int load_workload(const char *path, const SampleMap *map, hsize_t file_rows, Workload *w) {
+    FILE *fp = fopen(path, "r");
+    if (fp == NULL) {
+        perror("fopen failed for workload");
+        return -1;
+    }
+    memset(w, 0, sizeof(*w));
+    unsigned int seed = BENCH_SEED;
+    char *line = NULL;
+    size_t cap = 0;
+    int lineno = 0;
+    int status = 0;
+    while (status == 0 && getline(&line, &cap, fp) != -1) {
+        lineno++;
+        char *hash = strchr(line, '#');
+        if (hash != NULL) {
+            *hash = '\0';
+        }
+        char label[BENCH_LABEL_LEN], meshes[4096], hours[64];
+        int fields = sscanf(line, "%31s %4095s %63s", label, meshes, hours);
+        if (fields <= 0) {
+            continue;
+        }
+        ShapeRead r = {0};
+        if (fields != 3 || !parse_hours(hours, file_rows, &r.t0, &r.t1) || (r.label = find_label(w, label)) < 0) {
+            fprintf(stderr, "%s:%d: expected <label> <meshes> <hours> within the file\n", path, lineno);
+            status = -1;
+            break;
+        }
+        hsize_t orig_t0 = r.t0, orig_t1 = r.t1;
+        bool moved = false;
+        if (strcmp(meshes, "*") == 0 || meshes[0] == '@') {
+            int n = meshes[0] == '@' ? atoi(meshes + 1) : (int)map->cols;
+            if (n <= 0 || (hsize_t)n > map->cols) {
+                fprintf(stderr, "%s:%d: mesh count must be 1-%llu: %s\n", path, lineno,
+                        (unsigned long long)map->cols, meshes);
+                status = -1;
+                break;
+            }
+            seed = seed * 1103515245u + 12345u;
+            hsize_t first = n == (int)map->cols ? 0 : (seed >> 8) % (map->cols - (hsize_t)n + 1);
+            r.num_cols = n;
+            r.cols = (hsize_t *)malloc(sizeof(hsize_t) * n);
+            for (int j = 0; j < n; ++j) {
+                r.cols[j] = first + (hsize_t)j;
+            }
+            long long dummy = (long long)map->col_begin;
+            moved = map_into_sample(map, &dummy, &r.t0, &r.t1);
+        } else {
+            r.cols = (hsize_t *)malloc(sizeof(hsize_t) * (strlen(meshes) / 2 + 1));
+            char *save = NULL;
+            for (char *tok = strtok_r(meshes, ",", &save); tok != NULL; tok = strtok_r(NULL, ",", &save)) {
+                long long col = mesh_column(map, (uint32_t)strtoul(tok, NULL, 10));
+                if (col < 0) {
+                    fprintf(stderr, "%s:%d: mesh %s is not in meshid_list\n", path, lineno, tok);
+                    status = -1;
+                    break;
+                }
+                r.t0 = orig_t0;
+                r.t1 = orig_t1;
+                moved |= map_into_sample(map, &col, &r.t0, &r.t1);
+                r.cols[r.num_cols++] = (hsize_t)col;
+            }
+            qsort(r.cols, r.num_cols, sizeof(hsize_t), compare_hsize);
+            int k = 0;
+            for (int j = 0; j < r.num_cols; ++j) {
+                if (k == 0 || r.cols[k - 1] != r.cols[j]) {
+                    r.cols[k++] = r.cols[j];
+                }
+            }
+            r.num_cols = k;
+        }
+        if (status != 0 || r.num_cols == 0) {
+            free(r.cols);
+            continue;
+        }
+        w->remapped += moved;
+        add_read(w, &r);
+    }
+    free(line);
+    fclose(fp);
+    if (status == 0 && w->num_reads == 0) {
+        fprintf(stderr, "No reads in workload: %s\n", path);
+        status = -1;
+    }
+    return status;
+}
+
+// ワークロードが指すメッシュの最小の列から (なければ中央から) サンプルを取る。境界は一番幅の広い候補に揃える
+static hsize_t choose_sample_begin(const char *path, const SampleMap *map, hsize_t align) {
+    long long first = -1;
+    FILE *fp = fopen(path, "r");
+    char *line = NULL;
+    size_t cap = 0;
+    while (fp != NULL && getline(&line, &cap, fp) != -1) {
+        char label[BENCH_LABEL_LEN], meshes[4096];
+        if (line[0] == '#' || sscanf(line, "%31s %4095s", label, meshes) != 2 || meshes[0] == '*' ||
+            meshes[0] == '@') {
+            continue;
+        }
+        long long col = mesh_column(map, (uint32_t)strtoul(meshes, NULL, 10));
+        if (col >= 0 && (first < 0 || col < first)) {
+            first = col;
+        }
+    }
+    free(line);
+    if (fp != NULL) {
+        fclose(fp);
+    }
+    hsize_t begin = first >= 0 ? (hsize_t)first : (map->file_cols - map->cols) / 2;
+    begin = begin / align * align;
+    if (begin + map->cols > map->file_cols) {
+        begin = map->file_cols - map->cols;
+    }
+    return begin;
+}
+
+typedef struct {
+    uint64_t chunks;
+    uint64_t bytes;
+    uint64_t *latency_ns;   // 読み出しごと
+    int reads;
+} LabelStats;
+
+static int compare_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+// r が触れるチャンクの数と、それらがファイル上で占めるバイト数
+static void count_chunks(hid_t dataset_id, const ShapeRead *r, const ChunkShape *s, uint64_t *chunks,
+                         uint64_t *bytes) {
+    *chunks = 0;
+    *bytes = 0;
+    long long last = -1;
+    for (int j = 0; j < r->num_cols; ++j) {
+        long long cj = (long long)(r->cols[j] / s->mesh_chunk);
+        if (cj == last) {
+            continue;
+        }
+        last = cj;
+        for (hsize_t ti = r->t0 / s->time_chunk; ti <= r->t1 / s->time_chunk; ++ti) {
+            hsize_t offset[2] = {ti * s->time_chunk, (hsize_t)cj * s->mesh_chunk};
+            hsize_t stored = 0;
+            H5Dget_chunk_storage_size(dataset_id, offset, &stored);
+            (*chunks)++;
+            *bytes += stored;
+        }
+    }
+}
+
+// 連続する列をまとめたハイパースラブで r を読む
+static herr_t read_columns(hid_t dataset_id, hid_t file_space, const ShapeRead *r, int *buf) {
+    H5Sselect_none(file_space);
+    for (int j = 0; j < r->num_cols;) {
+        int k = j + 1;
+        while (k < r->num_cols && r->cols[k] == r->cols[k - 1] + 1) {
+            k++;
+        }
+        hsize_t start[2] = {r->t0, r->cols[j]};
+        hsize_t count[2] = {r->t1 - r->t0 + 1, (hsize_t)(k - j)};
+        H5Sselect_hyperslab(file_space, H5S_SELECT_OR, start, NULL, count, NULL);
+        j = k;
+    }
+    hsize_t mem_dims[1] = {(r->t1 - r->t0 + 1) * (hsize_t)r->num_cols};
+    hid_t mem_space = H5Screate_simple(1, mem_dims, NULL);
+    herr_t status = H5Dread(dataset_id, H5T_NATIVE_INT, mem_space, file_space, H5P_DEFAULT, buf);
+    H5Sclose(mem_space);
+    return status;
+}
+
+// サンプルを形状 s で書き、ワークロードを再生する。ファイルはメモリ上に置き、時間はディスクを含まない
+static int bench_shape(const ChunkShape *s, const int *sample, const SampleMap *map, const Workload *w,
+                       ChunkCodec codec, int level, int *buf) {
+    hid_t fapl = H5Pcreate(H5P_FILE_ACCESS);
+    H5Pset_fapl_core(fapl, 64 * 1024 * 1024, false);
+    hid_t file_id = H5Fcreate("bench_chunk_shape.h5", H5F_ACC_TRUNC, H5P_DEFAULT, fapl);
+    H5Pclose(fapl);
+    if (file_id < 0) {
+        return -1;
+    }
+    hid_t dataset_id = create_population_dataset(file_id, "population_data", map->rows, map->cols, s->time_chunk,
+                                                 s->mesh_chunk, codec, level);
+    if (dataset_id < 0 || H5Dwrite(dataset_id, H5T_NATIVE_INT, H5S_ALL, H5S_ALL, H5P_DEFAULT, sample) < 0) {
+        fprintf(stderr, "Failed to write the sample with chunk %llux%llu\n", (unsigned long long)s->time_chunk,
+                (unsigned long long)s->mesh_chunk);
+        if (dataset_id >= 0) {
+            H5Dclose(dataset_id);
+        }
+        H5Fclose(file_id);
+        return -1;
+    }
+    hsize_t stored = H5Dget_storage_size(dataset_id);
+    H5Dclose(dataset_id);
+
+    // チャンクキャッシュを無効にして、読み出しごとに触れたチャンクを全部読ませる
+    hid_t dapl = H5Pcreate(H5P_DATASET_ACCESS);
+    H5Pset_chunk_cache(dapl, 0, 0, H5D_CHUNK_CACHE_W0_DEFAULT);
+    dataset_id = H5Dopen2(file_id, "population_data", dapl);
+    H5Pclose(dapl);
+    hid_t file_space = H5Dget_space(dataset_id);
+
+    LabelStats stats[BENCH_MAX_LABELS + 1] = {0};
+    for (int l = 0; l <= w->num_labels; ++l) {
+        stats[l].latency_ns = (uint64_t *)malloc(sizeof(uint64_t) * w->num_reads);
+    }
+    int status = 0;
+    for (int i = 0; i < w->num_reads && status == 0; ++i) {
+        const ShapeRead *r = &w->reads[i];
+        uint64_t chunks, bytes;
+        count_chunks(dataset_id, r, s, &chunks, &bytes);
+        uint64_t t0 = monotonic_ns();
+        status = read_columns(dataset_id, file_space, r, buf) < 0 ? -1 : 0;
+        uint64_t elapsed = monotonic_ns() - t0;
+        // 中身も元のサンプルと同じであること
+        for (hsize_t t = r->t0, k = 0; status == 0 && t <= r->t1; ++t) {
+            for (int j = 0; j < r->num_cols; ++j, ++k) {
+                if (buf[k] != sample[t * map->cols + r->cols[j]]) {
+                    fprintf(stderr, "Read back a different value with chunk %llux%llu\n",
+                            (unsigned long long)s->time_chunk, (unsigned long long)s->mesh_chunk);
+                    status = -1;
+                    break;
+                }
+            }
+        }
+        int labels[2] = {r->label, w->num_labels};
+        for (int k = 0; k < 2; ++k) {
+            LabelStats *ls = &stats[labels[k]];
+            ls->chunks += chunks;
+            ls->bytes += bytes;
+            ls->latency_ns[ls->reads++] = elapsed;
+        }
+    }
+
+    char shape[32];
+    snprintf(shape, sizeof(shape), "%llux%llu", (unsigned long long)s->time_chunk, (unsigned long long)s->mesh_chunk);
+    for (int l = 0; l <= w->num_labels && status == 0; ++l) {
+        LabelStats *ls = &stats[l];
+        if (ls->reads == 0) {
+            continue;
+        }
+        uint64_t total = 0;
+        for (int i = 0; i < ls->reads; ++i) {
+            total += ls->latency_ns[i];
+        }
+        qsort(ls->latency_ns, ls->reads, sizeof(uint64_t), compare_u64);
+        uint64_t p95 = ls->latency_ns[(ls->reads * 95 + 99) / 100 - 1];
+        printf("%-12s %-12s %7d %10.1f %10.1f %10.3f %10.3f %10.3f", l == 0 ? shape : "",
+               l < w->num_labels ? w->labels[l] : "(all)", ls->reads, (double)ls->chunks / ls->reads,
+               ls->bytes / (1024.0 * 1024.0), total / 1e6 / ls->reads, p95 / 1e6, total / 1e9);
+        if (l == 0) {
+            printf("  stored %.1f MiB", stored / (1024.0 * 1024.0));
+        }
+        printf("\n");
+    }
+    for (int l = 0; l <= w->num_labels; ++l) {
+        free(stats[l].latency_ns);
+    }
+    H5Sclose(file_space);
+    H5Dclose(dataset_id);
+    H5Fclose(file_id);
+    return status;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 3) {
+        fprintf(stderr, "Usage: %s <hdf5_file> <workload_file> [shapes|-] [meshes] [hours]\n", argv[0]);
+        return 1;
+    }
+    const char *shape_arg = argc > 3 && strcmp(argv[3], "-") != 0 ? argv[3] : BENCH_DEFAULT_SHAPES;
+    long long meshes = argc > 4 ? atoll(argv[4]) : BENCH_DEFAULT_MESHES;
+    long long hours = argc > 5 ? atoll(argv[5]) : BENCH_DEFAULT_HOURS;
+    if (meshes <= 0 || hours <= 0) {
+        fprintf(stderr, "meshes and hours must be positive\n");
+        return 1;
+    }
+
+    register_delta_bitpack_filter();
+    hid_t file_id = H5Fopen(argv[1], H5F_ACC_RDONLY, H5P_DEFAULT);
+    if (file_id < 0) {
+        fprintf(stderr, "Failed to open HDF5 file: %s\n", argv[1]);
+        return 1;
+    }
+    hid_t dataset_id = H5Dopen(file_id, "population_data", H5P_DEFAULT);
+    if (dataset_id < 0) {
+        fprintf(stderr, "Failed to open population_data dataset\n");
+        H5Fclose(file_id);
+        return 1;
+    }
+    hid_t space_id = H5Dget_space(dataset_id);
+    hsize_t dims[2];
+    H5Sget_simple_extent_dims(space_id, dims, NULL);
+
+    // 候補にはいまのファイルの形状も入れる
+    ChunkShape shapes[BENCH_MAX_SHAPES];
+    int num_shapes = 0;
+    hid_t plist_id = H5Dget_create_plist(dataset_id);
+    if (H5Pget_layout(plist_id) == H5D_CHUNKED) {
+        hsize_t chunk[2];
+        H5Pget_chunk(plist_id, 2, chunk);
+        shapes[num_shapes++] = (ChunkShape){chunk[0], chunk[1]};
+    }
+    H5Pclose(plist_id);
+    num_shapes = parse_shapes(shape_arg, shapes, num_shapes);
+    if (num_shapes <= 0) {
+        return 1;
+    }
+    ChunkCodec codec = CHUNK_CODEC_NONE;
+    int level = 0;
+    if (get_population_codec(dataset_id, &codec, &level) != 0) {
+        fprintf(stderr, "Unknown filter pipeline; comparing shapes without compression\n");
+        codec = CHUNK_CODEC_NONE;
+        level = 0;
+    }
+
+    SampleMap map = {
+        .rows = (hsize_t)hours < dims[0] ? (hsize_t)hours : dims[0],
+        .cols = (hsize_t)meshes < dims[1] ? (hsize_t)meshes : dims[1],
+        .file_cols = dims[1],
+    };
+    hsize_t align = 1;
+    for (int i = 0; i < num_shapes; ++i) {
+        // サンプルより大きいチャンクは作れないので、サンプルの大きさで切る
+        if (shapes[i].time_chunk > map.rows) {
+            shapes[i].time_chunk = map.rows;
+        }
+        if (shapes[i].mesh_chunk > map.cols) {
+            shapes[i].mesh_chunk = map.cols;
+        }
+        if (shapes[i].mesh_chunk > align) {
+            align = shapes[i].mesh_chunk;
+        }
+    }
+    load_mesh_columns(file_id, &map);
+    map.col_begin = choose_sample_begin(argv[2], &map, align);
+
+    Workload w;
+    if (load_workload(argv[2], &map, dims[0], &w) != 0) {
+        return 1;
+    }
+
+    size_t nbytes = (size_t)map.rows * map.cols * sizeof(int);
+    int *sample = (int *)malloc(nbytes);
+    int *buf = (int *)malloc(nbytes);
+    if (sample == NULL || buf == NULL) {
+        perror("malloc failed");
+        return 1;
+    }
+    hsize_t start[2] = {0, map.col_begin};
+    hsize_t count[2] = {map.rows, map.cols};
+    H5Sselect_hyperslab(space_id, H5S_SELECT_SET, start, NULL, count, NULL);
+    hid_t mem_space = H5Screate_simple(2, count, NULL);
+    herr_t status = H5Dread(dataset_id, H5T_NATIVE_INT, mem_space, space_id, H5P_DEFAULT, sample);
+    H5Sclose(mem_space);
+    H5Sclose(space_id);
+    H5Dclose(dataset_id);
+    H5Fclose(file_id);
+    if (status < 0) {
+        fprintf(stderr, "Failed to read population_data\n");
+        return 1;
+    }
+
+    printf("Sample: %llu hours x %llu meshes from column %llu (%.1f MiB), compression %s\n",
+           (unsigned long long)map.rows, (unsigned long long)map.cols, (unsigned long long)map.col_begin,
+           nbytes / (1024.0 * 1024.0), chunk_codec_name(codec));
+    printf("Workload: %d reads in %d labels, %d moved into the sample\n", w.num_reads, w.num_labels, w.remapped);
+    printf("%-12s %-12s %7s %10s %10s %10s %10s %10s\n", "chunk", "label", "reads", "chunks/rd", "MiB read",
+           "mean ms", "p95 ms", "total s");
+    int result = 0;
+    for (int i = 0; i < num_shapes; ++i) {
+        if (bench_shape(&shapes[i], sample, &map, &w, codec, level, buf) != 0) {
+            result = 1;
+        }
+    }
+    for (int i = 0; i < w.num_reads; ++i) {
+        free(w.reads[i].cols);
+    }
+    free(w.reads);
+    free(map.id_to_col);
+    free(sample);
+    free(buf);
+    return result;
+}
@@ -0,0 +1,178 @@
+//
+// 既存の HDF5 ファイルの population_data の一部を各フィルタ構成で書き直し、圧縮率と圧縮・展開の速度を測る
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <hdf5.h>
+
+#include "chunk_codec.h"
+#include "delta_bitpack.h"
+#include "hdf5_ops.h"
+#include "write_behind.h"
+
+#define BENCH_DEFAULT_MESHES 256
+
+// チャンク化されていない (シャードをまとめた仮想データセットなど) ときに使うチャンク形状
+#define BENCH_TIME_CHUNK 8760
+#define BENCH_MESH_CHUNK 16
+
+typedef struct {
+    ChunkCodec codec;
+    int level;
+} BenchCase;
+
+static const BenchCase BENCH_CASES[] = {
+    {CHUNK_CODEC_NONE, 0},
+    {CHUNK_CODEC_DEFLATE, 1},
+    {CHUNK_CODEC_DEFLATE, 4},
+    {CHUNK_CODEC_DEFLATE, 9},
+    {CHUNK_CODEC_SCALEOFFSET, 0},
+    {CHUNK_CODEC_SCALEOFFSET_DEFLATE, 1},
+    {CHUNK_CODEC_SCALEOFFSET_DEFLATE, 4},
+    {CHUNK_CODEC_ZSTD, 3},
+    {CHUNK_CODEC_ZSTD, 9},
+    {CHUNK_CODEC_DELTA_BITPACK, 1},
+    {CHUNK_CODEC_DELTA_BITPACK, 2},
+};
+
+// data を codec で書いて読み戻す。ファイルはメモリ上に置き、ディスクではなくフィルタの速度を測る。
+// 成功したら 0、codec が使えなければ 1、失敗したら -1
+static int bench_case(const BenchCase *c, const int *data, hsize_t rows, hsize_t cols, const hsize_t chunk[2],
+                      int *readback) {
+    hid_t fapl = H5Pcreate(H5P_FILE_ACCESS);
+    H5Pset_fapl_core(fapl, 64 * 1024 * 1024, false);
+    hid_t file_id = H5Fcreate("bench_compression.h5", H5F_ACC_TRUNC, H5P_DEFAULT, fapl);
+    H5Pclose(fapl);
+    if (file_id < 0) {
+        return -1;
+    }
+    hid_t dataset_id = create_population_dataset(file_id, "population_data", rows, cols, chunk[0], chunk[1],
+                                                 c->codec, c->level);
+    if (dataset_id < 0) {
+        H5Fclose(file_id);
+        return 1;
+    }
+    double raw_mb = (double)rows * cols * sizeof(int) / (1024.0 * 1024.0);
+    uint64_t t0 = monotonic_ns();
+    herr_t status = H5Dwrite(dataset_id, H5T_NATIVE_INT, H5S_ALL, H5S_ALL, H5P_DEFAULT, data);
+    H5Dclose(dataset_id);
+    uint64_t t1 = monotonic_ns();
+    if (status < 0) {
+        H5Fclose(file_id);
+        return -1;
+    }
+
+    // チャンクキャッシュを無効にして開き直し、全チャンクを展開させる
+    hid_t dapl = H5Pcreate(H5P_DATASET_ACCESS);
+    H5Pset_chunk_cache(dapl, 0, 0, H5D_CHUNK_CACHE_W0_DEFAULT);
+    dataset_id = H5Dopen2(file_id, "population_data", dapl);
+    H5Pclose(dapl);
+    hsize_t stored = H5Dget_storage_size(dataset_id);
+    uint64_t t2 = monotonic_ns();
+    status = H5Dread(dataset_id, H5T_NATIVE_INT, H5S_ALL, H5S_ALL, H5P_DEFAULT, readback);
+    uint64_t t3 = monotonic_ns();
+    H5Dclose(dataset_id);
+    H5Fclose(file_id);
+    if (status < 0) {
+        return -1;
+    }
+    bool lossless = memcmp(data, readback, (size_t)rows * cols * sizeof(int)) == 0;
+
+    char label[48];
+    int default_level, min_level, max_level;
+    if (chunk_codec_level_range(c->codec, &default_level, &min_level, &max_level)) {
+        snprintf(label, sizeof(label), "%s-%d", chunk_codec_name(c->codec), c->level);
+    } else {
+        snprintf(label, sizeof(label), "%s", chunk_codec_name(c->codec));
+    }
+    double ratio = stored > 0 ? (double)rows * cols * sizeof(int) / (double)stored : 0.0;
+    printf("%-24s %8.2f %10.1f %12.1f %12.1f%s\n", label, ratio,
+           stored / (1024.0 * 1024.0), raw_mb / ((t1 - t0) / 1e9), raw_mb / ((t3 - t2) / 1e9),
+           lossless ? "" : "  MISMATCH");
+    return lossless ? 0 : -1;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s <hdf5_file> [meshes]\n", argv[0]);
+        return 1;
+    }
+    int meshes = argc > 2 ? atoi(argv[2]) : BENCH_DEFAULT_MESHES;
+    if (meshes <= 0) {
+        fprintf(stderr, "meshes must be positive: %s\n", argv[2]);
+        return 1;
+    }
+
+    // 元のファイルが delta-bitpack で書かれていても読めるようにする
+    register_delta_bitpack_filter();
+    hid_t file_id = H5Fopen(argv[1], H5F_ACC_RDONLY, H5P_DEFAULT);
+    if (file_id < 0) {
+        fprintf(stderr, "Failed to open HDF5 file: %s\n", argv[1]);
+        return 1;
+    }
+    hid_t dataset_id = H5Dopen(file_id, "population_data", H5P_DEFAULT);
+    if (dataset_id < 0) {
+        fprintf(stderr, "Failed to open population_data dataset\n");
+        H5Fclose(file_id);
+        return 1;
+    }
+    hid_t space_id = H5Dget_space(dataset_id);
+    hsize_t dims[2];
+    H5Sget_simple_extent_dims(space_id, dims, NULL);
+    hid_t plist_id = H5Dget_create_plist(dataset_id);
+    hsize_t chunk[2] = {BENCH_TIME_CHUNK, BENCH_MESH_CHUNK};
+    if (H5Pget_layout(plist_id) == H5D_CHUNKED) {
+        H5Pget_chunk(plist_id, 2, chunk);
+    }
+    H5Pclose(plist_id);
+    if (chunk[0] > dims[0]) {
+        chunk[0] = dims[0];
+    }
+
+    // 端のメッシュは海などで 0 ばかりのことがあるので、列の中央からチャンク単位で取る
+    hsize_t cols = ((hsize_t)meshes + chunk[1] - 1) / chunk[1] * chunk[1];
+    if (cols > dims[1]) {
+        cols = dims[1];
+    }
+    hsize_t rows = dims[0];
+    hsize_t start[2] = {0, (dims[1] - cols) / 2 / chunk[1] * chunk[1]};
+    hsize_t count[2] = {rows, cols};
+    size_t nbytes = (size_t)rows * cols * sizeof(int);
+    int *data = (int *)malloc(nbytes);
+    int *readback = (int *)malloc(nbytes);
+    if (data == NULL || readback == NULL) {
+        perror("malloc failed");
+        return 1;
+    }
+    H5Sselect_hyperslab(space_id, H5S_SELECT_SET, start, NULL, count, NULL);
+    hid_t mem_space = H5Screate_simple(2, count, NULL);
+    herr_t status = H5Dread(dataset_id, H5T_NATIVE_INT, mem_space, space_id, H5P_DEFAULT, data);
+    H5Sclose(mem_space);
+    H5Sclose(space_id);
+    H5Dclose(dataset_id);
+    H5Fclose(file_id);
+    if (status < 0) {
+        fprintf(stderr, "Failed to read population_data\n");
+        return 1;
+    }
+
+    printf("Sample: %llu hours x %llu meshes from column %llu (%.1f MiB), chunk %llu x %llu\n",
+           (unsigned long long)rows, (unsigned long long)cols, (unsigned long long)start[1],
+           nbytes / (1024.0 * 1024.0), (unsigned long long)chunk[0], (unsigned long long)chunk[1]);
+    printf("delta-bitpack kernels: %s\n", delta_bitpack_isa_name(delta_bitpack_active_isa()));
+    printf("%-24s %8s %10s %12s %12s\n", "filter", "ratio", "MiB", "encode MB/s", "decode MB/s");
+    int result = 0;
+    for (size_t i = 0; i < sizeof(BENCH_CASES) / sizeof(BENCH_CASES[0]); ++i) {
+        int rc = bench_case(&BENCH_CASES[i], data, rows, cols, chunk, readback);
+        if (rc == 1) {
+            printf("%-24s (filter not available)\n", chunk_codec_name(BENCH_CASES[i].codec));
+        } else if (rc < 0) {
+            result = 1;
+        }
+    }
+    free(data);
+    free(readback);
+    return result;
+}
@@ -0,0 +1,18 @@
+//
+// 既存の HDF5 ファイルに日・月・年と 3次・2次・1次メッシュの集計を作る、または最終時刻まで追いつかせる
+//
+#include <stdio.h>
+
+#include <hdf5.h>
+
+#include "derived_build.h"
+#include "rollup.h"
+
+static void report(hid_t file_id, double seconds) {
+    printf("%s covers %llu hours (%.1f s, %s kernels)\n", ROLLUP_GROUP, (unsigned long long)read_rollup_rows(file_id),
+           seconds, rollup_isa_name(rollup_active_isa()));
+}
+
+int main(int argc, char *argv[]) {
+    return run_derived_build(argc, argv, build_rollups, report);
+}
@@ -0,0 +1,20 @@
+//
+// 既存の HDF5 ファイルに population_snapshot を作る、または最終時刻まで追いつかせる
+//
+#include <stdio.h>
+
+#include <hdf5.h>
+
+#include "derived_build.h"
+#include "snapshot_dataset.h"
+
+static void report(hid_t file_id, double seconds) {
+    hid_t dataset_id = H5Dopen(file_id, SNAPSHOT_DATASET, H5P_DEFAULT);
+    printf("%s holds %llu hours (%.1f s)\n", SNAPSHOT_DATASET, (unsigned long long)read_snapshot_rows(dataset_id),
+           seconds);
+    H5Dclose(dataset_id);
+}
+
+int main(int argc, char *argv[]) {
+    return run_derived_build(argc, argv, build_snapshot_dataset, report);
+}
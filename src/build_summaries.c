@@ -0,0 +1,19 @@
+//
+// 既存の HDF5 ファイルにメッシュごとの日・月・年・チャンクの集計を作る、または最終時刻まで追いつかせる
+//
+#include <stdio.h>
+
+#include <hdf5.h>
+
+#include "derived_build.h"
+#include "mesh_summary.h"
+#include "rollup.h"
+
+static void report(hid_t file_id, double seconds) {
+    printf("Mesh summaries in %s cover %llu hours (%.1f s)\n", ROLLUP_GROUP,
+           (unsigned long long)read_summary_rows(file_id), seconds);
+}
+
+int main(int argc, char *argv[]) {
+    return run_derived_build(argc, argv, build_mesh_summaries, report);
+}
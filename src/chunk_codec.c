@@ -0,0 +1,197 @@
+//
+// population_data のフィルタ構成と、producer 側で HDF5 のフィルタと同じ形式にチャンクを圧縮する処理
+//
+
+#include "chunk_codec.h"
+#include "delta_bitpack.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <zlib.h>
+
+int parse_chunk_codec(const char *name) {
+    if (name == NULL || name[0] == '\0' || strcmp(name, "none") == 0) {
+        return CHUNK_CODEC_NONE;
+    }
+    if (strcmp(name, "deflate") == 0) {
+        return CHUNK_CODEC_DEFLATE;
+    }
+    if (strcmp(name, "scaleoffset") == 0) {
+        return CHUNK_CODEC_SCALEOFFSET;
+    }
+    if (strcmp(name, "scaleoffset-deflate") == 0) {
+        return CHUNK_CODEC_SCALEOFFSET_DEFLATE;
+    }
+    if (strcmp(name, "zstd") == 0) {
+        return CHUNK_CODEC_ZSTD;
+    }
+    if (strcmp(name, "delta-bitpack") == 0) {
+        return CHUNK_CODEC_DELTA_BITPACK;
+    }
+    return -1;
+}
+
+const char* chunk_codec_name(ChunkCodec codec) {
+    switch (codec) {
+        case CHUNK_CODEC_DEFLATE: return "deflate";
+        case CHUNK_CODEC_SCALEOFFSET: return "scaleoffset";
+        case CHUNK_CODEC_SCALEOFFSET_DEFLATE: return "scaleoffset-deflate";
+        case CHUNK_CODEC_ZSTD: return "zstd";
+        case CHUNK_CODEC_DELTA_BITPACK: return "delta-bitpack";
+        case CHUNK_CODEC_NONE:
+        default: return "none";
+    }
+}
+
+bool chunk_codec_in_producer(ChunkCodec codec) {
+    return codec == CHUNK_CODEC_NONE || codec == CHUNK_CODEC_DEFLATE || codec == CHUNK_CODEC_DELTA_BITPACK;
+}
+
+bool chunk_is_zero(const void *src, size_t nbytes) {
+    // ブロックごとに OR を取ってから調べる (値のあるチャンクは先頭近くで抜ける)
+    const unsigned char *p = (const unsigned char *)src;
+    size_t i = 0;
+    for (; i + 256 <= nbytes; i += 256) {
+        uint64_t acc = 0;
+        for (size_t k = 0; k < 256; k += sizeof(uint64_t)) {
+            uint64_t v;
+            memcpy(&v, p + i + k, sizeof(v));
+            acc |= v;
+        }
+        if (acc != 0) {
+            return false;
+        }
+    }
+    for (; i < nbytes; ++i) {
+        if (p[i] != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool chunk_codec_level_range(ChunkCodec codec, int *default_level, int *min_level, int *max_level) {
+    switch (codec) {
+        case CHUNK_CODEC_DEFLATE:
+        case CHUNK_CODEC_SCALEOFFSET_DEFLATE:
+            *default_level = DEFAULT_CHUNK_DEFLATE_LEVEL;
+            *min_level = 1;
+            *max_level = 9;
+            return true;
+        case CHUNK_CODEC_ZSTD:
+            *default_level = DEFAULT_CHUNK_ZSTD_LEVEL;
+            *min_level = 1;
+            *max_level = MAX_CHUNK_ZSTD_LEVEL;
+            return true;
+        case CHUNK_CODEC_DELTA_BITPACK:
+            // 1 は差分、2 は差分の差分
+            *default_level = DEFAULT_DELTA_BITPACK_ORDER;
+            *min_level = 1;
+            *max_level = MAX_DELTA_BITPACK_ORDER;
+            return true;
+        default:
+            return false;
+    }
+}
+
+size_t chunk_codec_bound(ChunkCodec codec, size_t nbytes) {
+    if (codec == CHUNK_CODEC_DEFLATE) {
+        return (size_t)compressBound((uLong)nbytes);
+    }
+    if (codec == CHUNK_CODEC_DELTA_BITPACK) {
+        return delta_bitpack_bound(nbytes);
+    }
+    return nbytes;
+}
+
+// H5Z_filter_shuffle と同じ並び: 全要素の 0 バイト目、全要素の 1 バイト目、... の順
+static void byte_shuffle(const uint8_t *src, uint8_t *dst, size_t nbytes, size_t elem_size) {
+    size_t n = nbytes / elem_size;
+    for (size_t b = 0; b < elem_size; ++b) {
+        uint8_t *out = dst + b * n;
+        const uint8_t *in = src + b;
+        for (size_t i = 0; i < n; ++i) {
+            out[i] = in[i * elem_size];
+        }
+    }
+    // 要素サイズで割り切れない端数はそのまま末尾に置く
+    memcpy(dst + n * elem_size, src + n * elem_size, nbytes - n * elem_size);
+}
+
+static void byte_unshuffle(const uint8_t *src, uint8_t *dst, size_t nbytes, size_t elem_size) {
+    size_t n = nbytes / elem_size;
+    for (size_t b = 0; b < elem_size; ++b) {
+        const uint8_t *in = src + b * n;
+        uint8_t *out = dst + b;
+        for (size_t i = 0; i < n; ++i) {
+            out[i * elem_size] = in[i];
+        }
+    }
+    memcpy(dst + n * elem_size, src + n * elem_size, nbytes - n * elem_size);
+}
+
+int encode_chunk(ChunkCodec codec, int level, const void *src, size_t nbytes, size_t elem_size, size_t row_elems,
+                 void *scratch, void *out, size_t *out_size) {
+    if (codec == CHUNK_CODEC_NONE) {
+        memcpy(out, src, nbytes);
+        *out_size = nbytes;
+        return 0;
+    }
+    if (!chunk_codec_in_producer(codec)) {
+        fprintf(stderr, "%s chunks cannot be encoded in producers\n", chunk_codec_name(codec));
+        return -1;
+    }
+    if (codec == CHUNK_CODEC_DELTA_BITPACK) {
+        return delta_bitpack_encode(src, nbytes, row_elems, level, out, out_size);
+    }
+    const void *input = src;
+    if (elem_size > 1 && nbytes >= elem_size) {
+        byte_shuffle((const uint8_t *)src, (uint8_t *)scratch, nbytes, elem_size);
+        input = scratch;
+    }
+    // H5Z_filter_deflate と同じく zlib 形式 (compress2) で出力する
+    uLongf dest_len = (uLongf)compressBound((uLong)nbytes);
+    int status = compress2((Bytef *)out, &dest_len, (const Bytef *)input, (uLong)nbytes, level);
+    if (status != Z_OK) {
+        fprintf(stderr, "compress2 failed: %d\n", status);
+        return -1;
+    }
+    *out_size = (size_t)dest_len;
+    return 0;
+}
+
+int decode_chunk(ChunkCodec codec, const void *src, size_t size, size_t elem_size, void *scratch, void *out,
+                 size_t nbytes) {
+    switch (codec) {
+        case CHUNK_CODEC_NONE:
+            if (size != nbytes) {
+                fprintf(stderr, "Unfiltered chunk has %zu bytes instead of %zu\n", size, nbytes);
+                return -1;
+            }
+            memcpy(out, src, nbytes);
+            return 0;
+        case CHUNK_CODEC_DELTA_BITPACK:
+            if (delta_bitpack_decoded_size(src, size) != nbytes) {
+                fprintf(stderr, "delta-bitpack chunk does not expand to %zu bytes\n", nbytes);
+                return -1;
+            }
+            return delta_bitpack_decode(src, size, out, nbytes);
+        case CHUNK_CODEC_DEFLATE: {
+            bool shuffled = elem_size > 1 && nbytes >= elem_size;
+            uLongf dest_len = (uLongf)nbytes;
+            int status = uncompress((Bytef *)(shuffled ? scratch : out), &dest_len, (const Bytef *)src, (uLong)size);
+            if (status != Z_OK || dest_len != nbytes) {
+                fprintf(stderr, "uncompress failed: %d\n", status);
+                return -1;
+            }
+            if (shuffled) {
+                byte_unshuffle((const uint8_t *)scratch, (uint8_t *)out, nbytes, elem_size);
+            }
+            return 0;
+        }
+        default:
+            fprintf(stderr, "%s chunks cannot be decoded outside HDF5\n", chunk_codec_name(codec));
+            return -1;
+    }
+}
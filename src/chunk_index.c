@@ -0,0 +1,357 @@
+//
+// メッシュ x 時刻チャンクの統計を索引にした、しきい値と上位 K 件の検索
+//
+
+#include "chunk_index.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "mesh_summary.h"
+#include "rollup.h"
+
+// 端の population を一度に読む列数
+#define CHUNK_INDEX_BATCH 256
+
+// 区間に部分的にかかるチャンクの区間の行 [t0, t0 + hours)
+typedef struct {
+    hsize_t t0;
+    hsize_t hours;
+} EdgeRows;
+
+typedef struct {
+    ChunkQueryStat stat;
+    hsize_t cols;
+    int64_t *lower;         // 丸ごと入る区間だけから作った値
+    int64_t *upper;         // かかるすべての区間から作った値
+    EdgeRows edges[2];
+    int num_edges;
+} ChunkBounds;
+
+const char* chunk_query_stat_name(ChunkQueryStat stat) {
+    switch (stat) {
+        case CHUNK_QUERY_MAX: return "max";
+        case CHUNK_QUERY_SUM: return "sum";
+        default: return "unknown";
+    }
+}
+
+static int64_t combine(ChunkQueryStat stat, int64_t a, int64_t b) {
+    return stat == CHUNK_QUERY_SUM ? a + b : (a > b ? a : b);
+}
+
+static void free_bounds(ChunkBounds *b) {
+    free(b->lower);
+    free(b->upper);
+}
+
+// 全メッシュの [t0, t1) を population_data から読むときに触れるチャンクの要素数
+static uint64_t scan_values(const PopulationReader *r, hsize_t t0, hsize_t t1) {
+    const hsize_t *chunk = r->chunk[POPULATION_LAYOUT_SERIES];
+    uint64_t time_chunks = (t1 - 1) / chunk[0] - t0 / chunk[0] + 1;
+    uint64_t mesh_chunks = (r->cols + chunk[1] - 1) / chunk[1];
+    return time_chunks * mesh_chunks * chunk[0] * chunk[1];
+}
+
+// rollup/mesh_chunk_<stat> の [t0, t1) にかかる区間を読んで、列ごとの下限と上限を作る
+static int load_bounds(PopulationReader *r, ChunkQueryStat stat, hsize_t t0, hsize_t t1, ChunkBounds *b,
+                       ChunkQueryCost *cost) {
+    b->stat = stat;
+    b->cols = r->cols;
+    b->lower = NULL;
+    b->upper = NULL;
+    b->num_edges = 0;
+    hsize_t summary_rows = read_summary_rows(r->file_id);
+    if (t0 >= t1 || t1 > summary_rows) {
+        fprintf(stderr, "Hours [%llu, %llu) are outside the summaries (%llu hours)\n", (unsigned long long)t0,
+                (unsigned long long)t1, (unsigned long long)summary_rows);
+        return -1;
+    }
+    hsize_t first = summary_bucket_of(SUMMARY_PERIOD_CHUNK, t0);
+    hsize_t count = summary_bucket_of(SUMMARY_PERIOD_CHUNK, t1 - 1) - first + 1;
+    b->lower = (int64_t *)calloc(b->cols > 0 ? b->cols : 1, sizeof(int64_t));
+    b->upper = (int64_t *)calloc(b->cols > 0 ? b->cols : 1, sizeof(int64_t));
+    int64_t *block = (int64_t *)malloc(sizeof(int64_t) * count * (b->cols > 0 ? b->cols : 1));
+    if (b->lower == NULL || b->upper == NULL || block == NULL) {
+        perror("malloc failed");
+        free(block);
+        free_bounds(b);
+        return -1;
+    }
+
+    char name[64];
+    mesh_summary_dataset_name(name, sizeof(name), SUMMARY_PERIOD_CHUNK,
+                              stat == CHUNK_QUERY_SUM ? SUMMARY_STAT_SUM : SUMMARY_STAT_MAX);
+    if (H5Lexists(r->file_id, name, H5P_DEFAULT) <= 0) {
+        fprintf(stderr, "%s dataset is missing\n", name);
+        free(block);
+        free_bounds(b);
+        return -1;
+    }
+    hid_t dataset_id = H5Dopen(r->file_id, name, H5P_DEFAULT);
+    hid_t file_space = H5Dget_space(dataset_id);
+    hsize_t offset[2] = {first, 0};
+    hsize_t dims[2] = {count, b->cols};
+    H5Sselect_hyperslab(file_space, H5S_SELECT_SET, offset, NULL, dims, NULL);
+    hid_t mem_space = H5Screate_simple(2, dims, NULL);
+    herr_t status = b->cols == 0 ? 0 : H5Dread(dataset_id, H5T_NATIVE_INT64, mem_space, file_space, H5P_DEFAULT,
+                                               block);
+    H5Sclose(mem_space);
+    H5Sclose(file_space);
+    H5Dclose(dataset_id);
+    if (status < 0) {
+        fprintf(stderr, "Failed to read %s\n", name);
+        free(block);
+        free_bounds(b);
+        return -1;
+    }
+    if (cost != NULL) {
+        cost->index_values += count * b->cols;
+    }
+
+    // 最後の区間は集計し終えた行までしか値を持たない
+    for (hsize_t i = 0; i < count; ++i) {
+        hsize_t begin = summary_bucket_start(SUMMARY_PERIOD_CHUNK, first + i);
+        hsize_t end = summary_bucket_start(SUMMARY_PERIOD_CHUNK, first + i + 1);
+        end = end < summary_rows ? end : summary_rows;
+        bool full = begin >= t0 && end <= t1;
+        if (!full) {
+            hsize_t from = begin > t0 ? begin : t0;
+            hsize_t to = end < t1 ? end : t1;
+            b->edges[b->num_edges++] = (EdgeRows){from, to - from};
+        }
+        const int64_t *row = block + i * b->cols;
+        for (hsize_t c = 0; c < b->cols; ++c) {
+            b->upper[c] = combine(stat, b->upper[c], row[c]);
+            if (full) {
+                b->lower[c] = combine(stat, b->lower[c], row[c]);
+            }
+        }
+    }
+    free(block);
+    return 0;
+}
+
+// 昇順の列 cols (n 個) の正確な値を、下限に端の population を合わせて values に入れる
+static int resolve_columns(PopulationReader *r, const ChunkBounds *b, const hsize_t *cols, int n, int64_t *values,
+                           ChunkQueryCost *cost) {
+    for (int j = 0; j < n; ++j) {
+        values[j] = b->lower[cols[j]];
+    }
+    if (cost != NULL) {
+        cost->resolved += (hsize_t)n;
+    }
+    hsize_t max_hours = 0;
+    for (int e = 0; e < b->num_edges; ++e) {
+        max_hours = b->edges[e].hours > max_hours ? b->edges[e].hours : max_hours;
+    }
+    if (n == 0 || max_hours == 0) {
+        return 0;
+    }
+    int *buf = (int *)malloc(sizeof(int) * max_hours * n);
+    int64_t *sum = (int64_t *)malloc(sizeof(int64_t) * n);
+    int32_t *max = (int32_t *)malloc(sizeof(int32_t) * n);
+    int status = buf != NULL && sum != NULL && max != NULL ? 0 : -1;
+    if (status != 0) {
+        perror("malloc failed");
+    }
+    for (int e = 0; e < b->num_edges && status == 0; ++e) {
+        const EdgeRows *edge = &b->edges[e];
+        PopulationLayout used;
+        if (read_population(r, edge->t0, edge->hours, cols, n, buf, &used) < 0) {
+            fprintf(stderr, "Failed to read population at hour %llu\n", (unsigned long long)edge->t0);
+            status = -1;
+            break;
+        }
+        if (cost != NULL) {
+            cost->values_read += population_read_cost(r, used, edge->t0, edge->hours, cols, n);
+        }
+        rollup_reduce_rows((const int32_t *)buf, (size_t)n, (size_t)edge->hours, (size_t)n, sum, max);
+        for (int j = 0; j < n; ++j) {
+            values[j] = combine(b->stat, values[j], b->stat == CHUNK_QUERY_SUM ? sum[j] : max[j]);
+        }
+    }
+    free(buf);
+    free(sum);
+    free(max);
+    return status;
+}
+
+static int compare_column(const void *a, const void *b) {
+    hsize_t x = *(const hsize_t *)a;
+    hsize_t y = *(const hsize_t *)b;
+    return (x > y) - (x < y);
+}
+
+static void init_cost(PopulationReader *r, hsize_t t0, hsize_t t1, ChunkQueryCost *cost) {
+    if (cost != NULL) {
+        *cost = (ChunkQueryCost){0, 0, t0 < t1 && r->cols > 0 ? scan_values(r, t0, t1) : 0, 0};
+    }
+}
+
+long long chunk_index_above(PopulationReader *r, ChunkQueryStat stat, hsize_t t0, hsize_t t1, int64_t threshold,
+                            hsize_t **columns, ChunkQueryCost *cost) {
+    *columns = NULL;
+    init_cost(r, t0, t1, cost);
+    ChunkBounds b;
+    if (load_bounds(r, stat, t0, t1, &b, cost) < 0) {
+        return -1;
+    }
+    hsize_t *out = (hsize_t *)malloc(sizeof(hsize_t) * (b.cols > 0 ? b.cols : 1));
+    if (out == NULL) {
+        perror("malloc failed");
+        free_bounds(&b);
+        return -1;
+    }
+    // 下限が超えれば当たり、上限が超えなければ外れ。残りは端を読んで決める
+    long long found = 0;
+    hsize_t pending[CHUNK_INDEX_BATCH];
+    int64_t values[CHUNK_INDEX_BATCH];
+    int num_pending = 0;
+    int status = 0;
+    for (hsize_t c = 0; c <= b.cols && status == 0; ++c) {
+        if (c < b.cols && b.lower[c] > threshold) {
+            out[found++] = c;
+        } else if (c < b.cols && b.upper[c] > threshold) {
+            pending[num_pending++] = c;
+        }
+        if (num_pending > 0 && (num_pending == CHUNK_INDEX_BATCH || c == b.cols)) {
+            status = resolve_columns(r, &b, pending, num_pending, values, cost);
+            for (int j = 0; j < num_pending && status == 0; ++j) {
+                if (values[j] > threshold) {
+                    out[found++] = pending[j];
+                }
+            }
+            num_pending = 0;
+        }
+    }
+    free_bounds(&b);
+    if (status != 0) {
+        free(out);
+        return -1;
+    }
+    qsort(out, (size_t)found, sizeof(hsize_t), compare_column);
+    *columns = out;
+    return found;
+}
+
+// hits の並び (値の大きい順、同じなら列の小さい順) で a が b より後ろか
+static bool worse_hit(const ChunkQueryHit *a, const ChunkQueryHit *b) {
+    return a->value < b->value || (a->value == b->value && a->column > b->column);
+}
+
+// 一番後ろの当たりを根に置くヒープ
+static void sift_down(ChunkQueryHit *heap, size_t n, size_t i) {
+    while (true) {
+        size_t worst = i;
+        size_t l = 2 * i + 1, r = 2 * i + 2;
+        if (l < n && worse_hit(&heap[l], &heap[worst])) {
+            worst = l;
+        }
+        if (r < n && worse_hit(&heap[r], &heap[worst])) {
+            worst = r;
+        }
+        if (worst == i) {
+            return;
+        }
+        ChunkQueryHit tmp = heap[i];
+        heap[i] = heap[worst];
+        heap[worst] = tmp;
+        i = worst;
+    }
+}
+
+static void offer_hit(ChunkQueryHit *heap, size_t *n, size_t k, ChunkQueryHit hit) {
+    if (*n < k) {
+        size_t i = (*n)++;
+        heap[i] = hit;
+        while (i > 0 && worse_hit(&heap[i], &heap[(i - 1) / 2])) {
+            ChunkQueryHit tmp = heap[i];
+            heap[i] = heap[(i - 1) / 2];
+            heap[(i - 1) / 2] = tmp;
+            i = (i - 1) / 2;
+        }
+    } else if (worse_hit(&heap[0], &hit)) {
+        heap[0] = hit;
+        sift_down(heap, *n, 0);
+    }
+}
+
+// 上限で並べる列。比較関数が外の配列を見ずに済むように上限を一緒に持つ
+typedef struct {
+    hsize_t column;
+    int64_t upper;
+} ColumnUpper;
+
+static int compare_by_upper(const void *a, const void *b) {
+    const ColumnUpper *x = (const ColumnUpper *)a;
+    const ColumnUpper *y = (const ColumnUpper *)b;
+    if (x->upper != y->upper) {
+        return x->upper < y->upper ? 1 : -1;
+    }
+    return (x->column > y->column) - (x->column < y->column);
+}
+
+static int compare_hit(const void *a, const void *b) {
+    const ChunkQueryHit *x = (const ChunkQueryHit *)a;
+    const ChunkQueryHit *y = (const ChunkQueryHit *)b;
+    return worse_hit(x, y) ? 1 : (worse_hit(y, x) ? -1 : 0);
+}
+
+long long chunk_index_top_k(PopulationReader *r, ChunkQueryStat stat, hsize_t t0, hsize_t t1, size_t k,
+                            ChunkQueryHit *hits, ChunkQueryCost *cost) {
+    init_cost(r, t0, t1, cost);
+    ChunkBounds b;
+    if (load_bounds(r, stat, t0, t1, &b, cost) < 0) {
+        return -1;
+    }
+    ColumnUpper *order = (ColumnUpper *)malloc(sizeof(ColumnUpper) * (b.cols > 0 ? b.cols : 1));
+    if (order == NULL) {
+        perror("malloc failed");
+        free_bounds(&b);
+        return -1;
+    }
+    for (hsize_t c = 0; c < b.cols; ++c) {
+        order[c] = (ColumnUpper){c, b.upper[c]};
+    }
+    qsort(order, b.cols, sizeof(ColumnUpper), compare_by_upper);
+
+    // 上限の大きい列から順に正確な値を出し、次の上限が K 番目の値に届かなくなったら止める。
+    // 上限と下限が同じ列は読まずに決まる
+    size_t found = 0;
+    hsize_t batch[CHUNK_INDEX_BATCH];
+    int64_t values[CHUNK_INDEX_BATCH];
+    int status = 0;
+    hsize_t pos = 0;
+    while (pos < b.cols && k > 0 && status == 0) {
+        int n = 0;
+        while (pos < b.cols && n < CHUNK_INDEX_BATCH &&
+               (found < k || order[pos].upper >= hits[0].value)) {
+            hsize_t c = order[pos++].column;
+            if (b.lower[c] == b.upper[c]) {
+                offer_hit(hits, &found, k, (ChunkQueryHit){c, b.lower[c]});
+            } else {
+                batch[n++] = c;
+            }
+        }
+        if (n == 0) {
+            if (pos < b.cols && found == k && order[pos].upper < hits[0].value) {
+                break;
+            }
+            continue;
+        }
+        qsort(batch, (size_t)n, sizeof(hsize_t), compare_column);
+        status = resolve_columns(r, &b, batch, n, values, cost);
+        for (int j = 0; j < n && status == 0; ++j) {
+            offer_hit(hits, &found, k, (ChunkQueryHit){batch[j], values[j]});
+        }
+    }
+    free(order);
+    free_bounds(&b);
+    if (status != 0) {
+        return -1;
+    }
+    qsort(hits, found, sizeof(ChunkQueryHit), compare_hit);
+    return (long long)found;
+}
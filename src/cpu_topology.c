@@ -0,0 +1,312 @@
+//
+// sysfs から CPU トポロジーを読み、スレッドの配置を決める
+//
+#define _GNU_SOURCE
+
+#include "cpu_topology.h"
+
+#include <ctype.h>
+#include <dirent.h>
+#include <libgen.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+
+int parse_cpulist(const char *text, cpu_set_t *set) {
+    const char *p = text;
+    while (*p != '\0' && *p != '\n') {
+        char *end;
+        long first = strtol(p, &end, 10);
+        if (end == p || first < 0) {
+            return -1;
+        }
+        long last = first;
+        p = end;
+        if (*p == '-') {
+            p++;
+            last = strtol(p, &end, 10);
+            if (end == p || last < first) {
+                return -1;
+            }
+            p = end;
+        }
+        for (long cpu = first; cpu <= last && cpu < CPU_SETSIZE; ++cpu) {
+            CPU_SET((int)cpu, set);
+        }
+        if (*p == ',') {
+            p++;
+        } else if (*p != '\0' && *p != '\n') {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// sysfs の1行を読む。読めなければ -1
+static int read_sysfs_line(const char *path, char *buf, size_t size) {
+    FILE *fp = fopen(path, "r");
+    if (fp == NULL) {
+        return -1;
+    }
+    char *line = fgets(buf, (int)size, fp);
+    fclose(fp);
+    return line != NULL ? 0 : -1;
+}
+
+static int read_sysfs_int(const char *path, int fallback) {
+    char buf[64];
+    if (read_sysfs_line(path, buf, sizeof(buf)) != 0) {
+        return fallback;
+    }
+    return atoi(buf);
+}
+
+// node_of[cpu] を devices/system/node/node*/cpulist から埋める (ノードがなければ全て 0)
+static int load_cpu_nodes(const char *sysfs_root, int *node_of, int *num_nodes) {
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/devices/system/node", sysfs_root);
+    *num_nodes = 1;
+    DIR *dir = opendir(path);
+    if (dir == NULL) {
+        return 0;
+    }
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (strncmp(entry->d_name, "node", 4) != 0 || !isdigit((unsigned char)entry->d_name[4])) {
+            continue;
+        }
+        int node = atoi(entry->d_name + 4);
+        char list_path[PATH_MAX + 256];
+        char list[4096];
+        snprintf(list_path, sizeof(list_path), "%s/%s/cpulist", path, entry->d_name);
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        if (read_sysfs_line(list_path, list, sizeof(list)) != 0 || parse_cpulist(list, &set) != 0) {
+            continue;
+        }
+        for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+            if (CPU_ISSET(cpu, &set)) {
+                node_of[cpu] = node;
+            }
+        }
+        if (node + 1 > *num_nodes) {
+            *num_nodes = node + 1;
+        }
+    }
+    closedir(dir);
+    return 0;
+}
+
+int load_cpu_topology(const char *sysfs_root, const cpu_set_t *allowed, CpuTopology *topo) {
+    cpu_set_t affinity;
+    if (allowed == NULL) {
+        if (sched_getaffinity(0, sizeof(affinity), &affinity) != 0) {
+            perror("sched_getaffinity failed");
+            return -1;
+        }
+        allowed = &affinity;
+    }
+    int count = CPU_COUNT(allowed);
+    if (count == 0) {
+        fprintf(stderr, "No CPUs available for thread placement\n");
+        return -1;
+    }
+    int *node_of = (int *)calloc(CPU_SETSIZE, sizeof(int));
+    // 物理コアの識別に使う (physical_package_id, core_id)
+    int (*core_keys)[2] = malloc(sizeof(int[2]) * count);
+    topo->cpus = (CpuInfo *)malloc(sizeof(CpuInfo) * count);
+    if (node_of == NULL || core_keys == NULL || topo->cpus == NULL) {
+        perror("malloc failed");
+        free(node_of);
+        free(core_keys);
+        free(topo->cpus);
+        return -1;
+    }
+    load_cpu_nodes(sysfs_root, node_of, &topo->num_nodes);
+
+    topo->num_cpus = 0;
+    topo->num_cores = 0;
+    for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+        if (!CPU_ISSET(cpu, allowed)) {
+            continue;
+        }
+        char path[PATH_MAX];
+        snprintf(path, sizeof(path), "%s/devices/system/cpu/cpu%d/topology/physical_package_id", sysfs_root, cpu);
+        int package = read_sysfs_int(path, 0);
+        // トポロジーが読めなければ各 CPU を別の物理コアとして扱う
+        snprintf(path, sizeof(path), "%s/devices/system/cpu/cpu%d/topology/core_id", sysfs_root, cpu);
+        int core_id = read_sysfs_int(path, -1 - cpu);
+
+        int core = 0;
+        while (core < topo->num_cores && (core_keys[core][0] != package || core_keys[core][1] != core_id)) {
+            core++;
+        }
+        if (core == topo->num_cores) {
+            core_keys[core][0] = package;
+            core_keys[core][1] = core_id;
+            topo->num_cores++;
+        }
+        int smt_rank = 0;
+        for (int i = 0; i < topo->num_cpus; ++i) {
+            if (topo->cpus[i].core == core) {
+                smt_rank++;
+            }
+        }
+        topo->cpus[topo->num_cpus++] = (CpuInfo){.cpu = cpu, .core = core, .node = node_of[cpu], .smt_rank = smt_rank};
+    }
+    free(node_of);
+    free(core_keys);
+    return 0;
+}
+
+void free_cpu_topology(CpuTopology *topo) {
+    free(topo->cpus);
+    topo->cpus = NULL;
+    topo->num_cpus = 0;
+}
+
+void shard_cpu_set(const CpuTopology *topo, int shard, int num_shards, cpu_set_t *set) {
+    CPU_ZERO(set);
+    for (int i = 0; i < topo->num_cpus; ++i) {
+        const CpuInfo *c = &topo->cpus[i];
+        if (topo->num_cores >= num_shards ? c->core % num_shards == shard
+                                          : topo->num_cpus < num_shards || i % num_shards == shard) {
+            CPU_SET(c->cpu, set);
+        }
+    }
+}
+
+int path_numa_node(const char *sysfs_root, const char *path) {
+    struct stat st;
+    if (stat(path, &st) != 0) {
+        char *copy = strdup(path);
+        if (copy == NULL) {
+            return -1;
+        }
+        int status = stat(dirname(copy), &st);
+        free(copy);
+        if (status != 0) {
+            return -1;
+        }
+    }
+    // パーティションには device がないので、親のディスクも見る
+    static const char *const candidates[] = {"device/numa_node", "../device/numa_node"};
+    for (size_t i = 0; i < sizeof(candidates) / sizeof(candidates[0]); ++i) {
+        char node_path[PATH_MAX];
+        snprintf(node_path, sizeof(node_path), "%s/dev/block/%u:%u/%s", sysfs_root,
+                 major(st.st_dev), minor(st.st_dev), candidates[i]);
+        int node = read_sysfs_int(node_path, -1);
+        if (node >= 0) {
+            return node;
+        }
+    }
+    return -1;
+}
+
+int plan_thread_placement(const CpuTopology *topo, int writer_node, int num_producers, ThreadPlacement *placement) {
+    bool node_present = false;
+    for (int i = 0; i < topo->num_cpus; ++i) {
+        node_present |= topo->cpus[i].node == writer_node;
+    }
+    if (!node_present) {
+        writer_node = topo->cpus[0].node;
+    }
+
+    // writer: 出力先ノードの最初の物理コア
+    const CpuInfo *writer = nullptr;
+    for (int i = 0; i < topo->num_cpus && writer == nullptr; ++i) {
+        if (topo->cpus[i].node == writer_node && topo->cpus[i].smt_rank == 0) {
+            writer = &topo->cpus[i];
+        }
+    }
+    // meshlist_producer: writer の SMT sibling、なければ同じノードの別の CPU
+    const CpuInfo *meshlist = nullptr;
+    for (int i = 0; i < topo->num_cpus && meshlist == nullptr; ++i) {
+        if (topo->cpus[i].core == writer->core && topo->cpus[i].cpu != writer->cpu) {
+            meshlist = &topo->cpus[i];
+        }
+    }
+    for (int i = 0; i < topo->num_cpus && meshlist == nullptr; ++i) {
+        if (topo->cpus[i].node == writer_node && topo->cpus[i].cpu != writer->cpu) {
+            meshlist = &topo->cpus[i];
+        }
+    }
+    placement->writer_cpu = writer->cpu;
+    placement->writer_node = writer_node;
+    placement->meshlist_cpu = meshlist != nullptr ? meshlist->cpu : writer->cpu;
+
+    // producer の候補: writer のコアを除き、SMT の順番ごとにノードを交互にたどる
+    int *order = (int *)malloc(sizeof(int) * topo->num_cpus);
+    int *taken = (int *)calloc(topo->num_nodes, sizeof(int));
+    placement->producer_cpus = (int *)malloc(sizeof(int) * (num_producers > 0 ? num_producers : 1));
+    if (order == NULL || taken == NULL || placement->producer_cpus == NULL) {
+        perror("malloc failed");
+        free(order);
+        free(taken);
+        free(placement->producer_cpus);
+        return -1;
+    }
+    int num_candidates = 0;
+    int max_rank = 0;
+    for (int i = 0; i < topo->num_cpus; ++i) {
+        if (topo->cpus[i].smt_rank > max_rank) {
+            max_rank = topo->cpus[i].smt_rank;
+        }
+    }
+    for (int rank = 0; rank <= max_rank; ++rank) {
+        memset(taken, 0, sizeof(int) * topo->num_nodes);
+        bool added = true;
+        while (added) {
+            added = false;
+            for (int node = 0; node < topo->num_nodes; ++node) {
+                // このノードで taken[node] 番目の候補
+                int seen = 0;
+                for (int i = 0; i < topo->num_cpus; ++i) {
+                    const CpuInfo *c = &topo->cpus[i];
+                    if (c->node != node || c->smt_rank != rank || c->core == writer->core) {
+                        continue;
+                    }
+                    if (seen++ == taken[node]) {
+                        order[num_candidates++] = c->cpu;
+                        taken[node]++;
+                        added = true;
+                        break;
+                    }
+                }
+            }
+        }
+    }
+    // 物理コアが1つしかなければ writer と同居させる
+    if (num_candidates == 0) {
+        for (int i = 0; i < topo->num_cpus; ++i) {
+            order[num_candidates++] = topo->cpus[i].cpu;
+        }
+    }
+    for (int i = 0; i < num_producers; ++i) {
+        placement->producer_cpus[i] = order[i % num_candidates];
+    }
+    placement->num_producers = num_producers;
+    free(order);
+    free(taken);
+    return 0;
+}
+
+void free_thread_placement(ThreadPlacement *placement) {
+    free(placement->producer_cpus);
+    placement->producer_cpus = NULL;
+}
+
+void print_thread_placement(const CpuTopology *topo, const ThreadPlacement *placement) {
+    cpu_set_t used;
+    CPU_ZERO(&used);
+    for (int i = 0; i < placement->num_producers; ++i) {
+        CPU_SET(placement->producer_cpus[i], &used);
+    }
+    printf("CPU topology: %d CPUs, %d cores, %d NUMA nodes\n", topo->num_cpus, topo->num_cores, topo->num_nodes);
+    printf("Thread placement: writer CPU %d (node %d), mesh list CPU %d, %d producers on %d CPUs\n",
+           placement->writer_cpu, placement->writer_node, placement->meshlist_cpu, placement->num_producers,
+           CPU_COUNT(&used));
+}
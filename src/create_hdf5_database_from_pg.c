@@ -15,6 +15,9 @@
 #include <stdint.h>
 #include <arpa/inet.h>
 #include <endian.h>
+#include <getopt.h>
+#include <limits.h>
+#include <sys/wait.h>
 
 #include <hdf5.h>
 
@@ -22,13 +25,25 @@
 #include "db_credentials.h"
 #include "meshid_ops.h"
 #include "fifioq.h"
-
-#define NUM_PRODUCERS 32
-#define MESHLIST_ONCE_LEN 16
+#include "pg_ingest.h"
+#include "hdf5_ops.h"
+#include "cpu_topology.h"
+#include "write_behind.h"
+#include "autotune.h"
+#include "snapshot_dataset.h"
+#include "mesh_summary.h"
+#include "rollup.h"
 
 #define NOW_ENTIRE_LEN_FOR_ONE_MESH 74160
 #define HDF5_DATETIME_CHUNK 8760 //365 * 24
 #define HDF5_MESH_CHUNK 16
+#define CONSUMER_DEQUEUE_BATCH 16
+
+// 完了したバッチを記録して flush する間隔
+#define CHECKPOINT_INTERVAL_SEC 30
+
+// --shards で分けられる最大のファイル数
+#define MAX_SHARDS 64
 
 // テスト用縮小データセット作成を有効にする場合はdefineを有効にする
 //#define CREATE_SMALL_DATASET
@@ -37,331 +52,227 @@
 #define DATASET_REDUCTION_FACTOR 70
 #endif
 
-typedef struct {
-    int rows;
-    int cols;
-    int *data;
-    int meshid_start;
-} PQdataMatrix;
-
-typedef struct {
-    int meshid_number;
-    uint32_t *meshid_list;
-} MeshidList;
-
-typedef struct {
-    FIFOQueue *DataQueue;
-    FIFOQueue * MeshlistQueue;
-    const char * conninfo;
-} ProducerObject;
-
-// データ解放関数
-void free_pqdata_matrix(void *data) {
-    PQdataMatrix *m = (PQdataMatrix *)data;
-    free(m->data);
-    free(m);
-}
-
-void free_meshid_list(void *data) {
-    MeshidList *ml = (MeshidList *)data;
-    free(ml->meshid_list);
-    free(ml);
-}
-
-void *producer(void *arg) {
-    ProducerObject *obj = (ProducerObject *)arg;
-    PGconn *conn = PQconnectdb(obj->conninfo);
-    if (PQstatus(conn) != CONNECTION_OK) {
-        fprintf(stderr, "Connection to database failed: %s\n", PQerrorMessage(conn));
-        PQfinish(conn);
-        pthread_exit(NULL);
-    }
-    FIFOQueue *data_queue = obj->DataQueue;
-    FIFOQueue *meshlist_queue = obj->MeshlistQueue;
-
-    const char *stmtName = "select_population";
-    const char *query = "SELECT mesh_id, datetime, population FROM population_00000 WHERE mesh_id = ANY($1) ORDER BY datetime";
-    PGresult *prepRes = PQprepare(conn, stmtName, query, 1, NULL);
-    if (PQresultStatus(prepRes) != PGRES_COMMAND_OK) {
-        fprintf(stderr, "PQprepare failed: %s\n", PQerrorMessage(conn));
-        PQclear(prepRes);
-        PQfinish(conn);
-        pthread_exit(NULL);
-    }
-    PQclear(prepRes);
-
-    while (true) {
-        MeshidList *meshid_list = (MeshidList*)dequeue(meshlist_queue);
-        if (meshid_list == NULL) {
-            break;
-        }
-
-        // mesh_idリストをPostgreSQLの配列形式の文字列に変換
-        char mesh_ids_str[4096] = "{";
-        for (int i = 0; i < meshid_list->meshid_number; ++i) {
-            char temp[32];
-            snprintf(temp, sizeof(temp), "%u", meshid_list->meshid_list[i]);
-            strcat(mesh_ids_str, temp);
-            if (i < meshid_list->meshid_number - 1) {
-                strcat(mesh_ids_str, ",");
-            }
-        }
-        strcat(mesh_ids_str, "}");
-
-        const char *paramValues[1] = {mesh_ids_str};
-        int paramLengths[1] = {strlen(mesh_ids_str)};
-        int paramFormats[1] = {0};
-
-        PGresult *res = PQexecPrepared(conn, stmtName, 1, paramValues, paramLengths, paramFormats, 1);
-
-        int num_rows = PQntuples(res);
-        int num_fields = PQnfields(res);
-
-        if (PQresultStatus(res) != PGRES_TUPLES_OK) {
-            fprintf(stderr, "SELECT failed: %s\n", PQerrorMessage(conn));
-            PQclear(res);
-            free_meshid_list(meshid_list);
-            continue;
-        }
-
-        PQdataMatrix *qdata_matrix = (PQdataMatrix *)malloc(sizeof(PQdataMatrix));
-        qdata_matrix->rows = NOW_ENTIRE_LEN_FOR_ONE_MESH;
-        qdata_matrix->cols = meshid_list->meshid_number; // 取得するデータ数（mesh_idの数）
-        qdata_matrix->data = (int *)malloc(sizeof(int) * qdata_matrix->rows * qdata_matrix->cols);
-        qdata_matrix->meshid_start = meshid_list->meshid_list[0];
-        memset(qdata_matrix->data, 0, sizeof(int) * qdata_matrix->rows * qdata_matrix->cols);
-        if (qdata_matrix->data == NULL) {
-            perror("malloc failed");
-            exit(1);
-        }
-
-        int idx_mesh = -1;
-        int idx_datetime = -1;
-        int idx_population = -1;
-        for (int k = 0; k < num_fields; k++) {
-            const char* fieldName = PQfname(res, k);
-            if (strcmp(fieldName, "mesh_id") == 0) {
-                idx_mesh = k;
-            } else if (strcmp(fieldName, "datetime") == 0) {
-                idx_datetime = k;
-            } else if (strcmp(fieldName, "population") == 0) {
-                idx_population = k;
-            }
-        }
-        if (idx_mesh == -1 || idx_datetime == -1 || idx_population == -1) {
-            fprintf(stderr, "KEY ERROR");
-            PQclear(res);
-            free(qdata_matrix->data);
-            free(qdata_matrix);
-            free_meshid_list(meshid_list);
-            continue;
-        }
-
-        cmph_t *local_hash = create_local_mph_from_int(meshid_list->meshid_list, meshid_list->meshid_number);
-
-        for (int j = 0; j < num_rows; j++) {
-            int32_t meshid_value = ntohl(*((int32_t *)PQgetvalue(res, j, idx_mesh)));
-            int32_t population = ntohl(*((int32_t *)PQgetvalue(res, j, idx_population)));
-
-            char *datetime_binary_ptr = PQgetvalue(res, j, idx_datetime);
-            int datetime_binary_len = PQgetlength(res, j, idx_datetime);
-
-            time_t datetime_binary_jst = pg_bin_timestamp_to_jst(datetime_binary_ptr, datetime_binary_len);
-
-            int time_index = get_time_index_mobaku_datetime_from_time(datetime_binary_jst);
-            int meshid_index = find_local_id(local_hash, meshid_value);
-            qdata_matrix->data[time_index * qdata_matrix->cols + meshid_index] = population;    //row-major
-        }
-        cmph_destroy(local_hash);
-        PQclear(res);
-        enqueue(data_queue, qdata_matrix);
-        free_meshid_list(meshid_list);
-    }
-    enqueue(data_queue, NULL);
-    PQfinish(conn);
-    pthread_exit(NULL);
-}
-
 typedef struct {
     FIFOQueue *queue;
     hid_t hdf5_file_id;
+    hid_t dataset_id;
     cmph_t *global_hash;
     int total_meshes;
+    int last_ingested_hour; // 追記前の最終時刻インデックス。新規作成なら -1
+    BatchCheckpoint *checkpoint;    // NULL なら完了バッチを記録しない (追記時)
+    SummaryDatasets *summaries;     // NULL なら行列の集計を書かない
+    int num_producers;
+    atomic_int *dropped_batches;    // producer が取得できずに捨てたバッチ数。全 producer の終了後に読む
+    int column_base;        // このファイルの先頭列の全体での列番号 (シャードでなければ 0)
+    bool show_progress;
+    bool report;            // 終了時に書き込みの集計と最終時刻を表示する
+    int writer_cpu;         // HDF5 に書き込む I/O スレッドの CPU
+    // 以下は終了後に読む測定値 (--autotune で使う)
+    uint64_t io_wait_ns;    // ステージングが I/O スレッドの空きを待った時間
+    double queue_occupancy; // 取り出す時点のデータキューの平均の埋まり具合
+    size_t queue_peak;      // 取り出す時点でデータキューに積まれていた最大数
+    bool complete;          // 全バッチが記録された (checkpoint がなければ常に true)
+    size_t write_failures;  // I/O スレッドが書けなかったバッチ数
 } ConsumerArgs;
 
+// producer から受け取った行列の書き込み内容を用意し、HDF5 への書き込みと完了記録は I/O スレッドに任せる
 void *consumer(void *consumer_args) {
     ConsumerArgs *args = (ConsumerArgs *)consumer_args;
     FIFOQueue *q = args->queue;
     hid_t file_id = args->hdf5_file_id;
+    hid_t dataset_id = args->dataset_id;
     cmph_t *hash_for_all_mesh = args->global_hash;
     int nulp_counter = 0;
+    BatchCheckpoint *checkpoint = args->checkpoint;
 
-    // データセットの作成準備
-    hsize_t dims[2] = {NOW_ENTIRE_LEN_FOR_ONE_MESH, meshid_list_size};
-    hid_t dataspace_id = H5Screate_simple(2, dims, NULL);
-    if (dataspace_id < 0) {
-        fprintf(stderr, "Failed to create dataspace in consumer\n");
-        pthread_exit(NULL);
-    }
-    hid_t plist_id = H5Pcreate(H5P_DATASET_CREATE);
-    hsize_t chunk_dims[2] = {HDF5_DATETIME_CHUNK, HDF5_MESH_CHUNK};
-    H5Pset_chunk(plist_id, 2, chunk_dims);
-    hid_t dataset_id = H5Dcreate(file_id, "population_data", H5T_NATIVE_INT, dataspace_id, H5P_DEFAULT, plist_id, H5P_DEFAULT);
-    int fill_value = 0;
-    herr_t status_fill = H5Pset_fill_value(plist_id, H5T_NATIVE_INT, &fill_value);
-    if (status_fill < 0) {
-        fprintf(stderr, "Failed to set fill value for HDF5 dataset\n");
-        H5Pclose(plist_id);
-        H5Sclose(dataspace_id);
-        H5Fclose(file_id);
-        pthread_exit(NULL);
-    }
-    H5Pclose(plist_id);
-    if (dataset_id < 0) {
-        fprintf(stderr, "Failed to create dataset in consumer\n");
-        H5Sclose(dataspace_id);
-        pthread_exit(NULL);
+    WriteBehind writer;
+    if (start_write_behind(&writer, file_id, dataset_id, HDF5_DATETIME_CHUNK, HDF5_MESH_CHUNK, checkpoint,
+                           CHECKPOINT_INTERVAL_SEC, args->summaries, args->last_ingested_hour,
+                           args->writer_cpu) != 0) {
+        exit(1);
     }
+    hsize_t dataset_rows = (hsize_t)writer.max_hour + 1;
+    uint64_t staging_ns = 0;
+    uint64_t producer_wait_ns = 0;
+    double occupancy_sum = 0.0;
+    size_t occupancy_samples = 0;
+    size_t queue_peak = 0;
 
     int processed_meshes = 0; // プログレスバー用カウンタ (処理済みメッシュ数)
     int total_meshes = args->total_meshes; // プログレスバー用合計メッシュ数
 
+    // 溜まっている行列はまとめて取り出す
+    void *dequeued[CONSUMER_DEQUEUE_BATCH];
+    size_t dequeued_len = 0;
+    size_t dequeued_pos = 0;
     while (true) {
-        PQdataMatrix *m = dequeue(q);
+        if (dequeued_pos == dequeued_len) {
+            size_t queued = queue_length(q);
+            occupancy_sum += (double)queued / queue_capacity(q);
+            occupancy_samples++;
+            if (queued > queue_peak) {
+                queue_peak = queued;
+            }
+            uint64_t t0 = monotonic_ns();
+            dequeued_len = dequeue_batch(q, dequeued, CONSUMER_DEQUEUE_BATCH);
+            producer_wait_ns += monotonic_ns() - t0;
+            dequeued_pos = 0;
+        }
+        PQdataMatrix *m = dequeued[dequeued_pos++];
         if (m == NULL) {
             nulp_counter++;
-            if (nulp_counter == NUM_PRODUCERS) {
+            if (nulp_counter == args->num_producers) {
                 break;
             }
             continue;
         }
 
+        uint64_t t0 = monotonic_ns();
         processed_meshes += m->cols;
-        printProgressBar(processed_meshes, total_meshes);
-        hsize_t offset[2];
-        hsize_t count[2];
-
-        offset[0] = 0; // 常に先頭から
-        offset[1] = find_local_id(hash_for_all_mesh, m->meshid_start); // 書き込み開始のメッシュID
-
-        count[0] = m->rows;
-        count[1] = m->cols;
-
-        hid_t memspace_id = H5Screate_simple(2, count, NULL);
-        hid_t dataset_space_id = H5Dget_space(dataset_id);
-        H5Sselect_hyperslab(dataset_space_id, H5S_SELECT_SET, offset, NULL, count, NULL);
+        if (args->show_progress) {
+            printProgressBar(processed_meshes, total_meshes);
+        }
 
-        herr_t status = H5Dwrite(dataset_id, H5T_NATIVE_INT, memspace_id, dataset_space_id, H5P_DEFAULT, m->data);
-        if (status < 0) {
-            fprintf(stderr, "Failed to write data to HDF5 dataset\n");
+        hsize_t column_offset = 0;
+        if (m->columns == NULL) {
+            // 書き込み開始のメッシュID
+            column_offset = find_local_id(hash_for_all_mesh, m->meshid_start) - args->column_base;
         }
+        PQdataWrite *w = (PQdataWrite *)malloc(sizeof(PQdataWrite));
+        if (w == NULL || plan_pqdata_write(w, m, column_offset, dataset_rows) != 0) {
+            exit(1);
+        }
+        staging_ns += monotonic_ns() - t0;
+        submit_pqdata_write(&writer, w);
+    }
+    finish_write_behind(&writer);
+    args->io_wait_ns = writer.submit_wait_ns;
+    args->queue_occupancy = occupancy_samples > 0 ? occupancy_sum / occupancy_samples : 0.0;
+    args->queue_peak = queue_peak;
 
-        H5Sclose(memspace_id);
-        H5Sclose(dataset_space_id);
-        free_pqdata_matrix(m);
+    if (args->show_progress) {
+        printf("\n"); // プログレスバー改行
+    }
+    if (args->report) {
+        report_write_behind(&writer, staging_ns, producer_wait_ns);
     }
 
-    printf("\n"); // プログレスバー改行
+    // 捨てられたバッチの列は埋まっていないので、次の追記で取り直せるよう最終時刻を進めない
+    int dropped = atomic_load(args->dropped_batches);
+    int last_ingested_hour = dropped > 0 ? writer.initial_hour : writer.last_ingested_hour;
+    if (dropped > 0) {
+        fprintf(stderr, "%d batches could not be fetched; last ingested hour kept at %d\n", dropped,
+                last_ingested_hour);
+    }
+    if (write_last_ingested_hour(file_id, last_ingested_hour) < 0) {
+        fprintf(stderr, "Failed to write %s attribute\n", LAST_INGESTED_HOUR_ATTR);
+    }
+    if (args->report) {
+        printf("Last ingested hour: %d\n", last_ingested_hour);
+    }
+    bool complete = true;
+    if (checkpoint != NULL) {
+        if (flush_batch_checkpoint(checkpoint) < 0) {
+            fprintf(stderr, "Failed to record completed batches\n");
+        }
+        int completed = count_completed_batches(checkpoint);
+        if (completed < checkpoint->num_batches) {
+            fprintf(stderr, "%d of %d batches are missing; rerun with --resume\n",
+                    checkpoint->num_batches - completed, checkpoint->num_batches);
+            complete = false;
+        }
+        close_batch_checkpoint(checkpoint);
+    }
+    args->complete = complete;
+    args->write_failures = writer.failures;
+    // 集計は全バッチを書き終えたときだけ最終時刻までを有効にする (途中なら --resume で埋まる)
+    if (args->summaries != NULL) {
+        bool written = complete && writer.failures == 0 && dropped == 0 && last_ingested_hour >= 0;
+        if (close_summary_datasets(args->summaries, written ? (hsize_t)last_ingested_hour + 1 : 0) < 0) {
+            fprintf(stderr, "Failed to write %s attribute\n", SUMMARY_ROWS_ATTR);
+        }
+    }
 
     // HDF5 リソースをクローズ
     H5Dclose(dataset_id);
-    H5Sclose(dataspace_id);
     H5Fclose(file_id);
 
     pthread_exit(NULL);
 }
 
+typedef struct {
+    FIFOQueue *meshid_queue;
+    const IngestOptions *options;
+    const uint8_t *completed;   // 再開時に飛ばすバッチ。NULL なら全バッチを積む
+    int num_producers;
+    int batch_meshes;   // リスト方式で1バッチに入れるメッシュ数
+    int column_begin;   // この範囲の列 (meshid_list の添字) だけを積む。バッチの大きさの倍数であること
+    int column_end;
+} MeshlistProducerArgs;
+
 void *meshlist_producer(void *arg) {
-    FIFOQueue *meshid_queue = (FIFOQueue *)arg;
-    int i;
-    int mesh_count = meshid_list_size;
-    #ifdef CREATE_SMALL_DATASET
-    mesh_count = meshid_list_size / DATASET_REDUCTION_FACTOR;
-    if (mesh_count == 0) mesh_count = 1; // 少なくとも1つは処理する
-    #endif
+    MeshlistProducerArgs *args = (MeshlistProducerArgs *)arg;
+    FIFOQueue *meshid_queue = args->meshid_queue;
+    int column_begin = args->column_begin;
+    int column_end = args->column_end;
+    int batch_meshes = args->batch_meshes;
 
-    for (i = 0; i < (int)(mesh_count / MESHLIST_ONCE_LEN); ++i) {
-        uint32_t *meshid_once_list = (uint32_t *)malloc(MESHLIST_ONCE_LEN * sizeof(uint32_t));
-        MeshidList *m = (MeshidList *)malloc(sizeof(MeshidList));
-        m->meshid_number = MESHLIST_ONCE_LEN;
-        for (int j = 0; j < MESHLIST_ONCE_LEN; ++j) {
-            meshid_once_list[j] = meshid_list[i * MESHLIST_ONCE_LEN + j];
+    if (args->options->scan == INGEST_SCAN_RANGE) {
+        // meshid_list の並びがそのまま書き込み先の列になる
+        if (enqueue_range_batches(meshid_queue, meshid_list + column_begin, column_end - column_begin,
+                                  args->options->range_meshes, args->completed) < 0) {
+            exit(1);
         }
-        m->meshid_list = meshid_once_list;
-        enqueue(meshid_queue, m);
+        for (int k = 0; k < args->num_producers; ++k) {
+            enqueue(meshid_queue, nullptr);
+        }
+        pthread_exit(NULL);
     }
-    if (mesh_count % MESHLIST_ONCE_LEN != 0) {
-        uint32_t *meshid_once_list = (uint32_t *)malloc((mesh_count % MESHLIST_ONCE_LEN) * sizeof(uint32_t));
+
+    // バッチ番号と列番号はこのファイルの中でのもの
+    for (int i = 0; column_begin + i * batch_meshes < column_end; ++i) {
+        if (args->completed != NULL && args->completed[i]) {
+            continue;
+        }
+        int first = column_begin + i * batch_meshes;
+        int n = column_end - first < batch_meshes ? column_end - first : batch_meshes;
+        uint32_t *meshid_once_list = (uint32_t *)malloc(n * sizeof(uint32_t));
         MeshidList *m = (MeshidList *)malloc(sizeof(MeshidList));
-        m->meshid_number = (mesh_count % MESHLIST_ONCE_LEN);
-        for (int j = 0; j < mesh_count % MESHLIST_ONCE_LEN; ++j) {
-            meshid_once_list[j] = meshid_list[i * MESHLIST_ONCE_LEN + j];
+        m->meshid_number = n;
+        for (int j = 0; j < n; ++j) {
+            meshid_once_list[j] = meshid_list[first + j];
         }
         m->meshid_list = meshid_once_list;
+        m->columns = NULL;
+        if (args->options->direct_chunk) {
+            // 列番号を明示してバッチをチャンクの列範囲に揃える (ハッシュの順序に依存しない)
+            m->columns = alloc_column_range(i * batch_meshes, m->meshid_number);
+        }
+        m->key_range = false;
+        m->batch_index = i;
         enqueue(meshid_queue, m);
     }
-    printf("\n");
-    for (int k = 0; k < NUM_PRODUCERS; ++k) {
+    for (int k = 0; k < args->num_producers; ++k) {
         enqueue(meshid_queue, nullptr);
     }
 
     pthread_exit(NULL);
 }
 
-int main(int argc, char* argv[]) {
-    int cpulist[] = {0,1,2,3,4,5,6,7,16,17,18,19,20,21,22,23};  //HARDCODEING AWARE!!!
-    const char* env_filepath = ".env";
-    if (argc > 1) {
-        env_filepath = argv[1];
-    }
-
-    if (!load_env_from_file(env_filepath)) {
-        fprintf(stderr, "Failed to load environment from %s\n", env_filepath);
-        return 1;
-    }
-    DbCredentials *creds = get_db_credentials();
-
-    if (!creds) {
-        return 1;
-    }
-
-    char conninfo[512];
-    snprintf(conninfo, sizeof(conninfo),
-             "host=%s port=%s dbname=%s user=%s password=%s",
-             creds->host, creds->port, creds->dbname, creds->user, creds->password);
-
-    FIFOQueue data_queue;
-    FIFOQueue meshid_queue;
-    init_queue(&data_queue);
-    init_queue(&meshid_queue);
-
-    // HDF5 ファイルを作成
-    const char* hdf5_filepath = getenv("HDF5_FILE_PATH");
-    if (hdf5_filepath == NULL) {
-        fprintf(stderr, "HDF5_FILE_PATH environment variable not set.\n");
-        return 1;
-    }
-    hid_t file_id = H5Fcreate(hdf5_filepath, H5F_ACC_TRUNC, H5P_DEFAULT, H5P_DEFAULT);
-    if (file_id < 0) {
-        fprintf(stderr, "Failed to create HDF5 file: %s\n", hdf5_filepath);
-        return 1;
-    }
-
-    // meshid_list メタデータの書き込み
+// meshid_list と cmph データを書き込む (読み出し側がメッシュIDから列を引くのに使う)
+static int write_mesh_metadata(hid_t file_id) {
     hsize_t meshid_list_dims[1] = {meshid_list_size};
     hid_t meshid_list_space_id = H5Screate_simple(1, meshid_list_dims, NULL);
     hid_t meshid_list_dataset_id = H5Dcreate(file_id, "meshid_list", H5T_NATIVE_UINT32, meshid_list_space_id, H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
     if (meshid_list_dataset_id < 0) {
         fprintf(stderr, "Failed to create meshid_list dataset\n");
         H5Sclose(meshid_list_space_id);
-        H5Fclose(file_id);
-        return 1;
+        return -1;
     }
     H5Dwrite(meshid_list_dataset_id, H5T_NATIVE_UINT32, H5S_ALL, H5S_ALL, H5P_DEFAULT, meshid_list);
     H5Dclose(meshid_list_dataset_id);
     H5Sclose(meshid_list_space_id);
 
-    // cmph データの書き込み
     size_t mph_size = (size_t)(_binary_meshid_mobaku_mph_end - _binary_meshid_mobaku_mph_start);
     hsize_t cmph_dims[1] = {mph_size};
     hid_t cmph_space_id = H5Screate_simple(1, cmph_dims, NULL);
@@ -369,59 +280,595 @@ int main(int argc, char* argv[]) {
     if (cmph_dataset_id < 0) {
         fprintf(stderr, "Failed to create cmph_data dataset\n");
         H5Sclose(cmph_space_id);
-        H5Fclose(file_id);
-        return 1;
+        return -1;
     }
     H5Dwrite(cmph_dataset_id, H5T_NATIVE_UINT8, H5S_ALL, H5S_ALL, H5P_DEFAULT, _binary_meshid_mobaku_mph_start);
     H5Dclose(cmph_dataset_id);
     H5Sclose(cmph_space_id);
+    return 0;
+}
+
+// 列範囲ごとの子プロセスを起動する。子プロセスではそのシャード番号、親では全員の終了を待って
+// 全員成功なら num_shards、失敗があれば -1 を返す
+static int fork_shard_writers(int num_shards) {
+    fflush(stdout);
+    fflush(stderr);
+    pid_t pids[MAX_SHARDS];
+    for (int k = 0; k < num_shards; ++k) {
+        pids[k] = fork();
+        if (pids[k] < 0) {
+            perror("fork failed");
+            for (int j = 0; j < k; ++j) {
+                waitpid(pids[j], NULL, 0);
+            }
+            return -1;
+        }
+        if (pids[k] == 0) {
+            return k;
+        }
+    }
+    int result = num_shards;
+    for (int k = 0; k < num_shards; ++k) {
+        int status;
+        if (waitpid(pids[k], &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            fprintf(stderr, "Shard %d writer failed\n", k);
+            result = -1;
+        }
+    }
+    return result;
+}
+
+// シャードファイルを列方向に並べた仮想データセットを持つファイルを作る
+static int merge_shard_files(const char *hdf5_filepath, int num_shards, const int *bounds) {
+    char shard_paths[MAX_SHARDS][PATH_MAX];
+    const char *paths[MAX_SHARDS];
+    hsize_t shard_cols[MAX_SHARDS];
+    hsize_t rows = 0;
+    int last_ingested_hour = -1;
+    for (int k = 0; k < num_shards; ++k) {
+        shard_file_path(shard_paths[k], sizeof(shard_paths[k]), hdf5_filepath, k);
+        paths[k] = shard_paths[k];
+        shard_cols[k] = (hsize_t)(bounds[k + 1] - bounds[k]);
+        hid_t shard_file = H5Fopen(shard_paths[k], H5F_ACC_RDONLY, H5P_DEFAULT);
+        if (shard_file < 0) {
+            fprintf(stderr, "Failed to open HDF5 file: %s\n", shard_paths[k]);
+            return -1;
+        }
+        // 全シャードが書き終えた時刻までを最終時刻とする
+        int hour = read_last_ingested_hour(shard_file);
+        if (k == 0 || hour < last_ingested_hour) {
+            last_ingested_hour = hour;
+        }
+        bool complete = is_batch_checkpoint_complete(shard_file);
+        hid_t dataset_id = H5Dopen(shard_file, "population_data", H5P_DEFAULT);
+        hid_t space_id = H5Dget_space(dataset_id);
+        hsize_t dims[2] = {0, 0};
+        H5Sget_simple_extent_dims(space_id, dims, NULL);
+        H5Sclose(space_id);
+        H5Dclose(dataset_id);
+        H5Fclose(shard_file);
+        if (!complete) {
+            fprintf(stderr, "%s is incomplete\n", shard_paths[k]);
+            return -1;
+        }
+        rows = dims[0];
+    }
+
+    hid_t file_id = H5Fcreate(hdf5_filepath, H5F_ACC_TRUNC, H5P_DEFAULT, H5P_DEFAULT);
+    if (file_id < 0) {
+        fprintf(stderr, "Failed to create HDF5 file: %s\n", hdf5_filepath);
+        return -1;
+    }
+    int status = write_mesh_metadata(file_id);
+    if (status == 0) {
+        hid_t dataset_id = create_virtual_population_dataset(file_id, "population_data", rows, paths, shard_cols, num_shards);
+        if (dataset_id < 0) {
+            fprintf(stderr, "Failed to create population_data virtual dataset\n");
+            status = -1;
+        } else {
+            H5Dclose(dataset_id);
+        }
+    }
+    if (status == 0 && write_last_ingested_hour(file_id, last_ingested_hour) < 0) {
+        fprintf(stderr, "Failed to write %s attribute\n", LAST_INGESTED_HOUR_ATTR);
+        status = -1;
+    }
+    H5Fclose(file_id);
+    if (status == 0) {
+        printf("Merged %d shard files into %s (last ingested hour %d)\n", num_shards, hdf5_filepath, last_ingested_hour);
+    }
+    return status;
+}
+
+// population_snapshot を最終時刻まで追いつかせる。create でなければ既にあるときだけ
+static int update_snapshot(const char *hdf5_filepath, bool create) {
+    hid_t file_id = H5Fopen(hdf5_filepath, H5F_ACC_RDWR, H5P_DEFAULT);
+    if (file_id < 0) {
+        fprintf(stderr, "Failed to open HDF5 file: %s\n", hdf5_filepath);
+        return -1;
+    }
+    int status = 0;
+    int last_ingested_hour = read_last_ingested_hour(file_id);
+    if (last_ingested_hour >= 0 && (create || H5Lexists(file_id, SNAPSHOT_DATASET, H5P_DEFAULT) > 0)) {
+        uint64_t t0 = monotonic_ns();
+        status = build_snapshot_dataset(file_id, (hsize_t)last_ingested_hour + 1, 0);
+        if (status == 0) {
+            printf("Updated %s through hour %d in %.1f s\n", SNAPSHOT_DATASET, last_ingested_hour,
+                   (monotonic_ns() - t0) / 1e9);
+        } else {
+            fprintf(stderr, "Failed to update %s\n", SNAPSHOT_DATASET);
+        }
+    }
+    H5Fclose(file_id);
+    return status;
+}
+
+static int gcd(int a, int b) {
+    while (b != 0) {
+        int t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+// population_data の from 行目から後を書き直す前に、そこから作った写しと集計の済んだ行数を下げる。
+// 下げないと、抜けたバッチを埋めても写しと集計には埋める前の 0 が残る
+static int lower_derived_rows(hid_t file_id, hsize_t from) {
+    if (lower_snapshot_rows(file_id, from) < 0 || lower_rollup_rows(file_id, from) < 0 ||
+        lower_summary_rows(file_id, from) < 0) {
+        fprintf(stderr, "Failed to reset the rows covered by %s or %s\n", SNAPSHOT_DATASET, ROLLUP_GROUP);
+        return -1;
+    }
+    return 0;
+}
+
+// 1回分の取り込み (キュー、producer、consumer の起動から終了まで)。
+// --autotune の試行でも同じ手順を一時ファイルに対して使う
+typedef struct {
+    const char *conninfo;
+    const IngestOptions *options;   // num_producers とバッチの大きさはこの実行の設定
+    const CpuTopology *topology;
+    int writer_node;
+    cmph_t *global_hash;
+    hid_t file_id;                  // consumer が閉じる
+    hid_t dataset_id;
+    BatchCheckpoint *checkpoint;    // NULL なら完了バッチを記録しない
+    SummaryDatasets *summaries;     // NULL なら行列の集計を書かない (consumer が閉じる)
+    const uint8_t *completed;       // 再開時に飛ばすバッチ
+    int last_ingested_hour;
+    int total_rows;
+    int column_begin;
+    int column_end;
+    bool verbose;                   // 進捗、スレッド配置、終了時の集計を表示する
+    bool show_progress;
+    ConsumerArgs consumer;          // 終了後に測定値を読む
+} IngestRun;
+
+static int run_ingest(IngestRun *run) {
+    const IngestOptions *options = run->options;
+    int num_producers = options->num_producers;
+    int batch_size = ingest_batch_meshes(options);
+
+    // データキューは件数ではなくバイト数で止まるよう、予算いっぱいのバッチと終端の NULL が収まる大きさにする
+    FIFOQueue data_queue;
+    FIFOQueue meshid_queue;
+    size_t data_queue_capacity = options->queue_depth;
+    if (data_queue_capacity == 0) {
+        data_queue_capacity = QUEUE_SIZE;
+        if (options->memory_budget > 0) {
+            size_t batch_bytes = (size_t)NOW_ENTIRE_LEN_FOR_ONE_MESH * batch_size * sizeof(int);
+            size_t needed = options->memory_budget / batch_bytes + num_producers * 2;
+            if (needed > data_queue_capacity) {
+                data_queue_capacity = needed;
+            }
+        }
+    }
+    if (init_queue_with_capacity(&data_queue, data_queue_capacity) != 0) {
+        return -1;
+    }
+    init_queue(&meshid_queue);
+
+    ThreadPlacement placement;
+    if (plan_thread_placement(run->topology, run->writer_node, num_producers, &placement) != 0) {
+        return -1;
+    }
+    if (run->verbose) {
+        print_thread_placement(run->topology, &placement);
+    }
 
     pthread_attr_t attr;
     cpu_set_t cpuset;
-    pthread_t producer_threads[NUM_PRODUCERS], consumer_thread, meshlist_producer_pthread;
-    ProducerObject producer_objects[NUM_PRODUCERS];
-    int target_cpu_core;
+    pthread_t consumer_thread, meshlist_producer_pthread;
+    pthread_t *producer_threads = (pthread_t *)malloc(sizeof(pthread_t) * num_producers);
+    ProducerObject *producer_objects = (ProducerObject *)malloc(sizeof(ProducerObject) * num_producers);
+    if (producer_threads == NULL || producer_objects == NULL) {
+        perror("malloc failed");
+        return -1;
+    }
 
     // meshlist_producer スレッドの作成と affinity 設定
     pthread_attr_init(&attr);
     CPU_ZERO(&cpuset);
-    CPU_SET(0, &cpuset);    //HARDCODE AWARE!!!
+    CPU_SET(placement.meshlist_cpu, &cpuset);
     if (pthread_attr_setaffinity_np(&attr, sizeof(cpu_set_t), &cpuset) != 0) {
         perror("pthread_attr_setaffinity_np failed for meshlist_producer");
     }
-    if (pthread_create(&meshlist_producer_pthread, &attr, meshlist_producer, &meshid_queue) != 0) {
+    MeshlistProducerArgs mpl_args = {
+        .meshid_queue = &meshid_queue,
+        .options = options,
+        .completed = run->completed,
+        .num_producers = num_producers,
+        .batch_meshes = batch_size,
+        .column_begin = run->column_begin,
+        .column_end = run->column_end
+    };
+    if (pthread_create(&meshlist_producer_pthread, &attr, meshlist_producer, &mpl_args) != 0) {
         perror("pthread_create failed for meshlist_producer");
-        return 1;
+        return -1;
     }
     pthread_attr_destroy(&attr);
 
+    // 直接チャンク書き込みでは時間方向もチャンク単位で確保する
+    int producer_rows = run->total_rows - options->time_start;
+    if (options->direct_chunk) {
+        producer_rows = (producer_rows + HDF5_DATETIME_CHUNK - 1) / HDF5_DATETIME_CHUNK * HDF5_DATETIME_CHUNK;
+    }
+
+    // 行列のデータ領域は producer ごとのプールで使い回す。
+    // 返却済みのまま保持する分は予算の一部を割り当て、残りをキュー上の行列の予算にする
+    size_t pool_buffer_bytes = (size_t)producer_rows * batch_size * sizeof(int);
+    size_t pool_bytes;
+    size_t pool_cached = matrix_pool_cached_for_budget(options->memory_budget, num_producers, pool_buffer_bytes,
+                                                       &pool_bytes);
+    ByteBudget data_budget;
+    init_byte_budget(&data_budget, options->memory_budget - pool_bytes);
+    atomic_int dropped_batches = 0;
+
     // producer スレッドの作成と affinity 設定
-    for (int i = 0; i < NUM_PRODUCERS; ++i) {
+    for (int i = 0; i < num_producers; ++i) {
         pthread_attr_init(&attr);
         CPU_ZERO(&cpuset);
-        target_cpu_core = cpulist[i % (sizeof(cpulist) / sizeof(cpulist[0]))];    //HARDCODE AWARE!!!
-        CPU_SET(target_cpu_core, &cpuset);
+        CPU_SET(placement.producer_cpus[i], &cpuset);
         if (pthread_attr_setaffinity_np(&attr, sizeof(cpu_set_t), &cpuset) != 0) {
             perror("pthread_attr_setaffinity_np failed for producer");
         }
         producer_objects[i].DataQueue = &data_queue;
         producer_objects[i].MeshlistQueue = &meshid_queue;
-        producer_objects[i].conninfo = conninfo;
-        if (pthread_create(&producer_threads[i], &attr, producer, &producer_objects[i]) != 0) {
+        producer_objects[i].conninfo = run->conninfo;
+        producer_objects[i].options = options;
+        producer_objects[i].rows = producer_rows;
+        producer_objects[i].time_chunk = options->direct_chunk ? HDF5_DATETIME_CHUNK : 0;
+        producer_objects[i].mesh_chunk = HDF5_MESH_CHUNK;
+        producer_objects[i].budget = options->memory_budget > 0 ? &data_budget : NULL;
+        producer_objects[i].stall_ns = 0;
+        producer_objects[i].pool = create_matrix_pool(pool_buffer_bytes, pool_cached);
+        producer_objects[i].dropped_batches = &dropped_batches;
+        if (pthread_create(&producer_threads[i], &attr, population_producer, &producer_objects[i]) != 0) {
             perror("pthread_create failed for producer");
-            return 1;
+            return -1;
         }
         pthread_attr_destroy(&attr);
     }
 
-    // consumer スレッドの作成と affinity 設定
+    // consumer スレッドの作成と affinity 設定。
+    // HDF5 に書き込む I/O スレッドが writer_cpu を使い、ステージングはその SMT sibling で動かす
     pthread_attr_init(&attr);
     CPU_ZERO(&cpuset);
-    CPU_SET(1, &cpuset);    //HARDCODE AWARE!!!
+    CPU_SET(placement.meshlist_cpu, &cpuset);
     if (pthread_attr_setaffinity_np(&attr, sizeof(cpu_set_t), &cpuset) != 0) {
         perror("pthread_attr_setaffinity_np failed for consumer");
     }
 
+    ConsumerArgs *consumer_args = &run->consumer;
+    consumer_args->queue = &data_queue;
+    consumer_args->hdf5_file_id = run->file_id;
+    consumer_args->dataset_id = run->dataset_id;
+    consumer_args->last_ingested_hour = run->last_ingested_hour;
+    consumer_args->writer_cpu = placement.writer_cpu;
+    consumer_args->checkpoint = run->checkpoint;
+    consumer_args->summaries = run->summaries;
+    consumer_args->global_hash = run->global_hash;
+    consumer_args->total_meshes = run->column_end - run->column_begin;
+    consumer_args->num_producers = num_producers;
+    consumer_args->dropped_batches = &dropped_batches;
+    consumer_args->column_base = run->column_begin;
+    consumer_args->show_progress = run->show_progress;
+    consumer_args->report = run->verbose;
+    if (pthread_create(&consumer_thread, &attr, consumer, consumer_args) != 0) {
+        perror("pthread_create failed for consumer");
+        // HDF5 ファイルをクローズ (エラー処理)
+        H5Fclose(run->file_id);
+        return -1;
+    }
+    pthread_attr_destroy(&attr);
+
+    // producer が全員途中で終了すると meshlist_producer は満杯のキューで止まるので、先に producer を待って
+    // 取り出されずに残った分を片付けてから meshlist_producer を待つ
+    for (int i = 0; i < num_producers; i++) {
+        pthread_join(producer_threads[i], NULL);
+    }
+    int failed_producers = drain_meshlist_queue(&meshid_queue, producer_objects, num_producers);
+    pthread_join(meshlist_producer_pthread, NULL);
+    pthread_join(consumer_thread, NULL);
+    int status = 0;
+    if (failed_producers == num_producers) {
+        fprintf(stderr, "All %d producers failed\n", num_producers);
+        status = -1;
+    } else if (failed_producers > 0) {
+        fprintf(stderr, "%d of %d producers stopped early\n", failed_producers, num_producers);
+    }
+    // 抜けのあるまま成功として終わると、シャードの親や呼び出し側が埋まっていないファイルを使ってしまう
+    if (failed_producers > 0 || atomic_load(&dropped_batches) > 0 || !consumer_args->complete ||
+        consumer_args->write_failures > 0) {
+        status = -1;
+    }
+
+    if (run->verbose) {
+        printf("All threads finished.\n");
+        report_backpressure(&data_budget, producer_objects, num_producers);
+    }
+    free_thread_placement(&placement);
+    size_t pool_mapped = 0, pool_reused = 0;
+    for (int i = 0; i < num_producers; i++) {
+        if (producer_objects[i].pool != NULL) {
+            pool_mapped += atomic_load(&producer_objects[i].pool->mapped);
+            pool_reused += atomic_load(&producer_objects[i].pool->reused);
+        }
+        destroy_matrix_pool(producer_objects[i].pool);
+    }
+    if (run->verbose) {
+        printf("Matrix pool: %zu buffers mapped, %zu batches reused a buffer\n", pool_mapped, pool_reused);
+    }
+    free(producer_threads);
+    free(producer_objects);
+    destroy_queue(&data_queue);
+    destroy_queue(&meshid_queue);
+    return status;
+}
+
+static void set_batch_meshes(IngestOptions *options, int batch_meshes) {
+    if (options->scan == INGEST_SCAN_RANGE) {
+        options->range_meshes = batch_meshes;
+    } else {
+        options->list_meshes = batch_meshes;
+    }
+}
+
+// 列の一部を一時ファイルに取り込む試行を繰り返して producer 数とバッチの大きさを決め、
+// options に反映して tuning_path に書き出す。失敗したら -1
+static int autotune_ingest(IngestOptions *options, const char *conninfo, const CpuTopology *topology,
+                           int writer_node, cmph_t *global_hash, const char *hdf5_filepath, int mesh_count,
+                           const char *tuning_path) {
+    char scratch_path[PATH_MAX];
+    snprintf(scratch_path, sizeof(scratch_path), "%s.autotune", hdf5_filepath);
+
+    TuningConfig initial = {
+        .num_producers = options->num_producers,
+        .batch_meshes = ingest_batch_meshes(options),
+        .queue_depth = options->queue_depth
+    };
+    // バッチはチャンクの列範囲に揃え、producer は CPU 数の 2 倍まで (待ち時間の長い DB 向け)
+    int max_producers = topology->num_cpus * 2 < MAX_INGEST_PRODUCERS ? topology->num_cpus * 2 : MAX_INGEST_PRODUCERS;
+    int max_batch = initial.batch_meshes * 4;
+    Autotuner tuner;
+    init_autotuner(&tuner, &initial, max_producers, HDF5_MESH_CHUNK, max_batch);
+    printf("Autotune: calibrating against %s (up to %d phases)\n", options->tables[0], AUTOTUNE_MAX_PHASES);
+
+    int window_begin = 0;
+    bool more = true;
+    while (more) {
+        TuningConfig config = tuner.current;
+        options->num_producers = config.num_producers;
+        set_batch_meshes(options, config.batch_meshes);
+
+        // 同じメッシュを読み直すと DB のキャッシュで速く見えるので、試行ごとに次の列範囲を使う
+        int window = config.num_producers * config.batch_meshes * 2;
+        if (window < AUTOTUNE_PHASE_MESHES) {
+            window = (AUTOTUNE_PHASE_MESHES + config.batch_meshes - 1) / config.batch_meshes * config.batch_meshes;
+        }
+        if (window > mesh_count) {
+            window = mesh_count;
+        }
+        if (window_begin + window > mesh_count) {
+            window_begin = 0;
+        }
+
+        hid_t file_id = H5Fcreate(scratch_path, H5F_ACC_TRUNC, H5P_DEFAULT, H5P_DEFAULT);
+        if (file_id < 0) {
+            fprintf(stderr, "Failed to create HDF5 file: %s\n", scratch_path);
+            return -1;
+        }
+        hid_t dataset_id = create_population_dataset(file_id, "population_data", NOW_ENTIRE_LEN_FOR_ONE_MESH, window,
+                                                     HDF5_DATETIME_CHUNK, HDF5_MESH_CHUNK, options->compression,
+                                                     options->compression_level);
+        if (dataset_id < 0) {
+            fprintf(stderr, "Failed to create population_data dataset\n");
+            H5Fclose(file_id);
+            unlink(scratch_path);
+            return -1;
+        }
+        IngestRun run = {
+            .conninfo = conninfo,
+            .options = options,
+            .topology = topology,
+            .writer_node = writer_node,
+            .global_hash = global_hash,
+            .file_id = file_id,
+            .dataset_id = dataset_id,
+            .checkpoint = NULL,
+            .completed = NULL,
+            .last_ingested_hour = -1,
+            .total_rows = NOW_ENTIRE_LEN_FOR_ONE_MESH,
+            .column_begin = window_begin,
+            .column_end = window_begin + window,
+            .verbose = false,
+            .show_progress = false
+        };
+        uint64_t t0 = monotonic_ns();
+        int status = run_ingest(&run);
+        double sec = (monotonic_ns() - t0) / 1e9;
+        unlink(scratch_path);
+        if (status != 0) {
+            return -1;
+        }
+
+        TuningSample sample = {
+            .rows_per_sec = (double)window * NOW_ENTIRE_LEN_FOR_ONE_MESH / sec,
+            .queue_occupancy = run.consumer.queue_occupancy,
+            .queue_peak = run.consumer.queue_peak,
+            .writer_stall = run.consumer.io_wait_ns / 1e9 / sec
+        };
+        print_tuning_sample(tuner.phases + 1, &config, &sample);
+        window_begin += window;
+        more = autotune_step(&tuner, &sample);
+    }
+
+    options->num_producers = tuner.best.num_producers;
+    set_batch_meshes(options, tuner.best.batch_meshes);
+    options->queue_depth = tuner.best.queue_depth;
+    printf("Autotune: %d producers, %d meshes per batch, queue depth %zu\n", tuner.best.num_producers,
+           tuner.best.batch_meshes, tuner.best.queue_depth);
+    if (write_tuning_file(tuning_path, &tuner.best, options->scan) != 0) {
+        return -1;
+    }
+    printf("Autotune: wrote %s; set MOBAKU_TUNING_FILE to it to reuse these settings\n", tuning_path);
+    return 0;
+}
+
+int main(int argc, char* argv[]) {
+    // --append: 既存ファイルの最終時刻より後の行だけを取得して時間軸を伸ばす
+    // --resume: 中断したファイルを開き直し、完了記録にないバッチだけを取得する
+    // --shards N: 列範囲を N 個に分け、それぞれ別プロセスが別ファイルに書き込んでから仮想データセットでまとめる。
+    //             中断したら最初から作り直す (--resume できない)。まとめたファイルには --append もできない
+    // --autotune: 短い試行で producer 数とバッチの大きさを決めて書き出してから、その設定で作成する
+    // --snapshot: 書き終えてから population_snapshot (時刻ごとの読み出し向けのチャンク) を作る。
+    //             既にあるファイルへの --append / --resume では指定がなくても追いつかせる
+    // メッシュごとの日・月・年の集計 (rollup グループの mesh_*) は MOBAKU_INGEST_SUMMARIES で新規作成時に作り、--append / --resume では続ける
+    bool append = false;
+    bool snapshot = false;
+    bool resume = false;
+    bool autotune = false;
+    int num_shards = 1;
+    static const struct option long_options[] = {
+        {"append", no_argument, NULL, 'a'},
+        {"resume", no_argument, NULL, 'r'},
+        {"shards", required_argument, NULL, 's'},
+        {"autotune", no_argument, NULL, 't'},
+        {"snapshot", no_argument, NULL, 'p'},
+        {NULL, 0, NULL, 0}
+    };
+    int opt;
+    while ((opt = getopt_long(argc, argv, "", long_options, NULL)) != -1) {
+        switch (opt) {
+            case 'a':
+                append = true;
+                break;
+            case 'r':
+                resume = true;
+                break;
+            case 's':
+                num_shards = atoi(optarg);
+                if (num_shards < 1 || num_shards > MAX_SHARDS) {
+                    fprintf(stderr, "--shards must be 1-%d\n", MAX_SHARDS);
+                    return 1;
+                }
+                break;
+            case 't':
+                autotune = true;
+                break;
+            case 'p':
+                snapshot = true;
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [--append | --resume | --shards N | --autotune] [--snapshot] [env_file]\n"
+                                "  --shards always builds from scratch: a sharded build cannot be resumed after an\n"
+                                "  interruption, and its merged file cannot be appended to\n",
+                        argv[0]);
+                return 1;
+        }
+    }
+    if (append && resume) {
+        fprintf(stderr, "--append and --resume cannot be combined\n");
+        return 1;
+    }
+    if (num_shards > 1 && (append || resume)) {
+        fprintf(stderr, "--shards only builds new files; it cannot be combined with --append or --resume\n");
+        return 1;
+    }
+    if (autotune && (append || resume || num_shards > 1)) {
+        fprintf(stderr, "--autotune only builds a single new file; it cannot be combined with --append, --resume or --shards\n");
+        return 1;
+    }
+    const char* env_filepath = ".env";
+    if (optind < argc) {
+        env_filepath = argv[optind];
+    }
+
+    if (!load_env_from_file(env_filepath)) {
+        fprintf(stderr, "Failed to load environment from %s\n", env_filepath);
+        return 1;
+    }
+    // 以前の --autotune の結果があれば .env の値より優先する
+    const char *tuning_path = getenv("MOBAKU_TUNING_FILE");
+    if (tuning_path != NULL && tuning_path[0] == '\0') {
+        tuning_path = NULL;
+    }
+    if (tuning_path != NULL && !autotune) {
+        if (access(tuning_path, R_OK) != 0) {
+            fprintf(stderr, "MOBAKU_TUNING_FILE %s not found; create it with --autotune\n", tuning_path);
+            return 1;
+        }
+        if (!load_env_from_file(tuning_path)) {
+            return 1;
+        }
+        printf("Tuning: %s\n", tuning_path);
+    }
+    DbCredentials *creds = get_db_credentials();
+
+    if (!creds) {
+        return 1;
+    }
+
+    char conninfo[512];
+    snprintf(conninfo, sizeof(conninfo),
+             "host=%s port=%s dbname=%s user=%s password=%s",
+             creds->host, creds->port, creds->dbname, creds->user, creds->password);
+
+    IngestOptions ingest_options;
+    if (!load_ingest_options(&ingest_options)) {
+        return 1;
+    }
+    // 直接チャンク書き込みではリスト方式のバッチがメッシュ方向のチャンクちょうどになる必要がある
+    if (ingest_options.direct_chunk && ingest_options.list_meshes % HDF5_MESH_CHUNK != 0) {
+        fprintf(stderr, "MOBAKU_INGEST_LIST_MESHES must be a multiple of %d for direct chunk writes\n", HDF5_MESH_CHUNK);
+        return 1;
+    }
+    printf("Ingest mode: %s (pipeline depth %d)\n", ingest_mode_name(ingest_options.mode), ingest_options.pipeline_depth);
+    if (ingest_options.compression != CHUNK_CODEC_NONE) {
+        printf("Chunk compression: %s level %d (%s)\n", chunk_codec_name(ingest_options.compression),
+               ingest_options.compression_level,
+               chunk_codec_in_producer(ingest_options.compression) ? "in producers" : "in the HDF5 writer");
+    }
+    if (resolve_source_tables(conninfo, &ingest_options) < 0) {
+        return 1;
+    }
+    for (int t = 0; t < ingest_options.num_tables; ++t) {
+        printf("Source table: %s\n", ingest_options.tables[t]);
+    }
+
+    if (ingest_options.memory_budget > 0) {
+        printf("Memory budget: %zu MiB\n", ingest_options.memory_budget / (1024 * 1024));
+    } else {
+        printf("Memory budget: unlimited\n");
+    }
+
+    // HDF5 ファイルを作成
+    const char* hdf5_filepath = getenv("HDF5_FILE_PATH");
+    if (hdf5_filepath == NULL) {
+        fprintf(stderr, "HDF5_FILE_PATH environment variable not set.\n");
+        return 1;
+    }
     int mesh_count = meshid_list_size;
 #ifdef CREATE_SMALL_DATASET
     mesh_count = meshid_list_size / DATASET_REDUCTION_FACTOR;
@@ -429,26 +876,266 @@ int main(int argc, char* argv[]) {
     printf("テスト用データセット作成: 元データセットの1/%dを使用します (mesh数: %d)\n", DATASET_REDUCTION_FACTOR, mesh_count);
 #endif
 
-    ConsumerArgs consumer_args;
-    consumer_args.queue = &data_queue;
-    consumer_args.hdf5_file_id = file_id;
-    consumer_args.global_hash = prepare_search();
-    consumer_args.total_meshes = mesh_count;
-    if (pthread_create(&consumer_thread, &attr, consumer, &consumer_args) != 0) {
-        perror("pthread_create failed for consumer");
-        // HDF5 ファイルをクローズ (エラー処理)
-        H5Fclose(file_id);
+    // スレッドの配置は実行中のマシンのトポロジーと出力先のデバイスの NUMA ノードから決める
+    CpuTopology topology;
+    if (load_cpu_topology(SYSFS_ROOT, NULL, &topology) != 0) {
         return 1;
     }
-    pthread_attr_destroy(&attr);
+    cmph_t *global_hash = prepare_search();
+    if (autotune) {
+        if (autotune_ingest(&ingest_options, conninfo, &topology, path_numa_node(SYSFS_ROOT, hdf5_filepath),
+                            global_hash, hdf5_filepath, mesh_count,
+                            tuning_path != NULL ? tuning_path : DEFAULT_TUNING_FILE) != 0) {
+            return 1;
+        }
+    }
 
-    pthread_join(meshlist_producer_pthread, NULL);
+    int batch_size = ingest_batch_meshes(&ingest_options);
 
-    for (int i = 0; i < NUM_PRODUCERS; i++) {
-        pthread_join(producer_threads[i], NULL);
+    // シャードの境界はバッチとチャンクの両方の境界に揃える
+    int shard_bounds[MAX_SHARDS + 1];
+    int shard_index = -1;
+    int column_begin = 0;
+    int column_end = mesh_count;
+    char shard_path[PATH_MAX];
+    if (num_shards > 1) {
+        int align = batch_size / gcd(batch_size, HDF5_MESH_CHUNK) * HDF5_MESH_CHUNK;
+        int per_shard = ((mesh_count + num_shards - 1) / num_shards + align - 1) / align * align;
+        num_shards = (mesh_count + per_shard - 1) / per_shard;
+        for (int k = 0; k <= num_shards; ++k) {
+            shard_bounds[k] = k * per_shard < mesh_count ? k * per_shard : mesh_count;
+        }
+        int shard_producers = ingest_options.num_producers / num_shards > 0 ? ingest_options.num_producers / num_shards : 1;
+        printf("Writing %d shard files with %d producers each\n", num_shards, shard_producers);
+        shard_index = fork_shard_writers(num_shards);
+        if (shard_index == num_shards) {
+            int status = merge_shard_files(hdf5_filepath, num_shards, shard_bounds);
+            if (status == 0 && snapshot) {
+                status = update_snapshot(hdf5_filepath, true);
+            }
+            free_ingest_options(&ingest_options);
+            return status == 0 ? 0 : 1;
+        }
+        if (shard_index < 0) {
+            fprintf(stderr, "Sharded builds cannot be resumed; rerun --shards to rebuild %s\n", hdf5_filepath);
+            return 1;
+        }
+        // ここから先は子プロセス。自分の列範囲だけを自分のファイルに書く
+        column_begin = shard_bounds[shard_index];
+        column_end = shard_bounds[shard_index + 1];
+        ingest_options.num_producers = shard_producers;
+        ingest_options.memory_budget /= num_shards;
+        shard_file_path(shard_path, sizeof(shard_path), hdf5_filepath, shard_index);
+        hdf5_filepath = shard_path;
     }
-    pthread_join(consumer_thread, NULL);
+    int shard_cols = column_end - column_begin;
+    // シャードでなければ従来どおり全メッシュ分の列を持つ
+    int dataset_cols = shard_index >= 0 ? shard_cols : (int)meshid_list_size;
 
-    printf("All threads finished.\n");
+    // meshlist_producer と同じ分け方でのバッチ数
+    int num_batches = (shard_cols + batch_size - 1) / batch_size;
+
+    hid_t file_id;
+    hid_t dataset_id;
+    int last_ingested_hour = -1;
+    int total_rows = NOW_ENTIRE_LEN_FOR_ONE_MESH;
+    BatchCheckpoint *checkpoint = NULL;
+    hsize_t dims[2] = {0, 0};
+    if (append || resume) {
+        file_id = H5Fopen(hdf5_filepath, H5F_ACC_RDWR, H5P_DEFAULT);
+        if (file_id < 0) {
+            fprintf(stderr, "Failed to open HDF5 file: %s\n", hdf5_filepath);
+            return 1;
+        }
+        dataset_id = H5Dopen(file_id, "population_data", H5P_DEFAULT);
+        if (dataset_id < 0) {
+            fprintf(stderr, "Failed to open population_data dataset\n");
+            H5Fclose(file_id);
+            return 1;
+        }
+        // --shards でまとめたファイルの population_data はシャードを並べた仮想データセットで、
+        // 時間軸を伸ばしたり直接書き込んだりするとシャードと食い違う
+        hid_t plist_id = H5Dget_create_plist(dataset_id);
+        bool is_virtual = plist_id >= 0 && H5Pget_layout(plist_id) == H5D_VIRTUAL;
+        if (plist_id >= 0) {
+            H5Pclose(plist_id);
+        }
+        if (is_virtual) {
+            fprintf(stderr, "%s was merged from --shards files and cannot be appended to or resumed; rebuild it\n",
+                    hdf5_filepath);
+            H5Dclose(dataset_id);
+            H5Fclose(file_id);
+            return 1;
+        }
+        match_ingest_compression(dataset_id, &ingest_options);
+        hid_t space_id = H5Dget_space(dataset_id);
+        H5Sget_simple_extent_dims(space_id, dims, NULL);
+        H5Sclose(space_id);
+        last_ingested_hour = read_last_ingested_hour(file_id);
+    }
+    if (resume) {
+        checkpoint = open_batch_checkpoint(file_id, num_batches, ingest_options.scan, batch_size);
+        if (checkpoint == NULL) {
+            fprintf(stderr, "Cannot resume %s; rebuild it\n", hdf5_filepath);
+            H5Dclose(dataset_id);
+            H5Fclose(file_id);
+            return 1;
+        }
+        int completed = count_completed_batches(checkpoint);
+        printf("Resuming: %d of %d batches already written\n", completed, num_batches);
+        if (completed == num_batches) {
+            close_batch_checkpoint(checkpoint);
+            H5Dclose(dataset_id);
+            H5Fclose(file_id);
+            free_ingest_options(&ingest_options);
+            return update_snapshot(hdf5_filepath, snapshot) == 0 ? 0 : 1;
+        }
+        // 残りのバッチは時間軸の全体を書く
+        if (lower_derived_rows(file_id, (hsize_t)ingest_options.time_start) != 0) {
+            close_batch_checkpoint(checkpoint);
+            H5Dclose(dataset_id);
+            H5Fclose(file_id);
+            return 1;
+        }
+    } else if (append) {
+        // 中断したままのファイルに追記すると抜けたバッチが埋まらない
+        if (!is_batch_checkpoint_complete(file_id)) {
+            fprintf(stderr, "%s is an unfinished build; run --resume with the same settings first\n", hdf5_filepath);
+            H5Dclose(dataset_id);
+            H5Fclose(file_id);
+            return 1;
+        }
+        if (dims[1] != meshid_list_size || last_ingested_hour < 0) {
+            fprintf(stderr, "%s does not match the current mesh list or lacks %s; rebuild it\n",
+                    hdf5_filepath, LAST_INGESTED_HOUR_ATTR);
+            H5Dclose(dataset_id);
+            H5Fclose(file_id);
+            return 1;
+        }
+        int latest = query_latest_time_index(conninfo, &ingest_options);
+        if (latest < -1) {
+            H5Dclose(dataset_id);
+            H5Fclose(file_id);
+            return 1;
+        }
+        if (latest <= last_ingested_hour) {
+            printf("Already up to date (last ingested hour %d)\n", last_ingested_hour);
+            H5Dclose(dataset_id);
+            H5Fclose(file_id);
+            free_ingest_options(&ingest_options);
+            return update_snapshot(hdf5_filepath, snapshot) == 0 ? 0 : 1;
+        }
+        ingest_options.time_start = last_ingested_hour + 1;
+        total_rows = latest + 1;
+        if (extend_time_axis(dataset_id, (hsize_t)total_rows) < 0) {
+            H5Dclose(dataset_id);
+            H5Fclose(file_id);
+            return 1;
+        }
+        printf("Appending hours %d..%d\n", ingest_options.time_start, latest);
+    } else {
+        file_id = H5Fcreate(hdf5_filepath, H5F_ACC_TRUNC, H5P_DEFAULT, H5P_DEFAULT);
+        if (file_id < 0) {
+            fprintf(stderr, "Failed to create HDF5 file: %s\n", hdf5_filepath);
+            return 1;
+        }
+
+        // メタデータはシャードをまとめるファイルにだけ書く
+        if (shard_index < 0 && write_mesh_metadata(file_id) != 0) {
+            H5Fclose(file_id);
+            return 1;
+        }
+
+        dataset_id = create_population_dataset(file_id, "population_data", NOW_ENTIRE_LEN_FOR_ONE_MESH, dataset_cols,
+                                               HDF5_DATETIME_CHUNK, HDF5_MESH_CHUNK, ingest_options.compression,
+                                               ingest_options.compression_level);
+        if (dataset_id < 0) {
+            fprintf(stderr, "Failed to create population_data dataset\n");
+            H5Fclose(file_id);
+            return 1;
+        }
+        checkpoint = create_batch_checkpoint(file_id, num_batches, ingest_options.scan, batch_size);
+        if (checkpoint == NULL) {
+            H5Dclose(dataset_id);
+            H5Fclose(file_id);
+            return 1;
+        }
+    }
+
+    // 集計は作成時に始めたファイルだけで続ける。シャードは仮想データセットでまとめないので作らない
+    SummaryDatasets summaries;
+    SummaryDatasets *summary_datasets = NULL;
+    if (shard_index >= 0) {
+        if (ingest_options.summaries) {
+            fprintf(stderr, "MOBAKU_INGEST_SUMMARIES is ignored with --shards\n");
+        }
+        ingest_options.summaries = false;
+    } else if (append || resume) {
+        bool has_summaries = has_mesh_summaries(file_id);
+        if (ingest_options.summaries && !has_summaries) {
+            fprintf(stderr, "%s was built without summaries; MOBAKU_INGEST_SUMMARIES is ignored\n", hdf5_filepath);
+        }
+        ingest_options.summaries = has_summaries;
+    }
+    if (ingest_options.summaries) {
+        hid_t space_id = H5Dget_space(dataset_id);
+        H5Sget_simple_extent_dims(space_id, dims, NULL);
+        H5Sclose(space_id);
+        int status = open_summary_datasets(&summaries, file_id, dims[0], dims[1], HDF5_MESH_CHUNK,
+                                           ingest_options.time_start);
+        if (status < 0) {
+            H5Dclose(dataset_id);
+            H5Fclose(file_id);
+            return 1;
+        }
+        if (status > 0) {
+            fprintf(stderr, "The mesh summaries in %s are out of date after an interrupted append; "
+                            "run build_summaries to restore them\n", ROLLUP_GROUP);
+            ingest_options.summaries = false;
+        } else {
+            summary_datasets = &summaries;
+            printf("Summaries: daily, monthly and yearly mesh statistics in %s\n", ROLLUP_GROUP);
+        }
+    }
+
+    // シャードの子プロセスは物理コアを分け合う
+    if (shard_index >= 0) {
+        cpu_set_t shard_cpus;
+        shard_cpu_set(&topology, shard_index, num_shards, &shard_cpus);
+        free_cpu_topology(&topology);
+        if (load_cpu_topology(SYSFS_ROOT, &shard_cpus, &topology) != 0) {
+            H5Fclose(file_id);
+            return 1;
+        }
+    }
+
+    IngestRun run = {
+        .conninfo = conninfo,
+        .options = &ingest_options,
+        .topology = &topology,
+        .writer_node = path_numa_node(SYSFS_ROOT, hdf5_filepath),
+        .global_hash = global_hash,
+        .file_id = file_id,
+        .dataset_id = dataset_id,
+        .checkpoint = checkpoint,
+        .summaries = summary_datasets,
+        .completed = resume ? checkpoint->completed : NULL,
+        .last_ingested_hour = last_ingested_hour,
+        .total_rows = total_rows,
+        .column_begin = column_begin,
+        .column_end = column_end,
+        .verbose = true,
+        // 子プロセスが並んで書くと崩れるので、プログレスバーは先頭のシャードだけ表示する
+        .show_progress = shard_index <= 0
+    };
+    if (run_ingest(&run) != 0) {
+        return 1;
+    }
+    free_cpu_topology(&topology);
+    free_ingest_options(&ingest_options);
+    // シャードの子プロセスは書かない (まとめたファイルに作る)
+    if (shard_index < 0 && update_snapshot(hdf5_filepath, snapshot) != 0) {
+        return 1;
+    }
     return 0;
 }
\ No newline at end of file
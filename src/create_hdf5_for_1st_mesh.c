@@ -15,6 +15,7 @@
 #include <stdint.h>
 #include <arpa/inet.h>
 #include <endian.h>
+#include <getopt.h>
 
 #include <hdf5.h>
 
@@ -22,6 +23,10 @@
 #include "db_credentials.h"
 #include "meshid_ops.h"
 #include "fifioq.h"
+#include "pg_ingest.h"
+#include "hdf5_ops.h"
+#include "cpu_topology.h"
+#include "write_behind.h"
 
 #define NUM_PRODUCERS 32
 #define MESHLIST_ONCE_LEN 16
@@ -29,197 +34,61 @@
 #define NOW_ENTIRE_LEN_FOR_ONE_MESH 74160
 #define HDF5_DATETIME_CHUNK 8760 //365 * 24
 #define HDF5_MESH_CHUNK 16
+#define CONSUMER_DEQUEUE_BATCH 16
+#define NUM_MESHES_1ST 25600 // 1次メッシュに入る 1/2 地域メッシュの候補数
 
-typedef struct {
-    int rows;
-    int cols;
-    int *data;
-    uint32_t meshid_start;
-    cmph_t *local_hash;
-} PQdataMatrix;
-
-typedef struct {
-    int meshid_number;
-    uint32_t *meshid_list;
-} MeshidList;
-
-typedef struct {
-    FIFOQueue *DataQueue;
-    FIFOQueue * MeshlistQueue;
-    const char * conninfo;
-} ProducerObject;
-
-// データ解放関数
-void free_pqdata_matrix(void *data) {
-    PQdataMatrix *m = (PQdataMatrix *)data;
-    free(m->data);
-    free(m);
-}
-
-void free_meshid_list(void *data) {
-    MeshidList *ml = (MeshidList *)data;
-    free(ml->meshid_list);
-    free(ml);
-}
-
-void *producer(void *arg) {
-    ProducerObject *obj = (ProducerObject *)arg;
-    PGconn *conn = PQconnectdb(obj->conninfo);
-    if (PQstatus(conn) != CONNECTION_OK) {
-        fprintf(stderr, "Connection to database failed: %s\n", PQerrorMessage(conn));
-        PQfinish(conn);
-        pthread_exit(NULL);
-    }
-    FIFOQueue *data_queue = obj->DataQueue;
-    FIFOQueue *meshlist_queue = obj->MeshlistQueue;
-
-    const char *stmtName = "select_population";
-    const char *query = "SELECT mesh_id, datetime, population FROM population_00000 WHERE mesh_id = ANY($1) ORDER BY datetime";
-    PGresult *prepRes = PQprepare(conn, stmtName, query, 1, NULL);
-    if (PQresultStatus(prepRes) != PGRES_COMMAND_OK) {
-        fprintf(stderr, "PQprepare failed: %s\n", PQerrorMessage(conn));
-        PQclear(prepRes);
-        PQfinish(conn);
-        pthread_exit(NULL);
-    }
-    PQclear(prepRes);
-
-    while (true) {
-        MeshidList *meshid_list = (MeshidList*)dequeue(meshlist_queue);
-        if (meshid_list == NULL) {
-            break;
-        }
-
-        // mesh_idリストをPostgreSQLの配列形式の文字列に変換
-        char mesh_ids_str[4096] = "{";
-        for (int i = 0; i < meshid_list->meshid_number; ++i) {
-            char temp[32];
-            snprintf(temp, sizeof(temp), "%u", meshid_list->meshid_list[i]);
-            strcat(mesh_ids_str, temp);
-            if (i < meshid_list->meshid_number - 1) {
-                strcat(mesh_ids_str, ",");
-            }
-        }
-        strcat(mesh_ids_str, "}");
-
-        const char *paramValues[1] = {mesh_ids_str};
-        int paramLengths[1] = {strlen(mesh_ids_str)};
-        int paramFormats[1] = {0};
-
-        PGresult *res = PQexecPrepared(conn, stmtName, 1, paramValues, paramLengths, paramFormats, 1);
-
-        int num_rows = PQntuples(res);
-        int num_fields = PQnfields(res);
-
-        if (PQresultStatus(res) != PGRES_TUPLES_OK) {
-            fprintf(stderr, "SELECT failed: %s\n", PQerrorMessage(conn));
-            PQclear(res);
-            free_meshid_list(meshid_list);
-            continue;
-        }
-
-        PQdataMatrix *qdata_matrix = (PQdataMatrix *)malloc(sizeof(PQdataMatrix));
-        qdata_matrix->rows = NOW_ENTIRE_LEN_FOR_ONE_MESH;
-        qdata_matrix->cols = meshid_list->meshid_number; // 取得するデータ数（mesh_idの数）
-        qdata_matrix->data = (int *)malloc(sizeof(int) * qdata_matrix->rows * qdata_matrix->cols);
-        qdata_matrix->meshid_start = meshid_list->meshid_list[0];
-        cmph_t *local_hash = create_local_mph_from_int(meshid_list->meshid_list, meshid_list->meshid_number);
-        memset(qdata_matrix->data, 0, sizeof(int) * qdata_matrix->rows * qdata_matrix->cols);
-        if (qdata_matrix->data == NULL) {
-            perror("malloc failed");
-            exit(1);
-        }
-
-        int idx_mesh = -1;
-        int idx_datetime = -1;
-        int idx_population = -1;
-        for (int k = 0; k < num_fields; k++) {
-            const char* fieldName = PQfname(res, k);
-            if (strcmp(fieldName, "mesh_id") == 0) {
-                idx_mesh = k;
-            } else if (strcmp(fieldName, "datetime") == 0) {
-                idx_datetime = k;
-            } else if (strcmp(fieldName, "population") == 0) {
-                idx_population = k;
-            }
-        }
-        if (idx_mesh == -1 || idx_datetime == -1 || idx_population == -1) {
-            fprintf(stderr, "KEY ERROR");
-            PQclear(res);
-            free(qdata_matrix->data);
-            free(qdata_matrix);
-            free_meshid_list(meshid_list);
-            continue;
-        }
+// ファイルの属性。meshid_list はこの 1 次メッシュの候補のうち人口のあるメッシュだけなので、
+// 載っていない候補は値がすべて 0 として読む
+#define MESH1ST_ATTR "mesh1st"
 
-        for (int j = 0; j < num_rows; j++) {
-            int32_t meshid_value = ntohl(*((int32_t *)PQgetvalue(res, j, idx_mesh)));
-            int32_t population = ntohl(*((int32_t *)PQgetvalue(res, j, idx_population)));
-
-            char *datetime_binary_ptr = PQgetvalue(res, j, idx_datetime);
-            int datetime_binary_len = PQgetlength(res, j, idx_datetime);
-
-            time_t datetime_binary_jst = pg_bin_timestamp_to_jst(datetime_binary_ptr, datetime_binary_len);
-
-            int time_index = get_time_index_mobaku_datetime_from_time(datetime_binary_jst);
-            int meshid_index = find_local_id(local_hash, meshid_value);
-            qdata_matrix->data[time_index * qdata_matrix->cols + meshid_index] = population;    //row-major
-        }
-        PQclear(res);
-        enqueue(data_queue, qdata_matrix);
-        free_meshid_list(meshid_list);
-    }
-    enqueue(data_queue, NULL);
-    PQfinish(conn);
-    pthread_exit(NULL);
-}
+// 直接チャンク書き込みではリスト方式のバッチがメッシュ方向のチャンクちょうどになる必要がある
+static_assert(MESHLIST_ONCE_LEN % HDF5_MESH_CHUNK == 0, "MESHLIST_ONCE_LEN must be a multiple of HDF5_MESH_CHUNK");
 
 typedef struct {
     FIFOQueue *queue;
     hid_t hdf5_file_id;
+    hid_t dataset_id;
     uint32_t *all_meshes;
     int num_meshes;
+    int last_ingested_hour; // 追記前の最終時刻インデックス。新規作成なら -1
+    int writer_cpu;         // HDF5 に書き込む I/O スレッドの CPU
+    atomic_int *dropped_batches;    // producer が取得できずに捨てたバッチ数。全 producer の終了後に読む
+    size_t write_failures;  // 終了後に読む。I/O スレッドが書けなかったバッチ数
 } ConsumerArgs;
 
+// producer から受け取った行列の書き込み内容を用意し、HDF5 への書き込みは I/O スレッドに任せる
 void *consumer(void *consumer_args) {
     ConsumerArgs *args = (ConsumerArgs *)consumer_args;
     FIFOQueue *q = args->queue;
     hid_t file_id = args->hdf5_file_id;
+    hid_t dataset_id = args->dataset_id;
     int nulp_counter = 0;
 
-    // データセットの作成準備
-    hsize_t dims[2] = {NOW_ENTIRE_LEN_FOR_ONE_MESH, meshid_list_size};
-    hid_t dataspace_id = H5Screate_simple(2, dims, NULL);
-    if (dataspace_id < 0) {
-        fprintf(stderr, "Failed to create dataspace in consumer\n");
-        pthread_exit(NULL);
-    }
-    hid_t plist_id = H5Pcreate(H5P_DATASET_CREATE);
-    hsize_t chunk_dims[2] = {HDF5_DATETIME_CHUNK, HDF5_MESH_CHUNK};
-    H5Pset_chunk(plist_id, 2, chunk_dims);
-    hid_t dataset_id = H5Dcreate(file_id, "population_data", H5T_NATIVE_INT, dataspace_id, H5P_DEFAULT, plist_id, H5P_DEFAULT);
-    int fill_value = 0;
-    herr_t status_fill = H5Pset_fill_value(plist_id, H5T_NATIVE_INT, &fill_value);
-    if (status_fill < 0) {
-        fprintf(stderr, "Failed to set fill value for HDF5 dataset\n");
-        H5Pclose(plist_id);
-        H5Sclose(dataspace_id);
-        H5Fclose(file_id);
-        pthread_exit(NULL);
-    }
-    H5Pclose(plist_id);
-    if (dataset_id < 0) {
-        fprintf(stderr, "Failed to create dataset in consumer\n");
-        H5Sclose(dataspace_id);
-        pthread_exit(NULL);
+    WriteBehind writer;
+    if (start_write_behind(&writer, file_id, dataset_id, HDF5_DATETIME_CHUNK, HDF5_MESH_CHUNK, NULL, 0, NULL,
+                           args->last_ingested_hour, args->writer_cpu) != 0) {
+        exit(1);
     }
+    hsize_t dataset_rows = (hsize_t)writer.max_hour + 1;
+    uint64_t staging_ns = 0;
+    uint64_t producer_wait_ns = 0;
 
     int processed_meshes = 0; // プログレスバー用カウンタ (処理済みメッシュ数)
     int total_meshes = args->num_meshes; // プログレスバー用合計メッシュ数
     cmph_t *local_hash = create_local_mph_from_int(args->all_meshes, total_meshes);
 
+    // 溜まっている行列はまとめて取り出す
+    void *dequeued[CONSUMER_DEQUEUE_BATCH];
+    size_t dequeued_len = 0;
+    size_t dequeued_pos = 0;
     while (true) {
-        PQdataMatrix *m = dequeue(q);
+        if (dequeued_pos == dequeued_len) {
+            uint64_t t0 = monotonic_ns();
+            dequeued_len = dequeue_batch(q, dequeued, CONSUMER_DEQUEUE_BATCH);
+            producer_wait_ns += monotonic_ns() - t0;
+            dequeued_pos = 0;
+        }
+        PQdataMatrix *m = dequeued[dequeued_pos++];
         if (m == NULL) {
             nulp_counter++;
             if (nulp_counter == NUM_PRODUCERS) {
@@ -228,44 +97,47 @@ void *consumer(void *consumer_args) {
             continue;
         }
 
+        uint64_t t0 = monotonic_ns();
         processed_meshes += m->cols;
         printProgressBar(processed_meshes, total_meshes);
-        hsize_t offset[2];
-        hsize_t count[2];
-
-        offset[0] = 0; // 常に先頭から
-        int global_mesh_index = find_local_id(local_hash, m->meshid_start);
-        if (global_mesh_index == -1) {
-            fprintf(stderr, "Error: mesh ID %u not found in global list.\n", m->meshid_start);
-            free_pqdata_matrix(m);
-            continue;
+        hsize_t column_offset = 0;
+        if (m->columns == NULL) {
+            int global_mesh_index = find_local_id(local_hash, m->meshid_start);
+            if (global_mesh_index == -1) {
+                fprintf(stderr, "Error: mesh ID %u not found in global list.\n", m->meshid_start);
+                free_pqdata_matrix(m);
+                continue;
+            }
+            column_offset = global_mesh_index; // 書き込み開始のメッシュID
         }
-        offset[1] = global_mesh_index; // 書き込み開始のメッシュID
-
-        count[0] = m->rows;
-        count[1] = m->cols;
 
-        hid_t memspace_id = H5Screate_simple(2, count, NULL);
-        hid_t dataset_space_id = H5Dget_space(dataset_id);
-        hsize_t selected_offset[2] = {offset[0], offset[1]};
-        hsize_t selected_count[2] = {count[0], count[1]};
-        H5Sselect_hyperslab(dataset_space_id, H5S_SELECT_SET, selected_offset, NULL, selected_count, NULL);
-
-        herr_t status = H5Dwrite(dataset_id, H5T_NATIVE_INT, memspace_id, dataset_space_id, H5P_DEFAULT, m->data);
-        if (status < 0) {
-            fprintf(stderr, "Failed to write data to HDF5 dataset\n");
+        PQdataWrite *w = (PQdataWrite *)malloc(sizeof(PQdataWrite));
+        if (w == NULL || plan_pqdata_write(w, m, column_offset, dataset_rows) != 0) {
+            exit(1);
         }
-
-        H5Sclose(memspace_id);
-        H5Sclose(dataset_space_id);
-        free_pqdata_matrix(m);
+        staging_ns += monotonic_ns() - t0;
+        submit_pqdata_write(&writer, w);
     }
+    finish_write_behind(&writer);
 
     printf("\n"); // プログレスバー改行
+    report_write_behind(&writer, staging_ns, producer_wait_ns);
+
+    // 捨てられたバッチの列は埋まっていないので、次の追記で取り直せるよう最終時刻を進めない
+    int dropped = atomic_load(args->dropped_batches);
+    int last_ingested_hour = dropped > 0 ? writer.initial_hour : writer.last_ingested_hour;
+    if (dropped > 0) {
+        fprintf(stderr, "%d batches could not be fetched; last ingested hour kept at %d\n", dropped,
+                last_ingested_hour);
+    }
+    if (write_last_ingested_hour(file_id, last_ingested_hour) < 0) {
+        fprintf(stderr, "Failed to write %s attribute\n", LAST_INGESTED_HOUR_ATTR);
+    }
+    printf("Last ingested hour: %d\n", last_ingested_hour);
+    args->write_failures = writer.failures;
 
     // HDF5 リソースをクローズ
     H5Dclose(dataset_id);
-    H5Sclose(dataspace_id);
     H5Fclose(file_id);
 
     pthread_exit(NULL);
@@ -275,6 +147,7 @@ typedef struct {
     FIFOQueue *meshid_queue;
     uint32_t *all_meshes;
     int num_meshes;
+    const IngestOptions *options;
 } MeshlistProducerArgs;
 
 void *meshlist_producer(void *arg) {
@@ -284,6 +157,16 @@ void *meshlist_producer(void *arg) {
     int mesh_count = args->num_meshes;
     int i;
 
+    if (args->options->scan == INGEST_SCAN_RANGE) {
+        if (enqueue_range_batches(meshid_queue, all_meshes, mesh_count, args->options->range_meshes, NULL) < 0) {
+            exit(1);
+        }
+        for (int k = 0; k < NUM_PRODUCERS; ++k) {
+            enqueue(meshid_queue, nullptr);
+        }
+        pthread_exit(NULL);
+    }
+
     for (i = 0; i < (int)(mesh_count / MESHLIST_ONCE_LEN); ++i) {
         uint32_t *meshid_once_list = (uint32_t *)malloc(MESHLIST_ONCE_LEN * sizeof(uint32_t));
         MeshidList *m = (MeshidList *)malloc(sizeof(MeshidList));
@@ -292,6 +175,13 @@ void *meshlist_producer(void *arg) {
             meshid_once_list[j] = all_meshes[i * MESHLIST_ONCE_LEN + j];
         }
         m->meshid_list = meshid_once_list;
+        m->columns = NULL;
+        if (args->options->direct_chunk) {
+            // 列番号を明示してバッチをチャンクの列範囲に揃える (ハッシュの順序に依存しない)
+            m->columns = alloc_column_range(i * MESHLIST_ONCE_LEN, m->meshid_number);
+        }
+        m->key_range = false;
+        m->batch_index = i;
         enqueue(meshid_queue, m);
     }
     if (mesh_count % MESHLIST_ONCE_LEN != 0) {
@@ -302,6 +192,13 @@ void *meshlist_producer(void *arg) {
             meshid_once_list[j] = all_meshes[i * MESHLIST_ONCE_LEN + j];
         }
         m->meshid_list = meshid_once_list;
+        m->columns = NULL;
+        if (args->options->direct_chunk) {
+            // 列番号を明示してバッチをチャンクの列範囲に揃える (ハッシュの順序に依存しない)
+            m->columns = alloc_column_range(i * MESHLIST_ONCE_LEN, m->meshid_number);
+        }
+        m->key_range = false;
+        m->batch_index = i;
         enqueue(meshid_queue, m);
     }
     printf("\n");
@@ -313,21 +210,34 @@ void *meshlist_producer(void *arg) {
 }
 
 int main(int argc, char* argv[]) {
-    int cpulist[] = {0,1,2,3,4,5,6,7,16,17,18,19,20,21,22,23};  //HARDCODEING AWARE!!!
+    // --append: 既存ファイルの最終時刻より後の行だけを取得して時間軸を伸ばす
+    bool append = false;
+    static const struct option long_options[] = {
+        {"append", no_argument, NULL, 'a'},
+        {NULL, 0, NULL, 0}
+    };
+    int opt;
+    while ((opt = getopt_long(argc, argv, "", long_options, NULL)) != -1) {
+        switch (opt) {
+            case 'a':
+                append = true;
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [--append] <env_file> <mesh1st> <output_file>\n", argv[0]);
+                return 1;
+        }
+    }
     const char* env_filepath = ".env";
-    if (argc > 1) {
-        env_filepath = argv[1];
+    if (optind < argc) {
+        env_filepath = argv[optind];
     }
     int mesh1st;
-    if (argc > 2) {
-        mesh1st = atoi(argv[2]);
+    if (optind + 1 < argc) {
+        mesh1st = atoi(argv[optind + 1]);
     } else {
-        fprintf(stderr, "Usage: %s <env_file> <mesh1st> <output_file>\n", argv[0]);
+        fprintf(stderr, "Usage: %s [--append] <env_file> <mesh1st> <output_file>\n", argv[0]);
         return 1;
     }
-    int NUM_MESHES_1ST = 25600;
-    int *all_meshes = get_all_meshes_in_1st_mesh(mesh1st, NUM_MESHES_1ST);
-
     if (!load_env_from_file(env_filepath)) {
         fprintf(stderr, "Failed to load environment from %s\n", env_filepath);
         return 1;
@@ -343,56 +253,218 @@ int main(int argc, char* argv[]) {
              "host=%s port=%s dbname=%s user=%s password=%s",
              creds->host, creds->port, creds->dbname, creds->user, creds->password);
 
+    IngestOptions ingest_options;
+    if (!load_ingest_options(&ingest_options)) {
+        return 1;
+    }
+    // 1次メッシュごとのファイルには日と月の集計を作らない
+    ingest_options.summaries = false;
+    printf("Ingest mode: %s (pipeline depth %d)\n", ingest_mode_name(ingest_options.mode), ingest_options.pipeline_depth);
+    if (ingest_options.compression != CHUNK_CODEC_NONE) {
+        printf("Chunk compression: %s level %d (%s)\n", chunk_codec_name(ingest_options.compression),
+               ingest_options.compression_level,
+               chunk_codec_in_producer(ingest_options.compression) ? "in producers" : "in the HDF5 writer");
+    }
+    if (resolve_source_tables(conninfo, &ingest_options) < 0) {
+        return 1;
+    }
+    for (int t = 0; t < ingest_options.num_tables; ++t) {
+        printf("Source table: %s\n", ingest_options.tables[t]);
+    }
+
+    if (ingest_options.memory_budget > 0) {
+        printf("Memory budget: %zu MiB\n", ingest_options.memory_budget / (1024 * 1024));
+    } else {
+        printf("Memory budget: unlimited\n");
+    }
+
+    // データキューは件数ではなくバイト数で止まるよう、予算いっぱいのバッチと終端の NULL が収まる大きさにする
     FIFOQueue data_queue;
     FIFOQueue meshid_queue;
-    init_queue(&data_queue);
+    size_t data_queue_capacity = QUEUE_SIZE;
+    if (ingest_options.memory_budget > 0) {
+        size_t batch_bytes = (size_t)NOW_ENTIRE_LEN_FOR_ONE_MESH * MESHLIST_ONCE_LEN * sizeof(int);
+        size_t needed = ingest_options.memory_budget / batch_bytes + NUM_PRODUCERS * 2;
+        if (needed > data_queue_capacity) {
+            data_queue_capacity = needed;
+        }
+    }
+    if (init_queue_with_capacity(&data_queue, data_queue_capacity) != 0) {
+        return 1;
+    }
     init_queue(&meshid_queue);
 
     // HDF5 ファイルを作成
     const char* hdf5_filepath;
-    if (argc > 3) {
-        hdf5_filepath = argv[3];
+    if (optind + 2 < argc) {
+        hdf5_filepath = argv[optind + 2];
     } else {
-        fprintf(stderr, "Usage: %s <env_file> <mesh1st> <output_file>\n", argv[0]);
-        return 1;
-    }
-    hid_t file_id = H5Fcreate(hdf5_filepath, H5F_ACC_TRUNC, H5P_DEFAULT, H5P_DEFAULT);
-    if (file_id < 0) {
-        fprintf(stderr, "Failed to create HDF5 file: %s\n", hdf5_filepath);
+        fprintf(stderr, "Usage: %s [--append] <env_file> <mesh1st> <output_file>\n", argv[0]);
         return 1;
     }
+    hid_t file_id;
+    hid_t dataset_id;
+    int last_ingested_hour = -1;
+    int total_rows = NOW_ENTIRE_LEN_FOR_ONE_MESH;
+    int *all_meshes;
+    int num_meshes;
+    if (append) {
+        file_id = H5Fopen(hdf5_filepath, H5F_ACC_RDWR, H5P_DEFAULT);
+        if (file_id < 0) {
+            fprintf(stderr, "Failed to open HDF5 file: %s\n", hdf5_filepath);
+            return 1;
+        }
+        dataset_id = H5Dopen(file_id, "population_data", H5P_DEFAULT);
+        if (dataset_id < 0) {
+            fprintf(stderr, "Failed to open population_data dataset\n");
+            H5Fclose(file_id);
+            return 1;
+        }
+        match_ingest_compression(dataset_id, &ingest_options);
+        // 列の並びは作成時に書いた meshid_list に従う (候補をすべて列にしていた古いファイルもそのまま追記できる)
+        hid_t meshid_list_dataset_id = H5Dopen(file_id, "meshid_list", H5P_DEFAULT);
+        hid_t meshid_list_space_id = meshid_list_dataset_id < 0 ? -1 : H5Dget_space(meshid_list_dataset_id);
+        hid_t data_space_id = H5Dget_space(dataset_id);
+        hsize_t meshid_list_dims[1] = {0};
+        hsize_t data_dims[2] = {0, 0};
+        if (meshid_list_space_id >= 0) {
+            H5Sget_simple_extent_dims(meshid_list_space_id, meshid_list_dims, NULL);
+            H5Sclose(meshid_list_space_id);
+        }
+        H5Sget_simple_extent_dims(data_space_id, data_dims, NULL);
+        H5Sclose(data_space_id);
+        if (meshid_list_dataset_id < 0 || meshid_list_dims[0] != data_dims[1]) {
+            fprintf(stderr, "meshid_list does not match the columns of population_data\n");
+            if (meshid_list_dataset_id >= 0) {
+                H5Dclose(meshid_list_dataset_id);
+            }
+            H5Dclose(dataset_id);
+            H5Fclose(file_id);
+            return 1;
+        }
+        num_meshes = (int)meshid_list_dims[0];
+        all_meshes = (int *)malloc(sizeof(int) * (num_meshes > 0 ? num_meshes : 1));
+        if (all_meshes == NULL ||
+            H5Dread(meshid_list_dataset_id, H5T_NATIVE_INT, H5S_ALL, H5S_ALL, H5P_DEFAULT, all_meshes) < 0) {
+            fprintf(stderr, "Failed to read meshid_list\n");
+            H5Dclose(meshid_list_dataset_id);
+            H5Dclose(dataset_id);
+            H5Fclose(file_id);
+            return 1;
+        }
+        H5Dclose(meshid_list_dataset_id);
+        last_ingested_hour = read_last_ingested_hour(file_id);
+        if (last_ingested_hour < 0) {
+            fprintf(stderr, "%s lacks %s; rebuild it\n", hdf5_filepath, LAST_INGESTED_HOUR_ATTR);
+            H5Dclose(dataset_id);
+            H5Fclose(file_id);
+            return 1;
+        }
+        int latest = query_latest_time_index(conninfo, &ingest_options);
+        if (latest < -1) {
+            H5Dclose(dataset_id);
+            H5Fclose(file_id);
+            return 1;
+        }
+        if (latest <= last_ingested_hour) {
+            printf("Already up to date (last ingested hour %d)\n", last_ingested_hour);
+            H5Dclose(dataset_id);
+            H5Fclose(file_id);
+            free_ingest_options(&ingest_options);
+            return 0;
+        }
+        ingest_options.time_start = last_ingested_hour + 1;
+        total_rows = latest + 1;
+        if (extend_time_axis(dataset_id, (hsize_t)total_rows) < 0) {
+            H5Dclose(dataset_id);
+            H5Fclose(file_id);
+            return 1;
+        }
+        printf("Appending hours %d..%d\n", ingest_options.time_start, latest);
+    } else {
+        // 候補のうちグローバルの meshid_list にある (人口のある) メッシュだけを列にする
+        all_meshes = get_all_meshes_in_1st_mesh(mesh1st, NUM_MESHES_1ST);
+        cmph_t *hash = prepare_search();
+        if (all_meshes == NULL || hash == NULL) {
+            fprintf(stderr, "Failed to prepare the mesh ID list\n");
+            return 1;
+        }
+        num_meshes = keep_populated_meshes(hash, all_meshes, NUM_MESHES_1ST);
+        cmph_destroy(hash);
+        printf("Populated meshes: %d of %d\n", num_meshes, NUM_MESHES_1ST);
+        if (num_meshes == 0) {
+            fprintf(stderr, "No populated meshes in 1st mesh %d\n", mesh1st);
+            free(all_meshes);
+            return 1;
+        }
+
+        file_id = H5Fcreate(hdf5_filepath, H5F_ACC_TRUNC, H5P_DEFAULT, H5P_DEFAULT);
+        if (file_id < 0) {
+            fprintf(stderr, "Failed to create HDF5 file: %s\n", hdf5_filepath);
+            return 1;
+        }
 
-    // meshid_list メタデータの書き込み
-    hsize_t meshid_list_dims[1] = {NUM_MESHES_1ST};
-    hid_t meshid_list_space_id = H5Screate_simple(1, meshid_list_dims, NULL);
-    hid_t meshid_list_dataset_id = H5Dcreate(file_id, "meshid_list", H5T_NATIVE_UINT32, meshid_list_space_id, H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
-    if (meshid_list_dataset_id < 0) {
-        fprintf(stderr, "Failed to create meshid_list dataset\n");
+        // meshid_list メタデータの書き込み
+        hsize_t meshid_list_dims[1] = {num_meshes};
+        hid_t meshid_list_space_id = H5Screate_simple(1, meshid_list_dims, NULL);
+        hid_t meshid_list_dataset_id = H5Dcreate(file_id, "meshid_list", H5T_NATIVE_UINT32, meshid_list_space_id, H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
+        if (meshid_list_dataset_id < 0) {
+            fprintf(stderr, "Failed to create meshid_list dataset\n");
+            H5Sclose(meshid_list_space_id);
+            H5Fclose(file_id);
+            return 1;
+        }
+        H5Dwrite(meshid_list_dataset_id, H5T_NATIVE_UINT32, H5S_ALL, H5S_ALL, H5P_DEFAULT, all_meshes);
+        H5Dclose(meshid_list_dataset_id);
         H5Sclose(meshid_list_space_id);
+
+        hid_t attr_space_id = H5Screate(H5S_SCALAR);
+        hid_t attr_id = H5Acreate(file_id, MESH1ST_ATTR, H5T_NATIVE_INT, attr_space_id, H5P_DEFAULT, H5P_DEFAULT);
+        H5Sclose(attr_space_id);
+        if (attr_id < 0 || H5Awrite(attr_id, H5T_NATIVE_INT, &mesh1st) < 0) {
+            fprintf(stderr, "Failed to write %s attribute\n", MESH1ST_ATTR);
+        }
+        if (attr_id >= 0) {
+            H5Aclose(attr_id);
+        }
+
+        dataset_id = create_population_dataset(file_id, "population_data", NOW_ENTIRE_LEN_FOR_ONE_MESH, num_meshes,
+                                               HDF5_DATETIME_CHUNK, HDF5_MESH_CHUNK, ingest_options.compression,
+                                               ingest_options.compression_level);
+        if (dataset_id < 0) {
+            fprintf(stderr, "Failed to create population_data dataset\n");
+            H5Fclose(file_id);
+            return 1;
+        }
+    }
+
+    // スレッドの配置は実行中のマシンのトポロジーと出力先のデバイスの NUMA ノードから決める
+    CpuTopology topology;
+    ThreadPlacement placement;
+    if (load_cpu_topology(SYSFS_ROOT, NULL, &topology) != 0 ||
+        plan_thread_placement(&topology, path_numa_node(SYSFS_ROOT, hdf5_filepath), NUM_PRODUCERS, &placement) != 0) {
         H5Fclose(file_id);
         return 1;
     }
-    H5Dwrite(meshid_list_dataset_id, H5T_NATIVE_UINT32, H5S_ALL, H5S_ALL, H5P_DEFAULT, all_meshes);
-    H5Dclose(meshid_list_dataset_id);
-    H5Sclose(meshid_list_space_id);
+    print_thread_placement(&topology, &placement);
 
     pthread_attr_t attr;
     cpu_set_t cpuset;
     pthread_t producer_threads[NUM_PRODUCERS], consumer_thread, meshlist_producer_pthread;
     ProducerObject producer_objects[NUM_PRODUCERS];
-    int target_cpu_core;
 
     // meshlist_producer スレッドの作成と affinity 設定
     pthread_attr_init(&attr);
     CPU_ZERO(&cpuset);
-    CPU_SET(0, &cpuset);    //HARDCODE AWARE!!!
+    CPU_SET(placement.meshlist_cpu, &cpuset);
     if (pthread_attr_setaffinity_np(&attr, sizeof(cpu_set_t), &cpuset) != 0) {
         perror("pthread_attr_setaffinity_np failed for meshlist_producer");
     }
     MeshlistProducerArgs mpl_args = {
         .meshid_queue = &meshid_queue,
         .all_meshes = all_meshes,
-        .num_meshes = NUM_MESHES_1ST
+        .num_meshes = num_meshes,
+        .options = &ingest_options
     };
     if (pthread_create(&meshlist_producer_pthread, &attr, meshlist_producer, &mpl_args) != 0) {
         perror("pthread_create failed for meshlist_producer");
@@ -400,29 +472,54 @@ int main(int argc, char* argv[]) {
     }
     pthread_attr_destroy(&attr);
 
+    // 直接チャンク書き込みでは時間方向もチャンク単位で確保する
+    int producer_rows = total_rows - ingest_options.time_start;
+    if (ingest_options.direct_chunk) {
+        producer_rows = (producer_rows + HDF5_DATETIME_CHUNK - 1) / HDF5_DATETIME_CHUNK * HDF5_DATETIME_CHUNK;
+    }
+
+    // 行列のデータ領域は producer ごとのプールで使い回す。
+    // 返却済みのまま保持する分は予算の一部を割り当て、残りをキュー上の行列の予算にする
+    int pool_cols = ingest_options.scan == INGEST_SCAN_RANGE ? ingest_options.range_meshes : MESHLIST_ONCE_LEN;
+    size_t pool_buffer_bytes = (size_t)producer_rows * pool_cols * sizeof(int);
+    size_t pool_bytes;
+    size_t pool_cached = matrix_pool_cached_for_budget(ingest_options.memory_budget, NUM_PRODUCERS, pool_buffer_bytes,
+                                                       &pool_bytes);
+    ByteBudget data_budget;
+    init_byte_budget(&data_budget, ingest_options.memory_budget - pool_bytes);
+    atomic_int dropped_batches = 0;
+
     // producer スレッドの作成と affinity 設定
     for (int i = 0; i < NUM_PRODUCERS; ++i) {
         pthread_attr_init(&attr);
         CPU_ZERO(&cpuset);
-        target_cpu_core = cpulist[i % (sizeof(cpulist) / sizeof(cpulist[0]))];    //HARDCODE AWARE!!!
-        CPU_SET(target_cpu_core, &cpuset);
+        CPU_SET(placement.producer_cpus[i], &cpuset);
         if (pthread_attr_setaffinity_np(&attr, sizeof(cpu_set_t), &cpuset) != 0) {
             perror("pthread_attr_setaffinity_np failed for producer");
         }
         producer_objects[i].DataQueue = &data_queue;
         producer_objects[i].MeshlistQueue = &meshid_queue;
         producer_objects[i].conninfo = conninfo;
-        if (pthread_create(&producer_threads[i], &attr, producer, &producer_objects[i]) != 0) {
+        producer_objects[i].options = &ingest_options;
+        producer_objects[i].rows = producer_rows;
+        producer_objects[i].time_chunk = ingest_options.direct_chunk ? HDF5_DATETIME_CHUNK : 0;
+        producer_objects[i].mesh_chunk = HDF5_MESH_CHUNK;
+        producer_objects[i].budget = ingest_options.memory_budget > 0 ? &data_budget : NULL;
+        producer_objects[i].stall_ns = 0;
+        producer_objects[i].pool = create_matrix_pool(pool_buffer_bytes, pool_cached);
+        producer_objects[i].dropped_batches = &dropped_batches;
+        if (pthread_create(&producer_threads[i], &attr, population_producer, &producer_objects[i]) != 0) {
             perror("pthread_create failed for producer");
             return 1;
         }
         pthread_attr_destroy(&attr);
     }
 
-    // consumer スレッドの作成と affinity 設定
+    // consumer スレッドの作成と affinity 設定。
+    // HDF5 に書き込む I/O スレッドが writer_cpu を使い、ステージングはその SMT sibling で動かす
     pthread_attr_init(&attr);
     CPU_ZERO(&cpuset);
-    CPU_SET(1, &cpuset);    //HARDCODE AWARE!!!
+    CPU_SET(placement.meshlist_cpu, &cpuset);
     if (pthread_attr_setaffinity_np(&attr, sizeof(cpu_set_t), &cpuset) != 0) {
         perror("pthread_attr_setaffinity_np failed for consumer");
     }
@@ -430,7 +527,11 @@ int main(int argc, char* argv[]) {
     ConsumerArgs consumer_args;
     consumer_args.queue = &data_queue;
     consumer_args.hdf5_file_id = file_id;
-    consumer_args.num_meshes = NUM_MESHES_1ST;
+    consumer_args.dataset_id = dataset_id;
+    consumer_args.last_ingested_hour = last_ingested_hour;
+    consumer_args.writer_cpu = placement.writer_cpu;
+    consumer_args.dropped_batches = &dropped_batches;
+    consumer_args.num_meshes = num_meshes;
     consumer_args.all_meshes = all_meshes;
     if (pthread_create(&consumer_thread, &attr, consumer, &consumer_args) != 0) {
         perror("pthread_create failed for consumer");
@@ -440,15 +541,41 @@ int main(int argc, char* argv[]) {
     }
     pthread_attr_destroy(&attr);
 
-    pthread_join(meshlist_producer_pthread, NULL);
-
+    // producer が全員途中で終了しても meshlist_producer が積み終えられるよう、先に producer を待つ
     for (int i = 0; i < NUM_PRODUCERS; i++) {
         pthread_join(producer_threads[i], NULL);
     }
+    int failed_producers = drain_meshlist_queue(&meshid_queue, producer_objects, NUM_PRODUCERS);
+    pthread_join(meshlist_producer_pthread, NULL);
     pthread_join(consumer_thread, NULL);
 
     printf("All threads finished.\n");
+    free_thread_placement(&placement);
+    free_cpu_topology(&topology);
+    report_backpressure(&data_budget, producer_objects, NUM_PRODUCERS);
+    size_t pool_mapped = 0, pool_reused = 0;
+    for (int i = 0; i < NUM_PRODUCERS; i++) {
+        if (producer_objects[i].pool != NULL) {
+            pool_mapped += atomic_load(&producer_objects[i].pool->mapped);
+            pool_reused += atomic_load(&producer_objects[i].pool->reused);
+        }
+        destroy_matrix_pool(producer_objects[i].pool);
+    }
+    printf("Matrix pool: %zu buffers mapped, %zu batches reused a buffer\n", pool_mapped, pool_reused);
+    destroy_queue(&data_queue);
+    destroy_queue(&meshid_queue);
+    free_ingest_options(&ingest_options);
 
     free(all_meshes);
+    if (failed_producers == NUM_PRODUCERS) {
+        fprintf(stderr, "All %d producers failed\n", NUM_PRODUCERS);
+        return 1;
+    }
+    if (failed_producers > 0) {
+        fprintf(stderr, "%d of %d producers stopped early\n", failed_producers, NUM_PRODUCERS);
+    }
+    if (failed_producers > 0 || atomic_load(&dropped_batches) > 0 || consumer_args.write_failures > 0) {
+        return 1;
+    }
     return 0;
 }
\ No newline at end of file
@@ -4,32 +4,319 @@
 
 #include "fifioq.h"
 
+#include <limits.h>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define cpu_relax() _mm_pause()
+#else
+#define cpu_relax() ((void)0)
+#endif
+
+static void futex_wait(_Atomic uint32_t *addr, uint32_t expected) {
+    syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, expected, NULL, NULL, 0);
+}
+
+static void futex_wake(_Atomic uint32_t *addr, int n) {
+    syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, n, NULL, NULL, 0);
+}
+
+// 待っているスレッドがいるときだけ futex_wake を呼ぶ。
+// 待つ側は waiters を増やしてから再確認するので、fence を挟めば起こし損ねない
+static void notify(_Atomic uint32_t *event, atomic_int *waiters, size_t n) {
+    atomic_fetch_add(event, 1);
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load(waiters) > 0) {
+        futex_wake(event, n > INT_MAX ? INT_MAX : (int)n);
+    }
+}
+
+int init_queue_with_capacity(FIFOQueue *q, size_t capacity) {
+    size_t size = 2;
+    while (size < capacity) {
+        size <<= 1;
+    }
+    q->cells = (FIFOQueueCell *)aligned_alloc(QUEUE_CACHELINE,
+                                              (sizeof(FIFOQueueCell) * size + QUEUE_CACHELINE - 1) /
+                                              QUEUE_CACHELINE * QUEUE_CACHELINE);
+    if (q->cells == NULL) {
+        perror("aligned_alloc failed");
+        return -1;
+    }
+    for (size_t i = 0; i < size; ++i) {
+        atomic_init(&q->cells[i].sequence, i);
+        q->cells[i].data = NULL;
+    }
+    q->mask = size - 1;
+    q->spin_limit = sysconf(_SC_NPROCESSORS_ONLN) > 1 ? QUEUE_SPIN_LIMIT : 0;
+    atomic_init(&q->tail, 0);
+    atomic_init(&q->head, 0);
+    atomic_init(&q->items_event, 0);
+    atomic_init(&q->items_waiters, 0);
+    atomic_init(&q->space_event, 0);
+    atomic_init(&q->space_waiters, 0);
+    return 0;
+}
+
 void init_queue(FIFOQueue *q) {
-    q->head = 0;
-    q->tail = 0;
-    q->count = 0;
-    pthread_mutex_init(&q->mutex, NULL);
-    sem_init(&q->full, 0, QUEUE_SIZE);
-    sem_init(&q->empty, 0, 0);
+    if (init_queue_with_capacity(q, QUEUE_SIZE) != 0) {
+        exit(1);
+    }
+}
+
+void destroy_queue(FIFOQueue *q) {
+    free(q->cells);
+    q->cells = NULL;
+}
+
+size_t queue_capacity(const FIFOQueue *q) {
+    return q->mask + 1;
+}
+
+size_t queue_length(const FIFOQueue *q) {
+    size_t head = atomic_load_explicit(&q->head, memory_order_relaxed);
+    size_t tail = atomic_load_explicit(&q->tail, memory_order_relaxed);
+    // head を先に読むので tail が追い越されていることはないが、念のため範囲に収める
+    if (tail <= head) {
+        return 0;
+    }
+    return tail - head < q->mask + 1 ? tail - head : q->mask + 1;
+}
+
+// tail から最大 n 個の連続した空きセルを確保する。確保した個数を返し、先頭位置を *pos に入れる
+static size_t claim_for_enqueue(FIFOQueue *q, size_t n, size_t *pos_out) {
+    size_t pos = atomic_load_explicit(&q->tail, memory_order_relaxed);
+    for (;;) {
+        size_t k = 0;
+        while (k < n) {
+            FIFOQueueCell *cell = &q->cells[(pos + k) & q->mask];
+            size_t seq = atomic_load_explicit(&cell->sequence, memory_order_acquire);
+            intptr_t dif = (intptr_t)seq - (intptr_t)(pos + k);
+            if (dif != 0) {
+                break;
+            }
+            k++;
+        }
+        if (k == 0) {
+            FIFOQueueCell *cell = &q->cells[pos & q->mask];
+            size_t seq = atomic_load_explicit(&cell->sequence, memory_order_acquire);
+            if ((intptr_t)seq - (intptr_t)pos < 0) {
+                return 0;   // 満杯
+            }
+            pos = atomic_load_explicit(&q->tail, memory_order_relaxed);
+            continue;
+        }
+        if (atomic_compare_exchange_weak_explicit(&q->tail, &pos, pos + k,
+                                                  memory_order_relaxed, memory_order_relaxed)) {
+            *pos_out = pos;
+            return k;
+        }
+    }
+}
+
+// head から最大 n 個の連続した埋まっているセルを確保する
+static size_t claim_for_dequeue(FIFOQueue *q, size_t n, size_t *pos_out) {
+    size_t pos = atomic_load_explicit(&q->head, memory_order_relaxed);
+    for (;;) {
+        size_t k = 0;
+        while (k < n) {
+            FIFOQueueCell *cell = &q->cells[(pos + k) & q->mask];
+            size_t seq = atomic_load_explicit(&cell->sequence, memory_order_acquire);
+            intptr_t dif = (intptr_t)seq - (intptr_t)(pos + k + 1);
+            if (dif != 0) {
+                break;
+            }
+            k++;
+        }
+        if (k == 0) {
+            FIFOQueueCell *cell = &q->cells[pos & q->mask];
+            size_t seq = atomic_load_explicit(&cell->sequence, memory_order_acquire);
+            if ((intptr_t)seq - (intptr_t)(pos + 1) < 0) {
+                return 0;   // 空
+            }
+            pos = atomic_load_explicit(&q->head, memory_order_relaxed);
+            continue;
+        }
+        if (atomic_compare_exchange_weak_explicit(&q->head, &pos, pos + k,
+                                                  memory_order_relaxed, memory_order_relaxed)) {
+            *pos_out = pos;
+            return k;
+        }
+    }
+}
+
+static size_t push_some(FIFOQueue *q, void *const *items, size_t n) {
+    size_t pos;
+    size_t k = claim_for_enqueue(q, n, &pos);
+    for (size_t i = 0; i < k; ++i) {
+        FIFOQueueCell *cell = &q->cells[(pos + i) & q->mask];
+        cell->data = items[i];
+        atomic_store_explicit(&cell->sequence, pos + i + 1, memory_order_release);
+    }
+    if (k > 0) {
+        notify(&q->items_event, &q->items_waiters, k);
+    }
+    return k;
+}
+
+static size_t pop_some(FIFOQueue *q, void **items, size_t n) {
+    size_t pos;
+    size_t k = claim_for_dequeue(q, n, &pos);
+    for (size_t i = 0; i < k; ++i) {
+        FIFOQueueCell *cell = &q->cells[(pos + i) & q->mask];
+        items[i] = cell->data;
+        atomic_store_explicit(&cell->sequence, pos + i + q->mask + 1, memory_order_release);
+    }
+    if (k > 0) {
+        notify(&q->space_event, &q->space_waiters, k);
+    }
+    return k;
+}
+
+bool try_enqueue(FIFOQueue *q, void *data) {
+    return push_some(q, &data, 1) == 1;
+}
+
+bool try_dequeue(FIFOQueue *q, void **data) {
+    return pop_some(q, data, 1) == 1;
+}
+
+void enqueue_batch(FIFOQueue *q, void *const *items, size_t n) {
+    size_t done = 0;
+    int spin = 0;
+    while (done < n) {
+        size_t k = push_some(q, items + done, n - done);
+        if (k > 0) {
+            done += k;
+            spin = 0;
+            continue;
+        }
+        if (spin < q->spin_limit) {
+            spin++;
+            cpu_relax();
+            continue;
+        }
+        uint32_t seen = atomic_load(&q->space_event);
+        atomic_fetch_add(&q->space_waiters, 1);
+        atomic_thread_fence(memory_order_seq_cst);
+        k = push_some(q, items + done, n - done);
+        if (k == 0) {
+            futex_wait(&q->space_event, seen);
+        }
+        atomic_fetch_sub(&q->space_waiters, 1);
+        done += k;
+    }
+}
+
+size_t dequeue_batch(FIFOQueue *q, void **items, size_t max) {
+    int spin = 0;
+    for (;;) {
+        size_t k = pop_some(q, items, max);
+        if (k > 0) {
+            return k;
+        }
+        if (spin < q->spin_limit) {
+            spin++;
+            cpu_relax();
+            continue;
+        }
+        uint32_t seen = atomic_load(&q->items_event);
+        atomic_fetch_add(&q->items_waiters, 1);
+        atomic_thread_fence(memory_order_seq_cst);
+        k = pop_some(q, items, max);
+        if (k == 0) {
+            futex_wait(&q->items_event, seen);
+        }
+        atomic_fetch_sub(&q->items_waiters, 1);
+        if (k > 0) {
+            return k;
+        }
+    }
 }
 
 void enqueue(FIFOQueue *q, void *data) {
-    sem_wait(&q->full);
-    pthread_mutex_lock(&q->mutex);
-    q->queue[q->tail] = data;
-    q->tail = (q->tail + 1) % QUEUE_SIZE;
-    q->count++;
-    pthread_mutex_unlock(&q->mutex);
-    sem_post(&q->empty);
+    enqueue_batch(q, &data, 1);
 }
 
 void * dequeue(FIFOQueue *q) {
-    sem_wait(&q->empty);
-    pthread_mutex_lock(&q->mutex);
-    void *data = q->queue[q->head];
-    q->head = (q->head + 1) % QUEUE_SIZE;
-    q->count--;
-    pthread_mutex_unlock(&q->mutex);
-    sem_post(&q->full);
+    void *data;
+    dequeue_batch(q, &data, 1);
     return data;
 }
+
+void init_byte_budget(ByteBudget *b, size_t limit) {
+    b->limit = limit;
+    atomic_init(&b->in_flight, 0);
+    atomic_init(&b->peak, 0);
+    atomic_init(&b->event, 0);
+    atomic_init(&b->waiters, 0);
+    atomic_init(&b->stall_ns, 0);
+    atomic_init(&b->stalls, 0);
+}
+
+static bool try_acquire_bytes(ByteBudget *b, size_t bytes) {
+    size_t cur = atomic_load(&b->in_flight);
+    while (cur == 0 || cur + bytes <= b->limit) {
+        if (atomic_compare_exchange_weak(&b->in_flight, &cur, cur + bytes)) {
+            size_t peak = atomic_load_explicit(&b->peak, memory_order_relaxed);
+            while (cur + bytes > peak &&
+                   !atomic_compare_exchange_weak_explicit(&b->peak, &peak, cur + bytes,
+                                                          memory_order_relaxed, memory_order_relaxed)) {
+            }
+            return true;
+        }
+    }
+    return false;
+}
+
+uint64_t byte_budget_acquire(ByteBudget *b, size_t bytes) {
+    if (b->limit == 0) {
+        atomic_fetch_add(&b->in_flight, bytes);
+        return 0;
+    }
+    if (try_acquire_bytes(b, bytes)) {
+        return 0;
+    }
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (;;) {
+        uint32_t seen = atomic_load(&b->event);
+        atomic_fetch_add(&b->waiters, 1);
+        atomic_thread_fence(memory_order_seq_cst);
+        bool acquired = try_acquire_bytes(b, bytes);
+        if (!acquired) {
+            futex_wait(&b->event, seen);
+        }
+        atomic_fetch_sub(&b->waiters, 1);
+        if (acquired || try_acquire_bytes(b, bytes)) {
+            break;
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    uint64_t ns = (uint64_t)(t1.tv_sec - t0.tv_sec) * 1000000000ULL + (uint64_t)(t1.tv_nsec - t0.tv_nsec);
+    atomic_fetch_add_explicit(&b->stall_ns, ns, memory_order_relaxed);
+    atomic_fetch_add_explicit(&b->stalls, 1, memory_order_relaxed);
+    return ns;
+}
+
+void byte_budget_release(ByteBudget *b, size_t bytes) {
+    atomic_fetch_sub(&b->in_flight, bytes);
+    if (b->limit != 0) {
+        // 待っている要求の大きさはまちまちなので全員起こす
+        notify(&b->event, &b->waiters, INT_MAX);
+    }
+}
+
+size_t default_memory_budget(void) {
+    long pages = sysconf(_SC_PHYS_PAGES);
+    long page_size = sysconf(_SC_PAGESIZE);
+    if (pages <= 0 || page_size <= 0) {
+        return 0;
+    }
+    return (size_t)pages * (size_t)page_size / 2;
+}
@@ -0,0 +1,16 @@
+//
+// delta-bitpack フィルタの HDF5 プラグインの入口。HDF5_PLUGIN_PATH に置くと、このリポジトリ以外の
+// 読み手 (h5dump、h5py など) も delta-bitpack で書いた population_data を読める
+//
+
+#include <H5PLextern.h>
+
+#include "delta_bitpack.h"
+
+H5PL_type_t H5PLget_plugin_type(void) {
+    return H5PL_TYPE_FILTER;
+}
+
+const void *H5PLget_plugin_info(void) {
+    return H5Z_DELTA_BITPACK;
+}
@@ -1,6 +1,11 @@
 #include "hdf5_ops.h""
 #include <stdlib.h>
 #include <string.h>
+#include <stdio.h>
+#include <libgen.h>
+#include <limits.h>
+
+#include "delta_bitpack.h"
 
 hdf5_thread_safe_t* hdf5_create(const char* filename, const char* dataset_name, hsize_t size) {
     hdf5_thread_safe_t* hdf5 = malloc(sizeof(hdf5_thread_safe_t));
@@ -33,4 +38,729 @@ void hdf5_close(hdf5_thread_safe_t* hdf5) {
     H5Fclose(hdf5->file_id);
     pthread_mutex_destroy(&hdf5->mutex);
     free(hdf5);
-}
\ No newline at end of file
+}
+
+int plan_pqdata_write(PQdataWrite *w, PQdataMatrix *m, hsize_t column_offset, hsize_t dataset_rows) {
+    w->m = m;
+    w->chunked = m->chunk_order;
+    w->num_runs = 0;
+    w->runs = NULL;
+    // チャンク境界に合わせて行を余分に確保した行列は、データセットの範囲内だけを書く
+    w->rows = 0;
+    if ((hsize_t)m->time_start < dataset_rows) {
+        w->rows = dataset_rows - m->time_start < (hsize_t)m->rows ? dataset_rows - m->time_start : (hsize_t)m->rows;
+    }
+    if (w->rows == 0) {
+        return 0;
+    }
+    w->runs = (hsize_t (*)[2])malloc(sizeof(hsize_t[2]) * (m->cols > 0 ? m->cols : 1));
+    if (w->runs == NULL) {
+        perror("malloc failed");
+        return -1;
+    }
+    if (m->columns == NULL) {
+        w->runs[0][0] = column_offset;
+        w->runs[0][1] = (hsize_t)m->cols;
+        w->num_runs = 1;
+        return 0;
+    }
+    // 連続する列はまとめて1つのハイパースラブにする
+    int run_start = 0;
+    for (int j = 1; j <= m->cols; ++j) {
+        if (j == m->cols || m->columns[j] != m->columns[j - 1] + 1) {
+            w->runs[w->num_runs][0] = (hsize_t)m->columns[run_start];
+            w->runs[w->num_runs][1] = (hsize_t)(j - run_start);
+            w->num_runs++;
+            run_start = j;
+        }
+    }
+    return 0;
+}
+
+// offset から始まるチャンクがファイルに確保されているか。
+// H5Dget_chunk_storage_size は読んだだけでキャッシュにある未確保のチャンクも大きさを返すので、アドレスで見る
+static bool chunk_allocated(hid_t dataset_id, const hsize_t offset[2]) {
+    unsigned filter_mask = 0;
+    haddr_t addr = HADDR_UNDEF;
+    hsize_t nbytes = 0;
+    return H5Dget_chunk_info_by_coord(dataset_id, offset, &filter_mask, &addr, &nbytes) >= 0 && addr != HADDR_UNDEF;
+}
+
+// 書き込む範囲をデータセットのチャンクで区切った部分
+typedef struct {
+    hsize_t t;          // データセット上の先頭行
+    hsize_t rows;
+    hsize_t col;        // データセット上の先頭列
+    hsize_t mem_col;    // 行列上の先頭列
+    hsize_t cols;
+    bool skip;
+} WriteBlock;
+
+// w の範囲をチャンクで区切り、値がなくチャンクも確保されていない部分を除いて file_space と mem_space を選択する。
+// 除いた部分の数を返し、*kept に残した部分の数を入れる。除くものがなければ何も選択しない。失敗したら -1
+static long long select_nonzero_blocks(hid_t dataset_id, const PQdataWrite *w, hsize_t time_chunk,
+                                       hsize_t mesh_chunk, hid_t file_space, hid_t mem_space, long long *kept) {
+    const PQdataMatrix *m = w->m;
+    hsize_t t_begin = (hsize_t)m->time_start;
+    hsize_t t_end = t_begin + w->rows;
+    size_t max_blocks = (size_t)((t_end - 1) / time_chunk - t_begin / time_chunk + 1) *
+                        (size_t)((hsize_t)m->cols / mesh_chunk + 2 * w->num_runs);
+    WriteBlock *blocks = (WriteBlock *)malloc(sizeof(WriteBlock) * max_blocks);
+    if (blocks == NULL) {
+        perror("malloc failed");
+        return -1;
+    }
+    size_t n = 0;
+    long long skipped = 0;
+    for (hsize_t t = t_begin; t < t_end; t = (t / time_chunk + 1) * time_chunk) {
+        hsize_t t_next = (t / time_chunk + 1) * time_chunk;
+        hsize_t rows = (t_next < t_end ? t_next : t_end) - t;
+        hsize_t mem_col = 0;
+        for (int r = 0; r < w->num_runs; ++r) {
+            hsize_t run_end = w->runs[r][0] + w->runs[r][1];
+            for (hsize_t c = w->runs[r][0]; c < run_end; c = (c / mesh_chunk + 1) * mesh_chunk) {
+                hsize_t c_next = (c / mesh_chunk + 1) * mesh_chunk;
+                WriteBlock *b = &blocks[n++];
+                *b = (WriteBlock){t, rows, c, mem_col, (c_next < run_end ? c_next : run_end) - c, true};
+                mem_col += b->cols;
+                for (hsize_t i = 0; i < rows && b->skip; ++i) {
+                    b->skip = chunk_is_zero(m->data + (size_t)(t - t_begin + i) * m->cols + b->mem_col,
+                                            sizeof(int) * b->cols);
+                }
+                if (b->skip) {
+                    hsize_t offset[2] = {t / time_chunk * time_chunk, c / mesh_chunk * mesh_chunk};
+                    b->skip = !chunk_allocated(dataset_id, offset);
+                }
+                skipped += b->skip ? 1 : 0;
+            }
+        }
+    }
+    *kept = (long long)n - skipped;
+    if (skipped > 0) {
+        H5Sselect_none(file_space);
+        H5Sselect_none(mem_space);
+        for (size_t i = 0; i < n; ++i) {
+            if (blocks[i].skip) {
+                continue;
+            }
+            hsize_t file_offset[2] = {blocks[i].t, blocks[i].col};
+            hsize_t mem_offset[2] = {blocks[i].t - t_begin, blocks[i].mem_col};
+            hsize_t count[2] = {blocks[i].rows, blocks[i].cols};
+            H5Sselect_hyperslab(file_space, H5S_SELECT_OR, file_offset, NULL, count, NULL);
+            H5Sselect_hyperslab(mem_space, H5S_SELECT_OR, mem_offset, NULL, count, NULL);
+        }
+    }
+    free(blocks);
+    return skipped;
+}
+
+herr_t execute_pqdata_write(hid_t dataset_id, const PQdataWrite *w, hsize_t time_chunk, hsize_t mesh_chunk) {
+    const PQdataMatrix *m = w->m;
+    if (w->chunked) {
+        return write_pqdata_matrix_chunks(dataset_id, m, time_chunk, mesh_chunk);
+    }
+    if (w->rows == 0) {
+        return 0;
+    }
+    hsize_t dims[2] = {(hsize_t)m->rows, (hsize_t)m->cols};
+    hid_t memspace_id = H5Screate_simple(2, dims, NULL);
+    hid_t dataset_space_id = H5Dget_space(dataset_id);
+    // チャンク形状が分かれば、値のないチャンクは確保しないまま fill value に任せる
+    if (time_chunk > 0 && mesh_chunk > 0) {
+        long long kept = 0;
+        long long skipped = select_nonzero_blocks(dataset_id, w, time_chunk, mesh_chunk, dataset_space_id,
+                                                  memspace_id, &kept);
+        if (skipped != 0) {
+            herr_t status = skipped < 0 ? -1 : 0;
+            if (skipped > 0 && kept > 0) {
+                status = H5Dwrite(dataset_id, H5T_NATIVE_INT, memspace_id, dataset_space_id, H5P_DEFAULT, m->data);
+            }
+            H5Sclose(memspace_id);
+            H5Sclose(dataset_space_id);
+            return status;
+        }
+    }
+    if (w->rows < dims[0]) {
+        hsize_t mem_offset[2] = {0, 0};
+        hsize_t count[2] = {w->rows, dims[1]};
+        H5Sselect_hyperslab(memspace_id, H5S_SELECT_SET, mem_offset, NULL, count, NULL);
+    }
+    for (int r = 0; r < w->num_runs; ++r) {
+        hsize_t offset[2] = {(hsize_t)m->time_start, w->runs[r][0]};
+        hsize_t count[2] = {w->rows, w->runs[r][1]};
+        H5Sselect_hyperslab(dataset_space_id, r == 0 ? H5S_SELECT_SET : H5S_SELECT_OR, offset, NULL, count, NULL);
+    }
+
+    herr_t status = H5Dwrite(dataset_id, H5T_NATIVE_INT, memspace_id, dataset_space_id, H5P_DEFAULT, m->data);
+
+    H5Sclose(memspace_id);
+    H5Sclose(dataset_space_id);
+    return status;
+}
+
+void free_pqdata_write(PQdataWrite *w) {
+    free(w->runs);
+    w->runs = NULL;
+    if (w->m != NULL) {
+        free_pqdata_matrix(w->m);
+        w->m = NULL;
+    }
+}
+
+herr_t write_pqdata_matrix(hid_t dataset_id, const PQdataMatrix *m, hsize_t column_offset) {
+    hid_t dataset_space_id = H5Dget_space(dataset_id);
+    hsize_t dims[2];
+    H5Sget_simple_extent_dims(dataset_space_id, dims, NULL);
+    H5Sclose(dataset_space_id);
+
+    // 行列の並びによらず行優先として書く (従来どおり)
+    PQdataWrite w;
+    if (plan_pqdata_write(&w, (PQdataMatrix *)m, column_offset, dims[0]) != 0) {
+        return -1;
+    }
+    w.chunked = false;
+    herr_t status = execute_pqdata_write(dataset_id, &w, 0, 0);
+    free(w.runs);
+    return status;
+}
+
+// offset から始まるチャンクのうちデータセットの範囲に入る部分に 0 を書く (フィルタは HDF5 が掛ける)
+static herr_t write_zero_chunk(hid_t dataset_id, const hsize_t offset[2], hsize_t time_chunk, hsize_t mesh_chunk) {
+    hid_t file_space = H5Dget_space(dataset_id);
+    hsize_t dims[2];
+    H5Sget_simple_extent_dims(file_space, dims, NULL);
+    hsize_t count[2] = {offset[0] + time_chunk <= dims[0] ? time_chunk : dims[0] - offset[0],
+                        offset[1] + mesh_chunk <= dims[1] ? mesh_chunk : dims[1] - offset[1]};
+    int *zeros = (int *)calloc((size_t)(count[0] * count[1]), sizeof(int));
+    herr_t status = -1;
+    if (zeros != NULL) {
+        H5Sselect_hyperslab(file_space, H5S_SELECT_SET, offset, NULL, count, NULL);
+        hid_t mem_space = H5Screate_simple(2, count, NULL);
+        status = H5Dwrite(dataset_id, H5T_NATIVE_INT, mem_space, file_space, H5P_DEFAULT, zeros);
+        H5Sclose(mem_space);
+    }
+    free(zeros);
+    H5Sclose(file_space);
+    return status;
+}
+
+herr_t write_pqdata_matrix_chunks(hid_t dataset_id, const PQdataMatrix *m, hsize_t time_chunk, hsize_t mesh_chunk) {
+    size_t chunk_bytes = (size_t)(time_chunk * mesh_chunk) * sizeof(int);
+    const unsigned char *chunk = m->filtered != NULL ? m->filtered : (const unsigned char *)m->data;
+    size_t c = 0;
+    for (hsize_t tc = 0; tc < (hsize_t)m->rows; tc += time_chunk) {
+        for (hsize_t mc = 0; mc < (hsize_t)m->cols; mc += mesh_chunk) {
+            hsize_t offset[2] = {(hsize_t)m->time_start + tc, (hsize_t)m->columns[0] + mc};
+            size_t nbytes = m->filtered != NULL ? m->filtered_sizes[c] : chunk_bytes;
+            bool zero = m->filtered != NULL ? nbytes == 0 : chunk_is_zero(chunk, chunk_bytes);
+            // 値のないチャンクは確保しない。前に書いたチャンクがあるときだけ 0 で上書きする
+            herr_t status = 0;
+            if (!zero) {
+                // filter mask 0: データセットのフィルタは producer で全て適用済み。型変換もしない
+                status = H5Dwrite_chunk(dataset_id, H5P_DEFAULT, 0, offset, nbytes, chunk);
+            } else if (chunk_allocated(dataset_id, offset)) {
+                status = m->filtered != NULL ? write_zero_chunk(dataset_id, offset, time_chunk, mesh_chunk)
+                                             : H5Dwrite_chunk(dataset_id, H5P_DEFAULT, 0, offset, nbytes, chunk);
+            }
+            if (status < 0) {
+                return -1;
+            }
+            chunk += nbytes;
+            c++;
+        }
+    }
+    return 0;
+}
+
+int set_population_filters(hid_t plist_id, ChunkCodec codec, int level) {
+    switch (codec) {
+        case CHUNK_CODEC_NONE:
+            return 0;
+        case CHUNK_CODEC_DEFLATE:
+            // encode_chunk と同じ順序 (shuffle → deflate)
+            H5Pset_shuffle(plist_id);
+            return H5Pset_deflate(plist_id, (unsigned)level) < 0 ? -1 : 0;
+        case CHUNK_CODEC_SCALEOFFSET:
+        case CHUNK_CODEC_SCALEOFFSET_DEFLATE:
+            // 最小値からの差を必要なビット数に詰める。人口は小さな非負整数なのでよく縮む
+            if (H5Pset_scaleoffset(plist_id, H5Z_SO_INT, H5Z_SO_INT_MINBITS_DEFAULT) < 0) {
+                return -1;
+            }
+            if (codec == CHUNK_CODEC_SCALEOFFSET_DEFLATE) {
+                return H5Pset_deflate(plist_id, (unsigned)level) < 0 ? -1 : 0;
+            }
+            return 0;
+        case CHUNK_CODEC_ZSTD: {
+            if (H5Zfilter_avail(H5Z_FILTER_ZSTD) <= 0) {
+                fprintf(stderr, "zstd filter (%d) is not available; set HDF5_PLUGIN_PATH to the plugin directory\n",
+                        H5Z_FILTER_ZSTD);
+                return -1;
+            }
+            unsigned int cd_values[1] = {(unsigned int)level};
+            H5Pset_shuffle(plist_id);
+            return H5Pset_filter(plist_id, H5Z_FILTER_ZSTD, H5Z_FLAG_MANDATORY, 1, cd_values) < 0 ? -1 : 0;
+        }
+        case CHUNK_CODEC_DELTA_BITPACK: {
+            // フィルタはこのリポジトリにあるので、プラグインを探さずにプロセス内で登録する
+            if (register_delta_bitpack_filter() < 0) {
+                return -1;
+            }
+            // 1行の要素数は set_local がチャンク形状から足す
+            unsigned int cd_values[1] = {(unsigned int)level};
+            return H5Pset_filter(plist_id, H5Z_FILTER_DELTA_BITPACK, H5Z_FLAG_MANDATORY, 1, cd_values) < 0 ? -1 : 0;
+        }
+    }
+    return -1;
+}
+
+hid_t create_population_dataset(hid_t file_id, const char *name, hsize_t rows, hsize_t cols,
+                                hsize_t time_chunk, hsize_t mesh_chunk, ChunkCodec codec, int level) {
+    // 時間軸は追記で伸ばせるように上限なしにする
+    hsize_t dims[2] = {rows, cols};
+    hsize_t max_dims[2] = {H5S_UNLIMITED, cols};
+    hid_t dataspace_id = H5Screate_simple(2, dims, max_dims);
+    if (dataspace_id < 0) {
+        return H5I_INVALID_HID;
+    }
+    hid_t plist_id = H5Pcreate(H5P_DATASET_CREATE);
+    hsize_t chunk_dims[2] = {time_chunk, mesh_chunk};
+    H5Pset_chunk(plist_id, 2, chunk_dims);
+    int fill_value = 0;
+    H5Pset_fill_value(plist_id, H5T_NATIVE_INT, &fill_value);
+    if (set_population_filters(plist_id, codec, level) != 0) {
+        H5Pclose(plist_id);
+        H5Sclose(dataspace_id);
+        return H5I_INVALID_HID;
+    }
+    hid_t dataset_id = H5Dcreate(file_id, name, H5T_NATIVE_INT, dataspace_id, H5P_DEFAULT, plist_id, H5P_DEFAULT);
+    H5Pclose(plist_id);
+    H5Sclose(dataspace_id);
+    return dataset_id;
+}
+
+void shard_file_path(char *buf, size_t size, const char *path, int shard) {
+    size_t len = strlen(path);
+    if (len > 3 && strcmp(path + len - 3, ".h5") == 0) {
+        snprintf(buf, size, "%.*s-shard%02d.h5", (int)(len - 3), path, shard);
+    } else {
+        snprintf(buf, size, "%s-shard%02d", path, shard);
+    }
+}
+
+hid_t create_virtual_population_dataset(hid_t file_id, const char *name, hsize_t rows,
+                                        const char *const *shard_paths, const hsize_t *shard_cols, int num_shards) {
+    hsize_t total_cols = 0;
+    for (int k = 0; k < num_shards; ++k) {
+        total_cols += shard_cols[k];
+    }
+    hsize_t dims[2] = {rows, total_cols};
+    hsize_t max_dims[2] = {H5S_UNLIMITED, total_cols};
+    hid_t virtual_space = H5Screate_simple(2, dims, max_dims);
+    hid_t plist_id = H5Pcreate(H5P_DATASET_CREATE);
+    int fill_value = 0;
+    H5Pset_fill_value(plist_id, H5T_NATIVE_INT, &fill_value);
+
+    // 時間軸は上限なしで対応させ、シャードが伸びれば仮想データセットも伸びる
+    herr_t status = 0;
+    hsize_t column = 0;
+    for (int k = 0; k < num_shards && status >= 0; ++k) {
+        hsize_t src_dims[2] = {rows, shard_cols[k]};
+        hsize_t src_max[2] = {H5S_UNLIMITED, shard_cols[k]};
+        hid_t src_space = H5Screate_simple(2, src_dims, src_max);
+        hsize_t start[2] = {0, 0};
+        hsize_t count[2] = {1, 1};
+        hsize_t block[2] = {H5S_UNLIMITED, shard_cols[k]};
+        H5Sselect_hyperslab(src_space, H5S_SELECT_SET, start, NULL, count, block);
+        hsize_t virtual_start[2] = {0, column};
+        H5Sselect_hyperslab(virtual_space, H5S_SELECT_SET, virtual_start, NULL, count, block);
+
+        char *copy = strdup(shard_paths[k]);
+        status = copy != NULL ? H5Pset_virtual(plist_id, virtual_space, basename(copy), name, src_space) : -1;
+        free(copy);
+        H5Sclose(src_space);
+        column += shard_cols[k];
+    }
+    hid_t dataset_id = H5I_INVALID_HID;
+    if (status >= 0) {
+        H5Sselect_all(virtual_space);
+        dataset_id = H5Dcreate(file_id, name, H5T_NATIVE_INT, virtual_space, H5P_DEFAULT, plist_id, H5P_DEFAULT);
+    }
+    H5Pclose(plist_id);
+    H5Sclose(virtual_space);
+    return dataset_id;
+}
+
+// 仮想データセットの index 番目の対応先のデータセットを開き、そのファイルを *src_file に入れる。
+// 相対パスの対応先は仮想データセットのファイルと同じディレクトリから探す
+static hid_t open_virtual_source(hid_t dataset_id, hid_t plist_id, size_t index, hid_t *src_file) {
+    size_t count = 0;
+    char source_name[PATH_MAX];
+    char source_dataset[256];
+    if (H5Pget_virtual_count(plist_id, &count) < 0 || index >= count) {
+        return H5I_INVALID_HID;
+    }
+    ssize_t name_len = H5Pget_virtual_filename(plist_id, index, source_name, sizeof(source_name));
+    ssize_t dataset_len = H5Pget_virtual_dsetname(plist_id, index, source_dataset, sizeof(source_dataset));
+    if (name_len < 0 || (size_t)name_len >= sizeof(source_name) ||
+        dataset_len < 0 || (size_t)dataset_len >= sizeof(source_dataset)) {
+        return H5I_INVALID_HID;
+    }
+
+    hid_t file_id = H5Iget_file_id(dataset_id);
+    if (file_id < 0) {
+        return H5I_INVALID_HID;
+    }
+    // 同じファイル内の対応先は "." で表される
+    if (strcmp(source_name, ".") == 0) {
+        *src_file = file_id;
+    } else {
+        char path[PATH_MAX];
+        char file_name[PATH_MAX];
+        if (source_name[0] == '/' || H5Fget_name(file_id, file_name, sizeof(file_name)) < 0) {
+            snprintf(path, sizeof(path), "%s", source_name);
+        } else {
+            snprintf(path, sizeof(path), "%s/%s", dirname(file_name), source_name);
+        }
+        H5Fclose(file_id);
+        *src_file = H5Fopen(path, H5F_ACC_RDONLY, H5P_DEFAULT);
+        if (*src_file < 0) {
+            fprintf(stderr, "Failed to open HDF5 file: %s\n", path);
+            return H5I_INVALID_HID;
+        }
+    }
+    hid_t src_id = H5Dopen(*src_file, source_dataset, H5P_DEFAULT);
+    if (src_id < 0) {
+        H5Fclose(*src_file);
+    }
+    return src_id;
+}
+
+int get_population_codec(hid_t dataset_id, ChunkCodec *codec, int *level) {
+    hid_t plist_id = H5Dget_create_plist(dataset_id);
+    if (H5Pget_layout(plist_id) == H5D_VIRTUAL) {
+        // 仮想データセット自体はフィルタを持たない。--shards のシャードは全て同じ設定で作るので先頭のものを読む
+        hid_t src_file;
+        hid_t src_id = open_virtual_source(dataset_id, plist_id, 0, &src_file);
+        H5Pclose(plist_id);
+        *codec = CHUNK_CODEC_NONE;
+        *level = 0;
+        if (src_id < 0) {
+            fprintf(stderr, "Failed to open the source dataset of a virtual dataset\n");
+            return -1;
+        }
+        int status = get_population_codec(src_id, codec, level);
+        H5Dclose(src_id);
+        H5Fclose(src_file);
+        return status;
+    }
+    int nfilters = H5Pget_nfilters(plist_id);
+    H5Z_filter_t filters[2] = {H5Z_FILTER_NONE, H5Z_FILTER_NONE};
+    unsigned int levels[2] = {0, 0};
+    for (int i = 0; i < nfilters && i < 2; ++i) {
+        unsigned int flags;
+        size_t nelmts = 1;
+        unsigned int cd_values[1] = {0};
+        filters[i] = H5Pget_filter2(plist_id, (unsigned)i, &flags, &nelmts, cd_values, 0, NULL, NULL);
+        levels[i] = nelmts > 0 ? cd_values[0] : 0;
+    }
+    H5Pclose(plist_id);
+
+    *level = 0;
+    int status = 0;
+    if (nfilters == 0) {
+        *codec = CHUNK_CODEC_NONE;
+    } else if (nfilters == 1 && filters[0] == H5Z_FILTER_SCALEOFFSET) {
+        *codec = CHUNK_CODEC_SCALEOFFSET;
+    } else if (nfilters == 2 && filters[0] == H5Z_FILTER_SHUFFLE && filters[1] == H5Z_FILTER_DEFLATE) {
+        *codec = CHUNK_CODEC_DEFLATE;
+        *level = (int)levels[1];
+    } else if (nfilters == 2 && filters[0] == H5Z_FILTER_SCALEOFFSET && filters[1] == H5Z_FILTER_DEFLATE) {
+        *codec = CHUNK_CODEC_SCALEOFFSET_DEFLATE;
+        *level = (int)levels[1];
+    } else if (nfilters == 2 && filters[0] == H5Z_FILTER_SHUFFLE && filters[1] == H5Z_FILTER_ZSTD) {
+        *codec = CHUNK_CODEC_ZSTD;
+        *level = (int)levels[1];
+    } else if (nfilters == 1 && filters[0] == H5Z_FILTER_DELTA_BITPACK) {
+        // 追記で H5Dwrite するときにもフィルタが要る
+        *codec = CHUNK_CODEC_DELTA_BITPACK;
+        *level = (int)levels[0];
+        status = register_delta_bitpack_filter() < 0 ? -1 : 0;
+    } else {
+        *codec = CHUNK_CODEC_NONE;
+        status = -1;
+    }
+    return status;
+}
+
+void match_ingest_compression(hid_t dataset_id, IngestOptions *opts) {
+    ChunkCodec codec;
+    int level;
+    if (get_population_codec(dataset_id, &codec, &level) != 0) {
+        // 知らないフィルタ構成なので HDF5 のフィルタに任せる
+        fprintf(stderr, "Existing dataset has an unknown filter pipeline; HDF5 applies it on write\n");
+        opts->compression = CHUNK_CODEC_NONE;
+        opts->direct_chunk = false;
+        return;
+    }
+    if (codec != opts->compression || level != opts->compression_level) {
+        fprintf(stderr, "Using the compression of the existing dataset (%s) instead of MOBAKU_INGEST_COMPRESSION\n",
+                chunk_codec_name(codec));
+    }
+    opts->compression = codec;
+    opts->compression_level = level;
+    if (codec != CHUNK_CODEC_NONE && chunk_codec_in_producer(codec)) {
+        opts->direct_chunk = true;
+    } else if (codec != CHUNK_CODEC_NONE) {
+        // producer では再現できないフィルタなので HDF5 のフィルタに任せる
+        opts->direct_chunk = false;
+    }
+}
+
+herr_t extend_time_axis(hid_t dataset_id, hsize_t rows) {
+    hid_t space_id = H5Dget_space(dataset_id);
+    hsize_t dims[2], max_dims[2];
+    H5Sget_simple_extent_dims(space_id, dims, max_dims);
+    H5Sclose(space_id);
+    if (rows <= dims[0]) {
+        return 0;
+    }
+    if (max_dims[0] != H5S_UNLIMITED && rows > max_dims[0]) {
+        fprintf(stderr, "Time axis of the dataset is fixed at %llu rows; rebuild the file to append\n",
+                (unsigned long long)max_dims[0]);
+        return -1;
+    }
+    dims[0] = rows;
+    return H5Dset_extent(dataset_id, dims);
+}
+
+int read_last_ingested_hour(hid_t file_id) {
+    int last_hour = -1;
+    return get_last_ingested_hour(file_id, &last_hour) == 0 ? last_hour : -1;
+}
+
+int get_last_ingested_hour(hid_t file_id, int *last_hour) {
+    htri_t exists = H5Aexists(file_id, LAST_INGESTED_HOUR_ATTR);
+    if (exists == 0) {
+        return 1;
+    }
+    hid_t attr_id = exists > 0 ? H5Aopen(file_id, LAST_INGESTED_HOUR_ATTR, H5P_DEFAULT) : H5I_INVALID_HID;
+    if (attr_id < 0) {
+        return -1;
+    }
+    herr_t status = H5Aread(attr_id, H5T_NATIVE_INT, last_hour);
+    H5Aclose(attr_id);
+    return status < 0 ? -1 : 0;
+}
+
+herr_t write_last_ingested_hour(hid_t file_id, int last_hour) {
+    hid_t attr_id;
+    if (H5Aexists(file_id, LAST_INGESTED_HOUR_ATTR) > 0) {
+        attr_id = H5Aopen(file_id, LAST_INGESTED_HOUR_ATTR, H5P_DEFAULT);
+    } else {
+        hid_t space_id = H5Screate(H5S_SCALAR);
+        attr_id = H5Acreate(file_id, LAST_INGESTED_HOUR_ATTR, H5T_NATIVE_INT, space_id, H5P_DEFAULT, H5P_DEFAULT);
+        H5Sclose(space_id);
+    }
+    if (attr_id < 0) {
+        return -1;
+    }
+    herr_t status = H5Awrite(attr_id, H5T_NATIVE_INT, &last_hour);
+    H5Aclose(attr_id);
+    return status;
+}
+
+static const char *CHECKPOINT_SCAN_ATTR = "scan";
+static const char *CHECKPOINT_BATCH_SIZE_ATTR = "batch_size";
+
+static herr_t write_int_attribute(hid_t obj_id, const char *name, int value) {
+    hid_t space_id = H5Screate(H5S_SCALAR);
+    hid_t attr_id = H5Acreate(obj_id, name, H5T_NATIVE_INT, space_id, H5P_DEFAULT, H5P_DEFAULT);
+    H5Sclose(space_id);
+    if (attr_id < 0) {
+        return -1;
+    }
+    herr_t status = H5Awrite(attr_id, H5T_NATIVE_INT, &value);
+    H5Aclose(attr_id);
+    return status;
+}
+
+static int read_int_attribute(hid_t obj_id, const char *name, int default_value) {
+    if (H5Aexists(obj_id, name) <= 0) {
+        return default_value;
+    }
+    hid_t attr_id = H5Aopen(obj_id, name, H5P_DEFAULT);
+    int value = default_value;
+    if (H5Aread(attr_id, H5T_NATIVE_INT, &value) < 0) {
+        value = default_value;
+    }
+    H5Aclose(attr_id);
+    return value;
+}
+
+static BatchCheckpoint* alloc_batch_checkpoint(hid_t file_id, hid_t dataset_id, int num_batches) {
+    BatchCheckpoint *cp = (BatchCheckpoint *)malloc(sizeof(BatchCheckpoint));
+    if (cp == NULL) {
+        perror("malloc failed");
+        return NULL;
+    }
+    cp->file_id = file_id;
+    cp->dataset_id = dataset_id;
+    cp->num_batches = num_batches;
+    cp->completed = (uint8_t *)calloc(num_batches > 0 ? num_batches : 1, sizeof(uint8_t));
+    cp->pending = (int *)malloc(sizeof(int) * (num_batches > 0 ? num_batches : 1));
+    cp->num_pending = 0;
+    if (cp->completed == NULL || cp->pending == NULL) {
+        perror("malloc failed");
+        free(cp->completed);
+        free(cp->pending);
+        free(cp);
+        return NULL;
+    }
+    return cp;
+}
+
+BatchCheckpoint* create_batch_checkpoint(hid_t file_id, int num_batches, int scan, int batch_size) {
+    hsize_t dims[1] = {(hsize_t)num_batches};
+    hid_t space_id = H5Screate_simple(1, dims, NULL);
+    hid_t plist_id = H5Pcreate(H5P_DATASET_CREATE);
+    uint8_t fill_value = 0;
+    H5Pset_fill_value(plist_id, H5T_NATIVE_UINT8, &fill_value);
+    H5Pset_alloc_time(plist_id, H5D_ALLOC_TIME_EARLY);
+    hid_t dataset_id = H5Dcreate(file_id, COMPLETED_BATCHES_DATASET, H5T_NATIVE_UINT8, space_id, H5P_DEFAULT, plist_id, H5P_DEFAULT);
+    H5Pclose(plist_id);
+    H5Sclose(space_id);
+    if (dataset_id < 0) {
+        fprintf(stderr, "Failed to create %s dataset\n", COMPLETED_BATCHES_DATASET);
+        return NULL;
+    }
+    if (write_int_attribute(dataset_id, CHECKPOINT_SCAN_ATTR, scan) < 0 ||
+        write_int_attribute(dataset_id, CHECKPOINT_BATCH_SIZE_ATTR, batch_size) < 0) {
+        fprintf(stderr, "Failed to write attributes of %s\n", COMPLETED_BATCHES_DATASET);
+        H5Dclose(dataset_id);
+        return NULL;
+    }
+    BatchCheckpoint *cp = alloc_batch_checkpoint(file_id, dataset_id, num_batches);
+    if (cp == NULL) {
+        H5Dclose(dataset_id);
+    }
+    return cp;
+}
+
+static bool has_batch_checkpoint(hid_t file_id) {
+    return H5Lexists(file_id, COMPLETED_BATCHES_DATASET, H5P_DEFAULT) > 0;
+}
+
+bool is_batch_checkpoint_complete(hid_t file_id) {
+    if (!has_batch_checkpoint(file_id)) {
+        return true;
+    }
+    hid_t dataset_id = H5Dopen(file_id, COMPLETED_BATCHES_DATASET, H5P_DEFAULT);
+    hid_t space_id = H5Dget_space(dataset_id);
+    hssize_t n = H5Sget_simple_extent_npoints(space_id);
+    H5Sclose(space_id);
+    uint8_t *completed = (uint8_t *)malloc(n > 0 ? (size_t)n : 1);
+    bool complete = completed != NULL &&
+                    (n == 0 || H5Dread(dataset_id, H5T_NATIVE_UINT8, H5S_ALL, H5S_ALL, H5P_DEFAULT, completed) >= 0);
+    for (hssize_t i = 0; complete && i < n; ++i) {
+        complete = completed[i] != 0;
+    }
+    free(completed);
+    H5Dclose(dataset_id);
+    return complete;
+}
+
+BatchCheckpoint* open_batch_checkpoint(hid_t file_id, int num_batches, int scan, int batch_size) {
+    if (!has_batch_checkpoint(file_id)) {
+        fprintf(stderr, "%s dataset not found\n", COMPLETED_BATCHES_DATASET);
+        return NULL;
+    }
+    hid_t dataset_id = H5Dopen(file_id, COMPLETED_BATCHES_DATASET, H5P_DEFAULT);
+    if (dataset_id < 0) {
+        return NULL;
+    }
+    hid_t space_id = H5Dget_space(dataset_id);
+    hsize_t dims[1];
+    H5Sget_simple_extent_dims(space_id, dims, NULL);
+    H5Sclose(space_id);
+    int saved_scan = read_int_attribute(dataset_id, CHECKPOINT_SCAN_ATTR, -1);
+    int saved_batch_size = read_int_attribute(dataset_id, CHECKPOINT_BATCH_SIZE_ATTR, -1);
+    if (dims[0] != (hsize_t)num_batches || saved_scan != scan || saved_batch_size != batch_size) {
+        fprintf(stderr, "Batch layout changed since the interrupted run (%llu batches, scan %d, size %d)\n",
+                (unsigned long long)dims[0], saved_scan, saved_batch_size);
+        H5Dclose(dataset_id);
+        return NULL;
+    }
+    BatchCheckpoint *cp = alloc_batch_checkpoint(file_id, dataset_id, num_batches);
+    if (cp == NULL) {
+        H5Dclose(dataset_id);
+        return NULL;
+    }
+    if (num_batches > 0 && H5Dread(dataset_id, H5T_NATIVE_UINT8, H5S_ALL, H5S_ALL, H5P_DEFAULT, cp->completed) < 0) {
+        fprintf(stderr, "Failed to read %s dataset\n", COMPLETED_BATCHES_DATASET);
+        close_batch_checkpoint(cp);
+        return NULL;
+    }
+    return cp;
+}
+
+void mark_batch_completed(BatchCheckpoint *cp, int batch_index) {
+    if (batch_index < 0 || batch_index >= cp->num_batches || cp->completed[batch_index]) {
+        return;
+    }
+    cp->completed[batch_index] = 1;
+    cp->pending[cp->num_pending++] = batch_index;
+}
+
+herr_t flush_batch_checkpoint(BatchCheckpoint *cp) {
+    if (cp->num_pending == 0) {
+        return H5Fflush(cp->file_id, H5F_SCOPE_LOCAL);
+    }
+    // 先にデータを永続化する
+    if (H5Fflush(cp->file_id, H5F_SCOPE_LOCAL) < 0) {
+        return -1;
+    }
+    hsize_t *coords = (hsize_t *)malloc(sizeof(hsize_t) * cp->num_pending);
+    uint8_t *ones = (uint8_t *)malloc(cp->num_pending);
+    if (coords == NULL || ones == NULL) {
+        perror("malloc failed");
+        free(coords);
+        free(ones);
+        return -1;
+    }
+    for (int i = 0; i < cp->num_pending; ++i) {
+        coords[i] = (hsize_t)cp->pending[i];
+        ones[i] = 1;
+    }
+    hsize_t count[1] = {(hsize_t)cp->num_pending};
+    hid_t memspace_id = H5Screate_simple(1, count, NULL);
+    hid_t filespace_id = H5Dget_space(cp->dataset_id);
+    H5Sselect_elements(filespace_id, H5S_SELECT_SET, (size_t)cp->num_pending, coords);
+    herr_t status = H5Dwrite(cp->dataset_id, H5T_NATIVE_UINT8, memspace_id, filespace_id, H5P_DEFAULT, ones);
+    H5Sclose(memspace_id);
+    H5Sclose(filespace_id);
+    free(coords);
+    free(ones);
+    if (status < 0) {
+        return -1;
+    }
+    cp->num_pending = 0;
+    return H5Fflush(cp->file_id, H5F_SCOPE_LOCAL);
+}
+
+int count_completed_batches(const BatchCheckpoint *cp) {
+    int n = 0;
+    for (int i = 0; i < cp->num_batches; ++i) {
+        n += cp->completed[i] != 0;
+    }
+    return n;
+}
+
+void close_batch_checkpoint(BatchCheckpoint *cp) {
+    if (cp == NULL) {
+        return;
+    }
+    H5Dclose(cp->dataset_id);
+    free(cp->completed);
+    free(cp->pending);
+    free(cp);
+}
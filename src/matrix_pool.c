@@ -0,0 +1,124 @@
+//
+// producer ごとに PQdataMatrix のデータ領域を使い回すプール
+//
+
+#include "matrix_pool.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+static size_t aligned_buffer_bytes(size_t buffer_bytes) {
+    size_t mapped_bytes = (buffer_bytes + MATRIX_POOL_ALIGN - 1) / MATRIX_POOL_ALIGN * MATRIX_POOL_ALIGN;
+    return mapped_bytes > 0 ? mapped_bytes : MATRIX_POOL_ALIGN;
+}
+
+MatrixPool *create_matrix_pool(size_t buffer_bytes, size_t max_cached) {
+    MatrixPool *pool = (MatrixPool *)malloc(sizeof(MatrixPool));
+    if (pool == NULL) {
+        perror("malloc failed");
+        return NULL;
+    }
+    pool->buffer_bytes = buffer_bytes;
+    pool->mapped_bytes = aligned_buffer_bytes(buffer_bytes);
+    pool->max_cached = max_cached;
+    atomic_init(&pool->mapped, 0);
+    atomic_init(&pool->reused, 0);
+    if (init_queue_with_capacity(&pool->free_list, max_cached > 0 ? max_cached : 1) != 0) {
+        free(pool);
+        return NULL;
+    }
+    return pool;
+}
+
+size_t matrix_pool_cached_for_budget(size_t budget, int num_producers, size_t buffer_bytes, size_t *pooled_bytes) {
+    size_t mapped_bytes = aligned_buffer_bytes(buffer_bytes);
+    size_t cached = MATRIX_POOL_MAX_CACHED;
+    if (budget > 0) {
+        cached = budget / MATRIX_POOL_BUDGET_SHARE / (size_t)num_producers / mapped_bytes;
+        if (cached > MATRIX_POOL_MAX_CACHED) {
+            cached = MATRIX_POOL_MAX_CACHED;
+        }
+        // free_list の容量は 2 のべき乗に切り上げられるので、超えないよう切り下げておく
+        while ((cached & (cached - 1)) != 0) {
+            cached &= cached - 1;
+        }
+    }
+    *pooled_bytes = budget > 0 ? cached * (size_t)num_producers * mapped_bytes : 0;
+    return cached;
+}
+
+// 2MiB 境界に揃えるため余分に確保し、前後の端数を返す
+static void *map_buffer(MatrixPool *pool) {
+    size_t len = pool->mapped_bytes + MATRIX_POOL_ALIGN;
+    char *raw = (char *)mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (raw == MAP_FAILED) {
+        perror("mmap failed");
+        return NULL;
+    }
+    uintptr_t aligned = ((uintptr_t)raw + MATRIX_POOL_ALIGN - 1) & ~(uintptr_t)(MATRIX_POOL_ALIGN - 1);
+    size_t head = aligned - (uintptr_t)raw;
+    size_t tail = len - head - pool->mapped_bytes;
+    if (head > 0) {
+        munmap(raw, head);
+    }
+    if (tail > 0) {
+        munmap((char *)aligned + pool->mapped_bytes, tail);
+    }
+#ifdef MADV_HUGEPAGE
+    madvise((void *)aligned, pool->mapped_bytes, MADV_HUGEPAGE);
+#endif
+    atomic_fetch_add_explicit(&pool->mapped, 1, memory_order_relaxed);
+    return (void *)aligned;
+}
+
+int matrix_pool_reserve(MatrixPool *pool, size_t n) {
+    if (n > pool->max_cached) {
+        n = pool->max_cached;
+    }
+    for (size_t i = 0; i < n; ++i) {
+        void *buffer = map_buffer(pool);
+        if (buffer == NULL) {
+            return -1;
+        }
+        // ここでページを割り当てさせる
+        memset(buffer, 0, pool->buffer_bytes);
+        if (!try_enqueue(&pool->free_list, buffer)) {
+            munmap(buffer, pool->mapped_bytes);
+            break;
+        }
+    }
+    return 0;
+}
+
+void *matrix_pool_get(MatrixPool *pool) {
+    void *buffer;
+    if (try_dequeue(&pool->free_list, &buffer)) {
+        atomic_fetch_add_explicit(&pool->reused, 1, memory_order_relaxed);
+        return buffer;
+    }
+    return map_buffer(pool);
+}
+
+void matrix_pool_put(MatrixPool *pool, void *buffer) {
+    if (buffer == NULL) {
+        return;
+    }
+    if (pool->max_cached == 0 || !try_enqueue(&pool->free_list, buffer)) {
+        munmap(buffer, pool->mapped_bytes);
+    }
+}
+
+void destroy_matrix_pool(MatrixPool *pool) {
+    if (pool == NULL) {
+        return;
+    }
+    void *buffer;
+    while (try_dequeue(&pool->free_list, &buffer)) {
+        munmap(buffer, pool->mapped_bytes);
+    }
+    destroy_queue(&pool->free_list);
+    free(pool);
+}
@@ -0,0 +1,493 @@
+//
+// 取り込み中に producer が行列から計算する、メッシュごとの日・月・年・チャンクの集計
+//
+// 日はロールアップのカーネルで行列から直接まとめ、月・年・チャンクは日の集計を足し合わせる。
+// 行列の先頭と末尾の区間は欠けていることがあり、追記では先頭の区間を書いてある値と合わせてから書く
+//
+
+#include "mesh_summary.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "chunk_codec.h"
+#include "hdf5_ops.h"
+#include "population_slab.h"
+
+#define SUMMARY_DEFLATE_LEVEL 4
+// population_data の時刻方向のチャンク (8760 時間) と同じ 365 日
+#define SUMMARY_DAY_CHUNK 365
+#define SUMMARY_MONTH_CHUNK 12
+#define SUMMARY_YEAR_CHUNK 16
+#define SUMMARY_CHUNK_CHUNK 16
+// build_mesh_summaries で一度に読む列数 (population_data のメッシュ方向のチャンク幅に切り上げる)
+#define SUMMARY_SLAB_COLS 1024
+
+// チャンクの区間は日の境目で切れる (月・年・チャンクを日から組み立てる)
+_Static_assert(SUMMARY_CHUNK_HOURS % 24 == 0, "SUMMARY_CHUNK_HOURS must be whole days");
+
+const char* summary_period_name(SummaryPeriod period) {
+    switch (period) {
+        case SUMMARY_PERIOD_DAY: return "day";
+        case SUMMARY_PERIOD_MONTH: return "month";
+        case SUMMARY_PERIOD_YEAR: return "year";
+        case SUMMARY_PERIOD_CHUNK: return "chunk";
+        default: return "unknown";
+    }
+}
+
+hsize_t summary_bucket_start(SummaryPeriod period, hsize_t bucket) {
+    switch (period) {
+        case SUMMARY_PERIOD_DAY: return rollup_bucket_start(ROLLUP_PERIOD_DAY, bucket);
+        case SUMMARY_PERIOD_MONTH: return rollup_bucket_start(ROLLUP_PERIOD_MONTH, bucket);
+        case SUMMARY_PERIOD_YEAR: return rollup_bucket_start(ROLLUP_PERIOD_YEAR, bucket);
+        case SUMMARY_PERIOD_CHUNK:
+        default: return bucket * SUMMARY_CHUNK_HOURS;
+    }
+}
+
+hsize_t summary_bucket_of(SummaryPeriod period, hsize_t hour) {
+    switch (period) {
+        case SUMMARY_PERIOD_DAY: return rollup_bucket_of(ROLLUP_PERIOD_DAY, hour);
+        case SUMMARY_PERIOD_MONTH: return rollup_bucket_of(ROLLUP_PERIOD_MONTH, hour);
+        case SUMMARY_PERIOD_YEAR: return rollup_bucket_of(ROLLUP_PERIOD_YEAR, hour);
+        case SUMMARY_PERIOD_CHUNK:
+        default: return hour / SUMMARY_CHUNK_HOURS;
+    }
+}
+
+const char* summary_stat_name(SummaryStat stat) {
+    switch (stat) {
+        case SUMMARY_STAT_SUM: return "sum";
+        case SUMMARY_STAT_MIN: return "min";
+        case SUMMARY_STAT_MAX: return "max";
+        case SUMMARY_STAT_COUNT: return "count";
+        default: return "unknown";
+    }
+}
+
+void mesh_summary_dataset_name(char *buf, size_t size, SummaryPeriod period, SummaryStat stat) {
+    snprintf(buf, size, "%s/%s_%s_%s", ROLLUP_GROUP, rollup_area_name(ROLLUP_AREA_MESH), summary_period_name(period),
+             summary_stat_name(stat));
+}
+
+static hid_t stat_type(SummaryStat stat) {
+    return stat == SUMMARY_STAT_SUM ? H5T_NATIVE_INT64 : H5T_NATIVE_INT32;
+}
+
+// rows 行を覆う区間の数
+static hsize_t bucket_count(SummaryPeriod period, hsize_t rows) {
+    return rows == 0 ? 0 : summary_bucket_of(period, rows - 1) + 1;
+}
+
+// 時刻 [time_start, time_start + rows) にかかる区間
+static void bucket_range(SummaryPeriod period, int rows, int time_start, hsize_t *first, hsize_t *count) {
+    if (rows <= 0) {
+        *first = 0;
+        *count = 0;
+        return;
+    }
+    *first = summary_bucket_of(period, (hsize_t)time_start);
+    *count = summary_bucket_of(period, (hsize_t)time_start + rows - 1) - *first + 1;
+}
+
+size_t mesh_summary_bytes(int rows, int cols, int time_start) {
+    size_t bytes = sizeof(MeshSummary);
+    for (int p = 0; p < NUM_SUMMARY_PERIODS; ++p) {
+        hsize_t first, count;
+        bucket_range((SummaryPeriod)p, rows, time_start, &first, &count);
+        bytes += (size_t)count * cols * (sizeof(int64_t) + 3 * sizeof(int32_t));
+    }
+    return bytes;
+}
+
+void free_mesh_summary(MeshSummary *s) {
+    if (s == NULL) {
+        return;
+    }
+    for (int p = 0; p < NUM_SUMMARY_PERIODS; ++p) {
+        free(s->sum[p]);
+        free(s->min[p]);
+        free(s->max[p]);
+        free(s->hours[p]);
+    }
+    free(s);
+}
+
+// row (width 列) に other を合わせる。min は 0 でない値の最小なので、値のない側は使わない
+static void merge_stats(int64_t *sum, int32_t *min, int32_t *max, int32_t *hours, const int64_t *other_sum,
+                        const int32_t *other_min, const int32_t *other_max, const int32_t *other_hours,
+                        size_t width) {
+    for (size_t j = 0; j < width; ++j) {
+        sum[j] += other_sum[j];
+        if (other_hours[j] > 0 && (hours[j] == 0 || other_min[j] < min[j])) {
+            min[j] = other_min[j];
+        }
+        max[j] = other_max[j] > max[j] ? other_max[j] : max[j];
+        hours[j] += other_hours[j];
+    }
+}
+
+MeshSummary* compute_mesh_summary(const int *data, size_t stride, int rows, int cols, int time_start) {
+    MeshSummary *s = (MeshSummary *)calloc(1, sizeof(MeshSummary));
+    if (s == NULL) {
+        perror("calloc failed");
+        return NULL;
+    }
+    s->cols = cols;
+    s->time_start = time_start;
+    s->bytes = mesh_summary_bytes(rows, cols, time_start);
+    for (int p = 0; p < NUM_SUMMARY_PERIODS; ++p) {
+        bucket_range((SummaryPeriod)p, rows, time_start, &s->first[p], &s->count[p]);
+        size_t n = (size_t)s->count[p] * cols;
+        s->sum[p] = (int64_t *)calloc(n > 0 ? n : 1, sizeof(int64_t));
+        s->min[p] = (int32_t *)calloc(n > 0 ? n : 1, sizeof(int32_t));
+        s->max[p] = (int32_t *)calloc(n > 0 ? n : 1, sizeof(int32_t));
+        s->hours[p] = (int32_t *)calloc(n > 0 ? n : 1, sizeof(int32_t));
+        if (s->sum[p] == NULL || s->min[p] == NULL || s->max[p] == NULL || s->hours[p] == NULL) {
+            perror("calloc failed");
+            free_mesh_summary(s);
+            return NULL;
+        }
+    }
+
+    // 日は行列の行から、月・年・チャンクは日から
+    const int day = SUMMARY_PERIOD_DAY;
+    hsize_t time_end = (hsize_t)time_start + (rows > 0 ? rows : 0);
+    for (hsize_t d = 0; d < s->count[day]; ++d) {
+        hsize_t begin = summary_bucket_start(SUMMARY_PERIOD_DAY, s->first[day] + d);
+        hsize_t end = begin + 24;
+        begin = begin > (hsize_t)time_start ? begin : (hsize_t)time_start;
+        end = end < time_end ? end : time_end;
+        size_t k = (size_t)d * cols;
+        rollup_reduce_stats(data + (size_t)(begin - time_start) * stride, stride, (size_t)(end - begin),
+                            (size_t)cols, s->sum[day] + k, s->min[day] + k, s->max[day] + k, s->hours[day] + k);
+
+        for (int p = SUMMARY_PERIOD_MONTH; p < NUM_SUMMARY_PERIODS; ++p) {
+            size_t pk = (size_t)(summary_bucket_of((SummaryPeriod)p, begin) - s->first[p]) * cols;
+            merge_stats(s->sum[p] + pk, s->min[p] + pk, s->max[p] + pk, s->hours[p] + pk,
+                        s->sum[day] + k, s->min[day] + k, s->max[day] + k, s->hours[day] + k, (size_t)cols);
+        }
+    }
+    return s;
+}
+
+// --- データセット ---
+
+hsize_t read_summary_rows(hid_t file_id) {
+    if (H5Lexists(file_id, ROLLUP_GROUP, H5P_DEFAULT) <= 0 ||
+        H5Aexists_by_name(file_id, ROLLUP_GROUP, SUMMARY_ROWS_ATTR, H5P_DEFAULT) <= 0) {
+        return 0;
+    }
+    hid_t attr_id = H5Aopen_by_name(file_id, ROLLUP_GROUP, SUMMARY_ROWS_ATTR, H5P_DEFAULT, H5P_DEFAULT);
+    unsigned long long rows = 0;
+    if (H5Aread(attr_id, H5T_NATIVE_ULLONG, &rows) < 0) {
+        rows = 0;
+    }
+    H5Aclose(attr_id);
+    return (hsize_t)rows;
+}
+
+static herr_t write_summary_rows(hid_t group_id, hsize_t rows) {
+    hid_t attr_id;
+    if (H5Aexists(group_id, SUMMARY_ROWS_ATTR) > 0) {
+        attr_id = H5Aopen(group_id, SUMMARY_ROWS_ATTR, H5P_DEFAULT);
+    } else {
+        hid_t space_id = H5Screate(H5S_SCALAR);
+        attr_id = H5Acreate(group_id, SUMMARY_ROWS_ATTR, H5T_NATIVE_ULLONG, space_id, H5P_DEFAULT, H5P_DEFAULT);
+        H5Sclose(space_id);
+    }
+    if (attr_id < 0) {
+        return -1;
+    }
+    unsigned long long value = rows;
+    herr_t status = H5Awrite(attr_id, H5T_NATIVE_ULLONG, &value);
+    H5Aclose(attr_id);
+    return status;
+}
+
+herr_t lower_summary_rows(hid_t file_id, hsize_t from) {
+    if (read_summary_rows(file_id) <= from) {
+        return 0;
+    }
+    hid_t group_id = H5Gopen(file_id, ROLLUP_GROUP, H5P_DEFAULT);
+    if (group_id < 0) {
+        return -1;
+    }
+    herr_t status = write_summary_rows(group_id, from);
+    H5Gclose(group_id);
+    return status;
+}
+
+bool has_mesh_summaries(hid_t file_id) {
+    char name[64];
+    mesh_summary_dataset_name(name, sizeof(name), SUMMARY_PERIOD_DAY, SUMMARY_STAT_COUNT);
+    return H5Lexists(file_id, ROLLUP_GROUP, H5P_DEFAULT) > 0 && H5Lexists(file_id, name, H5P_DEFAULT) > 0;
+}
+
+// ROLLUP_GROUP の下の mesh_<period>_<stat>。build_rollups が作った sum と max はそのまま使う
+static hid_t open_or_create_summary(hid_t group_id, SummaryPeriod period, SummaryStat stat, hsize_t rows,
+                                    hsize_t cols, hsize_t mesh_chunk) {
+    char name[32];
+    snprintf(name, sizeof(name), "%s_%s_%s", rollup_area_name(ROLLUP_AREA_MESH), summary_period_name(period),
+             summary_stat_name(stat));
+    hsize_t buckets = bucket_count(period, rows);
+    if (H5Lexists(group_id, name, H5P_DEFAULT) > 0) {
+        hid_t dataset_id = H5Dopen(group_id, name, H5P_DEFAULT);
+        if (dataset_id < 0) {
+            return H5I_INVALID_HID;
+        }
+        hid_t space_id = H5Dget_space(dataset_id);
+        hsize_t dims[2] = {0, 0};
+        H5Sget_simple_extent_dims(space_id, dims, NULL);
+        H5Sclose(space_id);
+        if (dims[1] != cols) {
+            fprintf(stderr, "%s/%s has %llu columns but population_data has %llu\n", ROLLUP_GROUP, name,
+                    (unsigned long long)dims[1], (unsigned long long)cols);
+            H5Dclose(dataset_id);
+            return H5I_INVALID_HID;
+        }
+        if (extend_time_axis(dataset_id, buckets) < 0) {
+            H5Dclose(dataset_id);
+            return H5I_INVALID_HID;
+        }
+        return dataset_id;
+    }
+    hsize_t dims[2] = {buckets, cols};
+    hsize_t max_dims[2] = {H5S_UNLIMITED, cols};
+    hid_t space_id = H5Screate_simple(2, dims, max_dims);
+    hid_t plist_id = H5Pcreate(H5P_DATASET_CREATE);
+    static const hsize_t time_chunks[NUM_SUMMARY_PERIODS] = {SUMMARY_DAY_CHUNK, SUMMARY_MONTH_CHUNK,
+                                                             SUMMARY_YEAR_CHUNK, SUMMARY_CHUNK_CHUNK};
+    hsize_t chunk_dims[2] = {time_chunks[period], mesh_chunk < cols ? mesh_chunk : (cols > 0 ? cols : 1)};
+    H5Pset_chunk(plist_id, 2, chunk_dims);
+    set_population_filters(plist_id, CHUNK_CODEC_DEFLATE, SUMMARY_DEFLATE_LEVEL);
+    hid_t dataset_id = H5Dcreate(group_id, name, stat_type(stat), space_id, H5P_DEFAULT, plist_id, H5P_DEFAULT);
+    H5Pclose(plist_id);
+    H5Sclose(space_id);
+    return dataset_id;
+}
+
+int open_summary_datasets(SummaryDatasets *d, hid_t file_id, hsize_t rows, hsize_t cols, hsize_t mesh_chunk,
+                          int time_start) {
+    d->group_id = H5I_INVALID_HID;
+    for (int p = 0; p < NUM_SUMMARY_PERIODS; ++p) {
+        for (int stat = 0; stat < NUM_SUMMARY_STATS; ++stat) {
+            d->dataset_id[p][stat] = H5I_INVALID_HID;
+        }
+    }
+    d->rows = rows;
+    d->merge_before = time_start;
+    // 途中で止まった追記の後は先頭の区間に同じ時間を二度足すことになるので続けない
+    if (time_start > 0 && (!has_mesh_summaries(file_id) || read_summary_rows(file_id) != (hsize_t)time_start)) {
+        return 1;
+    }
+    d->group_id = H5Lexists(file_id, ROLLUP_GROUP, H5P_DEFAULT) > 0
+                      ? H5Gopen(file_id, ROLLUP_GROUP, H5P_DEFAULT)
+                      : H5Gcreate(file_id, ROLLUP_GROUP, H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
+    if (d->group_id < 0) {
+        fprintf(stderr, "Failed to open the %s group\n", ROLLUP_GROUP);
+        return -1;
+    }
+    for (int p = 0; p < NUM_SUMMARY_PERIODS; ++p) {
+        for (int stat = 0; stat < NUM_SUMMARY_STATS; ++stat) {
+            d->dataset_id[p][stat] = open_or_create_summary(d->group_id, (SummaryPeriod)p, (SummaryStat)stat, rows,
+                                                            cols, mesh_chunk);
+            if (d->dataset_id[p][stat] < 0) {
+                char name[64];
+                mesh_summary_dataset_name(name, sizeof(name), (SummaryPeriod)p, (SummaryStat)stat);
+                fprintf(stderr, "Failed to open %s\n", name);
+                close_summary_datasets(d, 0);
+                return -1;
+            }
+        }
+    }
+    if (write_summary_rows(d->group_id, 0) < 0) {
+        close_summary_datasets(d, 0);
+        return -1;
+    }
+    return 0;
+}
+
+// 区間 [first, first + n) の runs の列と、buf (n x 列数、行優先) の間で読み書きする
+static herr_t transfer_rows(hid_t dataset_id, hid_t mem_type, hsize_t first, hsize_t n, hsize_t cols,
+                            const hsize_t (*runs)[2], int num_runs, void *buf, bool write) {
+    hsize_t mem_dims[2] = {n, cols};
+    hid_t mem_space = H5Screate_simple(2, mem_dims, NULL);
+    hid_t file_space = H5Dget_space(dataset_id);
+    for (int r = 0; r < num_runs; ++r) {
+        hsize_t offset[2] = {first, runs[r][0]};
+        hsize_t count[2] = {n, runs[r][1]};
+        H5Sselect_hyperslab(file_space, r == 0 ? H5S_SELECT_SET : H5S_SELECT_OR, offset, NULL, count, NULL);
+    }
+    herr_t status = write ? H5Dwrite(dataset_id, mem_type, mem_space, file_space, H5P_DEFAULT, buf)
+                          : H5Dread(dataset_id, mem_type, mem_space, file_space, H5P_DEFAULT, buf);
+    H5Sclose(file_space);
+    H5Sclose(mem_space);
+    return status;
+}
+
+// 追記の開始時刻をまたぐ先頭の区間に、前回までに書いた値を合わせる
+static herr_t merge_written_bucket(SummaryDatasets *d, MeshSummary *s, SummaryPeriod p, const hsize_t (*runs)[2],
+                                   int num_runs) {
+    size_t cols = (size_t)s->cols;
+    int64_t *sum = (int64_t *)malloc(sizeof(int64_t) * (cols > 0 ? cols : 1));
+    int32_t *stats = (int32_t *)malloc(sizeof(int32_t) * 3 * (cols > 0 ? cols : 1));
+    if (sum == NULL || stats == NULL) {
+        perror("malloc failed");
+        free(sum);
+        free(stats);
+        return -1;
+    }
+    int32_t *min = stats, *max = stats + cols, *hours = stats + 2 * cols;
+    herr_t status = transfer_rows(d->dataset_id[p][SUMMARY_STAT_SUM], H5T_NATIVE_INT64, s->first[p], 1, cols,
+                                  runs, num_runs, sum, false);
+    int32_t *bufs[3] = {min, max, hours};
+    for (int stat = SUMMARY_STAT_MIN; stat <= SUMMARY_STAT_COUNT && status >= 0; ++stat) {
+        status = transfer_rows(d->dataset_id[p][stat], H5T_NATIVE_INT32, s->first[p], 1, cols, runs, num_runs,
+                               bufs[stat - SUMMARY_STAT_MIN], false);
+    }
+    if (status >= 0) {
+        merge_stats(s->sum[p], s->min[p], s->max[p], s->hours[p], sum, min, max, hours, cols);
+    }
+    free(sum);
+    free(stats);
+    return status;
+}
+
+herr_t write_mesh_summary(SummaryDatasets *d, MeshSummary *s, const hsize_t (*runs)[2], int num_runs) {
+    for (int p = 0; p < NUM_SUMMARY_PERIODS; ++p) {
+        // 時間軸に合わせて行を余分に持つ行列の区間は、データセットの範囲だけを書く
+        hsize_t extent = bucket_count((SummaryPeriod)p, d->rows);
+        if (s->first[p] >= extent) {
+            continue;
+        }
+        hsize_t n = s->first[p] + s->count[p] <= extent ? s->count[p] : extent - s->first[p];
+        if (summary_bucket_start((SummaryPeriod)p, s->first[p]) < (hsize_t)d->merge_before &&
+            merge_written_bucket(d, s, (SummaryPeriod)p, runs, num_runs) < 0) {
+            return -1;
+        }
+        void *bufs[NUM_SUMMARY_STATS] = {s->sum[p], s->min[p], s->max[p], s->hours[p]};
+        for (int stat = 0; stat < NUM_SUMMARY_STATS; ++stat) {
+            if (transfer_rows(d->dataset_id[p][stat], stat_type((SummaryStat)stat), s->first[p], n,
+                              (hsize_t)s->cols, runs, num_runs, bufs[stat], true) < 0) {
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+herr_t close_summary_datasets(SummaryDatasets *d, hsize_t summary_rows) {
+    herr_t status = 0;
+    if (d->group_id >= 0 && summary_rows > 0) {
+        status = write_summary_rows(d->group_id, summary_rows);
+    }
+    for (int p = 0; p < NUM_SUMMARY_PERIODS; ++p) {
+        for (int stat = 0; stat < NUM_SUMMARY_STATS; ++stat) {
+            if (d->dataset_id[p][stat] >= 0) {
+                H5Dclose(d->dataset_id[p][stat]);
+                d->dataset_id[p][stat] = H5I_INVALID_HID;
+            }
+        }
+    }
+    if (d->group_id >= 0) {
+        H5Gclose(d->group_id);
+        d->group_id = H5I_INVALID_HID;
+    }
+    return status;
+}
+
+int build_mesh_summaries(hid_t file_id, hsize_t rows, int num_workers) {
+    hid_t src_id = H5Dopen(file_id, "population_data", H5P_DEFAULT);
+    if (src_id < 0) {
+        fprintf(stderr, "Failed to open population_data dataset\n");
+        return -1;
+    }
+    hid_t space_id = H5Dget_space(src_id);
+    hsize_t dims[2];
+    H5Sget_simple_extent_dims(space_id, dims, NULL);
+    H5Sclose(space_id);
+    if (rows > dims[0]) {
+        rows = dims[0];
+    }
+    hsize_t cols = dims[1];
+    hsize_t src_chunk[2] = {0, 0};
+    hid_t plist_id = H5Dget_create_plist(src_id);
+    bool chunked = H5Pget_layout(plist_id) == H5D_CHUNKED;
+    if (chunked) {
+        H5Pget_chunk(plist_id, 2, src_chunk);
+    }
+    H5Pclose(plist_id);
+    hsize_t slab_rows = chunked ? src_chunk[0] : SUMMARY_CHUNK_HOURS;
+    hsize_t slab_cols = chunked ? (SUMMARY_SLAB_COLS + src_chunk[1] - 1) / src_chunk[1] * src_chunk[1]
+                                : SUMMARY_SLAB_COLS;
+    hsize_t mesh_chunk = chunked ? src_chunk[1] : 16;
+
+    hsize_t done = read_summary_rows(file_id);
+    if (done >= rows || cols == 0) {
+        H5Dclose(src_id);
+        return 0;
+    }
+    SummaryDatasets d;
+    int status = open_summary_datasets(&d, file_id, rows, cols, mesh_chunk, (int)done);
+    if (status == 1) {
+        done = 0;
+        status = open_summary_datasets(&d, file_id, rows, cols, mesh_chunk, 0);
+    }
+    if (status != 0) {
+        H5Dclose(src_id);
+        return -1;
+    }
+    PopulationSlab slab;
+    status = open_population_slab(&slab, src_id, rows, slab_rows, slab_cols, num_workers);
+    // 時刻のスラブを順に進め、前のスラブから続く月やチャンクの区間は書いた値と合わせる
+    for (hsize_t t = done / slab_rows * slab_rows; t < rows && status == 0; t += slab_rows) {
+        hsize_t begin = t > done ? t : done;
+        d.merge_before = (int)begin;
+        for (hsize_t c = 0; c < cols && status == 0; c += slab_cols) {
+            if (read_population_slab(&slab, t, c) != 0) {
+                fprintf(stderr, "Failed to read population_data at hour %llu\n", (unsigned long long)t);
+                status = -1;
+                break;
+            }
+            MeshSummary *s = compute_mesh_summary(slab.data + (begin - t) * slab_cols, (size_t)slab_cols,
+                                                  (int)(slab.height - (begin - t)), (int)slab.width, (int)begin);
+            hsize_t runs[1][2] = {{c, slab.width}};
+            if (s == NULL || write_mesh_summary(&d, s, (const hsize_t (*)[2])runs, 1) < 0) {
+                status = -1;
+            }
+            free_mesh_summary(s);
+        }
+    }
+    close_population_slab(&slab);
+    // データを永続化してから集計し終えた行数を記録する
+    if (status == 0 && H5Fflush(file_id, H5F_SCOPE_LOCAL) < 0) {
+        status = -1;
+    }
+    if (close_summary_datasets(&d, status == 0 ? rows : 0) < 0) {
+        status = -1;
+    }
+    H5Dclose(src_id);
+    return status;
+}
+
+herr_t read_mesh_summary(hid_t file_id, SummaryPeriod period, SummaryStat stat, hsize_t column, hsize_t first,
+                         hsize_t count, int64_t *out) {
+    char name[64];
+    mesh_summary_dataset_name(name, sizeof(name), period, stat);
+    if (H5Lexists(file_id, ROLLUP_GROUP, H5P_DEFAULT) <= 0 || H5Lexists(file_id, name, H5P_DEFAULT) <= 0) {
+        fprintf(stderr, "%s dataset is missing\n", name);
+        return -1;
+    }
+    hid_t dataset_id = H5Dopen(file_id, name, H5P_DEFAULT);
+    if (dataset_id < 0) {
+        return -1;
+    }
+    hsize_t run[1][2] = {{column, 1}};
+    herr_t status = transfer_rows(dataset_id, H5T_NATIVE_INT64, first, count, 1, run, 1, out, false);
+    H5Dclose(dataset_id);
+    return status;
+}
@@ -251,3 +251,15 @@ int * get_all_meshes_in_1st_mesh(int meshid_1, int NUM_MESHES) {
     }
     return mesh_ids;
 }
+
+int keep_populated_meshes(cmph_t *hash, int *mesh_ids, int n) {
+    // MPH は登録していないキーにも何かの位置を返すので、その位置のメッシュIDと照らし合わせる
+    int kept = 0;
+    for (int i = 0; i < n; ++i) {
+        uint32_t id = search_id(hash, (uint32_t)mesh_ids[i]);
+        if (id < meshid_list_size && meshid_list[id] == (uint32_t)mesh_ids[i]) {
+            mesh_ids[kept++] = mesh_ids[i];
+        }
+    }
+    return kept;
+}
@@ -0,0 +1,1340 @@
+//
+// PostgreSQL から population データを取得して PQdataMatrix に展開する処理
+//
+
+#include "pg_ingest.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <arpa/inet.h>
+
+#include "meshid_ops.h"
+
+static const char *DEFAULT_SOURCE_TABLE = "population_00000";
+
+// 取得元テーブルごとに prepared statement を作る (名前の末尾にテーブル番号を付ける)
+static const char *SELECT_STMT_NAME = "select_population";
+static const char *SELECT_QUERY_FORMAT =
+    "SELECT mesh_id, datetime, population FROM %s WHERE mesh_id = ANY($1)%s ORDER BY datetime";
+
+// レンジスキャン用。行は集約先の列に直接書き込むので並び替えは不要
+static const char *SELECT_RANGE_STMT_NAME = "select_population_range";
+static const char *SELECT_RANGE_QUERY_FORMAT =
+    "SELECT mesh_id, datetime, population FROM %s WHERE mesh_id BETWEEN $1 AND $2%s";
+
+// COPY はパラメータを受け取れないので配列リテラルをクエリに埋め込む。並び替えは不要
+static const char *COPY_QUERY_HEAD_FORMAT =
+    "COPY (SELECT mesh_id, datetime, population FROM %s WHERE mesh_id = ANY('{";
+static const char *COPY_QUERY_TAIL_FORMAT = "}'::integer[])%s) TO STDOUT (FORMAT binary)";
+static const char *COPY_RANGE_QUERY_FORMAT =
+    "COPY (SELECT mesh_id, datetime, population FROM %s WHERE mesh_id BETWEEN %u AND %u%s) "
+    "TO STDOUT (FORMAT binary)";
+
+// 親テーブル配下の実データを持つテーブル (継承の子・パーティションを再帰的に) を列挙する。
+// 各テーブルは ONLY で参照するので、自身も行を持つ継承の親を重複して数えることはない
+static const char *DISCOVER_TABLES_QUERY =
+    "WITH RECURSIVE tree(relid) AS ("
+    " SELECT $1::regclass::oid"
+    " UNION ALL"
+    " SELECT i.inhrelid FROM pg_inherits i JOIN tree t ON i.inhparent = t.relid)"
+    " SELECT 'ONLY ' || c.oid::regclass::text FROM tree t JOIN pg_class c ON c.oid = t.relid"
+    " WHERE c.relkind = 'r' ORDER BY c.relname";
+
+static const char *CANONICAL_TABLE_QUERY = "SELECT $1::regclass::text";
+
+static const char *LATEST_DATETIME_QUERY_FORMAT = "SELECT max(datetime) FROM %s";
+
+// " AND datetime >= 'YYYY-MM-DD HH:MM:SS'" の最大長
+#define TIME_FILTER_LEN 48
+
+static const char PGCOPY_SIGNATURE[11] = "PGCOPY\n\377\r\n";
+
+// pg_type.h の OID (クライアント側では catalog ヘッダを参照できないため定義しておく)
+#define INT4OID 23
+#define INT4ARRAYOID 1007
+
+int parse_ingest_scan(const char *name) {
+    if (name == NULL || name[0] == '\0' || strcmp(name, "list") == 0) {
+        return INGEST_SCAN_LIST;
+    }
+    if (strcmp(name, "range") == 0) {
+        return INGEST_SCAN_RANGE;
+    }
+    return -1;
+}
+
+int parse_ingest_mode(const char *name) {
+    if (name == NULL || name[0] == '\0' || strcmp(name, "exec") == 0) {
+        return INGEST_MODE_EXEC;
+    }
+    if (strcmp(name, "copy") == 0) {
+        return INGEST_MODE_COPY;
+    }
+    if (strcmp(name, "rows") == 0) {
+        return INGEST_MODE_ROWS;
+    }
+    return -1;
+}
+
+const char * ingest_mode_name(IngestMode mode) {
+    switch (mode) {
+        case INGEST_MODE_EXEC: return "exec";
+        case INGEST_MODE_COPY: return "copy";
+        case INGEST_MODE_ROWS: return "rows";
+    }
+    return "unknown";
+}
+
+bool load_ingest_options(IngestOptions *opts) {
+    const char *mode_str = getenv("MOBAKU_INGEST_MODE");
+    int mode = parse_ingest_mode(mode_str);
+    if (mode < 0) {
+        fprintf(stderr, "Unknown MOBAKU_INGEST_MODE: %s\n", mode_str);
+        return false;
+    }
+    opts->mode = (IngestMode)mode;
+
+    opts->chunk_rows = DEFAULT_INGEST_CHUNK_ROWS;
+    const char *chunk_str = getenv("MOBAKU_INGEST_CHUNK_ROWS");
+    if (chunk_str != NULL && chunk_str[0] != '\0') {
+        opts->chunk_rows = atoi(chunk_str);
+        if (opts->chunk_rows <= 0) {
+            fprintf(stderr, "Invalid MOBAKU_INGEST_CHUNK_ROWS: %s\n", chunk_str);
+            return false;
+        }
+    }
+
+    opts->pipeline_depth = 1;
+    const char *depth_str = getenv("MOBAKU_INGEST_PIPELINE_DEPTH");
+    if (depth_str != NULL && depth_str[0] != '\0') {
+        opts->pipeline_depth = atoi(depth_str);
+        if (opts->pipeline_depth <= 0) {
+            fprintf(stderr, "Invalid MOBAKU_INGEST_PIPELINE_DEPTH: %s\n", depth_str);
+            return false;
+        }
+        if (opts->pipeline_depth > MAX_INGEST_PIPELINE_DEPTH) {
+            fprintf(stderr, "MOBAKU_INGEST_PIPELINE_DEPTH is limited to %d\n", MAX_INGEST_PIPELINE_DEPTH);
+            opts->pipeline_depth = MAX_INGEST_PIPELINE_DEPTH;
+        }
+    }
+    const char *scan_str = getenv("MOBAKU_INGEST_SCAN");
+    int scan = parse_ingest_scan(scan_str);
+    if (scan < 0) {
+        fprintf(stderr, "Unknown MOBAKU_INGEST_SCAN: %s\n", scan_str);
+        return false;
+    }
+    opts->scan = (IngestScan)scan;
+
+    opts->range_meshes = DEFAULT_INGEST_RANGE_MESHES;
+    const char *range_str = getenv("MOBAKU_INGEST_RANGE_MESHES");
+    if (range_str != NULL && range_str[0] != '\0') {
+        opts->range_meshes = atoi(range_str);
+        if (opts->range_meshes <= 0) {
+            fprintf(stderr, "Invalid MOBAKU_INGEST_RANGE_MESHES: %s\n", range_str);
+            return false;
+        }
+    }
+
+    if (opts->pipeline_depth > 1 && opts->mode == INGEST_MODE_COPY) {
+        fprintf(stderr, "MOBAKU_INGEST_PIPELINE_DEPTH is ignored in copy mode\n");
+        opts->pipeline_depth = 1;
+    }
+
+    // 取得元テーブル (カンマ区切り)。resolve_source_tables で正規化される
+    opts->tables = NULL;
+    opts->num_tables = 0;
+    const char *tables_str = getenv("MOBAKU_SOURCE_TABLES");
+    if (tables_str == NULL || tables_str[0] == '\0') {
+        tables_str = DEFAULT_SOURCE_TABLE;
+    }
+    char *tables_copy = strdup(tables_str);
+    if (tables_copy == NULL) {
+        perror("strdup failed");
+        return false;
+    }
+    char *saveptr = NULL;
+    for (char *tok = strtok_r(tables_copy, ", \t", &saveptr); tok != NULL; tok = strtok_r(NULL, ", \t", &saveptr)) {
+        char **tables = (char **)realloc(opts->tables, sizeof(char *) * (opts->num_tables + 1));
+        if (tables == NULL) {
+            perror("realloc failed");
+            free(tables_copy);
+            return false;
+        }
+        opts->tables = tables;
+        opts->tables[opts->num_tables++] = strdup(tok);
+    }
+    free(tables_copy);
+    if (opts->num_tables == 0) {
+        fprintf(stderr, "MOBAKU_SOURCE_TABLES is empty\n");
+        return false;
+    }
+
+    opts->time_start = 0;
+
+    // 1 ならチャンク境界に揃ったバッチを H5Dwrite_chunk で書き込む
+    const char *direct_str = getenv("MOBAKU_INGEST_DIRECT_CHUNK");
+    opts->direct_chunk = direct_str != NULL && atoi(direct_str) != 0;
+
+    const char *codec_str = getenv("MOBAKU_INGEST_COMPRESSION");
+    int codec = parse_chunk_codec(codec_str);
+    if (codec < 0) {
+        fprintf(stderr, "Unknown MOBAKU_INGEST_COMPRESSION: %s\n", codec_str);
+        return false;
+    }
+    opts->compression = (ChunkCodec)codec;
+    int min_level = 0;
+    int max_level = 0;
+    opts->compression_level = 0;
+    bool has_level = chunk_codec_level_range(opts->compression, &opts->compression_level, &min_level, &max_level);
+    const char *level_str = getenv("MOBAKU_INGEST_COMPRESSION_LEVEL");
+    if (has_level && level_str != NULL && level_str[0] != '\0') {
+        opts->compression_level = atoi(level_str);
+        if (opts->compression_level < min_level || opts->compression_level > max_level) {
+            fprintf(stderr, "MOBAKU_INGEST_COMPRESSION_LEVEL must be %d-%d for %s: %s\n", min_level, max_level,
+                    chunk_codec_name(opts->compression), level_str);
+            return false;
+        }
+    }
+    if (chunk_codec_in_producer(opts->compression)) {
+        // 圧縮済みのチャンクは H5Dwrite_chunk でしか渡せない
+        if (opts->compression != CHUNK_CODEC_NONE) {
+            opts->direct_chunk = true;
+        }
+    } else if (opts->direct_chunk) {
+        // H5Dwrite_chunk ではフィルタが掛からないので、HDF5 に圧縮させる
+        fprintf(stderr, "MOBAKU_INGEST_DIRECT_CHUNK is ignored with %s compression\n",
+                chunk_codec_name(opts->compression));
+        opts->direct_chunk = false;
+    }
+
+    // 未設定なら物理メモリの半分、0 なら無制限
+    opts->memory_budget = default_memory_budget();
+    const char *budget_str = getenv("MOBAKU_MEMORY_BUDGET_MB");
+    if (budget_str != NULL && budget_str[0] != '\0') {
+        char *end;
+        long long mb = strtoll(budget_str, &end, 10);
+        if (*end != '\0' || mb < 0) {
+            fprintf(stderr, "MOBAKU_MEMORY_BUDGET_MB must be a non-negative integer: %s\n", budget_str);
+            return false;
+        }
+        opts->memory_budget = (size_t)mb * 1024 * 1024;
+    }
+
+    opts->num_producers = DEFAULT_INGEST_PRODUCERS;
+    const char *producers_str = getenv("MOBAKU_PRODUCERS");
+    if (producers_str != NULL && producers_str[0] != '\0') {
+        opts->num_producers = atoi(producers_str);
+        if (opts->num_producers < 1 || opts->num_producers > MAX_INGEST_PRODUCERS) {
+            fprintf(stderr, "MOBAKU_PRODUCERS must be 1-%d: %s\n", MAX_INGEST_PRODUCERS, producers_str);
+            return false;
+        }
+    }
+
+    opts->list_meshes = DEFAULT_INGEST_LIST_MESHES;
+    const char *list_str = getenv("MOBAKU_INGEST_LIST_MESHES");
+    if (list_str != NULL && list_str[0] != '\0') {
+        opts->list_meshes = atoi(list_str);
+        if (opts->list_meshes <= 0) {
+            fprintf(stderr, "Invalid MOBAKU_INGEST_LIST_MESHES: %s\n", list_str);
+            return false;
+        }
+    }
+
+    opts->queue_depth = 0;
+    const char *queue_str = getenv("MOBAKU_QUEUE_DEPTH");
+    if (queue_str != NULL && queue_str[0] != '\0') {
+        long long depth = atoll(queue_str);
+        if (depth <= 0) {
+            fprintf(stderr, "Invalid MOBAKU_QUEUE_DEPTH: %s\n", queue_str);
+            return false;
+        }
+        opts->queue_depth = (size_t)depth;
+    }
+
+    // 1 なら producer が日と月の集計を計算し、consumer が population_data と一緒に書く
+    const char *summaries_str = getenv("MOBAKU_INGEST_SUMMARIES");
+    opts->summaries = summaries_str != NULL && atoi(summaries_str) != 0;
+
+    const char *parent_str = getenv("MOBAKU_SOURCE_PARENT");
+    opts->source_parent = (parent_str != NULL && parent_str[0] != '\0') ? strdup(parent_str) : NULL;
+    return true;
+}
+
+int ingest_batch_meshes(const IngestOptions *opts) {
+    return opts->scan == INGEST_SCAN_RANGE ? opts->range_meshes : opts->list_meshes;
+}
+
+static void clear_source_tables(IngestOptions *opts) {
+    for (int i = 0; i < opts->num_tables; ++i) {
+        free(opts->tables[i]);
+    }
+    free(opts->tables);
+    opts->tables = NULL;
+    opts->num_tables = 0;
+}
+
+void free_ingest_options(IngestOptions *opts) {
+    clear_source_tables(opts);
+    free(opts->source_parent);
+    opts->source_parent = NULL;
+}
+
+int resolve_source_tables(const char *conninfo, IngestOptions *opts) {
+    PGconn *conn = PQconnectdb(conninfo);
+    if (PQstatus(conn) != CONNECTION_OK) {
+        fprintf(stderr, "Connection to database failed: %s\n", PQerrorMessage(conn));
+        PQfinish(conn);
+        return -1;
+    }
+
+    if (opts->source_parent != NULL) {
+        const char *paramValues[1] = {opts->source_parent};
+        PGresult *res = PQexecParams(conn, DISCOVER_TABLES_QUERY, 1, NULL, paramValues, NULL, NULL, 0);
+        if (PQresultStatus(res) != PGRES_TUPLES_OK || PQntuples(res) == 0) {
+            fprintf(stderr, "Failed to discover tables under %s: %s\n", opts->source_parent, PQerrorMessage(conn));
+            PQclear(res);
+            PQfinish(conn);
+            return -1;
+        }
+        clear_source_tables(opts);
+        int n = PQntuples(res);
+        opts->tables = (char **)malloc(sizeof(char *) * n);
+        if (opts->tables == NULL) {
+            perror("malloc failed");
+            PQclear(res);
+            PQfinish(conn);
+            return -1;
+        }
+        for (int i = 0; i < n; ++i) {
+            opts->tables[i] = strdup(PQgetvalue(res, i, 0));
+        }
+        opts->num_tables = n;
+        PQclear(res);
+    } else {
+        // 設定された名前をクォート済みの正規形にする (存在しなければここでエラーになる)
+        for (int i = 0; i < opts->num_tables; ++i) {
+            const char *paramValues[1] = {opts->tables[i]};
+            PGresult *res = PQexecParams(conn, CANONICAL_TABLE_QUERY, 1, NULL, paramValues, NULL, NULL, 0);
+            if (PQresultStatus(res) != PGRES_TUPLES_OK) {
+                fprintf(stderr, "Unknown source table %s: %s\n", opts->tables[i], PQerrorMessage(conn));
+                PQclear(res);
+                PQfinish(conn);
+                return -1;
+            }
+            free(opts->tables[i]);
+            opts->tables[i] = strdup(PQgetvalue(res, 0, 0));
+            PQclear(res);
+        }
+    }
+    PQfinish(conn);
+    return opts->num_tables;
+}
+
+int query_latest_time_index(const char *conninfo, const IngestOptions *opts) {
+    PGconn *conn = PQconnectdb(conninfo);
+    if (PQstatus(conn) != CONNECTION_OK) {
+        fprintf(stderr, "Connection to database failed: %s\n", PQerrorMessage(conn));
+        PQfinish(conn);
+        return -2;
+    }
+    int latest = -1;
+    for (int t = 0; t < opts->num_tables; ++t) {
+        size_t query_size = strlen(LATEST_DATETIME_QUERY_FORMAT) + strlen(opts->tables[t]) + 1;
+        char *query = (char *)malloc(query_size);
+        if (query == NULL) {
+            perror("malloc failed");
+            PQfinish(conn);
+            return -2;
+        }
+        snprintf(query, query_size, LATEST_DATETIME_QUERY_FORMAT, opts->tables[t]);
+        // タイムスタンプはバイナリ形式で受け取り、行の展開と同じ変換で時刻インデックスにする
+        PGresult *res = PQexecParams(conn, query, 0, NULL, NULL, NULL, NULL, 1);
+        free(query);
+        if (PQresultStatus(res) != PGRES_TUPLES_OK) {
+            fprintf(stderr, "Failed to query latest datetime of %s: %s\n", opts->tables[t], PQerrorMessage(conn));
+            PQclear(res);
+            PQfinish(conn);
+            return -2;
+        }
+        if (!PQgetisnull(res, 0, 0)) {
+            time_t datetime_jst = pg_bin_timestamp_to_jst(PQgetvalue(res, 0, 0), PQgetlength(res, 0, 0));
+            int time_index = get_time_index_mobaku_datetime_from_time(datetime_jst);
+            if (time_index > latest) {
+                latest = time_index;
+            }
+        }
+        PQclear(res);
+    }
+    PQfinish(conn);
+    return latest;
+}
+
+// time_start 以降の行だけを取得する条件を buf に書く。time_start が 0 なら空文字列
+static void build_time_filter(char *buf, size_t size, int time_start) {
+    buf[0] = '\0';
+    if (time_start <= 0) {
+        return;
+    }
+    // datetime は JST の timestamp として格納されている
+    time_t naive_jst = REFERENCE_MOBAKU_TIME + JST_OFFSET_SEC + (time_t)time_start * 3600;
+    struct tm tm;
+    gmtime_r(&naive_jst, &tm);
+    char datetime_str[32];
+    strftime(datetime_str, sizeof(datetime_str), "%Y-%m-%d %H:%M:%S", &tm);
+    snprintf(buf, size, " AND datetime >= '%s'", datetime_str);
+}
+
+static PQdataMatrix *new_pqdata_matrix(int rows, int cols, uint32_t meshid_start) {
+    PQdataMatrix *m = (PQdataMatrix *)malloc(sizeof(PQdataMatrix));
+    if (m == NULL) {
+        perror("malloc failed");
+        return NULL;
+    }
+    m->rows = rows;
+    m->cols = cols; // 取得するデータ数（mesh_idの数）
+    m->meshid_start = meshid_start;
+    m->columns = NULL;
+    m->time_start = 0;
+    m->last_time_index = -1;
+    m->batch_index = -1;
+    m->chunk_order = false;
+    m->filtered = NULL;
+    m->filtered_sizes = NULL;
+    m->budget = NULL;
+    m->budget_bytes = 0;
+    m->pool = NULL;
+    m->summary = NULL;
+    m->data = NULL;
+    return m;
+}
+
+PQdataMatrix * alloc_pqdata_matrix(int rows, int cols, uint32_t meshid_start) {
+    PQdataMatrix *m = new_pqdata_matrix(rows, cols, meshid_start);
+    if (m == NULL) {
+        return NULL;
+    }
+    m->data = (int *)calloc((size_t)rows * cols, sizeof(int));
+    if (m->data == NULL) {
+        perror("calloc failed");
+        free(m);
+        return NULL;
+    }
+    return m;
+}
+
+PQdataMatrix * alloc_pooled_pqdata_matrix(MatrixPool *pool, int rows, int cols, uint32_t meshid_start) {
+    size_t bytes = (size_t)rows * cols * sizeof(int);
+    if (pool == NULL || bytes > pool->buffer_bytes) {
+        return alloc_pqdata_matrix(rows, cols, meshid_start);
+    }
+    PQdataMatrix *m = new_pqdata_matrix(rows, cols, meshid_start);
+    if (m == NULL) {
+        return NULL;
+    }
+    m->data = (int *)matrix_pool_get(pool);
+    if (m->data == NULL) {
+        free(m);
+        return NULL;
+    }
+    m->pool = pool;
+    memset(m->data, 0, bytes);
+    return m;
+}
+
+// data をプールまたはヒープに返す
+static void release_matrix_data(PQdataMatrix *m) {
+    if (m->pool != NULL) {
+        matrix_pool_put(m->pool, m->data);
+    } else {
+        free(m->data);
+    }
+    m->data = NULL;
+}
+
+int* alloc_column_range(int start, int n) {
+    int *columns = (int *)malloc(sizeof(int) * n);
+    if (columns == NULL) {
+        perror("malloc failed");
+        return NULL;
+    }
+    for (int j = 0; j < n; ++j) {
+        columns[j] = start + j;
+    }
+    return columns;
+}
+
+bool pqdata_matrix_chunk_aligned(const PQdataMatrix *m, int time_chunk, int mesh_chunk) {
+    if (m->columns == NULL || m->cols % mesh_chunk != 0 || m->rows % time_chunk != 0 ||
+        m->time_start % time_chunk != 0 || m->columns[0] % mesh_chunk != 0) {
+        return false;
+    }
+    for (int j = 1; j < m->cols; ++j) {
+        if (m->columns[j] != m->columns[0] + j) {
+            return false;
+        }
+    }
+    return true;
+}
+
+int layout_chunk_order(PQdataMatrix *m, int time_chunk, int mesh_chunk) {
+    if (!pqdata_matrix_chunk_aligned(m, time_chunk, mesh_chunk)) {
+        return 0;
+    }
+    // 列数がチャンク幅と同じなら行優先の並びがそのままチャンク順になっている
+    if (m->cols == mesh_chunk) {
+        m->chunk_order = true;
+        return 0;
+    }
+    // 並べ替え先も同じプールから取る (大きさは元と同じ)
+    int *chunked = m->pool != NULL ? (int *)matrix_pool_get(m->pool)
+                                   : (int *)malloc(sizeof(int) * (size_t)m->rows * m->cols);
+    if (chunked == NULL) {
+        perror("malloc failed");
+        return -1;
+    }
+    size_t k = 0;
+    for (int tc = 0; tc < m->rows; tc += time_chunk) {
+        for (int mc = 0; mc < m->cols; mc += mesh_chunk) {
+            for (int t = tc; t < tc + time_chunk; ++t) {
+                memcpy(chunked + k, m->data + (size_t)t * m->cols + mc, sizeof(int) * mesh_chunk);
+                k += mesh_chunk;
+            }
+        }
+    }
+    release_matrix_data(m);
+    m->data = chunked;
+    m->chunk_order = true;
+    return 0;
+}
+
+int compress_pqdata_chunks(PQdataMatrix *m, int time_chunk, int mesh_chunk, ChunkCodec codec, int level) {
+    if (!m->chunk_order || codec == CHUNK_CODEC_NONE) {
+        return 0;
+    }
+    size_t chunk_bytes = (size_t)time_chunk * mesh_chunk * sizeof(int);
+    size_t num_chunks = (size_t)m->rows * m->cols * sizeof(int) / chunk_bytes;
+    size_t bound = chunk_codec_bound(codec, chunk_bytes);
+    unsigned char *filtered = (unsigned char *)malloc(bound * num_chunks);
+    size_t *sizes = (size_t *)malloc(sizeof(size_t) * num_chunks);
+    void *scratch = malloc(chunk_bytes);
+    if (filtered == NULL || sizes == NULL || scratch == NULL) {
+        perror("malloc failed");
+        free(filtered);
+        free(sizes);
+        free(scratch);
+        return -1;
+    }
+    size_t pos = 0;
+    for (size_t c = 0; c < num_chunks; ++c) {
+        const char *src = (const char *)m->data + c * chunk_bytes;
+        // 値のないチャンクは圧縮せず、書き込み側で確保しないまま残す
+        if (chunk_is_zero(src, chunk_bytes)) {
+            sizes[c] = 0;
+            continue;
+        }
+        if (encode_chunk(codec, level, src, chunk_bytes, sizeof(int), (size_t)mesh_chunk, scratch,
+                         filtered + pos, &sizes[c]) != 0) {
+            free(filtered);
+            free(sizes);
+            free(scratch);
+            return -1;
+        }
+        pos += sizes[c];
+    }
+    free(scratch);
+    // 圧縮後の大きさまで縮め、元のデータは consumer に渡す前に解放する
+    unsigned char *shrunk = (unsigned char *)realloc(filtered, pos > 0 ? pos : 1);
+    m->filtered = shrunk != NULL ? shrunk : filtered;
+    m->filtered_sizes = sizes;
+    release_matrix_data(m);
+    // 縮んだ分は予算に返す
+    size_t kept = pos + sizeof(size_t) * num_chunks + (m->summary != NULL ? m->summary->bytes : 0);
+    if (m->budget != NULL && kept < m->budget_bytes) {
+        byte_budget_release(m->budget, m->budget_bytes - kept);
+        m->budget_bytes = kept;
+    }
+    return 0;
+}
+
+void free_pqdata_matrix(void *data) {
+    PQdataMatrix *m = (PQdataMatrix *)data;
+    release_matrix_data(m);
+    free(m->filtered);
+    free(m->filtered_sizes);
+    free(m->columns);
+    free_mesh_summary(m->summary);
+    if (m->budget != NULL) {
+        byte_budget_release(m->budget, m->budget_bytes);
+    }
+    free(m);
+}
+
+void free_meshid_list(void *data) {
+    MeshidList *ml = (MeshidList *)data;
+    free(ml->meshid_list);
+    free(ml->columns);
+    free(ml);
+}
+
+// 展開先の行列と、mesh_id から列を引くためのハッシュ
+typedef struct {
+    PQdataMatrix *m;
+    cmph_t *local_hash;
+    // レンジスキャンでは範囲内の対象外メッシュも返ってくるので、ハッシュの結果をこれで照合する
+    const uint32_t *verify_keys;
+} ScatterTarget;
+
+// 1行分の値を行列に書き込む (row-major)
+static inline void scatter_population(const ScatterTarget *t,
+                                      uint32_t meshid_value, const char *datetime_ptr, int datetime_len,
+                                      int32_t population) {
+    PQdataMatrix *m = t->m;
+    time_t datetime_jst = pg_bin_timestamp_to_jst(datetime_ptr, datetime_len);
+    int time_index = get_time_index_mobaku_datetime_from_time(datetime_jst) - m->time_start;
+    if (time_index < 0 || time_index >= m->rows) {
+        return;
+    }
+    int meshid_index = find_local_id(t->local_hash, meshid_value);
+    if (t->verify_keys != NULL &&
+        (meshid_index < 0 || meshid_index >= m->cols || t->verify_keys[meshid_index] != meshid_value)) {
+        return;
+    }
+    m->data[(size_t)time_index * m->cols + meshid_index] = population;
+    if (time_index + m->time_start > m->last_time_index) {
+        m->last_time_index = time_index + m->time_start;
+    }
+}
+
+static inline uint32_t read_be32(const char *p) {
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return ntohl(v);
+}
+
+static inline uint16_t read_be16(const char *p) {
+    uint16_t v;
+    memcpy(&v, p, 2);
+    return ntohs(v);
+}
+
+static void statement_name(char *buf, size_t size, bool key_range, int table_index) {
+    snprintf(buf, size, "%s_%d", key_range ? SELECT_RANGE_STMT_NAME : SELECT_STMT_NAME, table_index);
+}
+
+int prepare_population_query(PGconn *conn, const IngestOptions *opts) {
+    if (opts->mode == INGEST_MODE_COPY) {
+        return 0;
+    }
+    bool key_range = opts->scan == INGEST_SCAN_RANGE;
+    const char *format = key_range ? SELECT_RANGE_QUERY_FORMAT : SELECT_QUERY_FORMAT;
+    char time_filter[TIME_FILTER_LEN];
+    build_time_filter(time_filter, sizeof(time_filter), opts->time_start);
+    for (int t = 0; t < opts->num_tables; ++t) {
+        char stmt_name[64];
+        statement_name(stmt_name, sizeof(stmt_name), key_range, t);
+        size_t query_size = strlen(format) + strlen(opts->tables[t]) + strlen(time_filter) + 1;
+        char *query = (char *)malloc(query_size);
+        if (query == NULL) {
+            perror("malloc failed");
+            return -1;
+        }
+        snprintf(query, query_size, format, opts->tables[t], time_filter);
+
+        PGresult *prepRes;
+        if (key_range) {
+            const Oid paramTypes[2] = {INT4OID, INT4OID};
+            prepRes = PQprepare(conn, stmt_name, query, 2, paramTypes);
+        } else {
+            const Oid paramTypes[1] = {INT4ARRAYOID};
+            prepRes = PQprepare(conn, stmt_name, query, 1, paramTypes);
+        }
+        free(query);
+        if (PQresultStatus(prepRes) != PGRES_COMMAND_OK) {
+            fprintf(stderr, "PQprepare failed: %s\n", PQerrorMessage(conn));
+            PQclear(prepRes);
+            return -1;
+        }
+        PQclear(prepRes);
+    }
+    return 0;
+}
+
+static inline void write_be32(char *p, uint32_t v) {
+    v = htonl(v);
+    memcpy(p, &v, 4);
+}
+
+static void meshid_list_bounds(const MeshidList *meshid_list, uint32_t *lo, uint32_t *hi) {
+    *lo = UINT32_MAX;
+    *hi = 0;
+    for (int i = 0; i < meshid_list->meshid_number; ++i) {
+        uint32_t v = meshid_list->meshid_list[i];
+        if (v < *lo) *lo = v;
+        if (v > *hi) *hi = v;
+    }
+}
+
+int encode_int4_array_param(Int4ArrayParam *param, const uint32_t *values, int n) {
+    // ヘッダ (ndim, has_null, elemtype, 次元長, 下限) + 要素ごとに (長さ, 値)
+    size_t needed = 20 + (size_t)n * 8;
+    if (param->capacity < needed) {
+        size_t capacity = param->capacity > 0 ? param->capacity : 256;
+        while (capacity < needed) {
+            capacity *= 2;
+        }
+        char *data = (char *)realloc(param->data, capacity);
+        if (data == NULL) {
+            perror("realloc failed");
+            return -1;
+        }
+        param->data = data;
+        param->capacity = capacity;
+    }
+
+    char *p = param->data;
+    write_be32(p, 1);               // ndim
+    write_be32(p + 4, 0);           // has_null
+    write_be32(p + 8, INT4OID);     // elemtype
+    write_be32(p + 12, (uint32_t)n);
+    write_be32(p + 16, 1);          // lower bound
+    p += 20;
+    for (int i = 0; i < n; ++i) {
+        write_be32(p, 4);
+        write_be32(p + 4, values[i]);
+        p += 8;
+    }
+    param->length = (int)needed;
+    return 0;
+}
+
+void free_int4_array_param(Int4ArrayParam *param) {
+    free(param->data);
+    param->data = NULL;
+    param->capacity = 0;
+    param->length = 0;
+}
+
+typedef struct {
+    int mesh;
+    int datetime;
+    int population;
+} PopulationFields;
+
+static int resolve_population_fields(PGresult *res, PopulationFields *fields) {
+    int num_fields = PQnfields(res);
+    fields->mesh = -1;
+    fields->datetime = -1;
+    fields->population = -1;
+    for (int k = 0; k < num_fields; k++) {
+        const char* fieldName = PQfname(res, k);
+        if (strcmp(fieldName, "mesh_id") == 0) {
+            fields->mesh = k;
+        } else if (strcmp(fieldName, "datetime") == 0) {
+            fields->datetime = k;
+        } else if (strcmp(fieldName, "population") == 0) {
+            fields->population = k;
+        }
+    }
+    if (fields->mesh == -1 || fields->datetime == -1 || fields->population == -1) {
+        fprintf(stderr, "KEY ERROR\n");
+        return -1;
+    }
+    return 0;
+}
+
+// PGresult に含まれる全行を行列に展開する。単一行/チャンクモードでは結果ごとに呼ばれる
+static void scatter_result(PGresult *res, const PopulationFields *fields, const ScatterTarget *t) {
+    int num_rows = PQntuples(res);
+    for (int j = 0; j < num_rows; j++) {
+        uint32_t meshid_value = read_be32(PQgetvalue(res, j, fields->mesh));
+        int32_t population = (int32_t)read_be32(PQgetvalue(res, j, fields->population));
+        scatter_population(t, meshid_value,
+                           PQgetvalue(res, j, fields->datetime), PQgetlength(res, j, fields->datetime),
+                           population);
+    }
+}
+
+// SELECT を送信する。パイプラインモードでは送信キューに積むだけで結果は待たない
+static int send_select(PGconn *conn, int table_index, const MeshidList *meshid_list, Int4ArrayParam *param) {
+    char stmt_name[64];
+    statement_name(stmt_name, sizeof(stmt_name), meshid_list->key_range, table_index);
+    if (meshid_list->key_range) {
+        uint32_t lo, hi;
+        meshid_list_bounds(meshid_list, &lo, &hi);
+        char lo_be[4], hi_be[4];
+        write_be32(lo_be, lo);
+        write_be32(hi_be, hi);
+        const char *paramValues[2] = {lo_be, hi_be};
+        int paramLengths[2] = {4, 4};
+        int paramFormats[2] = {1, 1};
+        if (!PQsendQueryPrepared(conn, stmt_name, 2, paramValues, paramLengths, paramFormats, 1)) {
+            fprintf(stderr, "PQsendQueryPrepared failed: %s\n", PQerrorMessage(conn));
+            return -1;
+        }
+        return 0;
+    }
+
+    if (encode_int4_array_param(param, meshid_list->meshid_list, meshid_list->meshid_number) != 0) {
+        return -1;
+    }
+
+    const char *paramValues[1] = {param->data};
+    int paramLengths[1] = {param->length};
+    int paramFormats[1] = {1};
+
+    if (!PQsendQueryPrepared(conn, stmt_name, 1, paramValues, paramLengths, paramFormats, 1)) {
+        fprintf(stderr, "PQsendQueryPrepared failed: %s\n", PQerrorMessage(conn));
+        return -1;
+    }
+    return 0;
+}
+
+// 送信済みの SELECT 1件分の結果を受信して展開する。
+// INGEST_MODE_ROWS では単一行モード (libpq 17 以降はチャンクモード) で受信するので、
+// 同時に保持する PGresult は高々 chunk_rows 行分になる
+static int receive_select(PGconn *conn, const IngestOptions *opts, const ScatterTarget *t) {
+    if (opts->mode == INGEST_MODE_ROWS) {
+#ifdef LIBPQ_HAS_CHUNK_MODE
+        int mode_set = opts->chunk_rows > 1 ? PQsetChunkedRowsMode(conn, opts->chunk_rows) : PQsetSingleRowMode(conn);
+#else
+        int mode_set = PQsetSingleRowMode(conn);
+#endif
+        if (!mode_set) {
+            fprintf(stderr, "Failed to enter single-row mode\n");
+        }
+    }
+
+    int status = 0;
+    bool fields_resolved = false;
+    PopulationFields fields;
+    PGresult *res;
+    while ((res = PQgetResult(conn)) != NULL) {
+        switch (PQresultStatus(res)) {
+            case PGRES_SINGLE_TUPLE:
+#ifdef LIBPQ_HAS_CHUNK_MODE
+            case PGRES_TUPLES_CHUNK:
+#endif
+            case PGRES_TUPLES_OK:   // 最終結果 (0行) または行モードに入れなかった場合の全件
+                if (!fields_resolved && status == 0) {
+                    // 接続を同期させるため失敗しても残りは受信しきる
+                    status = resolve_population_fields(res, &fields);
+                    fields_resolved = true;
+                }
+                if (status == 0) {
+                    scatter_result(res, &fields, t);
+                }
+                break;
+            default:
+                fprintf(stderr, "SELECT failed: %s\n", PQerrorMessage(conn));
+                status = -1;
+                break;
+        }
+        PQclear(res);
+    }
+    return status;
+}
+
+#ifdef LIBPQ_HAS_PIPELINING
+// パイプラインモード用。クエリごとに同期点を置くので、1件の失敗が後続のクエリを巻き込まない。
+// 送信するのは数百バイトのクエリだけなので、深さを MAX_INGEST_PIPELINE_DEPTH までに抑えていれば
+// ブロッキング接続でもデッドロックしない
+// 1つのメッシュリストについて全取得元テーブル分のクエリを送る。
+// 失敗したときは途中のテーブルまで送信済みのことがあるので、呼び出し側はこの接続を使い続けないこと
+static int send_select_pipelined(PGconn *conn, const IngestOptions *opts, const MeshidList *meshid_list,
+                                 Int4ArrayParam *param) {
+    for (int t = 0; t < opts->num_tables; ++t) {
+        if (send_select(conn, t, meshid_list, param) != 0) {
+            return -1;
+        }
+        if (!PQpipelineSync(conn)) {
+            fprintf(stderr, "PQpipelineSync failed: %s\n", PQerrorMessage(conn));
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// 全取得元テーブル分の結果を同じ行列に展開する。失敗しても同期点までは全て読み切る
+static int receive_select_pipelined(PGconn *conn, const IngestOptions *opts, const ScatterTarget *t) {
+    int status = 0;
+    for (int table = 0; table < opts->num_tables; ++table) {
+        if (receive_select(conn, opts, t) != 0) {
+            status = -1;
+        }
+        PGresult *res = PQgetResult(conn);
+        if (PQresultStatus(res) != PGRES_PIPELINE_SYNC) {
+            fprintf(stderr, "Pipeline out of sync: %s\n", PQresStatus(PQresultStatus(res)));
+            status = -1;
+        }
+        PQclear(res);
+    }
+    return status;
+}
+#endif
+
+// COPY バイナリ形式のパーサ状態
+typedef struct {
+    bool header_done;
+    bool trailer_seen;
+} CopyBinaryState;
+
+// PQgetCopyData が返す 1 メッセージ分を展開する。
+// サーバは 1 行ごとに CopyData を送り、ファイルヘッダは最初の行と同じメッセージに入る。
+static int decode_copy_message(CopyBinaryState *st, const char *buf, int len, const ScatterTarget *t) {
+    int pos = 0;
+    if (!st->header_done) {
+        if (len < 19 || memcmp(buf, PGCOPY_SIGNATURE, sizeof(PGCOPY_SIGNATURE)) != 0) {
+            fprintf(stderr, "COPY: invalid binary header\n");
+            return -1;
+        }
+        pos = 11 + 4;   // signature + flags
+        uint32_t ext_len = read_be32(buf + pos);
+        pos += 4;
+        if (ext_len > (uint32_t)(len - pos)) {
+            fprintf(stderr, "COPY: truncated header extension\n");
+            return -1;
+        }
+        pos += (int)ext_len;
+        st->header_done = true;
+    }
+
+    while (pos < len) {
+        if (len - pos < 2) {
+            fprintf(stderr, "COPY: truncated tuple header\n");
+            return -1;
+        }
+        int16_t num_fields = (int16_t)read_be16(buf + pos);
+        pos += 2;
+        if (num_fields == -1) {
+            st->trailer_seen = true;
+            return 0;
+        }
+        if (num_fields != 3) {
+            fprintf(stderr, "COPY: unexpected field count %d\n", num_fields);
+            return -1;
+        }
+
+        const char *field_ptr[3];
+        int32_t field_len[3];
+        for (int k = 0; k < 3; ++k) {
+            if (len - pos < 4) {
+                fprintf(stderr, "COPY: truncated field length\n");
+                return -1;
+            }
+            field_len[k] = (int32_t)read_be32(buf + pos);
+            pos += 4;
+            field_ptr[k] = buf + pos;
+            if (field_len[k] > 0) {
+                if (len - pos < field_len[k]) {
+                    fprintf(stderr, "COPY: truncated field\n");
+                    return -1;
+                }
+                pos += field_len[k];
+            }
+        }
+        // mesh_id, datetime, population のいずれかが NULL の行は無視する
+        if (field_len[0] != 4 || field_len[1] != 8 || field_len[2] != 4) {
+            continue;
+        }
+        scatter_population(t, read_be32(field_ptr[0]),
+                           field_ptr[1], field_len[1], (int32_t)read_be32(field_ptr[2]));
+    }
+    return 0;
+}
+
+static char* build_copy_query(const char *table, int time_start, const MeshidList *meshid_list) {
+    char time_filter[TIME_FILTER_LEN];
+    build_time_filter(time_filter, sizeof(time_filter), time_start);
+    if (meshid_list->key_range) {
+        uint32_t lo, hi;
+        meshid_list_bounds(meshid_list, &lo, &hi);
+        size_t cap = strlen(COPY_RANGE_QUERY_FORMAT) + strlen(table) + strlen(time_filter) + 2 * 10 + 1;
+        char *query = (char *)malloc(cap);
+        if (query == NULL) {
+            perror("malloc failed");
+            return NULL;
+        }
+        snprintf(query, cap, COPY_RANGE_QUERY_FORMAT, table, lo, hi, time_filter);
+        return query;
+    }
+    size_t head_cap = strlen(COPY_QUERY_HEAD_FORMAT) + strlen(table) + 1;
+    size_t tail_len = strlen(COPY_QUERY_TAIL_FORMAT) + strlen(time_filter);
+    // uint32 は最大10桁 + 区切り文字
+    size_t cap = head_cap + tail_len + (size_t)meshid_list->meshid_number * 11 + 1;
+    char *query = (char *)malloc(cap);
+    if (query == NULL) {
+        perror("malloc failed");
+        return NULL;
+    }
+    size_t pos = (size_t)snprintf(query, head_cap, COPY_QUERY_HEAD_FORMAT, table);
+    for (int i = 0; i < meshid_list->meshid_number; ++i) {
+        if (i > 0) {
+            query[pos++] = ',';
+        }
+        uint2str(meshid_list->meshid_list[i], query + pos);
+        pos += strlen(query + pos);
+    }
+    snprintf(query + pos, tail_len + 1, COPY_QUERY_TAIL_FORMAT, time_filter);
+    return query;
+}
+
+static int fetch_copy(PGconn *conn, const char *table, int time_start, const MeshidList *meshid_list,
+                      const ScatterTarget *t) {
+    char *query = build_copy_query(table, time_start, meshid_list);
+    if (query == NULL) {
+        return -1;
+    }
+    PGresult *res = PQexec(conn, query);
+    free(query);
+    if (PQresultStatus(res) != PGRES_COPY_OUT) {
+        fprintf(stderr, "COPY failed: %s\n", PQerrorMessage(conn));
+        PQclear(res);
+        return -1;
+    }
+    PQclear(res);
+
+    CopyBinaryState st = {false, false};
+    int status = 0;
+    char *buf;
+    int len;
+    while ((len = PQgetCopyData(conn, &buf, 0)) > 0) {
+        if (status == 0 && decode_copy_message(&st, buf, len, t) != 0) {
+            status = -1;    // 接続を同期させるため残りも受信しきる
+        }
+        PQfreemem(buf);
+    }
+    if (len == -2) {
+        fprintf(stderr, "PQgetCopyData failed: %s\n", PQerrorMessage(conn));
+        status = -1;
+    }
+
+    while ((res = PQgetResult(conn)) != NULL) {
+        if (PQresultStatus(res) != PGRES_COMMAND_OK) {
+            fprintf(stderr, "COPY failed: %s\n", PQerrorMessage(conn));
+            status = -1;
+        }
+        PQclear(res);
+    }
+    if (status == 0 && !st.trailer_seen) {
+        fprintf(stderr, "COPY: missing binary trailer\n");
+        status = -1;
+    }
+    return status;
+}
+
+int fetch_population_matrix(PGconn *conn, const IngestOptions *opts, const MeshidList *meshid_list,
+                            Int4ArrayParam *param, cmph_t *local_hash, PQdataMatrix *m) {
+    ScatterTarget t = {m, local_hash, meshid_list->key_range ? meshid_list->meshid_list : NULL};
+    // 取得元テーブルごとにクエリを発行し、同じ行列に重ねて展開する
+    for (int table = 0; table < opts->num_tables; ++table) {
+        int status;
+        switch (opts->mode) {
+            case INGEST_MODE_COPY:
+                status = fetch_copy(conn, opts->tables[table], opts->time_start, meshid_list, &t);
+                break;
+            case INGEST_MODE_ROWS:
+            case INGEST_MODE_EXEC:
+            default:
+                status = send_select(conn, table, meshid_list, param);
+                if (status == 0) {
+                    status = receive_select(conn, opts, &t);
+                }
+                break;
+        }
+        if (status != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// 取得できなかったバッチは consumer が最終時刻を進めないよう数えておく
+static void count_dropped_batches(ProducerObject *obj, int n) {
+    if (obj->dropped_batches != NULL && n > 0) {
+        atomic_fetch_add(obj->dropped_batches, n);
+    }
+}
+
+void *population_producer(void *arg) {
+    ProducerObject *obj = (ProducerObject *)arg;
+    const IngestOptions *opts = obj->options;
+    FIFOQueue *data_queue = obj->DataQueue;
+    FIFOQueue *meshlist_queue = obj->MeshlistQueue;
+    obj->reached_end = false;
+    obj->failed = false;
+    // 接続できなくても終了の NULL は積む (consumer が待ち続けないように)。
+    // 取り出さなかったバッチは他の producer が処理する
+    PGconn *conn = PQconnectdb(obj->conninfo);
+    if (PQstatus(conn) != CONNECTION_OK) {
+        fprintf(stderr, "Connection to database failed: %s\n", PQerrorMessage(conn));
+        PQfinish(conn);
+        obj->failed = true;
+        enqueue(data_queue, NULL);
+        pthread_exit(NULL);
+    }
+
+    if (prepare_population_query(conn, opts) != 0) {
+        PQfinish(conn);
+        obj->failed = true;
+        enqueue(data_queue, NULL);
+        pthread_exit(NULL);
+    }
+
+    // このスレッドのノードにページを置くため、プールのバッファはここで触れておく
+    if (obj->pool != NULL && matrix_pool_reserve(obj->pool, MATRIX_POOL_PREFILL) != 0) {
+        fprintf(stderr, "Failed to prefill the matrix pool\n");
+    }
+
+    // パイプラインモードでは pipeline_depth 件までのメッシュリストを送信済みのまま保持する
+    int depth = 1;
+#ifdef LIBPQ_HAS_PIPELINING
+    if (opts->pipeline_depth > 1 && opts->mode != INGEST_MODE_COPY) {
+        if (PQenterPipelineMode(conn)) {
+            depth = opts->pipeline_depth;
+        } else {
+            fprintf(stderr, "PQenterPipelineMode failed: %s\n", PQerrorMessage(conn));
+        }
+    }
+#endif
+    bool pipelined = depth > 1;
+    MeshidList **inflight = (MeshidList **)malloc(sizeof(MeshidList *) * depth);
+    if (inflight == NULL) {
+        perror("malloc failed");
+        exit(1);
+    }
+    int inflight_head = 0;
+    int inflight_count = 0;
+    bool input_done = false;
+    bool broken = false;    // 接続が使えなくなった。送信済みのメッシュリストは取得せずに終了する
+    Int4ArrayParam param = {NULL, 0, 0};
+
+    while (true) {
+        MeshidList *meshid_list;
+        if (pipelined) {
+#ifdef LIBPQ_HAS_PIPELINING
+            while (!input_done && inflight_count < depth) {
+                MeshidList *next = (MeshidList*)dequeue(meshlist_queue);
+                if (next == NULL) {
+                    input_done = true;
+                    break;
+                }
+                if (send_select_pipelined(conn, opts, next, &param) != 0) {
+                    // 一部のテーブル分だけが送信済みになっていると、以降の結果と送信済みのメッシュリストの
+                    // 対応が取れなくなる。この接続はもう使わない
+                    free_meshid_list(next);
+                    count_dropped_batches(obj, 1);
+                    broken = true;
+                    break;
+                }
+                inflight[(inflight_head + inflight_count) % depth] = next;
+                inflight_count++;
+            }
+            if (broken) {
+                break;
+            }
+            // ブロッキング接続の PQflush は送りきるまで戻らないので、失敗は接続が切れたときだけ
+            if (inflight_count > 0 && PQflush(conn) < 0) {
+                fprintf(stderr, "PQflush failed: %s\n", PQerrorMessage(conn));
+                broken = true;
+                break;
+            }
+#endif
+            if (inflight_count == 0) {
+                break;
+            }
+            meshid_list = inflight[inflight_head];
+            inflight_head = (inflight_head + 1) % depth;
+            inflight_count--;
+        } else {
+            meshid_list = (MeshidList*)dequeue(meshlist_queue);
+            if (meshid_list == NULL) {
+                input_done = true;
+                break;
+            }
+        }
+
+        // consumer が書き終えて解放するまでの分をキューの予算から先に確保する。
+        // チャンク順への並べ替えで一時的に増える分は数えない (保持したまま待つと詰まるため)
+        size_t matrix_bytes = (size_t)obj->rows * meshid_list->meshid_number * sizeof(int);
+        if (opts->summaries) {
+            matrix_bytes += mesh_summary_bytes(obj->rows, meshid_list->meshid_number, opts->time_start);
+        }
+        if (obj->budget != NULL) {
+            obj->stall_ns += byte_budget_acquire(obj->budget, matrix_bytes);
+        }
+        PQdataMatrix *qdata_matrix = alloc_pooled_pqdata_matrix(obj->pool, obj->rows, meshid_list->meshid_number,
+                                                                meshid_list->meshid_list[0]);
+        if (qdata_matrix == NULL) {
+            exit(1);
+        }
+        qdata_matrix->budget = obj->budget;
+        qdata_matrix->budget_bytes = obj->budget != NULL ? matrix_bytes : 0;
+        qdata_matrix->time_start = opts->time_start;
+        qdata_matrix->batch_index = meshid_list->batch_index;
+        cmph_t *local_hash = create_local_mph_from_int((int *)meshid_list->meshid_list, meshid_list->meshid_number);
+
+        int status;
+#ifdef LIBPQ_HAS_PIPELINING
+        if (pipelined) {
+            ScatterTarget t = {qdata_matrix, local_hash, meshid_list->key_range ? meshid_list->meshid_list : NULL};
+            status = receive_select_pipelined(conn, opts, &t);
+        } else
+#endif
+        {
+            status = fetch_population_matrix(conn, opts, meshid_list, &param, local_hash, qdata_matrix);
+        }
+        cmph_destroy(local_hash);
+        if (status != 0) {
+            free_pqdata_matrix(qdata_matrix);
+            free_meshid_list(meshid_list);
+            count_dropped_batches(obj, 1);
+            continue;
+        }
+        // 書き込み先の列リストは行列に引き継ぐ
+        qdata_matrix->columns = meshid_list->columns;
+        meshid_list->columns = NULL;
+        // 行列がまだキャッシュにあるうちに、チャンク順に並べ替える前の行優先の並びで集計する
+        if (opts->summaries) {
+            qdata_matrix->summary = compute_mesh_summary(qdata_matrix->data, (size_t)qdata_matrix->cols,
+                                                         qdata_matrix->rows, qdata_matrix->cols,
+                                                         qdata_matrix->time_start);
+            if (qdata_matrix->summary == NULL) {
+                exit(1);
+            }
+        }
+        if (obj->time_chunk > 0) {
+            if (layout_chunk_order(qdata_matrix, obj->time_chunk, obj->mesh_chunk) != 0 ||
+                compress_pqdata_chunks(qdata_matrix, obj->time_chunk, obj->mesh_chunk,
+                                       opts->compression, opts->compression_level) != 0) {
+                exit(1);
+            }
+        }
+        enqueue(data_queue, qdata_matrix);
+        free_meshid_list(meshid_list);
+    }
+    if (broken) {
+        fprintf(stderr, "Producer stopped with %d batches unfetched\n", inflight_count);
+        count_dropped_batches(obj, inflight_count);
+    }
+    for (; inflight_count > 0; inflight_count--) {
+        free_meshid_list(inflight[inflight_head]);
+        inflight_head = (inflight_head + 1) % depth;
+    }
+    free(inflight);
+    obj->reached_end = input_done;
+    obj->failed = broken;
+    free_int4_array_param(&param);
+    enqueue(data_queue, NULL);
+    PQfinish(conn);
+    pthread_exit(NULL);
+}
+
+int drain_meshlist_queue(FIFOQueue *meshlist_queue, const ProducerObject *producers, int num_producers) {
+    // meshlist_producer は producer 数だけ NULL を積み、各 producer は高々1つ取り出す
+    int pending_ends = 0;
+    int failed = 0;
+    for (int i = 0; i < num_producers; ++i) {
+        if (!producers[i].reached_end) {
+            pending_ends++;
+        }
+        if (producers[i].failed) {
+            failed++;
+        }
+    }
+    int dropped = 0;
+    while (pending_ends > 0) {
+        MeshidList *meshid_list = (MeshidList *)dequeue(meshlist_queue);
+        if (meshid_list == NULL) {
+            pending_ends--;
+            continue;
+        }
+        free_meshid_list(meshid_list);
+        dropped++;
+    }
+    if (dropped > 0) {
+        fprintf(stderr, "%d batches were not fetched because every producer stopped\n", dropped);
+    }
+    return failed;
+}
+
+void report_backpressure(const ByteBudget *budget, const ProducerObject *producers, int num_producers) {
+    if (budget->limit == 0) {
+        return;
+    }
+    uint64_t max_ns = 0;
+    for (int i = 0; i < num_producers; ++i) {
+        if (producers[i].stall_ns > max_ns) {
+            max_ns = producers[i].stall_ns;
+        }
+    }
+    printf("Backpressure: %llu stalls, %.2f s total (max %.2f s in one producer), peak %.1f of %.1f MiB\n",
+           (unsigned long long)atomic_load(&budget->stalls), atomic_load(&budget->stall_ns) / 1e9, max_ns / 1e9,
+           atomic_load(&budget->peak) / (1024.0 * 1024.0), budget->limit / (1024.0 * 1024.0));
+}
+
+typedef struct {
+    uint32_t meshid;
+    int column;
+} MeshColumn;
+
+static int compare_mesh_column_by_meshid(const void *a, const void *b) {
+    uint32_t x = ((const MeshColumn *)a)->meshid;
+    uint32_t y = ((const MeshColumn *)b)->meshid;
+    return (x > y) - (x < y);
+}
+
+static int compare_mesh_column_by_column(const void *a, const void *b) {
+    return ((const MeshColumn *)a)->column - ((const MeshColumn *)b)->column;
+}
+
+int enqueue_range_batches(FIFOQueue *meshid_queue, const uint32_t *meshes, int num_meshes, int range_meshes,
+                          const uint8_t *completed) {
+    MeshColumn *sorted = (MeshColumn *)malloc(sizeof(MeshColumn) * num_meshes);
+    if (sorted == NULL) {
+        perror("malloc failed");
+        return -1;
+    }
+    for (int i = 0; i < num_meshes; ++i) {
+        sorted[i].meshid = meshes[i];
+        sorted[i].column = i;
+    }
+    qsort(sorted, num_meshes, sizeof(MeshColumn), compare_mesh_column_by_meshid);
+
+    int num_batches = 0;
+    for (int start = 0, batch = 0; start < num_meshes; start += range_meshes, ++batch) {
+        if (completed != NULL && completed[batch]) {
+            continue;
+        }
+        int n = num_meshes - start < range_meshes ? num_meshes - start : range_meshes;
+        // 範囲内は書き込み先の列順に並べる (consumer はこの順で列を選択する)
+        qsort(sorted + start, n, sizeof(MeshColumn), compare_mesh_column_by_column);
+
+        MeshidList *ml = (MeshidList *)malloc(sizeof(MeshidList));
+        uint32_t *ids = (uint32_t *)malloc(sizeof(uint32_t) * n);
+        int *columns = (int *)malloc(sizeof(int) * n);
+        if (ml == NULL || ids == NULL || columns == NULL) {
+            perror("malloc failed");
+            free(ml);
+            free(ids);
+            free(columns);
+            free(sorted);
+            return -1;
+        }
+        for (int j = 0; j < n; ++j) {
+            ids[j] = sorted[start + j].meshid;
+            columns[j] = sorted[start + j].column;
+        }
+        ml->meshid_number = n;
+        ml->meshid_list = ids;
+        ml->columns = columns;
+        ml->key_range = true;
+        ml->batch_index = batch;
+        enqueue(meshid_queue, ml);
+        num_batches++;
+    }
+    free(sorted);
+    return num_batches;
+}
@@ -0,0 +1,221 @@
+//
+// population_data と population_snapshot のうち、展開する量の少ない方から読む読み出し API
+//
+
+#include "population_reader.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "delta_bitpack.h"
+#include "snapshot_dataset.h"
+
+// 連続する列 [start, start + count)
+typedef struct {
+    hsize_t start;
+    hsize_t count;
+} ColumnRun;
+
+static int compare_id_col(const void *a, const void *b) {
+    uint32_t x = ((const uint32_t *)a)[0];
+    uint32_t y = ((const uint32_t *)b)[0];
+    return (x > y) - (x < y);
+}
+
+static void load_mesh_columns(PopulationReader *r) {
+    if (H5Lexists(r->file_id, "meshid_list", H5P_DEFAULT) <= 0) {
+        return;
+    }
+    hid_t dataset_id = H5Dopen(r->file_id, "meshid_list", H5P_DEFAULT);
+    hid_t space_id = H5Dget_space(dataset_id);
+    hsize_t n = (hsize_t)H5Sget_simple_extent_npoints(space_id);
+    H5Sclose(space_id);
+    uint32_t *ids = (uint32_t *)malloc(sizeof(uint32_t) * n);
+    r->id_to_col = (uint32_t (*)[2])malloc(sizeof(uint32_t[2]) * n);
+    if (ids != NULL && r->id_to_col != NULL &&
+        H5Dread(dataset_id, H5T_NATIVE_UINT32, H5S_ALL, H5S_ALL, H5P_DEFAULT, ids) >= 0) {
+        for (hsize_t i = 0; i < n; ++i) {
+            r->id_to_col[i][0] = ids[i];
+            r->id_to_col[i][1] = (uint32_t)i;
+        }
+        r->num_ids = n;
+        qsort(r->id_to_col, n, sizeof(uint32_t[2]), compare_id_col);
+    }
+    free(ids);
+    H5Dclose(dataset_id);
+}
+
+static void load_chunk_shape(hid_t dataset_id, hsize_t chunk[2]) {
+    chunk[0] = 1;
+    chunk[1] = 1;
+    hid_t plist_id = H5Dget_create_plist(dataset_id);
+    if (H5Pget_layout(plist_id) == H5D_CHUNKED) {
+        H5Pget_chunk(plist_id, 2, chunk);
+    }
+    H5Pclose(plist_id);
+}
+
+PopulationReader* open_population_reader(const char *path) {
+    // delta-bitpack で書かれていても読めるようにする
+    register_delta_bitpack_filter();
+    hid_t file_id = H5Fopen(path, H5F_ACC_RDONLY, H5P_DEFAULT);
+    if (file_id < 0) {
+        fprintf(stderr, "Failed to open HDF5 file: %s\n", path);
+        return NULL;
+    }
+    hid_t series_id = H5Dopen(file_id, "population_data", H5P_DEFAULT);
+    if (series_id < 0) {
+        fprintf(stderr, "Failed to open population_data dataset\n");
+        H5Fclose(file_id);
+        return NULL;
+    }
+    PopulationReader *r = (PopulationReader *)calloc(1, sizeof(PopulationReader));
+    r->file_id = file_id;
+    r->dataset_id[POPULATION_LAYOUT_SERIES] = series_id;
+    r->dataset_id[POPULATION_LAYOUT_SNAPSHOT] = H5I_INVALID_HID;
+    hid_t space_id = H5Dget_space(series_id);
+    hsize_t dims[2];
+    H5Sget_simple_extent_dims(space_id, dims, NULL);
+    H5Sclose(space_id);
+    r->rows = dims[0];
+    r->cols = dims[1];
+    load_chunk_shape(series_id, r->chunk[POPULATION_LAYOUT_SERIES]);
+
+    if (H5Lexists(file_id, SNAPSHOT_DATASET, H5P_DEFAULT) > 0) {
+        hid_t snapshot_id = H5Dopen(file_id, SNAPSHOT_DATASET, H5P_DEFAULT);
+        r->snapshot_rows = read_snapshot_rows(snapshot_id);
+        if (r->snapshot_rows > r->rows) {
+            r->snapshot_rows = r->rows;
+        }
+        r->dataset_id[POPULATION_LAYOUT_SNAPSHOT] = snapshot_id;
+        load_chunk_shape(snapshot_id, r->chunk[POPULATION_LAYOUT_SNAPSHOT]);
+    }
+    load_mesh_columns(r);
+    return r;
+}
+
+void close_population_reader(PopulationReader *r) {
+    if (r == NULL) {
+        return;
+    }
+    for (int l = 0; l < 2; ++l) {
+        if (r->dataset_id[l] >= 0) {
+            H5Dclose(r->dataset_id[l]);
+        }
+    }
+    H5Fclose(r->file_id);
+    free(r->id_to_col);
+    free(r);
+}
+
+long long population_reader_column(const PopulationReader *r, uint32_t meshid) {
+    uint32_t key[2] = {meshid, 0};
+    uint32_t *hit = (uint32_t *)bsearch(key, r->id_to_col, r->num_ids, sizeof(uint32_t[2]), compare_id_col);
+    return hit != NULL ? (long long)hit[1] : -1;
+}
+
+// 昇順の列を連続する範囲にまとめる。runs は ncols 個以上
+static int column_runs(const hsize_t *cols, int ncols, ColumnRun *runs) {
+    int n = 0;
+    for (int j = 0; j < ncols; ++j) {
+        if (n > 0 && cols[j] == runs[n - 1].start + runs[n - 1].count) {
+            runs[n - 1].count++;
+        } else {
+            runs[n++] = (ColumnRun){cols[j], 1};
+        }
+    }
+    return n;
+}
+
+// チャンクキャッシュに残らない前提で、触れたチャンクの要素数の合計
+static uint64_t runs_cost(const PopulationReader *r, PopulationLayout layout, hsize_t t0, hsize_t hours,
+                          const ColumnRun *runs, int num_runs) {
+    if (hours == 0 || num_runs == 0 || r->dataset_id[layout] < 0) {
+        return UINT64_MAX;
+    }
+    if (layout == POPULATION_LAYOUT_SNAPSHOT && t0 + hours > r->snapshot_rows) {
+        return UINT64_MAX;
+    }
+    const hsize_t *chunk = r->chunk[layout];
+    uint64_t time_chunks = (t0 + hours - 1) / chunk[0] - t0 / chunk[0] + 1;
+    uint64_t mesh_chunks = 0;
+    long long last = -1;
+    for (int i = 0; i < num_runs; ++i) {
+        long long first = (long long)(runs[i].start / chunk[1]);
+        long long end = (long long)((runs[i].start + runs[i].count - 1) / chunk[1]);
+        mesh_chunks += (uint64_t)(end - first + 1) - (first == last ? 1 : 0);
+        last = end;
+    }
+    return time_chunks * mesh_chunks * chunk[0] * chunk[1];
+}
+
+static PopulationLayout choose_runs_layout(const PopulationReader *r, hsize_t t0, hsize_t hours,
+                                           const ColumnRun *runs, int num_runs) {
+    uint64_t series = runs_cost(r, POPULATION_LAYOUT_SERIES, t0, hours, runs, num_runs);
+    uint64_t snapshot = runs_cost(r, POPULATION_LAYOUT_SNAPSHOT, t0, hours, runs, num_runs);
+    return snapshot < series ? POPULATION_LAYOUT_SNAPSHOT : POPULATION_LAYOUT_SERIES;
+}
+
+uint64_t population_read_cost(const PopulationReader *r, PopulationLayout layout, hsize_t t0, hsize_t hours,
+                              const hsize_t *cols, int ncols) {
+    ColumnRun *runs = (ColumnRun *)malloc(sizeof(ColumnRun) * (ncols > 0 ? ncols : 1));
+    uint64_t cost = runs_cost(r, layout, t0, hours, runs, column_runs(cols, ncols, runs));
+    free(runs);
+    return cost;
+}
+
+PopulationLayout choose_population_layout(const PopulationReader *r, hsize_t t0, hsize_t hours, const hsize_t *cols,
+                                          int ncols) {
+    ColumnRun *runs = (ColumnRun *)malloc(sizeof(ColumnRun) * (ncols > 0 ? ncols : 1));
+    PopulationLayout layout = choose_runs_layout(r, t0, hours, runs, column_runs(cols, ncols, runs));
+    free(runs);
+    return layout;
+}
+
+static herr_t read_runs(PopulationReader *r, hsize_t t0, hsize_t hours, const ColumnRun *runs, int num_runs,
+                        int *out, PopulationLayout *used) {
+    if (num_runs == 0 || hours == 0 || t0 + hours > r->rows || runs[num_runs - 1].start +
+        runs[num_runs - 1].count > r->cols) {
+        fprintf(stderr, "Read outside population_data (%llu rows x %llu meshes)\n", (unsigned long long)r->rows,
+                (unsigned long long)r->cols);
+        return -1;
+    }
+    PopulationLayout layout = choose_runs_layout(r, t0, hours, runs, num_runs);
+    hid_t dataset_id = r->dataset_id[layout];
+    hid_t file_space = H5Dget_space(dataset_id);
+    H5Sselect_none(file_space);
+    hsize_t ncols = 0;
+    for (int i = 0; i < num_runs; ++i) {
+        hsize_t start[2] = {t0, runs[i].start};
+        hsize_t count[2] = {hours, runs[i].count};
+        H5Sselect_hyperslab(file_space, H5S_SELECT_OR, start, NULL, count, NULL);
+        ncols += runs[i].count;
+    }
+    // 選択は行優先で並ぶので、hours x ncols のメモリにそのまま詰まる
+    hsize_t mem_dims[2] = {hours, ncols};
+    hid_t mem_space = H5Screate_simple(2, mem_dims, NULL);
+    herr_t status = H5Dread(dataset_id, H5T_NATIVE_INT, mem_space, file_space, H5P_DEFAULT, out);
+    H5Sclose(mem_space);
+    H5Sclose(file_space);
+    if (used != NULL) {
+        *used = layout;
+    }
+    return status;
+}
+
+herr_t read_population(PopulationReader *r, hsize_t t0, hsize_t hours, const hsize_t *cols, int ncols, int *out,
+                       PopulationLayout *used) {
+    ColumnRun *runs = (ColumnRun *)malloc(sizeof(ColumnRun) * (ncols > 0 ? ncols : 1));
+    if (runs == NULL) {
+        perror("malloc failed");
+        return -1;
+    }
+    herr_t status = read_runs(r, t0, hours, runs, column_runs(cols, ncols, runs), out, used);
+    free(runs);
+    return status;
+}
+
+herr_t read_population_snapshot(PopulationReader *r, hsize_t hour, int *out, PopulationLayout *used) {
+    ColumnRun all = {0, r->cols};
+    return read_runs(r, hour, 1, &all, 1, out, used);
+}
@@ -0,0 +1,224 @@
+//
+// population_data を 時刻 x メッシュ のスラブ単位で読む
+//
+
+#include "population_slab.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "hdf5_ops.h"
+
+struct SlabDecoder {
+    SlabWorker base;
+    PopulationSlab *s;
+    void *scratch;
+    void *chunk;
+};
+
+int run_slab_workers(void *workers, size_t worker_size, int num_workers, void *(*fn)(void *)) {
+    pthread_t threads[num_workers];
+    int started = 0;
+    for (; started < num_workers; ++started) {
+        if (pthread_create(&threads[started], NULL, fn, (char *)workers + worker_size * started) != 0) {
+            perror("pthread_create failed");
+            break;
+        }
+    }
+    int status = started == num_workers ? 0 : -1;
+    for (int i = 0; i < started; ++i) {
+        pthread_join(threads[i], NULL);
+        if (((SlabWorker *)((char *)workers + worker_size * i))->status != 0) {
+            status = -1;
+        }
+    }
+    return status;
+}
+
+// 元のチャンクを展開してスラブの列に置く
+static void* decode_source_chunks(void *arg) {
+    SlabDecoder *w = (SlabDecoder *)arg;
+    PopulationSlab *s = w->s;
+    hsize_t chunk_cols = s->chunk[1];
+    size_t chunk_bytes = (size_t)s->slab_rows * chunk_cols * sizeof(int);
+    for (int k = w->base.id; k < s->num_src && w->base.status == 0; k += w->base.num_workers) {
+        const int *chunk = (const int *)w->chunk;
+        if (s->src_size[k] == 0) {
+            memset(w->chunk, 0, chunk_bytes);
+        } else if (decode_chunk(s->codec, s->src_raw[k], s->src_size[k], sizeof(int), w->scratch, w->chunk,
+                                chunk_bytes) != 0) {
+            w->base.status = -1;
+            break;
+        }
+        for (hsize_t t = 0; t < s->slab_rows; ++t) {
+            memcpy(s->data + t * s->slab_cols + (hsize_t)k * chunk_cols, chunk + t * chunk_cols,
+                   sizeof(int) * chunk_cols);
+        }
+    }
+    return NULL;
+}
+
+int open_population_slab(PopulationSlab *s, hid_t dataset_id, hsize_t rows, hsize_t slab_rows, hsize_t slab_cols,
+                         int num_workers) {
+    memset(s, 0, sizeof(*s));
+    s->dataset_id = dataset_id;
+    s->slab_rows = slab_rows;
+    s->slab_cols = slab_cols;
+    hid_t space_id = H5Dget_space(dataset_id);
+    hsize_t dims[2];
+    H5Sget_simple_extent_dims(space_id, dims, NULL);
+    H5Sclose(space_id);
+    s->rows = rows < dims[0] ? rows : dims[0];
+    s->cols = dims[1];
+
+    hid_t plist_id = H5Dget_create_plist(dataset_id);
+    bool chunked = H5Pget_layout(plist_id) == H5D_CHUNKED;
+    if (chunked) {
+        H5Pget_chunk(plist_id, 2, s->chunk);
+    }
+    H5Pclose(plist_id);
+    int level;
+    s->raw_chunks = chunked && get_population_codec(dataset_id, &s->codec, &level) == 0 &&
+                    chunk_codec_in_producer(s->codec) && slab_rows == s->chunk[0] && slab_cols % s->chunk[1] == 0;
+
+    s->data = (int *)calloc(slab_rows * slab_cols, sizeof(int));
+    if (s->data == NULL) {
+        perror("calloc failed");
+        return -1;
+    }
+    if (!s->raw_chunks) {
+        return 0;
+    }
+
+    if (num_workers <= 0) {
+        num_workers = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    }
+    s->num_workers = num_workers;
+    s->max_src = (int)(slab_cols / s->chunk[1]);
+    s->src_raw = (unsigned char **)calloc(s->max_src, sizeof(unsigned char *));
+    s->src_size = (size_t *)calloc(s->max_src, sizeof(size_t));
+    s->src_capacity = (size_t *)calloc(s->max_src, sizeof(size_t));
+    s->decoders = (SlabDecoder *)calloc(num_workers, sizeof(SlabDecoder));
+    if (s->src_raw == NULL || s->src_size == NULL || s->src_capacity == NULL || s->decoders == NULL) {
+        perror("calloc failed");
+        return -1;
+    }
+    size_t chunk_bytes = sizeof(int) * slab_rows * s->chunk[1];
+    for (int i = 0; i < num_workers; ++i) {
+        s->decoders[i] = (SlabDecoder){.base = {.id = i, .num_workers = num_workers}, .s = s};
+        s->decoders[i].scratch = malloc(chunk_bytes);
+        s->decoders[i].chunk = malloc(chunk_bytes);
+        if (s->decoders[i].scratch == NULL || s->decoders[i].chunk == NULL) {
+            perror("malloc failed");
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// [t_begin, t_begin + height) x [c_begin, c_begin + width) を HDF5 のフィルタに任せて data の mem_col 列目から読む
+static int read_hyperslab(PopulationSlab *s, hsize_t t_begin, hsize_t c_begin, hsize_t mem_col, hsize_t width) {
+    hsize_t start[2] = {t_begin, c_begin};
+    hsize_t count[2] = {s->height, width};
+    hsize_t mem_dims[2] = {s->slab_rows, s->slab_cols};
+    hsize_t mem_start[2] = {0, mem_col};
+    hid_t mem_space = H5Screate_simple(2, mem_dims, NULL);
+    H5Sselect_hyperslab(mem_space, H5S_SELECT_SET, mem_start, NULL, count, NULL);
+    hid_t file_space = H5Dget_space(s->dataset_id);
+    H5Sselect_hyperslab(file_space, H5S_SELECT_SET, start, NULL, count, NULL);
+    herr_t status = H5Dread(s->dataset_id, H5T_NATIVE_INT, mem_space, file_space, H5P_DEFAULT, s->data);
+    H5Sclose(file_space);
+    H5Sclose(mem_space);
+    return status < 0 ? -1 : 0;
+}
+
+// 生のチャンクを読み、ワーカーで展開する
+static int read_slab_chunks(PopulationSlab *s, hsize_t t_begin, hsize_t c_begin) {
+    s->num_src = (int)((s->width + s->chunk[1] - 1) / s->chunk[1]);
+    if (s->width < s->slab_cols) {
+        // 右端のスラブでは元のチャンクのない列を 0 にしておく
+        memset(s->data, 0, sizeof(int) * s->slab_rows * s->slab_cols);
+    }
+    // 任意のフィルタ (deflate など) を飛ばして保存されたチャンクは decode_chunk では展開できない
+    int filtered[s->num_src];
+    int num_filtered = 0;
+    for (int k = 0; k < s->num_src; ++k) {
+        hsize_t offset[2] = {t_begin, c_begin + (hsize_t)k * s->chunk[1]};
+        // filter_mask はチャンクの索引から読む (HDF5 1.10 の H5Dread_chunk は常に 0 を返すことがある)
+        unsigned filter_mask = 0;
+        haddr_t address = HADDR_UNDEF;
+        hsize_t stored = 0;
+        s->src_size[k] = 0;
+        if (H5Dget_chunk_info_by_coord(s->dataset_id, offset, &filter_mask, &address, &stored) < 0 ||
+            address == HADDR_UNDEF || stored == 0) {
+            continue;
+        }
+        if (filter_mask != 0) {
+            filtered[num_filtered++] = k;   // ワーカーには 0 で埋めさせ、後で上書きする
+            continue;
+        }
+        if (stored > s->src_capacity[k]) {
+            unsigned char *grown = (unsigned char *)realloc(s->src_raw[k], stored);
+            if (grown == NULL) {
+                perror("realloc failed");
+                return -1;
+            }
+            s->src_raw[k] = grown;
+            s->src_capacity[k] = stored;
+        }
+        uint32_t read_mask = 0;
+        if (H5Dread_chunk(s->dataset_id, H5P_DEFAULT, offset, &read_mask, s->src_raw[k]) < 0) {
+            fprintf(stderr, "Failed to read the population_data chunk at %llu, %llu\n",
+                    (unsigned long long)offset[0], (unsigned long long)offset[1]);
+            return -1;
+        }
+        s->src_size[k] = (size_t)stored;
+    }
+    if (run_slab_workers(s->decoders, sizeof(SlabDecoder), s->num_workers, decode_source_chunks) != 0) {
+        return -1;
+    }
+    for (int i = 0; i < num_filtered; ++i) {
+        hsize_t col = (hsize_t)filtered[i] * s->chunk[1];
+        hsize_t width = s->width - col < s->chunk[1] ? s->width - col : s->chunk[1];
+        if (read_hyperslab(s, t_begin, c_begin + col, col, width) != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// HDF5 のフィルタに任せて読む
+static int read_slab_hyperslab(PopulationSlab *s, hsize_t t_begin, hsize_t c_begin) {
+    if (s->width < s->slab_cols || s->height < s->slab_rows) {
+        memset(s->data, 0, sizeof(int) * s->slab_rows * s->slab_cols);
+    }
+    return read_hyperslab(s, t_begin, c_begin, 0, s->width);
+}
+
+int read_population_slab(PopulationSlab *s, hsize_t t_begin, hsize_t c_begin) {
+    if (t_begin >= s->rows || c_begin >= s->cols) {
+        return -1;
+    }
+    s->height = s->rows - t_begin < s->slab_rows ? s->rows - t_begin : s->slab_rows;
+    s->width = s->cols - c_begin < s->slab_cols ? s->cols - c_begin : s->slab_cols;
+    return s->raw_chunks ? read_slab_chunks(s, t_begin, c_begin) : read_slab_hyperslab(s, t_begin, c_begin);
+}
+
+void close_population_slab(PopulationSlab *s) {
+    for (int k = 0; s->src_raw != NULL && k < s->max_src; ++k) {
+        free(s->src_raw[k]);
+    }
+    for (int i = 0; s->decoders != NULL && i < s->num_workers; ++i) {
+        free(s->decoders[i].scratch);
+        free(s->decoders[i].chunk);
+    }
+    free(s->src_raw);
+    free(s->src_size);
+    free(s->src_capacity);
+    free(s->decoders);
+    free(s->data);
+    memset(s, 0, sizeof(*s));
+}
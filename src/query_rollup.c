@@ -0,0 +1,54 @@
+//
+// 区域と期間を指定して、集計から合計・平均・最大を引く
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <hdf5.h>
+
+#include "delta_bitpack.h"
+#include "rollup.h"
+
+int main(int argc, char *argv[]) {
+    if (argc < 6) {
+        fprintf(stderr, "Usage: %s <hdf5_file> <mesh|mesh3|mesh2|mesh1> <code> <first_hour> <end_hour>\n", argv[0]);
+        return 1;
+    }
+    int area = 0;
+    for (; area < NUM_ROLLUP_AREAS && strcmp(argv[2], rollup_area_name((RollupArea)area)) != 0; ++area) {
+    }
+    if (area == NUM_ROLLUP_AREAS) {
+        fprintf(stderr, "Unknown area: %s\n", argv[2]);
+        return 1;
+    }
+    uint32_t code = (uint32_t)strtoul(argv[3], NULL, 10);
+    hsize_t t0 = strtoull(argv[4], NULL, 10);
+    hsize_t t1 = strtoull(argv[5], NULL, 10);
+
+    register_delta_bitpack_filter();
+    hid_t file_id = H5Fopen(argv[1], H5F_ACC_RDONLY, H5P_DEFAULT);
+    if (file_id < 0) {
+        fprintf(stderr, "Failed to open HDF5 file: %s\n", argv[1]);
+        return 1;
+    }
+    long long region = rollup_region(file_id, (RollupArea)area, code);
+    RollupValue v;
+    int status = -1;
+    if (region < 0) {
+        fprintf(stderr, "%s %u is not in the file\n", argv[2], code);
+    } else {
+        status = rollup_aggregate(file_id, (RollupArea)area, (hsize_t)region, t0, t1, &v);
+    }
+    if (status == 0) {
+        printf("sum %lld mean %.2f max %lld over %llu hours\n", (long long)v.sum,
+               v.hours > 0 ? (double)v.sum / (double)v.hours : 0.0, (long long)v.max, (unsigned long long)v.hours);
+        printf("reads:");
+        for (int period = NUM_ROLLUP_PERIODS - 1; period >= 0; --period) {
+            printf(" %s %d", rollup_period_name((RollupPeriod)period), v.reads[period]);
+        }
+        printf("\n");
+    }
+    H5Fclose(file_id);
+    return status == 0 ? 0 : 1;
+}
@@ -0,0 +1,1194 @@
+//
+// population_data を日・月・年と 3次・2次・1次メッシュにまとめた集計 (ロールアップ) のピラミッド
+//
+// 1回目の走査で population_data をスラブ単位で読み、列ごとの日の集計と、区域ごとの時間の合計・日の集計を作る。
+// meshid_list は昇順なので区域は連続した列になり、スラブの列の範囲で切れた区域だけを次のスラブに持ち越す。
+// 取り込み時の集計 (mesh_summary.h) が SUMMARY_ROWS_ATTR まで mesh の日・月・年を書いていれば、mesh の段は作らない。
+// 2回目の走査で日の集計から月と年を組み立てる。どちらも区間の合計と最大は縦方向 (時間方向) の
+// まとめ上げで、行優先のまま列を SIMD のレーンに載せて計算する。
+//
+
+#include "rollup.h"
+
+#include <immintrin.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "chunk_codec.h"
+#include "hdf5_ops.h"
+#include "mesh_summary.h"
+#include "meshid_ops.h"
+#include "population_slab.h"
+
+// population_data がチャンク化されていない (シャードをまとめた仮想データセット) ときのスラブの高さ
+#define ROLLUP_DEFAULT_SLAB_ROWS (24 * 365)
+// 1回目の走査で一度に読む列数 (population_data のメッシュ方向のチャンク幅に切り上げる)
+#define ROLLUP_SLAB_COLS 1024
+// 2回目の走査で一度に読む区域数
+#define ROLLUP_MERGE_COLS 1024
+#define ROLLUP_DEFLATE_LEVEL 4
+// 区域の範囲でスラブの端が切れたチャンクを書き終えるまで残しておくためのチャンクキャッシュ
+#define ROLLUP_CHUNK_CACHE_BYTES (16 * 1024 * 1024)
+
+// --- カーネル ---
+
+typedef void (*ReduceRowsFn)(const int32_t *src, size_t stride, size_t nrows, size_t width, int64_t *sum,
+                             int32_t *max);
+typedef void (*ReduceSumsFn)(const int64_t *sum_src, const int32_t *max_src, size_t stride, size_t nrows,
+                             size_t width, int64_t *sum, int32_t *max);
+
+typedef void (*ReduceStatsFn)(const int32_t *src, size_t stride, size_t nrows, size_t width, int64_t *sum,
+                              int32_t *min, int32_t *max, int32_t *count);
+
+typedef struct {
+    RollupIsa isa;
+    ReduceRowsFn reduce_rows;
+    ReduceSumsFn reduce_sums;
+    ReduceStatsFn reduce_stats;
+} RollupKernels;
+
+static void reduce_rows_scalar(const int32_t *src, size_t stride, size_t nrows, size_t width, int64_t *sum,
+                               int32_t *max) {
+    for (size_t j = 0; j < width; ++j) {
+        sum[j] = 0;
+        max[j] = nrows > 0 ? src[j] : 0;
+    }
+    for (size_t t = 0; t < nrows; ++t) {
+        const int32_t *row = src + t * stride;
+        for (size_t j = 0; j < width; ++j) {
+            sum[j] += row[j];
+            max[j] = row[j] > max[j] ? row[j] : max[j];
+        }
+    }
+}
+
+static void reduce_sums_scalar(const int64_t *sum_src, const int32_t *max_src, size_t stride, size_t nrows,
+                               size_t width, int64_t *sum, int32_t *max) {
+    for (size_t j = 0; j < width; ++j) {
+        sum[j] = 0;
+        max[j] = nrows > 0 ? max_src[j] : 0;
+    }
+    for (size_t t = 0; t < nrows; ++t) {
+        for (size_t j = 0; j < width; ++j) {
+            sum[j] += sum_src[t * stride + j];
+            max[j] = max_src[t * stride + j] > max[j] ? max_src[t * stride + j] : max[j];
+        }
+    }
+}
+
+static void reduce_stats_scalar(const int32_t *src, size_t stride, size_t nrows, size_t width, int64_t *sum,
+                                int32_t *min, int32_t *max, int32_t *count) {
+    for (size_t j = 0; j < width; ++j) {
+        sum[j] = 0;
+        min[j] = INT32_MAX;
+        max[j] = 0;
+        count[j] = 0;
+    }
+    for (size_t t = 0; t < nrows; ++t) {
+        const int32_t *row = src + t * stride;
+        for (size_t j = 0; j < width; ++j) {
+            sum[j] += row[j];
+            max[j] = row[j] > max[j] ? row[j] : max[j];
+            if (row[j] != 0) {
+                min[j] = row[j] < min[j] ? row[j] : min[j];
+                count[j]++;
+            }
+        }
+    }
+    for (size_t j = 0; j < width; ++j) {
+        min[j] = count[j] > 0 ? min[j] : 0;
+    }
+}
+
+// --- AVX2: 8 列ずつ。合計は 4 列ずつ int64 に広げて足す ---
+
+__attribute__((target("avx2")))
+static void reduce_rows_avx2(const int32_t *src, size_t stride, size_t nrows, size_t width, int64_t *sum,
+                             int32_t *max) {
+    size_t j = 0;
+    for (; nrows > 0 && j + 8 <= width; j += 8) {
+        __m256i lo = _mm256_setzero_si256();
+        __m256i hi = _mm256_setzero_si256();
+        __m256i mx = _mm256_loadu_si256((const __m256i *)(src + j));
+        for (size_t t = 0; t < nrows; ++t) {
+            __m256i v = _mm256_loadu_si256((const __m256i *)(src + t * stride + j));
+            lo = _mm256_add_epi64(lo, _mm256_cvtepi32_epi64(_mm256_castsi256_si128(v)));
+            hi = _mm256_add_epi64(hi, _mm256_cvtepi32_epi64(_mm256_extracti128_si256(v, 1)));
+            mx = _mm256_max_epi32(mx, v);
+        }
+        _mm256_storeu_si256((__m256i *)(sum + j), lo);
+        _mm256_storeu_si256((__m256i *)(sum + j + 4), hi);
+        _mm256_storeu_si256((__m256i *)(max + j), mx);
+    }
+    reduce_rows_scalar(src + j, stride, nrows, width - j, sum + j, max + j);
+}
+
+__attribute__((target("avx2")))
+static void reduce_sums_avx2(const int64_t *sum_src, const int32_t *max_src, size_t stride, size_t nrows,
+                             size_t width, int64_t *sum, int32_t *max) {
+    size_t j = 0;
+    for (; nrows > 0 && j + 8 <= width; j += 8) {
+        __m256i lo = _mm256_setzero_si256();
+        __m256i hi = _mm256_setzero_si256();
+        __m256i mx = _mm256_loadu_si256((const __m256i *)(max_src + j));
+        for (size_t t = 0; t < nrows; ++t) {
+            lo = _mm256_add_epi64(lo, _mm256_loadu_si256((const __m256i *)(sum_src + t * stride + j)));
+            hi = _mm256_add_epi64(hi, _mm256_loadu_si256((const __m256i *)(sum_src + t * stride + j + 4)));
+            mx = _mm256_max_epi32(mx, _mm256_loadu_si256((const __m256i *)(max_src + t * stride + j)));
+        }
+        _mm256_storeu_si256((__m256i *)(sum + j), lo);
+        _mm256_storeu_si256((__m256i *)(sum + j + 4), hi);
+        _mm256_storeu_si256((__m256i *)(max + j), mx);
+    }
+    reduce_sums_scalar(sum_src + j, max_src + j, stride, nrows, width - j, sum + j, max + j);
+}
+
+// 0 の要素は最小では INT32_MAX に置き換え、個数では比較のマスク (-1) を引いて数える
+__attribute__((target("avx2")))
+static void reduce_stats_avx2(const int32_t *src, size_t stride, size_t nrows, size_t width, int64_t *sum,
+                              int32_t *min, int32_t *max, int32_t *count) {
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i none = _mm256_set1_epi32(INT32_MAX);
+    size_t j = 0;
+    for (; j + 8 <= width; j += 8) {
+        __m256i lo = zero;
+        __m256i hi = zero;
+        __m256i mn = none;
+        __m256i mx = zero;
+        __m256i zeros = zero;
+        for (size_t t = 0; t < nrows; ++t) {
+            __m256i v = _mm256_loadu_si256((const __m256i *)(src + t * stride + j));
+            __m256i is_zero = _mm256_cmpeq_epi32(v, zero);
+            lo = _mm256_add_epi64(lo, _mm256_cvtepi32_epi64(_mm256_castsi256_si128(v)));
+            hi = _mm256_add_epi64(hi, _mm256_cvtepi32_epi64(_mm256_extracti128_si256(v, 1)));
+            mn = _mm256_min_epi32(mn, _mm256_blendv_epi8(v, none, is_zero));
+            mx = _mm256_max_epi32(mx, v);
+            zeros = _mm256_sub_epi32(zeros, is_zero);
+        }
+        __m256i cnt = _mm256_sub_epi32(_mm256_set1_epi32((int32_t)nrows), zeros);
+        mn = _mm256_blendv_epi8(mn, zero, _mm256_cmpeq_epi32(cnt, zero));
+        _mm256_storeu_si256((__m256i *)(sum + j), lo);
+        _mm256_storeu_si256((__m256i *)(sum + j + 4), hi);
+        _mm256_storeu_si256((__m256i *)(min + j), mn);
+        _mm256_storeu_si256((__m256i *)(max + j), mx);
+        _mm256_storeu_si256((__m256i *)(count + j), cnt);
+    }
+    reduce_stats_scalar(src + j, stride, nrows, width - j, sum + j, min + j, max + j, count + j);
+}
+
+// --- AVX-512: 16 列ずつ ---
+
+__attribute__((target("avx512f")))
+static void reduce_rows_avx512(const int32_t *src, size_t stride, size_t nrows, size_t width, int64_t *sum,
+                               int32_t *max) {
+    size_t j = 0;
+    for (; nrows > 0 && j + 16 <= width; j += 16) {
+        __m512i lo = _mm512_setzero_si512();
+        __m512i hi = _mm512_setzero_si512();
+        __m512i mx = _mm512_loadu_si512(src + j);
+        for (size_t t = 0; t < nrows; ++t) {
+            __m512i v = _mm512_loadu_si512(src + t * stride + j);
+            lo = _mm512_add_epi64(lo, _mm512_cvtepi32_epi64(_mm512_castsi512_si256(v)));
+            hi = _mm512_add_epi64(hi, _mm512_cvtepi32_epi64(_mm512_extracti64x4_epi64(v, 1)));
+            mx = _mm512_max_epi32(mx, v);
+        }
+        _mm512_storeu_si512(sum + j, lo);
+        _mm512_storeu_si512(sum + j + 8, hi);
+        _mm512_storeu_si512(max + j, mx);
+    }
+    reduce_rows_scalar(src + j, stride, nrows, width - j, sum + j, max + j);
+}
+
+__attribute__((target("avx512f")))
+static void reduce_sums_avx512(const int64_t *sum_src, const int32_t *max_src, size_t stride, size_t nrows,
+                               size_t width, int64_t *sum, int32_t *max) {
+    size_t j = 0;
+    for (; nrows > 0 && j + 16 <= width; j += 16) {
+        __m512i lo = _mm512_setzero_si512();
+        __m512i hi = _mm512_setzero_si512();
+        __m512i mx = _mm512_loadu_si512(max_src + j);
+        for (size_t t = 0; t < nrows; ++t) {
+            lo = _mm512_add_epi64(lo, _mm512_loadu_si512(sum_src + t * stride + j));
+            hi = _mm512_add_epi64(hi, _mm512_loadu_si512(sum_src + t * stride + j + 8));
+            mx = _mm512_max_epi32(mx, _mm512_loadu_si512(max_src + t * stride + j));
+        }
+        _mm512_storeu_si512(sum + j, lo);
+        _mm512_storeu_si512(sum + j + 8, hi);
+        _mm512_storeu_si512(max + j, mx);
+    }
+    reduce_sums_scalar(sum_src + j, max_src + j, stride, nrows, width - j, sum + j, max + j);
+}
+
+__attribute__((target("avx512f")))
+static void reduce_stats_avx512(const int32_t *src, size_t stride, size_t nrows, size_t width, int64_t *sum,
+                                int32_t *min, int32_t *max, int32_t *count) {
+    const __m512i zero = _mm512_setzero_si512();
+    const __m512i one = _mm512_set1_epi32(1);
+    size_t j = 0;
+    for (; j + 16 <= width; j += 16) {
+        __m512i lo = zero;
+        __m512i hi = zero;
+        __m512i mn = _mm512_set1_epi32(INT32_MAX);
+        __m512i mx = zero;
+        __m512i cnt = zero;
+        for (size_t t = 0; t < nrows; ++t) {
+            __m512i v = _mm512_loadu_si512(src + t * stride + j);
+            __mmask16 nonzero = _mm512_test_epi32_mask(v, v);
+            lo = _mm512_add_epi64(lo, _mm512_cvtepi32_epi64(_mm512_castsi512_si256(v)));
+            hi = _mm512_add_epi64(hi, _mm512_cvtepi32_epi64(_mm512_extracti64x4_epi64(v, 1)));
+            mn = _mm512_mask_min_epi32(mn, nonzero, mn, v);
+            mx = _mm512_max_epi32(mx, v);
+            cnt = _mm512_mask_add_epi32(cnt, nonzero, cnt, one);
+        }
+        mn = _mm512_mask_mov_epi32(mn, _mm512_cmpeq_epi32_mask(cnt, zero), zero);
+        _mm512_storeu_si512(sum + j, lo);
+        _mm512_storeu_si512(sum + j + 8, hi);
+        _mm512_storeu_si512(min + j, mn);
+        _mm512_storeu_si512(max + j, mx);
+        _mm512_storeu_si512(count + j, cnt);
+    }
+    reduce_stats_scalar(src + j, stride, nrows, width - j, sum + j, min + j, max + j, count + j);
+}
+
+// --- カーネルの選択 ---
+
+static const RollupKernels KERNELS[] = {
+    {ROLLUP_ISA_SCALAR, reduce_rows_scalar, reduce_sums_scalar, reduce_stats_scalar},
+    {ROLLUP_ISA_AVX2, reduce_rows_avx2, reduce_sums_avx2, reduce_stats_avx2},
+    {ROLLUP_ISA_AVX512, reduce_rows_avx512, reduce_sums_avx512, reduce_stats_avx512},
+};
+
+static const RollupKernels *active_kernels = nullptr;
+static pthread_once_t kernels_once = PTHREAD_ONCE_INIT;
+
+static bool isa_supported(RollupIsa isa) {
+    __builtin_cpu_init();
+    switch (isa) {
+        case ROLLUP_ISA_SCALAR: return true;
+        case ROLLUP_ISA_AVX2: return __builtin_cpu_supports("avx2");
+        case ROLLUP_ISA_AVX512: return __builtin_cpu_supports("avx512f");
+        default: return false;
+    }
+}
+
+static void select_best_kernels(void) {
+    if (active_kernels != nullptr) {
+        return;
+    }
+    for (int i = (int)(sizeof(KERNELS) / sizeof(KERNELS[0])) - 1; i >= 0; --i) {
+        if (isa_supported(KERNELS[i].isa)) {
+            active_kernels = &KERNELS[i];
+            return;
+        }
+    }
+}
+
+static const RollupKernels* kernels(void) {
+    pthread_once(&kernels_once, select_best_kernels);
+    return active_kernels;
+}
+
+int rollup_use_isa(RollupIsa isa) {
+    pthread_once(&kernels_once, select_best_kernels);
+    if (isa == ROLLUP_ISA_AUTO) {
+        active_kernels = nullptr;
+        select_best_kernels();
+        return 0;
+    }
+    if (!isa_supported(isa)) {
+        return -1;
+    }
+    for (size_t i = 0; i < sizeof(KERNELS) / sizeof(KERNELS[0]); ++i) {
+        if (KERNELS[i].isa == isa) {
+            active_kernels = &KERNELS[i];
+            return 0;
+        }
+    }
+    return -1;
+}
+
+RollupIsa rollup_active_isa(void) {
+    return kernels()->isa;
+}
+
+const char* rollup_isa_name(RollupIsa isa) {
+    switch (isa) {
+        case ROLLUP_ISA_SCALAR: return "scalar";
+        case ROLLUP_ISA_AVX2: return "avx2";
+        case ROLLUP_ISA_AVX512: return "avx512";
+        case ROLLUP_ISA_AUTO:
+        default: return "auto";
+    }
+}
+
+void rollup_reduce_rows(const int32_t *src, size_t stride, size_t nrows, size_t width, int64_t *sum, int32_t *max) {
+    kernels()->reduce_rows(src, stride, nrows, width, sum, max);
+}
+
+void rollup_reduce_sums(const int64_t *sum_src, const int32_t *max_src, size_t stride, size_t nrows, size_t width,
+                        int64_t *sum, int32_t *max) {
+    kernels()->reduce_sums(sum_src, max_src, stride, nrows, width, sum, max);
+}
+
+void rollup_reduce_stats(const int32_t *src, size_t stride, size_t nrows, size_t width, int64_t *sum, int32_t *min,
+                         int32_t *max, int32_t *count) {
+    kernels()->reduce_stats(src, stride, nrows, width, sum, min, max, count);
+}
+
+// --- 区域と区間 ---
+
+const char* rollup_area_name(RollupArea area) {
+    switch (area) {
+        case ROLLUP_AREA_MESH: return "mesh";
+        case ROLLUP_AREA_MESH3: return "mesh3";
+        case ROLLUP_AREA_MESH2: return "mesh2";
+        case ROLLUP_AREA_MESH1: return "mesh1";
+        default: return "unknown";
+    }
+}
+
+const char* rollup_period_name(RollupPeriod period) {
+    switch (period) {
+        case ROLLUP_PERIOD_HOUR: return "hour";
+        case ROLLUP_PERIOD_DAY: return "day";
+        case ROLLUP_PERIOD_MONTH: return "month";
+        case ROLLUP_PERIOD_YEAR: return "year";
+        default: return "unknown";
+    }
+}
+
+uint32_t rollup_area_divisor(RollupArea area) {
+    switch (area) {
+        case ROLLUP_AREA_MESH3: return 10;
+        case ROLLUP_AREA_MESH2: return 1000;
+        case ROLLUP_AREA_MESH1: return 100000;
+        case ROLLUP_AREA_MESH:
+        default: return 1;
+    }
+}
+
+// 1970-01-01 からの日数 (先発グレゴリオ暦)
+static int64_t days_from_civil(int64_t y, unsigned m, unsigned d) {
+    y -= m <= 2;
+    int64_t era = (y >= 0 ? y : y - 399) / 400;
+    unsigned yoe = (unsigned)(y - era * 400);
+    unsigned doy = (153 * (m > 2 ? m - 3 : m + 9) + 2) / 5 + d - 1;
+    unsigned doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    return era * 146097 + (int64_t)doe - 719468;
+}
+
+// REFERENCE_MOBAKU_DATETIME ("YYYY-MM-DD HH:MM:SS") の offset 文字目から width 桁の数
+static unsigned reference_field(size_t offset, size_t width) {
+    unsigned value = 0;
+    for (size_t i = 0; i < width; ++i) {
+        value = value * 10 + (unsigned)(REFERENCE_MOBAKU_DATETIME[offset + i] - '0');
+    }
+    return value;
+}
+
+// 時刻インデックス 0 (REFERENCE_MOBAKU_DATETIME。月の初日の 0 時であること) の月から数えて
+// month 番目の月の初日が、時刻インデックス 0 の日から何日目か
+static hsize_t month_start_day(hsize_t month) {
+    int64_t year = reference_field(0, 4);
+    unsigned first_month = reference_field(5, 2);
+    int64_t m = (int64_t)first_month - 1 + (int64_t)month;
+    return (hsize_t)(days_from_civil(year + m / 12, (unsigned)(m % 12) + 1, 1) -
+                     days_from_civil(year, first_month, reference_field(8, 2)));
+}
+
+hsize_t rollup_bucket_start(RollupPeriod period, hsize_t bucket) {
+    switch (period) {
+        case ROLLUP_PERIOD_DAY: return bucket * 24;
+        case ROLLUP_PERIOD_MONTH: return month_start_day(bucket) * 24;
+        case ROLLUP_PERIOD_YEAR: return month_start_day(bucket * 12) * 24;
+        case ROLLUP_PERIOD_HOUR:
+        default: return bucket;
+    }
+}
+
+hsize_t rollup_bucket_of(RollupPeriod period, hsize_t hour) {
+    hsize_t day = hour / 24;
+    hsize_t bucket;
+    switch (period) {
+        case ROLLUP_PERIOD_DAY: return day;
+        case ROLLUP_PERIOD_MONTH: bucket = day / 31; break;
+        case ROLLUP_PERIOD_YEAR: bucket = day / 366; break;
+        case ROLLUP_PERIOD_HOUR:
+        default: return hour;
+    }
+    // 長めの区間で割った下限から進める
+    while (rollup_bucket_start(period, bucket + 1) <= hour) {
+        ++bucket;
+    }
+    return bucket;
+}
+
+void rollup_dataset_name(char *buf, size_t size, RollupArea area, RollupPeriod period, RollupStat stat) {
+    snprintf(buf, size, "%s/%s_%s_%s", ROLLUP_GROUP, rollup_area_name(area), rollup_period_name(period),
+             stat == ROLLUP_STAT_SUM ? "sum" : "max");
+}
+
+// rows 行を覆う区間の数
+static hsize_t bucket_count(RollupPeriod period, hsize_t rows) {
+    return rows == 0 ? 0 : rollup_bucket_of(period, rows - 1) + 1;
+}
+
+static bool has_dataset(RollupArea area, RollupPeriod period, RollupStat stat) {
+    if (period == ROLLUP_PERIOD_HOUR) {
+        return area != ROLLUP_AREA_MESH && stat == ROLLUP_STAT_SUM;
+    }
+    return true;
+}
+
+static hid_t stat_type(RollupPeriod period, RollupStat stat) {
+    return period != ROLLUP_PERIOD_HOUR && stat == ROLLUP_STAT_SUM ? H5T_NATIVE_INT64 : H5T_NATIVE_INT32;
+}
+
+hsize_t read_rollup_rows(hid_t file_id) {
+    if (H5Lexists(file_id, ROLLUP_GROUP, H5P_DEFAULT) <= 0 ||
+        H5Aexists_by_name(file_id, ROLLUP_GROUP, ROLLUP_ROWS_ATTR, H5P_DEFAULT) <= 0) {
+        return 0;
+    }
+    hid_t attr_id = H5Aopen_by_name(file_id, ROLLUP_GROUP, ROLLUP_ROWS_ATTR, H5P_DEFAULT, H5P_DEFAULT);
+    unsigned long long rows = 0;
+    if (H5Aread(attr_id, H5T_NATIVE_ULLONG, &rows) < 0) {
+        rows = 0;
+    }
+    H5Aclose(attr_id);
+    return (hsize_t)rows;
+}
+
+static herr_t write_rollup_rows(hid_t group_id, hsize_t rows) {
+    hid_t attr_id;
+    if (H5Aexists(group_id, ROLLUP_ROWS_ATTR) > 0) {
+        attr_id = H5Aopen(group_id, ROLLUP_ROWS_ATTR, H5P_DEFAULT);
+    } else {
+        hid_t space_id = H5Screate(H5S_SCALAR);
+        attr_id = H5Acreate(group_id, ROLLUP_ROWS_ATTR, H5T_NATIVE_ULLONG, space_id, H5P_DEFAULT, H5P_DEFAULT);
+        H5Sclose(space_id);
+    }
+    if (attr_id < 0) {
+        return -1;
+    }
+    unsigned long long value = rows;
+    herr_t status = H5Awrite(attr_id, H5T_NATIVE_ULLONG, &value);
+    H5Aclose(attr_id);
+    return status;
+}
+
+herr_t lower_rollup_rows(hid_t file_id, hsize_t from) {
+    if (read_rollup_rows(file_id) <= from) {
+        return 0;
+    }
+    hid_t group_id = H5Gopen(file_id, ROLLUP_GROUP, H5P_DEFAULT);
+    if (group_id < 0) {
+        return -1;
+    }
+    herr_t status = write_rollup_rows(group_id, from);
+    H5Gclose(group_id);
+    return status;
+}
+
+// --- 区域の表 ---
+
+typedef struct {
+    uint32_t *ids[NUM_ROLLUP_AREAS];        // 区域のコード (mesh は meshid_list)
+    hsize_t count[NUM_ROLLUP_AREAS];
+    uint32_t *region_of[NUM_ROLLUP_AREAS];  // 列ごとの区域の番号 (mesh は NULL)
+    hsize_t *first_col[NUM_ROLLUP_AREAS];   // 区域の最初の列。count + 1 個目は列数
+} RollupAreas;
+
+static void free_rollup_areas(RollupAreas *a) {
+    for (int area = 0; area < NUM_ROLLUP_AREAS; ++area) {
+        free(a->ids[area]);
+        free(a->region_of[area]);
+        free(a->first_col[area]);
+    }
+}
+
+static uint32_t* read_meshid_list(hid_t file_id, hsize_t *n) {
+    if (H5Lexists(file_id, "meshid_list", H5P_DEFAULT) <= 0) {
+        fprintf(stderr, "meshid_list dataset is missing\n");
+        return NULL;
+    }
+    hid_t dataset_id = H5Dopen(file_id, "meshid_list", H5P_DEFAULT);
+    hid_t space_id = H5Dget_space(dataset_id);
+    *n = (hsize_t)H5Sget_simple_extent_npoints(space_id);
+    H5Sclose(space_id);
+    uint32_t *ids = (uint32_t *)malloc(sizeof(uint32_t) * (*n > 0 ? *n : 1));
+    if (ids == NULL || H5Dread(dataset_id, H5T_NATIVE_UINT32, H5S_ALL, H5S_ALL, H5P_DEFAULT, ids) < 0) {
+        fprintf(stderr, "Failed to read meshid_list\n");
+        free(ids);
+        ids = NULL;
+    }
+    H5Dclose(dataset_id);
+    return ids;
+}
+
+static int load_rollup_areas(hid_t file_id, hsize_t cols, RollupAreas *a) {
+    memset(a, 0, sizeof(*a));
+    hsize_t n = 0;
+    a->ids[ROLLUP_AREA_MESH] = read_meshid_list(file_id, &n);
+    if (a->ids[ROLLUP_AREA_MESH] == NULL) {
+        return -1;
+    }
+    if (n != cols) {
+        fprintf(stderr, "meshid_list has %llu meshes but population_data has %llu\n", (unsigned long long)n,
+                (unsigned long long)cols);
+        return -1;
+    }
+    const uint32_t *meshes = a->ids[ROLLUP_AREA_MESH];
+    for (hsize_t j = 1; j < cols; ++j) {
+        if (meshes[j] <= meshes[j - 1]) {
+            fprintf(stderr, "meshid_list must be in ascending order to build rollups\n");
+            return -1;
+        }
+    }
+    a->count[ROLLUP_AREA_MESH] = cols;
+    for (int area = ROLLUP_AREA_MESH3; area < NUM_ROLLUP_AREAS; ++area) {
+        uint32_t divisor = rollup_area_divisor((RollupArea)area);
+        a->ids[area] = (uint32_t *)malloc(sizeof(uint32_t) * (cols > 0 ? cols : 1));
+        a->region_of[area] = (uint32_t *)malloc(sizeof(uint32_t) * (cols > 0 ? cols : 1));
+        a->first_col[area] = (hsize_t *)malloc(sizeof(hsize_t) * (cols + 1));
+        if (a->ids[area] == NULL || a->region_of[area] == NULL || a->first_col[area] == NULL) {
+            perror("malloc failed");
+            return -1;
+        }
+        hsize_t count = 0;
+        for (hsize_t j = 0; j < cols; ++j) {
+            uint32_t code = meshes[j] / divisor;
+            if (count == 0 || a->ids[area][count - 1] != code) {
+                a->ids[area][count] = code;
+                a->first_col[area][count] = j;
+                ++count;
+            }
+            a->region_of[area][j] = (uint32_t)(count - 1);
+        }
+        a->first_col[area][count] = cols;
+        a->count[area] = count;
+    }
+    return 0;
+}
+
+// --- データセット ---
+
+typedef struct {
+    hid_t group_id;
+    hid_t dataset_id[NUM_ROLLUP_AREAS][NUM_ROLLUP_PERIODS][2];  // RollupStat ごと。ないものは H5I_INVALID_HID
+} RollupDatasets;
+
+static void close_rollup_datasets(RollupDatasets *d) {
+    for (int area = 0; area < NUM_ROLLUP_AREAS; ++area) {
+        for (int period = 0; period < NUM_ROLLUP_PERIODS; ++period) {
+            for (int stat = 0; stat < 2; ++stat) {
+                if (d->dataset_id[area][period][stat] >= 0) {
+                    H5Dclose(d->dataset_id[area][period][stat]);
+                }
+            }
+        }
+    }
+    if (d->group_id >= 0) {
+        H5Gclose(d->group_id);
+    }
+}
+
+static hid_t create_rollup_dataset(hid_t group_id, const char *name, hid_t type_id, hsize_t rows, hsize_t cols,
+                                   hsize_t time_chunk, hsize_t area_chunk, hid_t dapl_id) {
+    hsize_t dims[2] = {rows, cols};
+    hsize_t max_dims[2] = {H5S_UNLIMITED, cols};
+    hid_t space_id = H5Screate_simple(2, dims, max_dims);
+    hid_t plist_id = H5Pcreate(H5P_DATASET_CREATE);
+    hsize_t chunk_dims[2] = {time_chunk, area_chunk < cols ? area_chunk : (cols > 0 ? cols : 1)};
+    H5Pset_chunk(plist_id, 2, chunk_dims);
+    set_population_filters(plist_id, CHUNK_CODEC_DEFLATE, ROLLUP_DEFLATE_LEVEL);
+    hid_t dataset_id = H5Dcreate(group_id, name, type_id, space_id, H5P_DEFAULT, plist_id, dapl_id);
+    H5Pclose(plist_id);
+    H5Sclose(space_id);
+    return dataset_id;
+}
+
+static int write_area_ids(hid_t group_id, RollupArea area, const RollupAreas *a) {
+    char name[64];
+    snprintf(name, sizeof(name), "%s_ids", rollup_area_name(area));
+    if (H5Lexists(group_id, name, H5P_DEFAULT) > 0) {
+        hid_t dataset_id = H5Dopen(group_id, name, H5P_DEFAULT);
+        hid_t space_id = H5Dget_space(dataset_id);
+        hsize_t n = (hsize_t)H5Sget_simple_extent_npoints(space_id);
+        H5Sclose(space_id);
+        H5Dclose(dataset_id);
+        if (n != a->count[area]) {
+            fprintf(stderr, "%s/%s does not match meshid_list; delete the %s group and rebuild\n", ROLLUP_GROUP, name,
+                    ROLLUP_GROUP);
+            return -1;
+        }
+        return 0;
+    }
+    hsize_t dims[1] = {a->count[area]};
+    hid_t space_id = H5Screate_simple(1, dims, NULL);
+    hid_t dataset_id = H5Dcreate(group_id, name, H5T_NATIVE_UINT32, space_id, H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
+    herr_t status = dataset_id < 0 ? -1 : H5Dwrite(dataset_id, H5T_NATIVE_UINT32, H5S_ALL, H5S_ALL, H5P_DEFAULT,
+                                                     a->ids[area]);
+    if (dataset_id >= 0) {
+        H5Dclose(dataset_id);
+    }
+    H5Sclose(space_id);
+    return status < 0 ? -1 : 0;
+}
+
+// なければ作り、rows 行を覆うまで時間の軸を伸ばす
+static int open_rollup_datasets(hid_t file_id, const RollupAreas *a, hsize_t rows, hsize_t slab_rows,
+                                RollupDatasets *d) {
+    for (int area = 0; area < NUM_ROLLUP_AREAS; ++area) {
+        for (int period = 0; period < NUM_ROLLUP_PERIODS; ++period) {
+            d->dataset_id[area][period][0] = H5I_INVALID_HID;
+            d->dataset_id[area][period][1] = H5I_INVALID_HID;
+        }
+    }
+    d->group_id = H5Lexists(file_id, ROLLUP_GROUP, H5P_DEFAULT) > 0
+                      ? H5Gopen(file_id, ROLLUP_GROUP, H5P_DEFAULT)
+                      : H5Gcreate(file_id, ROLLUP_GROUP, H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
+    if (d->group_id < 0) {
+        fprintf(stderr, "Failed to open the %s group\n", ROLLUP_GROUP);
+        return -1;
+    }
+    for (int area = ROLLUP_AREA_MESH3; area < NUM_ROLLUP_AREAS; ++area) {
+        if (write_area_ids(d->group_id, (RollupArea)area, a) != 0) {
+            return -1;
+        }
+    }
+
+    // 時間方向のチャンクは1回目の走査で書く高さに揃え、区域方向は 1 チャンクが 1MiB 弱になる幅にする
+    const hsize_t time_chunk[NUM_ROLLUP_PERIODS] = {slab_rows, slab_rows / 24, 120, 16};
+    const hsize_t area_chunk[NUM_ROLLUP_PERIODS] = {16, 256, 1024, 4096};
+    hid_t dapl_id = H5Pcreate(H5P_DATASET_ACCESS);
+    H5Pset_chunk_cache(dapl_id, 12421, ROLLUP_CHUNK_CACHE_BYTES, 1.0);
+    int status = 0;
+    for (int area = 0; area < NUM_ROLLUP_AREAS && status == 0; ++area) {
+        for (int period = 0; period < NUM_ROLLUP_PERIODS && status == 0; ++period) {
+            for (int stat = 0; stat < 2 && status == 0; ++stat) {
+                if (!has_dataset((RollupArea)area, (RollupPeriod)period, (RollupStat)stat)) {
+                    continue;
+                }
+                char name[64];
+                snprintf(name, sizeof(name), "%s_%s_%s", rollup_area_name((RollupArea)area),
+                         rollup_period_name((RollupPeriod)period), stat == ROLLUP_STAT_SUM ? "sum" : "max");
+                hsize_t buckets = bucket_count((RollupPeriod)period, rows);
+                hid_t dataset_id;
+                if (H5Lexists(d->group_id, name, H5P_DEFAULT) > 0) {
+                    dataset_id = H5Dopen(d->group_id, name, dapl_id);
+                    if (dataset_id >= 0 && extend_time_axis(dataset_id, buckets) < 0) {
+                        H5Dclose(dataset_id);
+                        dataset_id = H5I_INVALID_HID;
+                    }
+                } else {
+                    dataset_id = create_rollup_dataset(d->group_id, name,
+                                                       stat_type((RollupPeriod)period, (RollupStat)stat), buckets,
+                                                       a->count[area], time_chunk[period], area_chunk[period],
+                                                       dapl_id);
+                }
+                if (dataset_id < 0) {
+                    fprintf(stderr, "Failed to open %s/%s\n", ROLLUP_GROUP, name);
+                    status = -1;
+                }
+                d->dataset_id[area][period][stat] = dataset_id;
+            }
+        }
+    }
+    H5Pclose(dapl_id);
+    return status;
+}
+
+// buf (行の間隔は mem_cols 要素) の nrows x ncols を dataset の (row, col) から書く
+static herr_t write_block(hid_t dataset_id, hid_t mem_type, const void *buf, hsize_t mem_cols, hsize_t row,
+                          hsize_t col, hsize_t nrows, hsize_t ncols) {
+    if (nrows == 0 || ncols == 0) {
+        return 0;
+    }
+    hsize_t mem_dims[2] = {nrows, mem_cols};
+    hsize_t mem_start[2] = {0, 0};
+    hsize_t start[2] = {row, col};
+    hsize_t count[2] = {nrows, ncols};
+    hid_t mem_space = H5Screate_simple(2, mem_dims, NULL);
+    H5Sselect_hyperslab(mem_space, H5S_SELECT_SET, mem_start, NULL, count, NULL);
+    hid_t file_space = H5Dget_space(dataset_id);
+    H5Sselect_hyperslab(file_space, H5S_SELECT_SET, start, NULL, count, NULL);
+    herr_t status = H5Dwrite(dataset_id, mem_type, mem_space, file_space, H5P_DEFAULT, buf);
+    H5Sclose(file_space);
+    H5Sclose(mem_space);
+    return status;
+}
+
+static herr_t read_block(hid_t dataset_id, hid_t mem_type, void *buf, hsize_t mem_cols, hsize_t row, hsize_t col,
+                         hsize_t nrows, hsize_t ncols) {
+    if (nrows == 0 || ncols == 0) {
+        return 0;
+    }
+    hsize_t mem_dims[2] = {nrows, mem_cols};
+    hsize_t mem_start[2] = {0, 0};
+    hsize_t start[2] = {row, col};
+    hsize_t count[2] = {nrows, ncols};
+    hid_t mem_space = H5Screate_simple(2, mem_dims, NULL);
+    H5Sselect_hyperslab(mem_space, H5S_SELECT_SET, mem_start, NULL, count, NULL);
+    hid_t file_space = H5Dget_space(dataset_id);
+    H5Sselect_hyperslab(file_space, H5S_SELECT_SET, start, NULL, count, NULL);
+    herr_t status = H5Dread(dataset_id, mem_type, mem_space, file_space, H5P_DEFAULT, buf);
+    H5Sclose(file_space);
+    H5Sclose(mem_space);
+    return status;
+}
+
+// --- 1回目の走査: 時間と日 ---
+
+typedef struct {
+    const PopulationSlab *slab;
+    const RollupAreas *areas;
+    bool mesh_written;                          // mesh の日の集計は取り込み時に書いてあるので作らない
+    hsize_t c_begin;
+    hsize_t days;                               // このスラブの日数 (最後の日は欠けていてよい)
+    int64_t *mesh_day_sum;                      // days x slab_cols
+    int32_t *mesh_day_max;
+    // 区域ごとの窓。列 0 が区域 lo で、ntouched 個の区域がこのスラブの列にかかる
+    size_t cap[NUM_ROLLUP_AREAS];               // 窓の幅
+    int32_t *hour_sum[NUM_ROLLUP_AREAS];        // slab_rows x cap
+    int64_t *day_sum[NUM_ROLLUP_AREAS];         // days x cap
+    int32_t *day_max[NUM_ROLLUP_AREAS];
+    hsize_t lo[NUM_ROLLUP_AREAS];
+    hsize_t ntouched[NUM_ROLLUP_AREAS];
+    hsize_t ncomplete[NUM_ROLLUP_AREAS];        // 列がすべてこのスラブまでに出てきた区域の数
+    bool carried[NUM_ROLLUP_AREAS];             // 列 0 に前のスラブで途中まで足した値が入っている
+} RollupSlab;
+
+typedef struct {
+    SlabWorker base;
+    RollupSlab *r;
+} RollupWorker;
+
+// [0, n) を 16 の倍数の幅でワーカーに分ける
+static void worker_range(const SlabWorker *w, hsize_t n, hsize_t align, hsize_t *begin, hsize_t *end) {
+    hsize_t per = (n + w->num_workers - 1) / w->num_workers;
+    per = (per + align - 1) / align * align;
+    *begin = per * w->id < n ? per * w->id : n;
+    *end = *begin + per < n ? *begin + per : n;
+}
+
+static hsize_t rows_in_day(hsize_t height, hsize_t day) {
+    return height - day * 24 < 24 ? height - day * 24 : 24;
+}
+
+// 列ごとの日の集計と、区域ごとの時間の合計
+static void* reduce_slab(void *arg) {
+    RollupWorker *w = (RollupWorker *)arg;
+    RollupSlab *r = w->r;
+    const PopulationSlab *s = r->slab;
+    hsize_t begin, end;
+    worker_range(&w->base, s->width, 16, &begin, &end);
+    for (hsize_t d = 0; d < r->days && begin < end && !r->mesh_written; ++d) {
+        rollup_reduce_rows(s->data + d * 24 * s->slab_cols + begin, s->slab_cols, rows_in_day(s->height, d),
+                           end - begin, r->mesh_day_sum + d * s->slab_cols + begin,
+                           r->mesh_day_max + d * s->slab_cols + begin);
+    }
+
+    // 区域の合計は行ごとに独立なので、行で分ける
+    worker_range(&w->base, s->height, 1, &begin, &end);
+    for (int area = ROLLUP_AREA_MESH3; area < NUM_ROLLUP_AREAS; ++area) {
+        const uint32_t *region_of = r->areas->region_of[area] + r->c_begin;
+        hsize_t lo = r->lo[area];
+        hsize_t keep = r->carried[area] ? 1 : 0;
+        for (hsize_t t = begin; t < end; ++t) {
+            int32_t *window = r->hour_sum[area] + t * r->cap[area];
+            const int *row = s->data + t * s->slab_cols;
+            memset(window + keep, 0, sizeof(int32_t) * (r->ntouched[area] - keep));
+            for (hsize_t j = 0; j < s->width; ++j) {
+                window[region_of[j] - lo] += row[j];
+            }
+        }
+    }
+    return NULL;
+}
+
+// 列がそろった区域の日の集計
+static void* reduce_regions(void *arg) {
+    RollupWorker *w = (RollupWorker *)arg;
+    RollupSlab *r = w->r;
+    for (int area = ROLLUP_AREA_MESH3; area < NUM_ROLLUP_AREAS; ++area) {
+        hsize_t begin, end;
+        worker_range(&w->base, r->ncomplete[area], 16, &begin, &end);
+        size_t cap = r->cap[area];
+        for (hsize_t d = 0; d < r->days && begin < end; ++d) {
+            rollup_reduce_rows(r->hour_sum[area] + d * 24 * cap + begin, cap, rows_in_day(r->slab->height, d),
+                               end - begin, r->day_sum[area] + d * cap + begin, r->day_max[area] + d * cap + begin);
+        }
+    }
+    return NULL;
+}
+
+static int rollup_slab_block(RollupSlab *r, const RollupDatasets *d, RollupWorker *workers, int num_workers,
+                             hsize_t t_begin, hsize_t c_begin, bool carry_valid[], hsize_t carry_region[]) {
+    const PopulationSlab *s = r->slab;
+    const RollupAreas *a = r->areas;
+    r->c_begin = c_begin;
+    r->days = (s->height + 23) / 24;
+    hsize_t c_end = c_begin + s->width;
+    for (int area = ROLLUP_AREA_MESH3; area < NUM_ROLLUP_AREAS; ++area) {
+        hsize_t lo = a->region_of[area][c_begin];
+        hsize_t hi = a->region_of[area][c_end - 1];
+        r->lo[area] = lo;
+        r->ntouched[area] = hi - lo + 1;
+        r->ncomplete[area] = a->first_col[area][hi + 1] <= c_end ? hi - lo + 1 : hi - lo;
+        r->carried[area] = carry_valid[area] && carry_region[area] == lo;
+    }
+    if (run_slab_workers(workers, sizeof(RollupWorker), num_workers, reduce_slab) != 0 ||
+        run_slab_workers(workers, sizeof(RollupWorker), num_workers, reduce_regions) != 0) {
+        return -1;
+    }
+
+    hsize_t day_begin = t_begin / 24;
+    if (!r->mesh_written &&
+        (write_block(d->dataset_id[ROLLUP_AREA_MESH][ROLLUP_PERIOD_DAY][ROLLUP_STAT_SUM], H5T_NATIVE_INT64,
+                    r->mesh_day_sum, s->slab_cols, day_begin, c_begin, r->days, s->width) < 0 ||
+         write_block(d->dataset_id[ROLLUP_AREA_MESH][ROLLUP_PERIOD_DAY][ROLLUP_STAT_MAX], H5T_NATIVE_INT32,
+                     r->mesh_day_max, s->slab_cols, day_begin, c_begin, r->days, s->width) < 0)) {
+        return -1;
+    }
+    for (int area = ROLLUP_AREA_MESH3; area < NUM_ROLLUP_AREAS; ++area) {
+        hsize_t n = r->ncomplete[area];
+        size_t cap = r->cap[area];
+        if (write_block(d->dataset_id[area][ROLLUP_PERIOD_HOUR][ROLLUP_STAT_SUM], H5T_NATIVE_INT32,
+                        r->hour_sum[area], cap, t_begin, r->lo[area], s->height, n) < 0 ||
+            write_block(d->dataset_id[area][ROLLUP_PERIOD_DAY][ROLLUP_STAT_SUM], H5T_NATIVE_INT64,
+                        r->day_sum[area], cap, day_begin, r->lo[area], r->days, n) < 0 ||
+            write_block(d->dataset_id[area][ROLLUP_PERIOD_DAY][ROLLUP_STAT_MAX], H5T_NATIVE_INT32,
+                        r->day_max[area], cap, day_begin, r->lo[area], r->days, n) < 0) {
+            return -1;
+        }
+        // 列が次のスラブに続く区域は、途中までの合計を窓の先頭に移して持ち越す
+        carry_valid[area] = n < r->ntouched[area];
+        carry_region[area] = r->lo[area] + n;
+        if (carry_valid[area] && n > 0) {
+            for (hsize_t t = 0; t < s->height; ++t) {
+                r->hour_sum[area][t * cap] = r->hour_sum[area][t * cap + n];
+            }
+        }
+    }
+    return 0;
+}
+
+// スラブの列の範囲にかかる区域の数の最大
+static size_t max_regions_per_block(const RollupAreas *a, RollupArea area, hsize_t cols, hsize_t slab_cols) {
+    size_t max = 1;
+    for (hsize_t c = 0; c < cols; c += slab_cols) {
+        hsize_t end = c + slab_cols < cols ? c + slab_cols : cols;
+        size_t n = a->region_of[area][end - 1] - a->region_of[area][c] + 1;
+        max = n > max ? n : max;
+    }
+    return max;
+}
+
+static int rollup_hours_and_days(hid_t src_id, const RollupAreas *a, const RollupDatasets *d, hsize_t rows,
+                                 hsize_t first, hsize_t slab_rows, hsize_t slab_cols, bool mesh_written,
+                                 int num_workers) {
+    PopulationSlab slab;
+    RollupSlab r = {.slab = &slab, .areas = a, .mesh_written = mesh_written};
+    RollupWorker *workers = (RollupWorker *)calloc(num_workers, sizeof(RollupWorker));
+    int status = open_population_slab(&slab, src_id, rows, slab_rows, slab_cols, num_workers);
+    hsize_t days = slab_rows / 24;
+    r.mesh_day_sum = (int64_t *)malloc(sizeof(int64_t) * days * slab_cols);
+    r.mesh_day_max = (int32_t *)malloc(sizeof(int32_t) * days * slab_cols);
+    bool allocated = workers != NULL && r.mesh_day_sum != NULL && r.mesh_day_max != NULL;
+    for (int area = ROLLUP_AREA_MESH3; area < NUM_ROLLUP_AREAS; ++area) {
+        r.cap[area] = max_regions_per_block(a, (RollupArea)area, slab.cols, slab_cols);
+        r.hour_sum[area] = (int32_t *)malloc(sizeof(int32_t) * slab_rows * r.cap[area]);
+        r.day_sum[area] = (int64_t *)malloc(sizeof(int64_t) * days * r.cap[area]);
+        r.day_max[area] = (int32_t *)malloc(sizeof(int32_t) * days * r.cap[area]);
+        allocated = allocated && r.hour_sum[area] != NULL && r.day_sum[area] != NULL && r.day_max[area] != NULL;
+    }
+    if (status == 0 && !allocated) {
+        perror("malloc failed");
+        status = -1;
+    }
+    for (int i = 0; i < num_workers && workers != NULL; ++i) {
+        workers[i] = (RollupWorker){.base = {.id = i, .num_workers = num_workers}, .r = &r};
+    }
+
+    for (hsize_t t_begin = first; t_begin < slab.rows && status == 0; t_begin += slab_rows) {
+        bool carry_valid[NUM_ROLLUP_AREAS] = {false};
+        hsize_t carry_region[NUM_ROLLUP_AREAS] = {0};
+        for (hsize_t c_begin = 0; c_begin < slab.cols && status == 0; c_begin += slab_cols) {
+            status = read_population_slab(&slab, t_begin, c_begin);
+            if (status == 0) {
+                status = rollup_slab_block(&r, d, workers, num_workers, t_begin, c_begin, carry_valid, carry_region);
+            }
+        }
+    }
+
+    for (int area = ROLLUP_AREA_MESH3; area < NUM_ROLLUP_AREAS; ++area) {
+        free(r.hour_sum[area]);
+        free(r.day_sum[area]);
+        free(r.day_max[area]);
+    }
+    free(r.mesh_day_sum);
+    free(r.mesh_day_max);
+    free(workers);
+    close_population_slab(&slab);
+    return status;
+}
+
+// --- 2回目の走査: 日から月と年 ---
+
+static int rollup_months_and_years(const RollupDatasets *d, RollupArea area, hsize_t regions, hsize_t rows,
+                                   hsize_t first) {
+    hsize_t year_begin = rollup_bucket_of(ROLLUP_PERIOD_YEAR, first);
+    hsize_t month_begin = year_begin * 12;
+    hsize_t day_begin = rollup_bucket_start(ROLLUP_PERIOD_YEAR, year_begin) / 24;
+    hsize_t ndays = bucket_count(ROLLUP_PERIOD_DAY, rows) - day_begin;
+    hsize_t nmonths = bucket_count(ROLLUP_PERIOD_MONTH, rows) - month_begin;
+    hsize_t nyears = bucket_count(ROLLUP_PERIOD_YEAR, rows) - year_begin;
+    hsize_t width = regions < ROLLUP_MERGE_COLS ? regions : ROLLUP_MERGE_COLS;
+
+    int64_t *day_sum = (int64_t *)malloc(sizeof(int64_t) * ndays * width);
+    int32_t *day_max = (int32_t *)malloc(sizeof(int32_t) * ndays * width);
+    int64_t *month_sum = (int64_t *)malloc(sizeof(int64_t) * nmonths * width);
+    int32_t *month_max = (int32_t *)malloc(sizeof(int32_t) * nmonths * width);
+    int64_t *year_sum = (int64_t *)malloc(sizeof(int64_t) * nyears * width);
+    int32_t *year_max = (int32_t *)malloc(sizeof(int32_t) * nyears * width);
+    int status = day_sum != NULL && day_max != NULL && month_sum != NULL && month_max != NULL && year_sum != NULL &&
+                 year_max != NULL ? 0 : -1;
+    if (status != 0) {
+        perror("malloc failed");
+    }
+    const hid_t (*ids)[2] = d->dataset_id[area];
+    for (hsize_t c = 0; c < regions && status == 0; c += width) {
+        hsize_t n = regions - c < width ? regions - c : width;
+        if (read_block(ids[ROLLUP_PERIOD_DAY][ROLLUP_STAT_SUM], H5T_NATIVE_INT64, day_sum, width, day_begin, c, ndays,
+                       n) < 0 ||
+            read_block(ids[ROLLUP_PERIOD_DAY][ROLLUP_STAT_MAX], H5T_NATIVE_INT32, day_max, width, day_begin, c, ndays,
+                       n) < 0) {
+            status = -1;
+            break;
+        }
+        for (hsize_t m = 0; m < nmonths; ++m) {
+            hsize_t from = rollup_bucket_start(ROLLUP_PERIOD_MONTH, month_begin + m) / 24 - day_begin;
+            hsize_t to = rollup_bucket_start(ROLLUP_PERIOD_MONTH, month_begin + m + 1) / 24 - day_begin;
+            to = to < ndays ? to : ndays;
+            rollup_reduce_sums(day_sum + from * width, day_max + from * width, width, to - from, n,
+                               month_sum + m * width, month_max + m * width);
+        }
+        for (hsize_t y = 0; y < nyears; ++y) {
+            hsize_t to = (y + 1) * 12 < nmonths ? (y + 1) * 12 : nmonths;
+            rollup_reduce_sums(month_sum + y * 12 * width, month_max + y * 12 * width, width, to - y * 12, n,
+                               year_sum + y * width, year_max + y * width);
+        }
+        if (write_block(ids[ROLLUP_PERIOD_MONTH][ROLLUP_STAT_SUM], H5T_NATIVE_INT64, month_sum, width, month_begin, c,
+                        nmonths, n) < 0 ||
+            write_block(ids[ROLLUP_PERIOD_MONTH][ROLLUP_STAT_MAX], H5T_NATIVE_INT32, month_max, width, month_begin, c,
+                        nmonths, n) < 0 ||
+            write_block(ids[ROLLUP_PERIOD_YEAR][ROLLUP_STAT_SUM], H5T_NATIVE_INT64, year_sum, width, year_begin, c,
+                        nyears, n) < 0 ||
+            write_block(ids[ROLLUP_PERIOD_YEAR][ROLLUP_STAT_MAX], H5T_NATIVE_INT32, year_max, width, year_begin, c,
+                        nyears, n) < 0) {
+            status = -1;
+        }
+    }
+    free(day_sum);
+    free(day_max);
+    free(month_sum);
+    free(month_max);
+    free(year_sum);
+    free(year_max);
+    return status;
+}
+
+int build_rollups(hid_t file_id, hsize_t rows, int num_workers) {
+    hid_t src_id = H5Dopen(file_id, "population_data", H5P_DEFAULT);
+    if (src_id < 0) {
+        fprintf(stderr, "Failed to open population_data dataset\n");
+        return -1;
+    }
+    hid_t space_id = H5Dget_space(src_id);
+    hsize_t dims[2];
+    H5Sget_simple_extent_dims(space_id, dims, NULL);
+    H5Sclose(space_id);
+    if (rows > dims[0]) {
+        rows = dims[0];
+    }
+    hsize_t cols = dims[1];
+    hsize_t src_chunk[2] = {0, 0};
+    hid_t plist_id = H5Dget_create_plist(src_id);
+    bool chunked = H5Pget_layout(plist_id) == H5D_CHUNKED;
+    if (chunked) {
+        H5Pget_chunk(plist_id, 2, src_chunk);
+    }
+    H5Pclose(plist_id);
+    // スラブは日の境目で切れるように 24 時間の倍数にする
+    hsize_t slab_rows = chunked ? (src_chunk[0] + 23) / 24 * 24 : ROLLUP_DEFAULT_SLAB_ROWS;
+    hsize_t slab_cols = chunked ? (ROLLUP_SLAB_COLS + src_chunk[1] - 1) / src_chunk[1] * src_chunk[1]
+                                : ROLLUP_SLAB_COLS;
+    if (num_workers <= 0) {
+        num_workers = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    }
+
+    RollupAreas areas;
+    RollupDatasets d = {.group_id = H5I_INVALID_HID};
+    int status = cols > 0 && load_rollup_areas(file_id, cols, &areas) == 0 ? 0 : -1;
+    if (status == 0) {
+        status = open_rollup_datasets(file_id, &areas, rows, slab_rows, &d);
+    }
+    hsize_t done = read_rollup_rows(file_id);
+    hsize_t first = done < rows ? done / slab_rows * slab_rows : rows;
+    // 区域の時間の合計は列をまたぐので population_data から作るが、mesh の段は取り込み時の集計をそのまま使う
+    bool mesh_written = read_summary_rows(file_id) >= rows;
+    if (status == 0 && first < rows) {
+        status = rollup_hours_and_days(src_id, &areas, &d, rows, first, slab_rows, slab_cols, mesh_written,
+                                       num_workers);
+    }
+    for (int area = mesh_written ? ROLLUP_AREA_MESH3 : ROLLUP_AREA_MESH; area < NUM_ROLLUP_AREAS && status == 0 &&
+                                                                         first < rows; ++area) {
+        status = rollup_months_and_years(&d, (RollupArea)area, areas.count[area], rows, first);
+    }
+    // データを永続化してから集計し終えた行数を記録する
+    if (status == 0 && first < rows) {
+        status = H5Fflush(file_id, H5F_SCOPE_LOCAL) >= 0 && write_rollup_rows(d.group_id, rows) >= 0 ? 0 : -1;
+    }
+    close_rollup_datasets(&d);
+    if (cols > 0) {
+        free_rollup_areas(&areas);
+    }
+    H5Dclose(src_id);
+    return status;
+}
+
+// --- 問い合わせ ---
+
+long long rollup_region(hid_t file_id, RollupArea area, uint32_t code) {
+    hsize_t n = 0;
+    uint32_t *ids = NULL;
+    if (area == ROLLUP_AREA_MESH) {
+        ids = read_meshid_list(file_id, &n);
+    } else {
+        char name[64];
+        snprintf(name, sizeof(name), "%s/%s_ids", ROLLUP_GROUP, rollup_area_name(area));
+        if (H5Lexists(file_id, ROLLUP_GROUP, H5P_DEFAULT) <= 0 || H5Lexists(file_id, name, H5P_DEFAULT) <= 0) {
+            return -1;
+        }
+        hid_t dataset_id = H5Dopen(file_id, name, H5P_DEFAULT);
+        hid_t space_id = H5Dget_space(dataset_id);
+        n = (hsize_t)H5Sget_simple_extent_npoints(space_id);
+        H5Sclose(space_id);
+        ids = (uint32_t *)malloc(sizeof(uint32_t) * (n > 0 ? n : 1));
+        if (ids != NULL && H5Dread(dataset_id, H5T_NATIVE_UINT32, H5S_ALL, H5S_ALL, H5P_DEFAULT, ids) < 0) {
+            free(ids);
+            ids = NULL;
+        }
+        H5Dclose(dataset_id);
+    }
+    long long region = -1;
+    // どちらも昇順
+    hsize_t lo = 0;
+    hsize_t hi = ids != NULL ? n : 0;
+    while (lo < hi) {
+        hsize_t mid = lo + (hi - lo) / 2;
+        if (ids[mid] < code) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    if (ids != NULL && lo < n && ids[lo] == code) {
+        region = (long long)lo;
+    }
+    free(ids);
+    return region;
+}
+
+herr_t read_rollup(hid_t file_id, RollupArea area, RollupPeriod period, RollupStat stat, hsize_t region, hsize_t first,
+                   hsize_t count, int64_t *out) {
+    if (count == 0) {
+        return 0;
+    }
+    char name[64];
+    if (period == ROLLUP_PERIOD_HOUR && area == ROLLUP_AREA_MESH) {
+        snprintf(name, sizeof(name), "population_data");
+    } else {
+        rollup_dataset_name(name, sizeof(name), area, period, has_dataset(area, period, stat) ? stat : ROLLUP_STAT_SUM);
+    }
+    hid_t dataset_id = H5Dopen(file_id, name, H5P_DEFAULT);
+    if (dataset_id < 0) {
+        fprintf(stderr, "Failed to open %s\n", name);
+        return -1;
+    }
+    herr_t status = read_block(dataset_id, H5T_NATIVE_INT64, out, 1, first, region, count, 1);
+    H5Dclose(dataset_id);
+    return status;
+}
+
+// 区間 [first, first + count) を読んで v に足す
+static int add_buckets(hid_t file_id, RollupArea area, RollupPeriod period, hsize_t region, hsize_t first,
+                       hsize_t count, RollupValue *v) {
+    int64_t *sums = (int64_t *)malloc(sizeof(int64_t) * count);
+    int64_t *maxes = (int64_t *)malloc(sizeof(int64_t) * count);
+    int status = sums != NULL && maxes != NULL ? 0 : -1;
+    if (status == 0 && (read_rollup(file_id, area, period, ROLLUP_STAT_SUM, region, first, count, sums) < 0 ||
+                        (period != ROLLUP_PERIOD_HOUR &&
+                         read_rollup(file_id, area, period, ROLLUP_STAT_MAX, region, first, count, maxes) < 0))) {
+        status = -1;
+    }
+    for (hsize_t i = 0; i < count && status == 0; ++i) {
+        // 人口は負にならないので、最大は 0 から始めてよい
+        int64_t max = period == ROLLUP_PERIOD_HOUR ? sums[i] : maxes[i];
+        v->max = max > v->max ? max : v->max;
+        v->sum += sums[i];
+    }
+    if (status == 0) {
+        v->reads[period]++;
+    }
+    free(sums);
+    free(maxes);
+    return status;
+}
+
+// [t0, t1) を period に丸ごと入る区間と、その前後の端に分ける
+static int aggregate_range(hid_t file_id, RollupArea area, hsize_t region, hsize_t t0, hsize_t t1, int period,
+                           RollupValue *v) {
+    if (t0 >= t1) {
+        return 0;
+    }
+    if (period == ROLLUP_PERIOD_HOUR) {
+        int status = add_buckets(file_id, area, ROLLUP_PERIOD_HOUR, region, t0, t1 - t0, v);
+        v->hours += t1 - t0;
+        return status;
+    }
+    hsize_t first = rollup_bucket_of((RollupPeriod)period, t0);
+    if (rollup_bucket_start((RollupPeriod)period, first) < t0) {
+        ++first;
+    }
+    hsize_t end = rollup_bucket_of((RollupPeriod)period, t1);
+    hsize_t inner_begin = rollup_bucket_start((RollupPeriod)period, first);
+    hsize_t inner_end = rollup_bucket_start((RollupPeriod)period, end);
+    if (first >= end) {
+        return aggregate_range(file_id, area, region, t0, t1, period - 1, v);
+    }
+    if (aggregate_range(file_id, area, region, t0, inner_begin, period - 1, v) != 0 ||
+        add_buckets(file_id, area, (RollupPeriod)period, region, first, end - first, v) != 0) {
+        return -1;
+    }
+    v->hours += inner_end - inner_begin;
+    return aggregate_range(file_id, area, region, inner_end, t1, period - 1, v);
+}
+
+int rollup_aggregate(hid_t file_id, RollupArea area, hsize_t region, hsize_t t0, hsize_t t1, RollupValue *out) {
+    memset(out, 0, sizeof(*out));
+    hsize_t done = read_rollup_rows(file_id);
+    // mesh の段は取り込み時の集計が先に進んでいることがある
+    if (area == ROLLUP_AREA_MESH && read_summary_rows(file_id) > done) {
+        done = read_summary_rows(file_id);
+    }
+    if (t1 > done || t0 > t1) {
+        fprintf(stderr, "Rollups cover hours [0, %llu)\n", (unsigned long long)done);
+        return -1;
+    }
+    return aggregate_range(file_id, area, region, t0, t1, ROLLUP_PERIOD_YEAR, out);
+}
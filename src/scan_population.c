@@ -0,0 +1,87 @@
+//
+// 期間の最大か合計がしきい値を超えるメッシュ、または上位 K 件を、チャンクの統計の索引で絞り込んで探す
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "chunk_index.h"
+
+static void print_cost(const ChunkQueryCost *cost) {
+    printf("read %llu of %llu values (%.2f%%), %llu index values, %llu meshes checked against population\n",
+           (unsigned long long)cost->values_read, (unsigned long long)cost->scan_values,
+           cost->scan_values > 0 ? 100.0 * (double)cost->values_read / (double)cost->scan_values : 0.0,
+           (unsigned long long)cost->index_values, (unsigned long long)cost->resolved);
+}
+
+// 列ごとのメッシュID。meshid_list がなければ列番号
+static uint32_t* column_mesh_ids(const PopulationReader *r) {
+    uint32_t *ids = (uint32_t *)malloc(sizeof(uint32_t) * (r->cols > 0 ? r->cols : 1));
+    if (ids == NULL) {
+        perror("malloc failed");
+        return NULL;
+    }
+    for (hsize_t c = 0; c < r->cols; ++c) {
+        ids[c] = (uint32_t)c;
+    }
+    for (size_t i = 0; i < r->num_ids; ++i) {
+        ids[r->id_to_col[i][1]] = r->id_to_col[i][0];
+    }
+    return ids;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 7 || (strcmp(argv[5], "above") != 0 && strcmp(argv[5], "top") != 0)) {
+        fprintf(stderr, "Usage: %s <hdf5_file> <max|sum> <first_hour> <end_hour> (above <threshold> | top <k>)\n",
+                argv[0]);
+        return 1;
+    }
+    ChunkQueryStat stat;
+    if (strcmp(argv[2], chunk_query_stat_name(CHUNK_QUERY_MAX)) == 0) {
+        stat = CHUNK_QUERY_MAX;
+    } else if (strcmp(argv[2], chunk_query_stat_name(CHUNK_QUERY_SUM)) == 0) {
+        stat = CHUNK_QUERY_SUM;
+    } else {
+        fprintf(stderr, "Unknown statistic: %s\n", argv[2]);
+        return 1;
+    }
+    hsize_t t0 = strtoull(argv[3], NULL, 10);
+    hsize_t t1 = strtoull(argv[4], NULL, 10);
+
+    PopulationReader *r = open_population_reader(argv[1]);
+    if (r == NULL) {
+        return 1;
+    }
+    uint32_t *ids = column_mesh_ids(r);
+    if (ids == NULL) {
+        close_population_reader(r);
+        return 1;
+    }
+    ChunkQueryCost cost;
+    long long n;
+    if (strcmp(argv[5], "above") == 0) {
+        hsize_t *columns;
+        n = chunk_index_above(r, stat, t0, t1, strtoll(argv[6], NULL, 10), &columns, &cost);
+        for (long long i = 0; i < n; ++i) {
+            printf("%u\n", ids[columns[i]]);
+        }
+        if (n >= 0) {
+            free(columns);
+        }
+    } else {
+        size_t k = strtoull(argv[6], NULL, 10);
+        ChunkQueryHit *hits = (ChunkQueryHit *)malloc(sizeof(ChunkQueryHit) * (k > 0 ? k : 1));
+        n = hits != NULL ? chunk_index_top_k(r, stat, t0, t1, k, hits, &cost) : -1;
+        for (long long i = 0; i < n; ++i) {
+            printf("%u %lld\n", ids[hits[i].column], (long long)hits[i].value);
+        }
+        free(hits);
+    }
+    if (n >= 0) {
+        printf("%lld meshes\n", n);
+        print_cost(&cost);
+    }
+    free(ids);
+    close_population_reader(r);
+    return n >= 0 ? 0 : 1;
+}
@@ -0,0 +1,264 @@
+//
+// 全メッシュのある時刻を読む問い合わせ向けに、population_data を時刻方向に細かいチャンクで写したデータセット
+//
+// population_data の時刻方向のチャンク1段 x SNAPSHOT_MESH_CHUNK 列ずつ (スラブ) 写す。
+// 生のチャンクの読み書きは呼び出したスレッドだけが行い (HDF5 はスレッドセーフではない)、
+// 元のチャンクの展開と写し先のチャンクの圧縮をワーカースレッドに分ける。
+//
+
+#include "snapshot_dataset.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "chunk_codec.h"
+#include "hdf5_ops.h"
+#include "population_slab.h"
+
+// population_data がチャンク化されていない (シャードをまとめた仮想データセット) ときのスラブの高さ
+#define SNAPSHOT_DEFAULT_SLAB_ROWS (SNAPSHOT_TIME_CHUNK * 365)
+
+// 写し先のチャンク (それぞれ chunk_codec_bound の大きさ)
+typedef struct {
+    const PopulationSlab *slab;
+    ChunkCodec codec;
+    int level;
+    int num_dst;
+    unsigned char **dst_raw;
+    size_t *dst_size;
+} SnapshotChunks;
+
+typedef struct {
+    SlabWorker base;
+    SnapshotChunks *c;
+    void *scratch;
+} SnapshotWorker;
+
+hsize_t read_snapshot_rows(hid_t snapshot_id) {
+    if (H5Aexists(snapshot_id, SNAPSHOT_ROWS_ATTR) <= 0) {
+        return 0;
+    }
+    hid_t attr_id = H5Aopen(snapshot_id, SNAPSHOT_ROWS_ATTR, H5P_DEFAULT);
+    unsigned long long rows = 0;
+    if (H5Aread(attr_id, H5T_NATIVE_ULLONG, &rows) < 0) {
+        rows = 0;
+    }
+    H5Aclose(attr_id);
+    return (hsize_t)rows;
+}
+
+static herr_t write_snapshot_rows(hid_t snapshot_id, hsize_t rows) {
+    hid_t attr_id;
+    if (H5Aexists(snapshot_id, SNAPSHOT_ROWS_ATTR) > 0) {
+        attr_id = H5Aopen(snapshot_id, SNAPSHOT_ROWS_ATTR, H5P_DEFAULT);
+    } else {
+        hid_t space_id = H5Screate(H5S_SCALAR);
+        attr_id = H5Acreate(snapshot_id, SNAPSHOT_ROWS_ATTR, H5T_NATIVE_ULLONG, space_id, H5P_DEFAULT, H5P_DEFAULT);
+        H5Sclose(space_id);
+    }
+    if (attr_id < 0) {
+        return -1;
+    }
+    unsigned long long value = rows;
+    herr_t status = H5Awrite(attr_id, H5T_NATIVE_ULLONG, &value);
+    H5Aclose(attr_id);
+    return status;
+}
+
+herr_t lower_snapshot_rows(hid_t file_id, hsize_t from) {
+    if (H5Lexists(file_id, SNAPSHOT_DATASET, H5P_DEFAULT) <= 0) {
+        return 0;
+    }
+    hid_t snapshot_id = H5Dopen(file_id, SNAPSHOT_DATASET, H5P_DEFAULT);
+    if (snapshot_id < 0) {
+        return -1;
+    }
+    herr_t status = read_snapshot_rows(snapshot_id) > from ? write_snapshot_rows(snapshot_id, from) : 0;
+    H5Dclose(snapshot_id);
+    return status;
+}
+
+// 写し先のチャンクはスラブの連続した SNAPSHOT_TIME_CHUNK 行なので、並べ替えずに圧縮できる
+static void* encode_snapshot_chunks(void *arg) {
+    SnapshotWorker *w = (SnapshotWorker *)arg;
+    SnapshotChunks *c = w->c;
+    hsize_t slab_cols = c->slab->slab_cols;
+    size_t rows_elems = (size_t)SNAPSHOT_TIME_CHUNK * slab_cols;
+    for (int d = w->base.id; d < c->num_dst && w->base.status == 0; d += w->base.num_workers) {
+        if (encode_chunk(c->codec, c->level, c->slab->data + (size_t)d * rows_elems, rows_elems * sizeof(int),
+                         sizeof(int), slab_cols, w->scratch, c->dst_raw[d], &c->dst_size[d]) != 0) {
+            w->base.status = -1;
+        }
+    }
+    return NULL;
+}
+
+// ワーカーで圧縮してから生のまま書く
+static int write_slab_chunks(hid_t dst_id, SnapshotChunks *c, SnapshotWorker *workers, int num_workers,
+                             hsize_t t_begin, hsize_t c_begin) {
+    c->num_dst = (int)((c->slab->height + SNAPSHOT_TIME_CHUNK - 1) / SNAPSHOT_TIME_CHUNK);
+    if (run_slab_workers(workers, sizeof(SnapshotWorker), num_workers, encode_snapshot_chunks) != 0) {
+        return -1;
+    }
+    for (int d = 0; d < c->num_dst; ++d) {
+        hsize_t offset[2] = {t_begin + (hsize_t)d * SNAPSHOT_TIME_CHUNK, c_begin};
+        if (H5Dwrite_chunk(dst_id, H5P_DEFAULT, 0, offset, c->dst_size[d], c->dst_raw[d]) < 0) {
+            fprintf(stderr, "Failed to write the %s chunk at %llu, %llu\n", SNAPSHOT_DATASET,
+                    (unsigned long long)offset[0], (unsigned long long)offset[1]);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// HDF5 のフィルタに任せて書く
+static int write_slab_hyperslab(hid_t dst_id, const PopulationSlab *slab, hsize_t t_begin, hsize_t c_begin) {
+    hsize_t start[2] = {t_begin, c_begin};
+    hsize_t count[2] = {slab->height, slab->width};
+    hsize_t mem_dims[2] = {slab->slab_rows, slab->slab_cols};
+    hsize_t mem_start[2] = {0, 0};
+    hid_t mem_space = H5Screate_simple(2, mem_dims, NULL);
+    H5Sselect_hyperslab(mem_space, H5S_SELECT_SET, mem_start, NULL, count, NULL);
+    hid_t dst_space = H5Dget_space(dst_id);
+    H5Sselect_hyperslab(dst_space, H5S_SELECT_SET, start, NULL, count, NULL);
+    herr_t status = H5Dwrite(dst_id, H5T_NATIVE_INT, mem_space, dst_space, H5P_DEFAULT, slab->data);
+    H5Sclose(dst_space);
+    H5Sclose(mem_space);
+    return status < 0 ? -1 : 0;
+}
+
+// 既存の population_snapshot を開くか、なければ population_data と同じ圧縮で作る
+static hid_t open_snapshot_dataset(hid_t file_id, hsize_t rows, hsize_t cols, ChunkCodec codec, int level) {
+    if (H5Lexists(file_id, SNAPSHOT_DATASET, H5P_DEFAULT) > 0) {
+        hid_t dst_id = H5Dopen(file_id, SNAPSHOT_DATASET, H5P_DEFAULT);
+        hid_t space_id = H5Dget_space(dst_id);
+        hsize_t dims[2];
+        H5Sget_simple_extent_dims(space_id, dims, NULL);
+        H5Sclose(space_id);
+        if (dims[1] != cols) {
+            fprintf(stderr, "%s has %llu meshes but population_data has %llu; delete it and rebuild\n",
+                    SNAPSHOT_DATASET, (unsigned long long)dims[1], (unsigned long long)cols);
+            H5Dclose(dst_id);
+            return H5I_INVALID_HID;
+        }
+        if (extend_time_axis(dst_id, rows) < 0) {
+            H5Dclose(dst_id);
+            return H5I_INVALID_HID;
+        }
+        return dst_id;
+    }
+    hsize_t mesh_chunk = cols < SNAPSHOT_MESH_CHUNK ? cols : SNAPSHOT_MESH_CHUNK;
+    return create_population_dataset(file_id, SNAPSHOT_DATASET, rows, cols, SNAPSHOT_TIME_CHUNK, mesh_chunk, codec,
+                                     level);
+}
+
+int build_snapshot_dataset(hid_t file_id, hsize_t rows, int num_workers) {
+    hid_t src_id = H5Dopen(file_id, "population_data", H5P_DEFAULT);
+    if (src_id < 0) {
+        fprintf(stderr, "Failed to open population_data dataset\n");
+        return -1;
+    }
+    hid_t space_id = H5Dget_space(src_id);
+    hsize_t dims[2];
+    H5Sget_simple_extent_dims(space_id, dims, NULL);
+    H5Sclose(space_id);
+    if (rows > dims[0]) {
+        rows = dims[0];
+    }
+    hsize_t cols = dims[1];
+
+    hsize_t src_chunk[2] = {0, 0};
+    hid_t plist_id = H5Dget_create_plist(src_id);
+    bool chunked = H5Pget_layout(plist_id) == H5D_CHUNKED;
+    if (chunked) {
+        H5Pget_chunk(plist_id, 2, src_chunk);
+    }
+    H5Pclose(plist_id);
+    ChunkCodec codec = CHUNK_CODEC_NONE;
+    int level = 0;
+    if (get_population_codec(src_id, &codec, &level) != 0) {
+        fprintf(stderr, "population_data has an unknown filter pipeline; %s is written uncompressed\n",
+                SNAPSHOT_DATASET);
+        codec = CHUNK_CODEC_NONE;
+        level = 0;
+    }
+
+    hid_t dst_id = open_snapshot_dataset(file_id, rows, cols, codec, level);
+    if (dst_id < 0) {
+        fprintf(stderr, "Failed to open %s dataset\n", SNAPSHOT_DATASET);
+        H5Dclose(src_id);
+        return -1;
+    }
+    hsize_t dst_chunk[2];
+    plist_id = H5Dget_create_plist(dst_id);
+    H5Pget_chunk(plist_id, 2, dst_chunk);
+    H5Pclose(plist_id);
+    ChunkCodec dst_codec;
+    int dst_level;
+    bool raw_write = get_population_codec(dst_id, &dst_codec, &dst_level) == 0 && dst_codec == codec &&
+                     dst_level == level && chunk_codec_in_producer(codec) && dst_chunk[0] == SNAPSHOT_TIME_CHUNK;
+
+    // スラブの高さは元のチャンクの高さを写し先のチャンクの高さに切り上げたもの
+    hsize_t slab_rows = chunked ? (src_chunk[0] + SNAPSHOT_TIME_CHUNK - 1) / SNAPSHOT_TIME_CHUNK * SNAPSHOT_TIME_CHUNK
+                                : SNAPSHOT_DEFAULT_SLAB_ROWS;
+    if (num_workers <= 0) {
+        num_workers = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    }
+    PopulationSlab slab;
+    int status = open_population_slab(&slab, src_id, rows, slab_rows, dst_chunk[1], num_workers);
+
+    SnapshotChunks c = {.slab = &slab, .codec = codec, .level = level};
+    int max_dst = raw_write ? (int)(slab_rows / SNAPSHOT_TIME_CHUNK) : 0;
+    size_t dst_bytes = sizeof(int) * SNAPSHOT_TIME_CHUNK * dst_chunk[1];
+    c.dst_raw = (unsigned char **)calloc(max_dst + 1, sizeof(unsigned char *));
+    c.dst_size = (size_t *)calloc(max_dst + 1, sizeof(size_t));
+    SnapshotWorker *workers = (SnapshotWorker *)calloc(num_workers, sizeof(SnapshotWorker));
+    if (status == 0 && (c.dst_raw == NULL || c.dst_size == NULL || workers == NULL)) {
+        perror("calloc failed");
+        status = -1;
+    }
+    for (int d = 0; d < max_dst && status == 0; ++d) {
+        c.dst_raw[d] = (unsigned char *)malloc(chunk_codec_bound(codec, dst_bytes));
+        status = c.dst_raw[d] != NULL ? 0 : -1;
+    }
+    for (int i = 0; i < num_workers && status == 0 && raw_write; ++i) {
+        workers[i] = (SnapshotWorker){.base = {.id = i, .num_workers = num_workers}, .c = &c};
+        workers[i].scratch = malloc(dst_bytes);
+        status = workers[i].scratch != NULL ? 0 : -1;
+    }
+    if (status != 0) {
+        perror("malloc failed");
+    }
+
+    hsize_t done = read_snapshot_rows(dst_id);
+    hsize_t first = done < rows ? done / slab_rows * slab_rows : rows;
+    for (hsize_t t_begin = first; t_begin < rows && status == 0; t_begin += slab_rows) {
+        for (hsize_t c_begin = 0; c_begin < cols && status == 0; c_begin += dst_chunk[1]) {
+            status = read_population_slab(&slab, t_begin, c_begin);
+            if (status == 0) {
+                status = raw_write ? write_slab_chunks(dst_id, &c, workers, num_workers, t_begin, c_begin)
+                                   : write_slab_hyperslab(dst_id, &slab, t_begin, c_begin);
+            }
+        }
+    }
+    // データを永続化してから写し終えた行数を記録する
+    if (status == 0 && first < rows) {
+        status = H5Fflush(file_id, H5F_SCOPE_LOCAL) >= 0 && write_snapshot_rows(dst_id, rows) >= 0 ? 0 : -1;
+    }
+
+    for (int i = 0; workers != NULL && i < num_workers; ++i) {
+        free(workers[i].scratch);
+    }
+    for (int d = 0; c.dst_raw != NULL && d < max_dst; ++d) {
+        free(c.dst_raw[d]);
+    }
+    free(workers);
+    free(c.dst_raw);
+    free(c.dst_size);
+    close_population_slab(&slab);
+    H5Dclose(dst_id);
+    H5Dclose(src_id);
+    return status;
+}
@@ -0,0 +1,138 @@
+//
+// consumer の書き込みを、書き込み内容を用意するステージングと HDF5 を呼ぶ I/O スレッドに分ける
+//
+#define _GNU_SOURCE
+
+#include "write_behind.h"
+
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+uint64_t monotonic_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static void *write_behind_io(void *arg) {
+    WriteBehind *wb = (WriteBehind *)arg;
+    time_t last_checkpoint = time(NULL);
+    while (true) {
+        uint64_t t0 = monotonic_ns();
+        PQdataWrite *w = (PQdataWrite *)dequeue(&wb->staged);
+        uint64_t t1 = monotonic_ns();
+        wb->idle_ns += t1 - t0;
+        if (w == NULL) {
+            break;
+        }
+
+        herr_t status = execute_pqdata_write(wb->dataset_id, w, wb->time_chunk, wb->mesh_chunk);
+        // 集計は行列を書けたときだけ書き、両方を書けたバッチを完了とする
+        if (status >= 0 && wb->summaries != NULL && w->m->summary != NULL && w->rows > 0) {
+            status = write_mesh_summary(wb->summaries, w->m->summary, w->runs, w->num_runs);
+        }
+        // 書けなかった列があれば、最終時刻を進めると次の追記でその列が埋まらなくなる
+        if (status < 0) {
+            fprintf(stderr, "Failed to write data to HDF5 dataset\n");
+            wb->failures++;
+            wb->last_ingested_hour = wb->initial_hour;
+        } else {
+            int hour = w->m->last_time_index < wb->max_hour ? w->m->last_time_index : wb->max_hour;
+            if (hour > wb->written_hour) {
+                wb->written_hour = hour;
+            }
+            if (wb->failures == 0) {
+                wb->last_ingested_hour = wb->written_hour;
+            }
+            if (wb->checkpoint != NULL) {
+                mark_batch_completed(wb->checkpoint, w->m->batch_index);
+            }
+            wb->writes++;
+        }
+        free_pqdata_write(w);
+        free(w);
+
+        if (wb->checkpoint != NULL && time(NULL) - last_checkpoint >= wb->checkpoint_interval_sec) {
+            write_last_ingested_hour(wb->file_id, wb->last_ingested_hour);
+            if (flush_batch_checkpoint(wb->checkpoint) < 0) {
+                fprintf(stderr, "Failed to record completed batches\n");
+            }
+            last_checkpoint = time(NULL);
+        }
+        wb->io_ns += monotonic_ns() - t1;
+    }
+    return NULL;
+}
+
+int start_write_behind(WriteBehind *wb, hid_t file_id, hid_t dataset_id, hsize_t time_chunk, hsize_t mesh_chunk,
+                       BatchCheckpoint *checkpoint, int checkpoint_interval_sec, SummaryDatasets *summaries,
+                       int last_ingested_hour, int writer_cpu) {
+    wb->file_id = file_id;
+    wb->dataset_id = dataset_id;
+    wb->time_chunk = time_chunk;
+    wb->mesh_chunk = mesh_chunk;
+    wb->checkpoint = checkpoint;
+    wb->checkpoint_interval_sec = checkpoint_interval_sec;
+    wb->summaries = summaries;
+    wb->last_ingested_hour = last_ingested_hour;
+    wb->initial_hour = last_ingested_hour;
+    wb->written_hour = last_ingested_hour;
+    wb->writes = 0;
+    wb->failures = 0;
+    wb->io_ns = 0;
+    wb->idle_ns = 0;
+    wb->submit_wait_ns = 0;
+
+    // チャンク境界に合わせて余分に確保した行は最終時刻に含めない
+    hid_t space_id = H5Dget_space(dataset_id);
+    hsize_t dims[2];
+    H5Sget_simple_extent_dims(space_id, dims, NULL);
+    H5Sclose(space_id);
+    wb->max_hour = (int)dims[0] - 1;
+
+    if (init_queue_with_capacity(&wb->staged, WRITE_BEHIND_DEPTH) != 0) {
+        return -1;
+    }
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    if (writer_cpu >= 0) {
+        cpu_set_t cpuset;
+        CPU_ZERO(&cpuset);
+        CPU_SET(writer_cpu, &cpuset);
+        if (pthread_attr_setaffinity_np(&attr, sizeof(cpu_set_t), &cpuset) != 0) {
+            perror("pthread_attr_setaffinity_np failed for writer");
+        }
+    }
+    int rc = pthread_create(&wb->thread, &attr, write_behind_io, wb);
+    pthread_attr_destroy(&attr);
+    if (rc != 0) {
+        perror("pthread_create failed for writer");
+        destroy_queue(&wb->staged);
+        return -1;
+    }
+    return 0;
+}
+
+void submit_pqdata_write(WriteBehind *wb, PQdataWrite *w) {
+    uint64_t t0 = monotonic_ns();
+    enqueue(&wb->staged, w);
+    wb->submit_wait_ns += monotonic_ns() - t0;
+}
+
+void finish_write_behind(WriteBehind *wb) {
+    enqueue(&wb->staged, NULL);
+    pthread_join(wb->thread, NULL);
+    destroy_queue(&wb->staged);
+}
+
+void report_write_behind(const WriteBehind *wb, uint64_t staging_ns, uint64_t producer_wait_ns) {
+    printf("Writer: %zu batches written (%zu failed)\n", wb->writes, wb->failures);
+    if (wb->failures > 0) {
+        printf("  last ingested hour kept at %d (%d written)\n", wb->last_ingested_hour, wb->written_hour);
+    }
+    printf("  staging %.2f s, waiting for producers %.2f s, waiting for I/O %.2f s\n",
+           staging_ns / 1e9, producer_wait_ns / 1e9, wb->submit_wait_ns / 1e9);
+    printf("  I/O %.2f s, I/O idle %.2f s\n", wb->io_ns / 1e9, wb->idle_ns / 1e9);
+}
@@ -0,0 +1,78 @@
+//
+// 作り物のスループットのモデルで山登りの探索と設定ファイルの書き出しを確認する
+//
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "autotune.h"
+#include "env_reader.h"
+
+// producer はコア 16 個まで伸び、それ以上は競合で落ちる。バッチが大きいほど問い合わせの固定費が薄まる
+static double producer_bound_rate(const TuningConfig *c) {
+    double per_producer = 100.0 * c->batch_meshes / (c->batch_meshes + 16);
+    double scale = c->num_producers > 16 ? 16.0 / c->num_producers : 1.0;
+    return (c->num_producers < 16 ? c->num_producers : 16) * per_producer * scale;
+}
+
+int main() {
+    // producer 側が詰まっている: producer 数を探してからバッチを大きくする
+    TuningConfig initial = {.num_producers = 32, .batch_meshes = 16, .queue_depth = 0};
+    Autotuner tuner;
+    init_autotuner(&tuner, &initial, 64, 16, 64);
+    const TuningConfig expected[] = {{32, 16, 0}, {64, 16, 0}, {16, 16, 0}, {8, 16, 0}, {16, 32, 0}, {16, 64, 0}};
+    int phase = 0;
+    bool more = true;
+    while (more) {
+        assert(phase < (int)(sizeof(expected) / sizeof(expected[0])));
+        assert(tuner.current.num_producers == expected[phase].num_producers);
+        assert(tuner.current.batch_meshes == expected[phase].batch_meshes);
+        TuningSample s = {
+            .rows_per_sec = producer_bound_rate(&tuner.current),
+            .queue_occupancy = 0.1,
+            .queue_peak = 12,
+            .writer_stall = 0.0
+        };
+        print_tuning_sample(phase + 1, &tuner.current, &s);
+        more = autotune_step(&tuner, &s);
+        phase++;
+    }
+    assert(phase == 6);
+    assert(tuner.best.num_producers == 16 && tuner.best.batch_meshes == 64);
+    assert(tuner.best.queue_depth == 32);
+    printf("producer-bound search test passed\n");
+
+    // 書き込み側が詰まっている: どちらに動かしても速くならなければ最初の設定のまま終わる
+    init_autotuner(&tuner, &initial, 64, 16, 64);
+    more = true;
+    phase = 0;
+    while (more) {
+        TuningSample s = {.rows_per_sec = 300.0, .queue_occupancy = 0.9, .queue_peak = 100, .writer_stall = 0.7};
+        if (phase == 1) {
+            // 書き込みが詰まっていれば producer を減らす方から試す
+            assert(tuner.current.num_producers == 16);
+        }
+        more = autotune_step(&tuner, &s);
+        phase++;
+        assert(phase <= AUTOTUNE_MAX_PHASES);
+    }
+    assert(tuner.best.num_producers == 32 && tuner.best.batch_meshes == 16);
+    assert(tuner.best.queue_depth == 200);
+    printf("writer-bound search test passed\n");
+
+    // 書き出した設定は次回の実行で IngestOptions として読み込める
+    const char *path = "example_tuning.env";
+    assert(write_tuning_file(path, &(TuningConfig){.num_producers = 12, .batch_meshes = 48, .queue_depth = 40},
+                             INGEST_SCAN_LIST) == 0);
+    assert(load_env_from_file(path));
+    IngestOptions opts;
+    assert(load_ingest_options(&opts));
+    assert(opts.num_producers == 12 && opts.list_meshes == 48 && opts.queue_depth == 40);
+    assert(ingest_batch_meshes(&opts) == 48);
+    free_ingest_options(&opts);
+    remove(path);
+    printf("tuning file test passed\n");
+
+    printf("All tests passed!\n");
+    return 0;
+}
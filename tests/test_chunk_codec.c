@@ -0,0 +1,112 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "chunk_codec.h"
+#include "hdf5_ops.h"
+
+#define ROWS 8
+#define COLS 4
+#define TIME_CHUNK 4
+#define MESH_CHUNK 2
+
+int main() {
+    assert(parse_chunk_codec(NULL) == CHUNK_CODEC_NONE);
+    assert(parse_chunk_codec("none") == CHUNK_CODEC_NONE);
+    assert(parse_chunk_codec("deflate") == CHUNK_CODEC_DEFLATE);
+    assert(parse_chunk_codec("scaleoffset") == CHUNK_CODEC_SCALEOFFSET);
+    assert(parse_chunk_codec("scaleoffset-deflate") == CHUNK_CODEC_SCALEOFFSET_DEFLATE);
+    assert(parse_chunk_codec("zstd") == CHUNK_CODEC_ZSTD);
+    assert(parse_chunk_codec("lz4") == -1);
+    assert(chunk_codec_in_producer(CHUNK_CODEC_DEFLATE) && !chunk_codec_in_producer(CHUNK_CODEC_SCALEOFFSET));
+    int def, lo, hi;
+    assert(chunk_codec_level_range(CHUNK_CODEC_ZSTD, &def, &lo, &hi) && def == DEFAULT_CHUNK_ZSTD_LEVEL && hi == 22);
+    assert(!chunk_codec_level_range(CHUNK_CODEC_SCALEOFFSET, &def, &lo, &hi));
+
+    // 端数のある大きさでも最後のバイトまで見る
+    unsigned char zeros[1000] = {0};
+    assert(chunk_is_zero(zeros, sizeof(zeros)) && chunk_is_zero(zeros, 0));
+    zeros[999] = 1;
+    assert(!chunk_is_zero(zeros, sizeof(zeros)) && chunk_is_zero(zeros, 999));
+    zeros[3] = 1;
+    assert(!chunk_is_zero(zeros, 256));
+
+    // producer で圧縮したチャンクを H5Dwrite_chunk で書き、HDF5 のフィルタで読み戻せること
+    hid_t file_id = H5Fcreate("example_codec.h5", H5F_ACC_TRUNC, H5P_DEFAULT, H5P_DEFAULT);
+    hid_t dataset_id = create_population_dataset(file_id, "population_data", ROWS, COLS, TIME_CHUNK, MESH_CHUNK,
+                                                 CHUNK_CODEC_DEFLATE, 4);
+    assert(dataset_id >= 0);
+    ChunkCodec codec;
+    int level;
+    assert(get_population_codec(dataset_id, &codec, &level) == 0);
+    assert(codec == CHUNK_CODEC_DEFLATE && level == 4);
+
+    PQdataMatrix *m = alloc_pqdata_matrix(ROWS, COLS, 0);
+    for (int i = 0; i < ROWS * COLS; ++i) {
+        m->data[i] = (i % 3 == 0) ? 0 : i * 1000 + 7;
+    }
+    int expected[ROWS * COLS];
+    memcpy(expected, m->data, sizeof(expected));
+    m->columns = alloc_column_range(0, COLS);
+    assert(layout_chunk_order(m, TIME_CHUNK, MESH_CHUNK) == 0);
+    assert(compress_pqdata_chunks(m, TIME_CHUNK, MESH_CHUNK, CHUNK_CODEC_DEFLATE, 4) == 0);
+    assert(m->data == NULL && m->filtered != NULL);
+    assert(write_pqdata_matrix_chunks(dataset_id, m, TIME_CHUNK, MESH_CHUNK) >= 0);
+    free_pqdata_matrix(m);
+
+    int out[ROWS * COLS];
+    assert(H5Dread(dataset_id, H5T_NATIVE_INT, H5S_ALL, H5S_ALL, H5P_DEFAULT, out) >= 0);
+    assert(memcmp(out, expected, sizeof(expected)) == 0);
+
+    // H5Dread_chunk で読んだチャンクは decode_chunk で HDF5 を通さずに展開できる
+    hsize_t offset[2] = {TIME_CHUNK, MESH_CHUNK};
+    hsize_t stored = 0;
+    assert(H5Dget_chunk_storage_size(dataset_id, offset, &stored) >= 0 && stored > 0);
+    unsigned char raw[256];
+    uint32_t filter_mask = 0;
+    assert(stored <= sizeof(raw) && H5Dread_chunk(dataset_id, H5P_DEFAULT, offset, &filter_mask, raw) >= 0);
+    int chunk[TIME_CHUNK * MESH_CHUNK];
+    int scratch[TIME_CHUNK * MESH_CHUNK];
+    assert(decode_chunk(CHUNK_CODEC_DEFLATE, raw, stored, sizeof(int), scratch, chunk, sizeof(chunk)) == 0);
+    for (int t = 0; t < TIME_CHUNK; ++t) {
+        for (int j = 0; j < MESH_CHUNK; ++j) {
+            assert(chunk[t * MESH_CHUNK + j] == expected[(TIME_CHUNK + t) * COLS + MESH_CHUNK + j]);
+        }
+    }
+    assert(decode_chunk(CHUNK_CODEC_SCALEOFFSET, raw, stored, sizeof(int), scratch, chunk, sizeof(chunk)) == -1);
+    H5Dclose(dataset_id);
+
+    // 無圧縮のデータセットはフィルタなしと判定される
+    dataset_id = create_population_dataset(file_id, "raw", ROWS, COLS, TIME_CHUNK, MESH_CHUNK, CHUNK_CODEC_NONE, 0);
+    assert(get_population_codec(dataset_id, &codec, &level) == 0);
+    assert(codec == CHUNK_CODEC_NONE);
+    H5Dclose(dataset_id);
+
+    // scale-offset は HDF5 の書き込み時にフィルタが掛かり、元の値に戻る
+    const ChunkCodec hdf5_codecs[] = {CHUNK_CODEC_SCALEOFFSET, CHUNK_CODEC_SCALEOFFSET_DEFLATE};
+    for (size_t k = 0; k < sizeof(hdf5_codecs) / sizeof(hdf5_codecs[0]); ++k) {
+        char name[32];
+        snprintf(name, sizeof(name), "codec%zu", k);
+        dataset_id = create_population_dataset(file_id, name, ROWS, COLS, TIME_CHUNK, MESH_CHUNK, hdf5_codecs[k], 6);
+        assert(dataset_id >= 0);
+        assert(get_population_codec(dataset_id, &codec, &level) == 0);
+        assert(codec == hdf5_codecs[k]);
+        assert(level == (codec == CHUNK_CODEC_SCALEOFFSET_DEFLATE ? 6 : 0));
+        assert(H5Dwrite(dataset_id, H5T_NATIVE_INT, H5S_ALL, H5S_ALL, H5P_DEFAULT, expected) >= 0);
+        assert(H5Dread(dataset_id, H5T_NATIVE_INT, H5S_ALL, H5S_ALL, H5P_DEFAULT, out) >= 0);
+        assert(memcmp(out, expected, sizeof(expected)) == 0);
+        H5Dclose(dataset_id);
+    }
+
+    // zstd はプラグインがなければ作成に失敗する
+    dataset_id = create_population_dataset(file_id, "zstd", ROWS, COLS, TIME_CHUNK, MESH_CHUNK, CHUNK_CODEC_ZSTD, 3);
+    assert((dataset_id >= 0) == (H5Zfilter_avail(H5Z_FILTER_ZSTD) > 0));
+    if (dataset_id >= 0) {
+        H5Dclose(dataset_id);
+    }
+    H5Fclose(file_id);
+
+    printf("All tests passed!\n");
+    return 0;
+}
@@ -0,0 +1,154 @@
+//
+// チャンクの統計の索引を使ったしきい値と上位 K 件の検索が、全部を数えた結果と一致し、
+// 索引だけで決まる問い合わせでは population をほとんど読まないことを確認する
+//
+#include <assert.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "chunk_index.h"
+#include "hdf5_ops.h"
+#include "mesh_summary.h"
+#include "test_fixture.h"
+
+// チャンクの区間 2 つと 3 つ目の途中まで
+#define ROWS (2 * SUMMARY_CHUNK_HOURS + 5000)
+#define COLS 200
+#define MESH_CHUNK 16
+#define SPIKE_COLS 50
+
+static int value_at(hsize_t t, hsize_t c) {
+    int base = (int)((t * 31 + c * 17) % 50);
+    // SPIKE_COLS の倍数の列だけ、まれに大きな値を持つ
+    if (c % SPIKE_COLS == 0 && t % 997 == c) {
+        base += 10000 + (int)c;
+    }
+    return base;
+}
+
+static int fixture_value(hsize_t t, hsize_t c, const void *ctx) {
+    (void)ctx;
+    return value_at(t, c);
+}
+
+static void make_file(const char *path) {
+    FixtureFile f = {.rows = ROWS, .cols = COLS, .time_chunk = SUMMARY_CHUNK_HOURS, .mesh_chunk = MESH_CHUNK,
+                     .codec = CHUNK_CODEC_DEFLATE, .level = 1, .value_at = fixture_value};
+    hid_t file_id = make_fixture_file(path, &f);
+    assert(build_mesh_summaries(file_id, ROWS, 2) == 0);
+    H5Fclose(file_id);
+}
+
+static void expect_values(ChunkQueryStat stat, hsize_t t0, hsize_t t1, int64_t *out) {
+    for (hsize_t c = 0; c < COLS; ++c) {
+        out[c] = 0;
+        for (hsize_t t = t0; t < t1; ++t) {
+            int64_t v = value_at(t, c);
+            out[c] = stat == CHUNK_QUERY_SUM ? out[c] + v : (v > out[c] ? v : out[c]);
+        }
+    }
+}
+
+static void check_above(PopulationReader *r, ChunkQueryStat stat, hsize_t t0, hsize_t t1, int64_t threshold,
+                        const int64_t *expect) {
+    hsize_t *columns;
+    ChunkQueryCost cost;
+    long long n = chunk_index_above(r, stat, t0, t1, threshold, &columns, &cost);
+    long long k = 0;
+    for (hsize_t c = 0; c < COLS; ++c) {
+        if (expect[c] > threshold) {
+            assert(k < n && columns[k] == c);
+            k++;
+        }
+    }
+    assert(k == n);
+    assert(cost.values_read <= cost.scan_values);
+    free(columns);
+}
+
+static void check_top_k(PopulationReader *r, ChunkQueryStat stat, hsize_t t0, hsize_t t1, size_t k,
+                        const int64_t *expect) {
+    ChunkQueryHit hits[COLS];
+    long long n = chunk_index_top_k(r, stat, t0, t1, k, hits, NULL);
+    assert(n == (long long)(k < COLS ? k : COLS));
+    for (long long i = 0; i < n; ++i) {
+        assert(hits[i].value == expect[hits[i].column]);
+        // 当たりより前に並ぶべき列が抜けていない
+        for (hsize_t c = 0; c < COLS; ++c) {
+            bool before = expect[c] > hits[i].value || (expect[c] == hits[i].value && c < hits[i].column);
+            if (before) {
+                bool listed = false;
+                for (long long j = 0; j < i; ++j) {
+                    listed |= hits[j].column == c;
+                }
+                assert(listed);
+            }
+        }
+    }
+}
+
+static void test_queries(PopulationReader *r) {
+    static const hsize_t ranges[][2] = {
+        {0, 2 * SUMMARY_CHUNK_HOURS},               // チャンクの境目にそろう
+        {100, 20000},                               // 両端が区間の途中
+        {9000, 9100},                               // 1 つの区間の中
+        {2 * SUMMARY_CHUNK_HOURS, ROWS},            // 集計し終えた行で切れた最後の区間
+        {5000, ROWS},
+    };
+    int64_t expect[COLS];
+    for (int stat = 0; stat < 2; ++stat) {
+        for (size_t q = 0; q < sizeof(ranges) / sizeof(ranges[0]); ++q) {
+            hsize_t t0 = ranges[q][0], t1 = ranges[q][1];
+            expect_values((ChunkQueryStat)stat, t0, t1, expect);
+            // 全列・なし・ある列の値ちょうど (同じ値は超えない) のしきい値
+            check_above(r, (ChunkQueryStat)stat, t0, t1, -1, expect);
+            check_above(r, (ChunkQueryStat)stat, t0, t1, INT64_MAX, expect);
+            for (hsize_t c = 0; c < COLS; c += 7) {
+                check_above(r, (ChunkQueryStat)stat, t0, t1, expect[c], expect);
+            }
+            static const size_t ks[] = {0, 1, 5, 30, COLS + 10};
+            for (size_t i = 0; i < sizeof(ks) / sizeof(ks[0]); ++i) {
+                check_top_k(r, (ChunkQueryStat)stat, t0, t1, ks[i], expect);
+            }
+        }
+    }
+    printf("query test passed\n");
+}
+
+static void test_cost(PopulationReader *r) {
+    // 区間がそろっていれば索引だけで決まる
+    hsize_t *columns;
+    ChunkQueryCost cost;
+    long long n = chunk_index_above(r, CHUNK_QUERY_MAX, 0, 2 * SUMMARY_CHUNK_HOURS, 5000, &columns, &cost);
+    assert(n == COLS / SPIKE_COLS);
+    assert(cost.values_read == 0 && cost.resolved == 0);
+    assert(cost.index_values == 2 * COLS);
+    free(columns);
+
+    // 端があっても、読むのは上限がしきい値を超える列の端のチャンクだけ
+    n = chunk_index_above(r, CHUNK_QUERY_MAX, 100, 8000, 5000, &columns, &cost);
+    assert(n == COLS / SPIKE_COLS && cost.resolved == COLS / SPIKE_COLS);
+    assert(cost.values_read > 0 && cost.values_read * 2 < cost.scan_values);
+    free(columns);
+
+    ChunkQueryHit hits[3];
+    assert(chunk_index_top_k(r, CHUNK_QUERY_MAX, 100, 20000, 3, hits, &cost) == 3);
+    assert(cost.values_read * 2 < cost.scan_values);
+
+    // 集計していない時間は問い合わせられない
+    assert(chunk_index_above(r, CHUNK_QUERY_SUM, 0, ROWS + 1, 0, &columns, NULL) == -1);
+    printf("cost test passed\n");
+}
+
+int main() {
+    const char *path = "example_chunk_index.h5";
+    make_file(path);
+    PopulationReader *r = open_population_reader(path);
+    assert(r != NULL);
+    test_queries(r);
+    test_cost(r);
+    close_population_reader(r);
+    printf("All tests passed!\n");
+    return 0;
+}
@@ -0,0 +1,113 @@
+//
+// 作り物の sysfs (2ノード x 2コア x SMT2) でトポロジーの読み込みと配置を確認する
+//
+#define _GNU_SOURCE
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "cpu_topology.h"
+
+static void write_file(const char *path, const char *text) {
+    char dir[512];
+    snprintf(dir, sizeof(dir), "mkdir -p $(dirname %s)", path);
+    assert(system(dir) == 0);
+    FILE *fp = fopen(path, "w");
+    assert(fp != NULL);
+    fputs(text, fp);
+    fclose(fp);
+}
+
+// cpu0-3 がノード0、cpu4-7 がノード1。cpu n と n+2 (同じノード内) が SMT sibling
+static void make_fake_sysfs(const char *root) {
+    char path[512];
+    char value[16];
+    for (int cpu = 0; cpu < 8; ++cpu) {
+        int node = cpu / 4;
+        snprintf(path, sizeof(path), "%s/devices/system/cpu/cpu%d/topology/physical_package_id", root, cpu);
+        snprintf(value, sizeof(value), "%d\n", node);
+        write_file(path, value);
+        snprintf(path, sizeof(path), "%s/devices/system/cpu/cpu%d/topology/core_id", root, cpu);
+        snprintf(value, sizeof(value), "%d\n", cpu % 2);
+        write_file(path, value);
+    }
+    snprintf(path, sizeof(path), "%s/devices/system/node/node0/cpulist", root);
+    write_file(path, "0-3\n");
+    snprintf(path, sizeof(path), "%s/devices/system/node/node1/cpulist", root);
+    write_file(path, "4-7\n");
+}
+
+int main() {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    assert(parse_cpulist("0-3,8,10-11\n", &set) == 0);
+    assert(CPU_COUNT(&set) == 7);
+    assert(CPU_ISSET(8, &set) && !CPU_ISSET(9, &set) && CPU_ISSET(11, &set));
+    assert(parse_cpulist("3-1", &set) == -1);
+    assert(parse_cpulist("a", &set) == -1);
+    printf("cpulist parse test passed\n");
+
+    char root[] = "/tmp/test_cpu_topology_XXXXXX";
+    assert(mkdtemp(root) != NULL);
+    make_fake_sysfs(root);
+
+    CPU_ZERO(&set);
+    parse_cpulist("0-7", &set);
+    CpuTopology topo;
+    assert(load_cpu_topology(root, &set, &topo) == 0);
+    assert(topo.num_cpus == 8 && topo.num_cores == 4 && topo.num_nodes == 2);
+    assert(topo.cpus[2].core == topo.cpus[0].core && topo.cpus[2].smt_rank == 1);
+    assert(topo.cpus[5].node == 1 && topo.cpus[5].smt_rank == 0);
+    printf("topology load test passed\n");
+
+    // writer はノード1の最初の物理コア、meshlist_producer はその sibling
+    ThreadPlacement placement;
+    assert(plan_thread_placement(&topo, 1, 6, &placement) == 0);
+    assert(placement.writer_cpu == 4 && placement.writer_node == 1);
+    assert(placement.meshlist_cpu == 6);
+    // 残りの物理コアをノード交互に使い、次に sibling、最後に先頭へ戻る
+    const int expected[6] = {0, 5, 1, 2, 7, 3};
+    for (int i = 0; i < 6; ++i) {
+        assert(placement.producer_cpus[i] == expected[i]);
+    }
+    free_thread_placement(&placement);
+
+    // 不明なノードなら最初の CPU のノードに置く
+    assert(plan_thread_placement(&topo, -1, 2, &placement) == 0);
+    assert(placement.writer_cpu == 0 && placement.meshlist_cpu == 2);
+    free_thread_placement(&placement);
+
+    // シャードごとに物理コアを分け合う
+    cpu_set_t shard;
+    shard_cpu_set(&topo, 1, 2, &shard);
+    assert(CPU_COUNT(&shard) == 4);
+    assert(CPU_ISSET(1, &shard) && CPU_ISSET(3, &shard) && CPU_ISSET(5, &shard) && CPU_ISSET(7, &shard));
+    shard_cpu_set(&topo, 5, 8, &shard);
+    assert(CPU_COUNT(&shard) == 1 && CPU_ISSET(5, &shard));
+    free_cpu_topology(&topo);
+
+    // 1 CPU だけなら全員同居する
+    CPU_ZERO(&set);
+    CPU_SET(3, &set);
+    assert(load_cpu_topology(root, &set, &topo) == 0);
+    assert(plan_thread_placement(&topo, 0, 4, &placement) == 0);
+    assert(placement.writer_cpu == 3 && placement.meshlist_cpu == 3 && placement.producer_cpus[3] == 3);
+    free_thread_placement(&placement);
+    free_cpu_topology(&topo);
+    printf("thread placement test passed\n");
+
+    // 実機の sysfs でも読めること
+    assert(load_cpu_topology(SYSFS_ROOT, NULL, &topo) == 0);
+    assert(plan_thread_placement(&topo, path_numa_node(SYSFS_ROOT, "/tmp"), 32, &placement) == 0);
+    print_thread_placement(&topo, &placement);
+    free_thread_placement(&placement);
+    free_cpu_topology(&topo);
+
+    char cleanup[512];
+    snprintf(cleanup, sizeof(cleanup), "rm -rf %s", root);
+    assert(system(cleanup) == 0);
+    printf("All tests passed!\n");
+    return 0;
+}
@@ -0,0 +1,145 @@
+//
+// delta-bitpack の往復と、スカラー・AVX2・AVX-512 のカーネルが同じ形式を読み書きすることを確認する
+//
+#include <assert.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "chunk_codec.h"
+#include "delta_bitpack.h"
+#include "hdf5_ops.h"
+
+#define HOURS 8760
+#define MESHES 16
+
+// 1日周期の人口に小さな揺らぎを足したもの。たまに 0 (欠測) が入る
+static void fill_population(int *data, int rows, int cols, unsigned seed) {
+    srand(seed);
+    for (int j = 0; j < cols; ++j) {
+        int base = 200 + j * 37;
+        for (int t = 0; t < rows; ++t) {
+            int hour = t % 24;
+            int v = base + (hour >= 8 && hour < 19 ? base / 2 : 0) + rand() % 11 - 5;
+            data[t * cols + j] = rand() % 97 == 0 ? 0 : v;
+        }
+    }
+}
+
+// 使えるカーネルのすべてで圧縮・展開し、圧縮結果がスカラーと同じバイト列になること
+static size_t roundtrip(const int *data, size_t n, size_t stride, int order) {
+    size_t bound = delta_bitpack_bound(n * sizeof(int));
+    unsigned char *reference = (unsigned char *)malloc(bound);
+    unsigned char *packed = (unsigned char *)malloc(bound);
+    int *out = (int *)malloc(n * sizeof(int) + 1);
+    size_t reference_size = 0;
+    const DeltaBitpackIsa isas[] = {DELTA_BITPACK_ISA_SCALAR, DELTA_BITPACK_ISA_AVX2, DELTA_BITPACK_ISA_AVX512};
+    for (size_t k = 0; k < sizeof(isas) / sizeof(isas[0]); ++k) {
+        if (delta_bitpack_use_isa(isas[k]) != 0) {
+            continue;
+        }
+        size_t size;
+        assert(delta_bitpack_encode(data, n * sizeof(int), stride, order, packed, &size) == 0);
+        assert(size <= bound);
+        if (isas[k] == DELTA_BITPACK_ISA_SCALAR) {
+            memcpy(reference, packed, size);
+            reference_size = size;
+        } else {
+            assert(size == reference_size && memcmp(packed, reference, size) == 0);
+        }
+        assert(delta_bitpack_decoded_size(packed, size) == n * sizeof(int));
+        memset(out, 0x5a, n * sizeof(int));
+        assert(delta_bitpack_decode(packed, size, out, n * sizeof(int)) == 0);
+        assert(memcmp(out, data, n * sizeof(int)) == 0);
+    }
+    delta_bitpack_use_isa(DELTA_BITPACK_ISA_AUTO);
+    free(reference);
+    free(packed);
+    free(out);
+    return reference_size;
+}
+
+int main() {
+    printf("Kernels: %s\n", delta_bitpack_isa_name(delta_bitpack_active_isa()));
+    assert(delta_bitpack_use_isa(DELTA_BITPACK_ISA_SCALAR) == 0);
+    assert(delta_bitpack_active_isa() == DELTA_BITPACK_ISA_SCALAR);
+    delta_bitpack_use_isa(DELTA_BITPACK_ISA_AUTO);
+
+    // 1年 x 16 メッシュのチャンク。時間方向の差分は小さいので大きく縮む
+    int *data = (int *)malloc(sizeof(int) * HOURS * MESHES);
+    fill_population(data, HOURS, MESHES, 1);
+    for (int order = 1; order <= MAX_DELTA_BITPACK_ORDER; ++order) {
+        size_t size = roundtrip(data, (size_t)HOURS * MESHES, MESHES, order);
+        printf("order %d: %zu -> %zu bytes (%.2fx)\n", order, sizeof(int) * HOURS * MESHES, size,
+               (double)sizeof(int) * HOURS * MESHES / size);
+        assert(size < sizeof(int) * HOURS * MESHES / 2);
+    }
+
+    // ブロックに満たない端数、行幅がレーン数と合わないもの、全ビットを使う値、すべて 0
+    roundtrip(data, 700, 7, 1);
+    roundtrip(data, 1, 1, 2);
+    int extreme[DELTA_BITPACK_BLOCK * 2 + 3];
+    for (size_t i = 0; i < sizeof(extreme) / sizeof(extreme[0]); ++i) {
+        extreme[i] = i % 2 == 0 ? INT_MIN : INT_MAX;
+    }
+    roundtrip(extreme, sizeof(extreme) / sizeof(extreme[0]), 1, 1);
+    roundtrip(extreme, sizeof(extreme) / sizeof(extreme[0]), 3, 2);
+    int zeros[DELTA_BITPACK_BLOCK] = {0};
+    assert(roundtrip(zeros, DELTA_BITPACK_BLOCK, MESHES, 1) == DELTA_BITPACK_HEADER + 4);
+    for (int bits = 1; bits <= 32; ++bits) {
+        int ramp[DELTA_BITPACK_BLOCK];
+        for (int i = 0; i < DELTA_BITPACK_BLOCK; ++i) {
+            ramp[i] = (int)((unsigned)(i * 2654435761u) >> (32 - bits));
+        }
+        roundtrip(ramp, DELTA_BITPACK_BLOCK, 1, 1);
+    }
+
+    // 壊れた入力は展開しない
+    unsigned char broken[DELTA_BITPACK_HEADER] = {9};
+    assert(delta_bitpack_decoded_size(broken, sizeof(broken)) == 0);
+    assert(delta_bitpack_encode(data, 6, 1, 1, broken, &(size_t){0}) == -1);
+    printf("codec roundtrip test passed\n");
+
+    // HDF5 のフィルタとして書いて読み戻す。producer で圧縮したチャンクも同じフィルタで読める
+    assert(parse_chunk_codec("delta-bitpack") == CHUNK_CODEC_DELTA_BITPACK);
+    assert(chunk_codec_in_producer(CHUNK_CODEC_DELTA_BITPACK));
+    hid_t file_id = H5Fcreate("example_delta_bitpack.h5", H5F_ACC_TRUNC, H5P_DEFAULT, H5P_DEFAULT);
+    hid_t dataset_id = create_population_dataset(file_id, "filtered", HOURS, MESHES * 2, HOURS, MESHES,
+                                                 CHUNK_CODEC_DELTA_BITPACK, 2);
+    assert(dataset_id >= 0);
+    ChunkCodec codec;
+    int level;
+    assert(get_population_codec(dataset_id, &codec, &level) == 0);
+    assert(codec == CHUNK_CODEC_DELTA_BITPACK && level == 2);
+    int *wide = (int *)malloc(sizeof(int) * HOURS * MESHES * 2);
+    int *out = (int *)malloc(sizeof(int) * HOURS * MESHES * 2);
+    fill_population(wide, HOURS, MESHES * 2, 2);
+    assert(H5Dwrite(dataset_id, H5T_NATIVE_INT, H5S_ALL, H5S_ALL, H5P_DEFAULT, wide) >= 0);
+    assert(H5Dread(dataset_id, H5T_NATIVE_INT, H5S_ALL, H5S_ALL, H5P_DEFAULT, out) >= 0);
+    assert(memcmp(out, wide, sizeof(int) * HOURS * MESHES * 2) == 0);
+    assert(H5Dget_storage_size(dataset_id) < sizeof(int) * HOURS * MESHES);
+    H5Dclose(dataset_id);
+
+    dataset_id = create_population_dataset(file_id, "direct", HOURS, MESHES * 2, HOURS, MESHES,
+                                           CHUNK_CODEC_DELTA_BITPACK, 1);
+    PQdataMatrix *m = alloc_pqdata_matrix(HOURS, MESHES * 2, 0);
+    memcpy(m->data, wide, sizeof(int) * HOURS * MESHES * 2);
+    m->columns = alloc_column_range(0, MESHES * 2);
+    assert(layout_chunk_order(m, HOURS, MESHES) == 0);
+    assert(compress_pqdata_chunks(m, HOURS, MESHES, CHUNK_CODEC_DELTA_BITPACK, 1) == 0);
+    assert(write_pqdata_matrix_chunks(dataset_id, m, HOURS, MESHES) >= 0);
+    free_pqdata_matrix(m);
+    memset(out, 0, sizeof(int) * HOURS * MESHES * 2);
+    assert(H5Dread(dataset_id, H5T_NATIVE_INT, H5S_ALL, H5S_ALL, H5P_DEFAULT, out) >= 0);
+    assert(memcmp(out, wide, sizeof(int) * HOURS * MESHES * 2) == 0);
+    H5Dclose(dataset_id);
+    H5Fclose(file_id);
+    free(wide);
+    free(out);
+    free(data);
+    printf("HDF5 filter test passed\n");
+
+    printf("All tests passed!\n");
+    return 0;
+}
@@ -0,0 +1,46 @@
+//
+// population_data と meshid_list を持つテスト用の HDF5 ファイル
+//
+#include "test_fixture.h"
+
+#include <assert.h>
+#include <stdlib.h>
+
+#include "hdf5_ops.h"
+
+void write_fixture_population(hid_t dataset_id, const FixtureFile *f) {
+    int *data = (int *)malloc(sizeof(int) * f->rows * f->cols);
+    assert(data != NULL);
+    for (hsize_t t = 0; t < f->rows; ++t) {
+        for (hsize_t c = 0; c < f->cols; ++c) {
+            data[t * f->cols + c] = f->value_at(t, c, f->ctx);
+        }
+    }
+    assert(H5Dwrite(dataset_id, H5T_NATIVE_INT, H5S_ALL, H5S_ALL, H5P_DEFAULT, data) >= 0);
+    free(data);
+}
+
+hid_t make_fixture_file(const char *path, const FixtureFile *f) {
+    hid_t file_id = H5Fcreate(path, H5F_ACC_TRUNC, H5P_DEFAULT, H5P_DEFAULT);
+    assert(file_id >= 0);
+    hid_t dataset_id = create_population_dataset(file_id, "population_data", f->rows, f->cols, f->time_chunk,
+                                                 f->mesh_chunk, f->codec, f->level);
+    assert(dataset_id >= 0);
+    write_fixture_population(dataset_id, f);
+    H5Dclose(dataset_id);
+
+    uint32_t *ids = (uint32_t *)malloc(sizeof(uint32_t) * (f->cols > 0 ? f->cols : 1));
+    assert(ids != NULL);
+    for (hsize_t c = 0; c < f->cols; ++c) {
+        ids[c] = f->meshids != NULL ? f->meshids[c] : FIXTURE_MESHID_BASE + (uint32_t)c;
+    }
+    hsize_t dims[1] = {f->cols};
+    hid_t space_id = H5Screate_simple(1, dims, NULL);
+    dataset_id = H5Dcreate(file_id, "meshid_list", H5T_NATIVE_UINT32, space_id, H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
+    assert(dataset_id >= 0);
+    assert(H5Dwrite(dataset_id, H5T_NATIVE_UINT32, H5S_ALL, H5S_ALL, H5P_DEFAULT, ids) >= 0);
+    H5Dclose(dataset_id);
+    H5Sclose(space_id);
+    free(ids);
+    return file_id;
+}
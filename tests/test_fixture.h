@@ -0,0 +1,38 @@
+//
+// population_data と meshid_list を持つテスト用の HDF5 ファイル
+//
+
+#ifndef TEST_FIXTURE_H
+#define TEST_FIXTURE_H
+
+#include <stdint.h>
+
+#include <hdf5.h>
+
+#include "chunk_codec.h"
+
+// 1次メッシュ 5339 の先頭
+#define FIXTURE_MESHID_BASE 533900000u
+
+// 時刻 t・列 c の値。ctx は FixtureFile の ctx
+typedef int (*FixtureValueFn)(hsize_t t, hsize_t c, const void *ctx);
+
+typedef struct {
+    hsize_t rows;
+    hsize_t cols;
+    hsize_t time_chunk;
+    hsize_t mesh_chunk;
+    ChunkCodec codec;
+    int level;
+    const uint32_t *meshids;    // cols 個。NULL なら FIXTURE_MESHID_BASE からの連番
+    FixtureValueFn value_at;
+    const void *ctx;
+} FixtureFile;
+
+// population_data の rows x cols を value_at の値で書く
+void write_fixture_population(hid_t dataset_id, const FixtureFile *f);
+
+// path に population_data と meshid_list を作り、開いたままのファイルを返す
+hid_t make_fixture_file(const char *path, const FixtureFile *f);
+
+#endif //TEST_FIXTURE_H
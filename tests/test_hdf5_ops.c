@@ -1,6 +1,9 @@
 #include "hdf5_ops.h"
+#include <assert.h>
 #include <pthread.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
 #define DATASET_SIZE 100
 #define NUM_THREADS 4
@@ -24,7 +27,232 @@ void* thread_function(void* arg) {
     return NULL;
 }
 
+// 時間軸を伸ばして後ろの行だけを書き足せることを確認する
+static void test_append_time_axis(void) {
+    hid_t file_id = H5Fcreate("example_append.h5", H5F_ACC_TRUNC, H5P_DEFAULT, H5P_DEFAULT);
+    hid_t dataset_id = create_population_dataset(file_id, "population_data", 4, 3, 2, 2, CHUNK_CODEC_NONE, 0);
+    assert(dataset_id >= 0);
+    int last_hour = 0;
+    assert(read_last_ingested_hour(file_id) == -1 && get_last_ingested_hour(file_id, &last_hour) == 1);
+    // 失敗した新規作成が残す -1 は、属性がないのとは区別して読める
+    assert(write_last_ingested_hour(file_id, -1) >= 0);
+    assert(get_last_ingested_hour(file_id, &last_hour) == 0 && last_hour == -1);
+
+    PQdataMatrix *m = alloc_pqdata_matrix(4, 3, 0);
+    for (int i = 0; i < 4 * 3; ++i) {
+        m->data[i] = i + 1;
+    }
+    assert(write_pqdata_matrix(dataset_id, m, 0) >= 0);
+    free_pqdata_matrix(m);
+    assert(write_last_ingested_hour(file_id, 3) >= 0);
+
+    assert(extend_time_axis(dataset_id, 6) >= 0);
+    m = alloc_pqdata_matrix(2, 3, 0);
+    m->time_start = 4;
+    for (int i = 0; i < 2 * 3; ++i) {
+        m->data[i] = 100 + i;
+    }
+    assert(write_pqdata_matrix(dataset_id, m, 0) >= 0);
+    free_pqdata_matrix(m);
+    assert(write_last_ingested_hour(file_id, 5) >= 0);
+    assert(read_last_ingested_hour(file_id) == 5);
+
+    int out[6 * 3];
+    assert(H5Dread(dataset_id, H5T_NATIVE_INT, H5S_ALL, H5S_ALL, H5P_DEFAULT, out) >= 0);
+    for (int i = 0; i < 4 * 3; ++i) {
+        assert(out[i] == i + 1);
+    }
+    for (int i = 0; i < 2 * 3; ++i) {
+        assert(out[4 * 3 + i] == 100 + i);
+    }
+    H5Dclose(dataset_id);
+    H5Fclose(file_id);
+}
+
+// 値のないチャンクは確保されず、前に書いたチャンクだけが 0 で上書きされることを確認する
+static void test_skip_zero_chunks(void) {
+    hid_t file_id = H5Fcreate("example_zero_chunks.h5", H5F_ACC_TRUNC, H5P_DEFAULT, H5P_DEFAULT);
+    hid_t dataset_id = create_population_dataset(file_id, "population_data", 6, 4, 2, 2, CHUNK_CODEC_NONE, 0);
+    assert(dataset_id >= 0);
+    hid_t space_id = H5Dget_space(dataset_id);
+    hsize_t num_chunks = 0;
+
+    // ハイパースラブで書く。値があるのは行 2-3 x 列 0-1 のチャンクだけ
+    PQdataMatrix *m = alloc_pqdata_matrix(6, 4, 0);
+    m->data[2 * 4 + 1] = 7;
+    PQdataWrite w;
+    assert(plan_pqdata_write(&w, m, 0, 6) == 0);
+    assert(execute_pqdata_write(dataset_id, &w, 2, 2) >= 0);
+    free_pqdata_write(&w);
+    assert(H5Dget_num_chunks(dataset_id, space_id, &num_chunks) >= 0 && num_chunks == 1);
+    int out[6 * 4];
+    assert(H5Dread(dataset_id, H5T_NATIVE_INT, H5S_ALL, H5S_ALL, H5P_DEFAULT, out) >= 0);
+    for (int i = 0; i < 6 * 4; ++i) {
+        assert(out[i] == (i == 2 * 4 + 1 ? 7 : 0));
+    }
+
+    // 0 だけの行列では確保済みのチャンクだけを書き直す
+    m = alloc_pqdata_matrix(6, 4, 0);
+    assert(plan_pqdata_write(&w, m, 0, 6) == 0);
+    assert(execute_pqdata_write(dataset_id, &w, 2, 2) >= 0);
+    free_pqdata_write(&w);
+    assert(H5Dget_num_chunks(dataset_id, space_id, &num_chunks) >= 0 && num_chunks == 1);
+    assert(H5Dread(dataset_id, H5T_NATIVE_INT, H5S_ALL, H5S_ALL, H5P_DEFAULT, out) >= 0);
+    for (int i = 0; i < 6 * 4; ++i) {
+        assert(out[i] == 0);
+    }
+    H5Sclose(space_id);
+    H5Dclose(dataset_id);
+
+    // producer で圧縮したチャンクも同じ
+    dataset_id = create_population_dataset(file_id, "compressed", 4, 4, 2, 2, CHUNK_CODEC_DEFLATE, 1);
+    space_id = H5Dget_space(dataset_id);
+    for (int pass = 0; pass < 2; ++pass) {
+        m = alloc_pqdata_matrix(4, 4, 0);
+        m->data[3 * 4 + 2] = pass == 0 ? 9 : 0;
+        m->columns = alloc_column_range(0, 4);
+        assert(layout_chunk_order(m, 2, 2) == 0);
+        assert(compress_pqdata_chunks(m, 2, 2, CHUNK_CODEC_DEFLATE, 1) == 0);
+        assert(write_pqdata_matrix_chunks(dataset_id, m, 2, 2) >= 0);
+        free_pqdata_matrix(m);
+        assert(H5Dget_num_chunks(dataset_id, space_id, &num_chunks) >= 0 && num_chunks == 1);
+        assert(H5Dread(dataset_id, H5T_NATIVE_INT, H5S_ALL, H5S_ALL, H5P_DEFAULT, out) >= 0);
+        for (int i = 0; i < 4 * 4; ++i) {
+            assert(out[i] == (pass == 0 && i == 3 * 4 + 2 ? 9 : 0));
+        }
+    }
+    H5Sclose(space_id);
+    H5Dclose(dataset_id);
+    H5Fclose(file_id);
+}
+
+// flush 済みの完了記録を開き直して読めることを確認する
+static void test_batch_checkpoint(void) {
+    hid_t file_id = H5Fcreate("example_checkpoint.h5", H5F_ACC_TRUNC, H5P_DEFAULT, H5P_DEFAULT);
+    assert(is_batch_checkpoint_complete(file_id));
+    BatchCheckpoint *cp = create_batch_checkpoint(file_id, 5, 0, 16);
+    assert(cp != NULL);
+    mark_batch_completed(cp, 1);
+    mark_batch_completed(cp, 3);
+    mark_batch_completed(cp, 3);
+    assert(flush_batch_checkpoint(cp) >= 0);
+    close_batch_checkpoint(cp);
+    H5Fclose(file_id);
+
+    file_id = H5Fopen("example_checkpoint.h5", H5F_ACC_RDWR, H5P_DEFAULT);
+    assert(open_batch_checkpoint(file_id, 5, 1, 16) == NULL);
+    assert(open_batch_checkpoint(file_id, 6, 0, 16) == NULL);
+    assert(!is_batch_checkpoint_complete(file_id));
+    cp = open_batch_checkpoint(file_id, 5, 0, 16);
+    assert(cp != NULL);
+    assert(count_completed_batches(cp) == 2);
+    assert(!cp->completed[0] && cp->completed[1] && !cp->completed[2] && cp->completed[3] && !cp->completed[4]);
+    mark_batch_completed(cp, 0);
+    mark_batch_completed(cp, 2);
+    mark_batch_completed(cp, 4);
+    assert(flush_batch_checkpoint(cp) >= 0);
+    close_batch_checkpoint(cp);
+    assert(is_batch_checkpoint_complete(file_id));
+    H5Fclose(file_id);
+}
+
+// チャンク順の行列を H5Dwrite_chunk で書き、行優先で読み戻せることを確認する
+static void test_direct_chunk_write(void) {
+    hid_t file_id = H5Fcreate("example_chunk.h5", H5F_ACC_TRUNC, H5P_DEFAULT, H5P_DEFAULT);
+    hid_t dataset_id = create_population_dataset(file_id, "population_data", 3, 4, 2, 2, CHUNK_CODEC_NONE, 0);
+    assert(dataset_id >= 0);
+
+    // 時間方向はチャンク2つ分 (4行) 確保し、範囲外の1行はデータセットに現れない
+    PQdataMatrix *m = alloc_pqdata_matrix(4, 4, 0);
+    for (int i = 0; i < 16; ++i) {
+        m->data[i] = i + 1;
+    }
+    m->columns = alloc_column_range(0, 4);
+    assert(layout_chunk_order(m, 2, 2) == 0);
+    assert(m->chunk_order);
+    assert(write_pqdata_matrix_chunks(dataset_id, m, 2, 2) >= 0);
+    free_pqdata_matrix(m);
+
+    int out[3 * 4];
+    assert(H5Dread(dataset_id, H5T_NATIVE_INT, H5S_ALL, H5S_ALL, H5P_DEFAULT, out) >= 0);
+    for (int i = 0; i < 12; ++i) {
+        assert(out[i] == i + 1);
+    }
+
+    // 同じ行列をハイパースラブで書いても範囲外の行は切り捨てられる
+    m = alloc_pqdata_matrix(4, 2, 0);
+    m->columns = alloc_column_range(2, 2);
+    assert(write_pqdata_matrix(dataset_id, m, 0) >= 0);
+    free_pqdata_matrix(m);
+    assert(H5Dread(dataset_id, H5T_NATIVE_INT, H5S_ALL, H5S_ALL, H5P_DEFAULT, out) >= 0);
+    assert(out[0] == 1 && out[2] == 0 && out[3] == 0 && out[11] == 0);
+    H5Dclose(dataset_id);
+    H5Fclose(file_id);
+}
+
+// シャードファイルを仮想データセットで列方向に並べて読めることを確認する
+static void test_virtual_shards(void) {
+    char path[64];
+    shard_file_path(path, sizeof(path), "example_shards.h5", 3);
+    assert(strcmp(path, "example_shards-shard03.h5") == 0);
+    shard_file_path(path, sizeof(path), "example_shards", 0);
+    assert(strcmp(path, "example_shards-shard00") == 0);
+
+    char shard_paths[2][64];
+    const char *paths[2];
+    const hsize_t cols[2] = {4, 2};
+    for (int k = 0; k < 2; ++k) {
+        shard_file_path(shard_paths[k], sizeof(shard_paths[k]), "example_shards.h5", k);
+        paths[k] = shard_paths[k];
+        hid_t file_id = H5Fcreate(paths[k], H5F_ACC_TRUNC, H5P_DEFAULT, H5P_DEFAULT);
+        hid_t dataset_id = create_population_dataset(file_id, "population_data", 3, cols[k], 2, 2, CHUNK_CODEC_DEFLATE, 4);
+        PQdataMatrix *m = alloc_pqdata_matrix(3, (int)cols[k], 0);
+        for (int i = 0; i < 3 * (int)cols[k]; ++i) {
+            m->data[i] = (k + 1) * 100 + i;
+        }
+        assert(write_pqdata_matrix(dataset_id, m, 0) >= 0);
+        free_pqdata_matrix(m);
+        H5Dclose(dataset_id);
+        H5Fclose(file_id);
+    }
+
+    hid_t file_id = H5Fcreate("example_shards.h5", H5F_ACC_TRUNC, H5P_DEFAULT, H5P_DEFAULT);
+    hid_t dataset_id = create_virtual_population_dataset(file_id, "population_data", 3, paths, cols, 2);
+    assert(dataset_id >= 0);
+    H5Dclose(dataset_id);
+    H5Fclose(file_id);
+
+    file_id = H5Fopen("example_shards.h5", H5F_ACC_RDONLY, H5P_DEFAULT);
+    dataset_id = H5Dopen(file_id, "population_data", H5P_DEFAULT);
+    hid_t space_id = H5Dget_space(dataset_id);
+    hsize_t dims[2];
+    H5Sget_simple_extent_dims(space_id, dims, NULL);
+    H5Sclose(space_id);
+    assert(dims[0] == 3 && dims[1] == 6);
+    // 圧縮の設定はシャードのデータセットから読む
+    ChunkCodec codec;
+    int level;
+    assert(get_population_codec(dataset_id, &codec, &level) == 0);
+    assert(codec == CHUNK_CODEC_DEFLATE && level == 4);
+    int out[3 * 6];
+    assert(H5Dread(dataset_id, H5T_NATIVE_INT, H5S_ALL, H5S_ALL, H5P_DEFAULT, out) >= 0);
+    for (int t = 0; t < 3; ++t) {
+        for (int j = 0; j < 6; ++j) {
+            int expected = j < 4 ? 100 + t * 4 + j : 200 + t * 2 + (j - 4);
+            assert(out[t * 6 + j] == expected);
+        }
+    }
+    H5Dclose(dataset_id);
+    H5Fclose(file_id);
+}
+
 int main() {
+    test_append_time_axis();
+    test_virtual_shards();
+    test_direct_chunk_write();
+    test_skip_zero_chunks();
+    test_batch_checkpoint();
+
     hdf5_thread_safe_t* hdf5 = hdf5_create("example.h5", "MyDataset", DATASET_SIZE * NUM_THREADS);
 
     pthread_t threads[NUM_THREADS];
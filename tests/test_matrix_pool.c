@@ -0,0 +1,102 @@
+//
+// MatrixPool と、プールから確保した PQdataMatrix の使い回しの確認
+//
+#include <assert.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "matrix_pool.h"
+#include "pg_ingest.h"
+
+static void *return_matrix(void *arg) {
+    free_pqdata_matrix(arg);
+    return NULL;
+}
+
+int main() {
+    const int rows = 1000;
+    const int cols = 16;
+    MatrixPool *pool = create_matrix_pool((size_t)rows * cols * sizeof(int), 2);
+    assert(pool != NULL);
+    assert(pool->mapped_bytes % MATRIX_POOL_ALIGN == 0);
+
+    assert(matrix_pool_reserve(pool, 2) == 0);
+    assert(atomic_load(&pool->mapped) == 2);
+
+    // プールのバッファは 2MiB 境界に揃っている
+    PQdataMatrix *m = alloc_pooled_pqdata_matrix(pool, rows, cols, 0);
+    assert(m != NULL && m->pool == pool);
+    assert((uintptr_t)m->data % MATRIX_POOL_ALIGN == 0);
+    assert(atomic_load(&pool->reused) == 1);
+    int *first = m->data;
+    for (int i = 0; i < rows * cols; ++i) {
+        m->data[i] = i + 1;
+    }
+    free_pqdata_matrix(m);
+
+    // 返したバッファは使い回され、使う範囲はゼロに戻っている
+    PQdataMatrix *a = alloc_pooled_pqdata_matrix(pool, rows, cols, 0);
+    PQdataMatrix *b = alloc_pooled_pqdata_matrix(pool, rows / 2, cols, 0);
+    assert(a->data == first || b->data == first);
+    for (int i = 0; i < rows * cols; ++i) {
+        assert(a->data[i] == 0);
+    }
+    for (int i = 0; i < rows / 2 * cols; ++i) {
+        assert(b->data[i] == 0);
+    }
+    assert(atomic_load(&pool->mapped) == 2);
+
+    // 空になったら新しく確保する。大きすぎる行列はプールを使わない
+    PQdataMatrix *c = alloc_pooled_pqdata_matrix(pool, rows, cols, 0);
+    assert(c->pool == pool);
+    assert(atomic_load(&pool->mapped) == 3);
+    PQdataMatrix *big = alloc_pooled_pqdata_matrix(pool, rows * 2, cols, 0);
+    assert(big->pool == NULL);
+    free_pqdata_matrix(big);
+
+    // チャンク順への並べ替えもプールのバッファで行う
+    c->columns = alloc_column_range(0, cols);
+    for (int i = 0; i < rows * cols; ++i) {
+        c->data[i] = i;
+    }
+    assert(layout_chunk_order(c, 500, 8) == 0);
+    assert(c->chunk_order && c->pool == pool);
+    assert(c->data[0] == 0 && c->data[8] == cols);
+    printf("matrix pool reuse test passed\n");
+
+    // consumer スレッドから返しても持ち主のプールに戻る
+    pthread_t t;
+    pthread_create(&t, NULL, return_matrix, a);
+    pthread_join(t, NULL);
+    pthread_create(&t, NULL, return_matrix, b);
+    pthread_join(t, NULL);
+    free_pqdata_matrix(c);  // 保持できる数を超えた分は munmap される
+    printf("matrix pool return test passed\n");
+
+    destroy_matrix_pool(pool);
+
+    // 予算のうちプールが保持する分は半分までで、保持数は 2 のべき乗に切り下げる
+    size_t pooled_bytes;
+    size_t buffer_bytes = MATRIX_POOL_ALIGN;
+    assert(matrix_pool_cached_for_budget(0, 4, buffer_bytes, &pooled_bytes) == MATRIX_POOL_MAX_CACHED);
+    assert(pooled_bytes == 0);
+    assert(matrix_pool_cached_for_budget(24 * buffer_bytes, 4, buffer_bytes, &pooled_bytes) == 2);
+    assert(pooled_bytes == 8 * buffer_bytes);
+    assert(matrix_pool_cached_for_budget(4 * buffer_bytes, 4, buffer_bytes, &pooled_bytes) == 0);
+    assert(pooled_bytes == 0);
+
+    // 保持しないプールは用意もせず、返されたバッファはすぐ解放する
+    pool = create_matrix_pool(buffer_bytes, 0);
+    assert(matrix_pool_reserve(pool, MATRIX_POOL_PREFILL) == 0);
+    assert(atomic_load(&pool->mapped) == 0);
+    m = alloc_pooled_pqdata_matrix(pool, 16, 16, 0);
+    free_pqdata_matrix(m);
+    assert(queue_length(&pool->free_list) == 0);
+    destroy_matrix_pool(pool);
+    printf("matrix pool budget test passed\n");
+
+    printf("All tests passed!\n");
+    return 0;
+}
@@ -0,0 +1,212 @@
+//
+// producer で計算する日・月・チャンクの集計が行列から直接数えた値と一致し、追記で月や日の途中から書き足しても
+// 一度に計算した集計と同じになることと、build_mesh_summaries で population_data から作っても同じになることを確認する
+//
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "hdf5_ops.h"
+#include "mesh_summary.h"
+
+#define ROWS 2000
+#define COLS 21
+#define DATASET_COLS 23
+// build_mesh_summaries はチャンクの区間を 2 つ以上にまたがせる。時刻方向のチャンクは日の途中で切れる高さにする
+#define BUILD_ROWS 20000
+#define BUILD_COLS 5
+#define BUILD_TIME_CHUNK 1000
+#define BUILD_MESH_CHUNK 2
+
+static int value_at(int t, int j) {
+    // 夜間と列 4 は 0 (値のない時間)
+    if (j == 4 || t % 24 < 5) {
+        return 0;
+    }
+    return (int)((t * 131 + j * 977) % 5000) + 1;
+}
+
+static int* make_matrix(int time_start, int rows) {
+    int *data = (int *)malloc(sizeof(int) * rows * COLS);
+    for (int t = 0; t < rows; ++t) {
+        for (int j = 0; j < COLS; ++j) {
+            // ROWS 以降はチャンク境界に合わせて余分に確保した 0 の行
+            data[t * COLS + j] = time_start + t < ROWS ? value_at(time_start + t, j) : 0;
+        }
+    }
+    return data;
+}
+
+// 区間 bucket の j 列を population の値から数える
+static void expect_stats(SummaryPeriod period, hsize_t bucket, int time_start, int time_end, int j, int64_t out[4]) {
+    hsize_t begin = summary_bucket_start(period, bucket);
+    hsize_t end = summary_bucket_start(period, bucket + 1);
+    out[0] = out[1] = out[2] = out[3] = 0;
+    for (hsize_t t = begin; t < end; ++t) {
+        if ((int)t < time_start || (int)t >= time_end) {
+            continue;
+        }
+        int v = value_at((int)t, j);
+        out[SUMMARY_STAT_SUM] += v;
+        out[SUMMARY_STAT_MAX] = v > out[SUMMARY_STAT_MAX] ? v : out[SUMMARY_STAT_MAX];
+        if (v != 0) {
+            out[SUMMARY_STAT_MIN] = out[SUMMARY_STAT_COUNT] == 0 || v < out[SUMMARY_STAT_MIN] ? v
+                                                                                           : out[SUMMARY_STAT_MIN];
+            out[SUMMARY_STAT_COUNT]++;
+        }
+    }
+}
+
+static void test_compute(void) {
+    // 1月30日の途中から 2月と 3月をまたいで 4月1日まで
+    const int time_start = 700;
+    const int rows = 1500;
+    int *data = make_matrix(time_start, rows);
+    MeshSummary *s = compute_mesh_summary(data, COLS, rows, COLS, time_start);
+    assert(s != NULL);
+    assert(s->first[SUMMARY_PERIOD_DAY] == 29 && s->count[SUMMARY_PERIOD_DAY] == (time_start + rows - 1) / 24 - 29 + 1);
+    assert(s->first[SUMMARY_PERIOD_MONTH] == 0 && s->count[SUMMARY_PERIOD_MONTH] == 4);
+    assert(s->first[SUMMARY_PERIOD_YEAR] == 0 && s->count[SUMMARY_PERIOD_YEAR] == 1);
+    assert(s->first[SUMMARY_PERIOD_CHUNK] == 0 && s->count[SUMMARY_PERIOD_CHUNK] == 1);
+    assert(s->bytes == mesh_summary_bytes(rows, COLS, time_start));
+    for (int p = 0; p < NUM_SUMMARY_PERIODS; ++p) {
+        for (hsize_t b = 0; b < s->count[p]; ++b) {
+            for (int j = 0; j < COLS; ++j) {
+                int64_t expect[4];
+                // ROWS 以降の行は 0
+                expect_stats((SummaryPeriod)p, s->first[p] + b, time_start, ROWS, j, expect);
+                size_t k = b * COLS + j;
+                assert(s->sum[p][k] == expect[SUMMARY_STAT_SUM]);
+                assert(s->min[p][k] == expect[SUMMARY_STAT_MIN]);
+                assert(s->max[p][k] == expect[SUMMARY_STAT_MAX]);
+                assert(s->hours[p][k] == expect[SUMMARY_STAT_COUNT]);
+            }
+        }
+    }
+    assert(s->hours[SUMMARY_PERIOD_MONTH][4] == 0 && s->min[SUMMARY_PERIOD_MONTH][4] == 0);
+    free_mesh_summary(s);
+    free(data);
+    printf("compute test passed\n");
+}
+
+// [time_start, time_start + rows) の行列の集計を書く。行列の列はデータセットの 0-9 列と 12-22 列
+static void write_part(SummaryDatasets *d, int time_start, int rows) {
+    static const hsize_t runs[2][2] = {{0, 10}, {12, 11}};
+    int *data = make_matrix(time_start, rows);
+    MeshSummary *s = compute_mesh_summary(data, COLS, rows, COLS, time_start);
+    assert(s != NULL);
+    assert(write_mesh_summary(d, s, runs, 2) >= 0);
+    free_mesh_summary(s);
+    free(data);
+}
+
+static void check_file(hid_t file_id) {
+    for (int p = 0; p < NUM_SUMMARY_PERIODS; ++p) {
+        hsize_t buckets = summary_bucket_of((SummaryPeriod)p, ROWS - 1) + 1;
+        int64_t *values = (int64_t *)malloc(sizeof(int64_t) * buckets);
+        for (int stat = 0; stat < NUM_SUMMARY_STATS; ++stat) {
+            for (hsize_t column = 0; column < DATASET_COLS; ++column) {
+                assert(read_mesh_summary(file_id, (SummaryPeriod)p, (SummaryStat)stat, column, 0, buckets,
+                                         values) >= 0);
+                for (hsize_t b = 0; b < buckets; ++b) {
+                    int64_t expect[4] = {0, 0, 0, 0};
+                    if (column < 10 || column >= 12) {
+                        expect_stats((SummaryPeriod)p, b, 0, ROWS, (int)(column < 10 ? column : column - 2), expect);
+                    }
+                    assert(values[b] == expect[stat]);
+                }
+            }
+        }
+        free(values);
+    }
+}
+
+static void test_append(const char *path) {
+    hid_t file_id = H5Fcreate(path, H5F_ACC_TRUNC, H5P_DEFAULT, H5P_DEFAULT);
+    assert(file_id >= 0);
+    SummaryDatasets d;
+    // 作成時は population_data の 1000 行分
+    assert(open_summary_datasets(&d, file_id, 1000, DATASET_COLS, 16, 0) == 0);
+    assert(read_summary_rows(file_id) == 0);
+    write_part(&d, 0, 1000);
+    assert(close_summary_datasets(&d, 1000) >= 0);
+    assert(read_summary_rows(file_id) == 1000);
+
+    // 集計した行数と違う時刻からの追記は続けない
+    assert(open_summary_datasets(&d, file_id, ROWS, DATASET_COLS, 16, 1500) == 1);
+
+    // 日の途中から追記し、2月の区間は書いてある値と合わせる。ROWS 以降の行は書かない
+    assert(open_summary_datasets(&d, file_id, ROWS, DATASET_COLS, 16, 1000) == 0);
+    assert(read_summary_rows(file_id) == 0);
+    write_part(&d, 1000, 1100);
+    assert(close_summary_datasets(&d, ROWS) >= 0);
+    assert(read_summary_rows(file_id) == ROWS);
+    check_file(file_id);
+
+    // 途中で止まった追記の後は続けない
+    assert(open_summary_datasets(&d, file_id, ROWS + 100, DATASET_COLS, 16, ROWS) == 0);
+    assert(close_summary_datasets(&d, 0) >= 0);
+    assert(open_summary_datasets(&d, file_id, ROWS + 100, DATASET_COLS, 16, ROWS) == 1);
+    H5Fclose(file_id);
+    printf("append test passed\n");
+}
+
+// population_data の全列を [0, rows) で集計した値と比べる
+static void check_built(hid_t file_id, hsize_t rows) {
+    assert(read_summary_rows(file_id) == rows);
+    for (int p = 0; p < NUM_SUMMARY_PERIODS; ++p) {
+        hsize_t buckets = summary_bucket_of((SummaryPeriod)p, rows - 1) + 1;
+        int64_t *values = (int64_t *)malloc(sizeof(int64_t) * buckets);
+        for (int stat = 0; stat < NUM_SUMMARY_STATS; ++stat) {
+            for (hsize_t column = 0; column < BUILD_COLS; ++column) {
+                assert(read_mesh_summary(file_id, (SummaryPeriod)p, (SummaryStat)stat, column, 0, buckets,
+                                         values) >= 0);
+                for (hsize_t b = 0; b < buckets; ++b) {
+                    int64_t expect[4];
+                    expect_stats((SummaryPeriod)p, b, 0, (int)rows, (int)column, expect);
+                    assert(values[b] == expect[stat]);
+                }
+            }
+        }
+        free(values);
+    }
+}
+
+static void test_build(const char *path) {
+    hid_t file_id = H5Fcreate(path, H5F_ACC_TRUNC, H5P_DEFAULT, H5P_DEFAULT);
+    hid_t dataset_id = create_population_dataset(file_id, "population_data", BUILD_ROWS, BUILD_COLS, BUILD_TIME_CHUNK,
+                                                 BUILD_MESH_CHUNK, CHUNK_CODEC_DEFLATE, 1);
+    assert(dataset_id >= 0);
+    int *data = (int *)malloc(sizeof(int) * BUILD_ROWS * BUILD_COLS);
+    for (int t = 0; t < BUILD_ROWS; ++t) {
+        for (int j = 0; j < BUILD_COLS; ++j) {
+            data[t * BUILD_COLS + j] = value_at(t, j);
+        }
+    }
+    assert(H5Dwrite(dataset_id, H5T_NATIVE_INT, H5S_ALL, H5S_ALL, H5P_DEFAULT, data) >= 0);
+    free(data);
+    H5Dclose(dataset_id);
+
+    // 日とチャンクの途中まで作ってから追いつかせる
+    assert(build_mesh_summaries(file_id, 9000, 2) == 0);
+    check_built(file_id, 9000);
+    assert(build_mesh_summaries(file_id, BUILD_ROWS, 2) == 0);
+    check_built(file_id, BUILD_ROWS);
+
+    // 途中で止まった集計の後は最初から作り直す
+    SummaryDatasets d;
+    assert(open_summary_datasets(&d, file_id, BUILD_ROWS, BUILD_COLS, BUILD_MESH_CHUNK, BUILD_ROWS) == 0);
+    assert(close_summary_datasets(&d, 0) >= 0);
+    assert(build_mesh_summaries(file_id, BUILD_ROWS, 2) == 0);
+    check_built(file_id, BUILD_ROWS);
+    H5Fclose(file_id);
+    printf("build test passed\n");
+}
+
+int main() {
+    test_compute();
+    test_append("example_summary.h5");
+    test_build("example_summary_build.h5");
+    printf("All tests passed!\n");
+    return 0;
+}
@@ -50,6 +50,13 @@ int main() {
     double time_taken = (double)(end_time - start_time) / CLOCKS_PER_SEC;
     printf("Time taken for %lu searches: %f seconds\n", meshid_list_size, time_taken);
 
+    // 人口のあるメッシュだけを順序を保って残す (0 と負の値はメッシュIDにない)
+    int candidates[] = {0, (int)meshid_list[0], -1, (int)meshid_list[meshid_list_size - 1], 0};
+    int kept = keep_populated_meshes(hash, candidates, sizeof(candidates) / sizeof(int));
+    assert(kept == 2);
+    assert(candidates[0] == (int)meshid_list[0] && candidates[1] == (int)meshid_list[meshid_list_size - 1]);
+    printf("Populated mesh filter test passed\n");
+
     // メモリ解放
     free(keys);
     cmph_destroy(hash);
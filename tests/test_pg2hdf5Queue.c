@@ -1,163 +1,307 @@
 //
 // Created by ryuzot on 25/01/06.
 //
+// meshlist_producer → producer x N → consumer と同じ形のパイプラインで、
+// 従来のセマフォ + mutex のキューと lock-free の FIFOQueue のスループットを比べる。
+// usage: test_pg2hdf5Queue [items] [producers] [capacity] [batch]
+//
 #include <assert.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <pthread.h>
 #include <semaphore.h>
-#include <unistd.h>
+#include <time.h>
 
-#include "meshid_ops.h"
 #include "fifioq.h"
 
-#define NUM_PRODUCERS 2
-#define NUM_ITEMS_PER_PRODUCER 30
-#define QUEUE_SIZE 100
-#define MESHLIST_ONCE_LEN 16
+#define DEFAULT_NUM_ITEMS 2000000
+#define DEFAULT_NUM_PRODUCERS 32
+#define DEFAULT_CAPACITY 1024
+#define DEFAULT_BATCH 16
 
+// 置き換え前の実装 (比較用)
+#define LOCKED_QUEUE_SIZE 1024
 
 typedef struct {
-    int rows;
-    int cols;
-    int *data;
-} PQdataMatrix;
+    void *queue[LOCKED_QUEUE_SIZE];
+    int head;
+    int tail;
+    int count;
+    pthread_mutex_t mutex;
+    sem_t full;
+    sem_t empty;
+} LockedQueue;
 
-typedef struct {
-    int meshid_number;
-    uint32_t *meshid_list;
-} MeshidList;
+static void locked_init(LockedQueue *q) {
+    q->head = 0;
+    q->tail = 0;
+    q->count = 0;
+    pthread_mutex_init(&q->mutex, NULL);
+    sem_init(&q->full, 0, LOCKED_QUEUE_SIZE);
+    sem_init(&q->empty, 0, 0);
+}
 
+static void locked_enqueue(LockedQueue *q, void *data) {
+    sem_wait(&q->full);
+    pthread_mutex_lock(&q->mutex);
+    q->queue[q->tail] = data;
+    q->tail = (q->tail + 1) % LOCKED_QUEUE_SIZE;
+    q->count++;
+    pthread_mutex_unlock(&q->mutex);
+    sem_post(&q->empty);
+}
 
-typedef struct {
-    FIFOQueue *DataQueue;
-    FIFOQueue * MeshlistQueue;
-} ProducerObject;
-
-// データ解放関数
-void free_pqdata_matrix(void *data) {
-    PQdataMatrix *m = (PQdataMatrix *)data;
-    free(m->data);
-    free(m);
+static void *locked_dequeue(LockedQueue *q) {
+    sem_wait(&q->empty);
+    pthread_mutex_lock(&q->mutex);
+    void *data = q->queue[q->head];
+    q->head = (q->head + 1) % LOCKED_QUEUE_SIZE;
+    q->count--;
+    pthread_mutex_unlock(&q->mutex);
+    sem_post(&q->full);
+    return data;
 }
 
-void free_meshid_list(void *data) {
-    MeshidList *ml = (MeshidList *)data;
-    free(ml->meshid_list);
-    free(ml);
+static void locked_destroy(LockedQueue *q) {
+    pthread_mutex_destroy(&q->mutex);
+    sem_destroy(&q->full);
+    sem_destroy(&q->empty);
 }
 
+typedef enum {
+    IMPL_LOCKED,
+    IMPL_LOCKFREE,
+    IMPL_LOCKFREE_BATCH,
+} QueueImpl;
 
-void *producer(void *arg) {
-    ProducerObject *obj = (ProducerObject *)arg;
-    FIFOQueue *data_queue = obj->DataQueue;
-    FIFOQueue * meshlist_queue = obj->MeshlistQueue;
-    while (true) {
-        MeshidList *meshid_list = dequeue(meshlist_queue);
-        if (meshid_list == nullptr) {
-            break;
-        }
-        PQdataMatrix *m = (PQdataMatrix *)malloc(sizeof(PQdataMatrix));
-        m->rows = 100;
-        m->cols = meshid_list->meshid_number;
-        m->data = (int *)malloc(sizeof(int) * m->rows * m->cols);
-        if (m->data == NULL) {
-            perror("malloc failed");
-            exit(1);
-        }
-        for (int j = 0; j < m->rows; j++) {
-            for (int k = 0; k < m->cols; k++) {
-                m->data[j * m->cols + k] = 1234;
-            }
-        }
-        enqueue(data_queue, m);
-        free_meshid_list(meshid_list);
+static const char *impl_name(QueueImpl impl) {
+    switch (impl) {
+        case IMPL_LOCKED: return "locked (sem + mutex)";
+        case IMPL_LOCKFREE: return "lock-free";
+        case IMPL_LOCKFREE_BATCH: return "lock-free batch";
+    }
+    return "";
+}
+
+typedef struct {
+    QueueImpl impl;
+    LockedQueue locked_in, locked_out;
+    FIFOQueue in, out;
+    long num_items;
+    int num_producers;
+    int batch;
+} Bench;
+
+// 0 は終端に使うので値は 1 から始める
+static inline void *item_of(long v) {
+    return (void *)(uintptr_t)v;
+}
+
+static void put(Bench *b, int to_out, void *data) {
+    if (b->impl == IMPL_LOCKED) {
+        locked_enqueue(to_out ? &b->locked_out : &b->locked_in, data);
+    } else {
+        enqueue(to_out ? &b->out : &b->in, data);
     }
-    enqueue(data_queue, nullptr);
+}
 
-    pthread_exit(NULL);
+static size_t take(Bench *b, int from_out, void **items) {
+    if (b->impl == IMPL_LOCKED) {
+        items[0] = locked_dequeue(from_out ? &b->locked_out : &b->locked_in);
+        return 1;
+    }
+    if (b->impl == IMPL_LOCKFREE) {
+        items[0] = dequeue(from_out ? &b->out : &b->in);
+        return 1;
+    }
+    return dequeue_batch(from_out ? &b->out : &b->in, items, (size_t)b->batch);
 }
 
-void *consumer(void *arg) {
-    FIFOQueue *q = (FIFOQueue *)arg;
-    int nulp_counter = 0;
-    while (true) {
-        PQdataMatrix *m = dequeue(q);
-        if (m == nullptr) {
-            nulp_counter++;
-            if (nulp_counter == NUM_PRODUCERS) {
-                break;
+static void *meshlist_producer(void *arg) {
+    Bench *b = (Bench *)arg;
+    if (b->impl == IMPL_LOCKFREE_BATCH) {
+        void **items = malloc(sizeof(void *) * b->batch);
+        for (long v = 1; v <= b->num_items;) {
+            int n = 0;
+            while (n < b->batch && v <= b->num_items) {
+                items[n++] = item_of(v++);
             }
-            continue;
+            enqueue_batch(&b->in, items, n);
         }
-        printf("Consumed matrix (rows: %d, cols: %d)\n",m->rows, m->cols);
-        free_pqdata_matrix(m);
+        free(items);
+    } else {
+        for (long v = 1; v <= b->num_items; ++v) {
+            put(b, 0, item_of(v));
+        }
+    }
+    for (int k = 0; k < b->num_producers; ++k) {
+        put(b, 0, NULL);
     }
-    pthread_exit(NULL);
+    return NULL;
 }
 
-void *meshlist_producer(void *arg) {
-    FIFOQueue *meshid_queue = (FIFOQueue *)arg;
-    int i;
-    for (i = 0; i < (int)(meshid_list_size / MESHLIST_ONCE_LEN); ++i) {
-        uint32_t *meshid_once_list = (int *)malloc(MESHLIST_ONCE_LEN * sizeof(uint32_t));
-        MeshidList *m = (MeshidList *)malloc(sizeof(MeshidList));
-        m->meshid_number = MESHLIST_ONCE_LEN;
-        for (int j = 0; j < MESHLIST_ONCE_LEN; ++j) {
-            meshid_once_list[j] = meshid_list[i * MESHLIST_ONCE_LEN + j];
+static void *producer(void *arg) {
+    Bench *b = (Bench *)arg;
+    void **items = malloc(sizeof(void *) * b->batch);
+    int done = 0;
+    while (!done) {
+        size_t n = take(b, 0, items);
+        size_t forward = n;
+        for (size_t i = 0; i < n; ++i) {
+            if (items[i] == NULL) {
+                // 終端以降の要素は他の producer 用の終端なので戻す
+                for (size_t j = i + 1; j < n; ++j) {
+                    put(b, 0, items[j]);
+                }
+                forward = i;
+                done = 1;
+                break;
+            }
         }
-        m->meshid_list = meshid_once_list;
-        enqueue(meshid_queue, m);
-
-        printf("Progress: %d / %lu\n",
-               i * MESHLIST_ONCE_LEN,
-               meshid_list_size);
-    }
-    if (meshid_list_size % MESHLIST_ONCE_LEN != 0) {
-        uint32_t *meshid_once_list = (int *)malloc((meshid_list_size % MESHLIST_ONCE_LEN) * sizeof(uint32_t));
-        MeshidList *m = (MeshidList *)malloc(sizeof(MeshidList));
-        m->meshid_number = (meshid_list_size % MESHLIST_ONCE_LEN);
-        for (int j = 0; j < meshid_list_size % MESHLIST_ONCE_LEN; ++j) {
-            meshid_once_list[j] = meshid_list[i * MESHLIST_ONCE_LEN + j];
+        if (b->impl == IMPL_LOCKFREE_BATCH) {
+            enqueue_batch(&b->out, items, forward);
+        } else {
+            for (size_t i = 0; i < forward; ++i) {
+                put(b, 1, items[i]);
+            }
         }
-        m->meshid_list = meshid_once_list;
-        enqueue(meshid_queue, m);
-    }
-    for (int k = 0; k < NUM_PRODUCERS; ++k) {
-        enqueue(meshid_queue, nullptr);
     }
+    put(b, 1, NULL);
+    free(items);
+    return NULL;
+}
 
-    pthread_exit(NULL);
+typedef struct {
+    ByteBudget *budget;
+    size_t bytes;
+} BudgetWaiter;
+
+static void *budget_waiter(void *arg) {
+    BudgetWaiter *w = (BudgetWaiter *)arg;
+    byte_budget_acquire(w->budget, w->bytes);
+    return NULL;
 }
 
+static void test_byte_budget(void) {
+    ByteBudget budget;
+    init_byte_budget(&budget, 100);
+    byte_budget_acquire(&budget, 60);
+    byte_budget_acquire(&budget, 40);
+    assert(atomic_load(&budget.in_flight) == 100);
 
-int main() {
-    FIFOQueue data_queue;
-    FIFOQueue meshid_queue;
-    init_queue(&data_queue);
-    init_queue(&meshid_queue);
+    // 空きができるまで待たされる
+    pthread_t t;
+    BudgetWaiter w = {.budget = &budget, .bytes = 50};
+    pthread_create(&t, NULL, budget_waiter, &w);
+    struct timespec pause = {.tv_sec = 0, .tv_nsec = 20000000};
+    nanosleep(&pause, NULL);
+    assert(atomic_load(&budget.in_flight) == 100);
+    byte_budget_release(&budget, 60);
+    pthread_join(t, NULL);
+    assert(atomic_load(&budget.in_flight) == 90);
+    assert(atomic_load(&budget.stalls) == 1);
+    assert(atomic_load(&budget.stall_ns) > 0);
+    assert(atomic_load(&budget.peak) == 100);
 
+    // 上限を超える要求も他に何もなければ通す
+    byte_budget_release(&budget, 90);
+    byte_budget_acquire(&budget, 250);
+    assert(atomic_load(&budget.in_flight) == 250);
+    byte_budget_release(&budget, 250);
+}
 
-    pthread_t producer_threads[NUM_PRODUCERS], consumer_thread, meshlist_producer_pthread;
+static double run(QueueImpl impl, long num_items, int num_producers, size_t capacity, int batch) {
+    Bench b = {.impl = impl, .num_items = num_items, .num_producers = num_producers, .batch = batch};
+    if (impl == IMPL_LOCKED) {
+        locked_init(&b.locked_in);
+        locked_init(&b.locked_out);
+    } else {
+        assert(init_queue_with_capacity(&b.in, capacity) == 0);
+        assert(init_queue_with_capacity(&b.out, capacity) == 0);
+    }
 
-    ProducerObject producer_objects[NUM_PRODUCERS];
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    pthread_t mp, producers[num_producers];
+    pthread_create(&mp, NULL, meshlist_producer, &b);
+    for (int i = 0; i < num_producers; ++i) {
+        pthread_create(&producers[i], NULL, producer, &b);
+    }
 
-    pthread_create(&meshlist_producer_pthread, NULL, meshlist_producer, &meshid_queue);
-    for (int i = 0; i < NUM_PRODUCERS; i++) {
-        producer_objects[i].DataQueue = &data_queue;
-        producer_objects[i].MeshlistQueue = &meshid_queue;
-        pthread_create(&producer_threads[i], NULL, producer, &producer_objects[i]);
+    // consumer: 全要素がちょうど1回ずつ届くことを和で確認する
+    void **items = malloc(sizeof(void *) * batch);
+    long received = 0;
+    unsigned long long sum = 0;
+    int nulls = 0;
+    while (nulls < num_producers) {
+        size_t n = take(&b, 1, items);
+        for (size_t i = 0; i < n; ++i) {
+            if (items[i] == NULL) {
+                nulls++;
+                continue;
+            }
+            received++;
+            sum += (uintptr_t)items[i];
+        }
+    }
+    free(items);
+    pthread_join(mp, NULL);
+    for (int i = 0; i < num_producers; ++i) {
+        pthread_join(producers[i], NULL);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+
+    assert(received == num_items);
+    assert(sum == (unsigned long long)num_items * (num_items + 1) / 2);
+
+    if (impl == IMPL_LOCKED) {
+        locked_destroy(&b.locked_in);
+        locked_destroy(&b.locked_out);
+    } else {
+        destroy_queue(&b.in);
+        destroy_queue(&b.out);
     }
+    return (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+}
 
-    pthread_create(&consumer_thread, NULL, consumer, &data_queue);
+int main(int argc, char *argv[]) {
+    long num_items = argc > 1 ? atol(argv[1]) : DEFAULT_NUM_ITEMS;
+    int num_producers = argc > 2 ? atoi(argv[2]) : DEFAULT_NUM_PRODUCERS;
+    size_t capacity = argc > 3 ? (size_t)atol(argv[3]) : DEFAULT_CAPACITY;
+    int batch = argc > 4 ? atoi(argv[4]) : DEFAULT_BATCH;
+    if (num_items <= 0 || num_producers <= 0 || capacity == 0 || batch <= 0) {
+        fprintf(stderr, "Usage: %s [items] [producers] [capacity] [batch]\n", argv[0]);
+        return 1;
+    }
 
-    pthread_join(meshlist_producer_pthread, NULL);
+    // 単一スレッドでの基本動作
+    FIFOQueue q;
+    assert(init_queue_with_capacity(&q, 3) == 0);
+    assert(queue_capacity(&q) == 4);
+    void *out;
+    assert(!try_dequeue(&q, &out));
+    for (long v = 1; v <= 4; ++v) {
+        assert(try_enqueue(&q, item_of(v)));
+    }
+    assert(!try_enqueue(&q, item_of(5)));
+    assert(queue_length(&q) == 4);
+    void *got[4];
+    assert(dequeue_batch(&q, got, 4) == 4);
+    assert(queue_length(&q) == 0);
+    for (long v = 1; v <= 4; ++v) {
+        assert(got[v - 1] == item_of(v));
+    }
+    destroy_queue(&q);
+    test_byte_budget();
 
-    for (int i = 0; i < NUM_PRODUCERS; i++) {
-        pthread_join(producer_threads[i], NULL);
+    printf("%ld items, %d producers, capacity %zu, batch %d\n", num_items, num_producers, capacity, batch);
+    const QueueImpl impls[] = {IMPL_LOCKED, IMPL_LOCKFREE, IMPL_LOCKFREE_BATCH};
+    for (size_t i = 0; i < sizeof(impls) / sizeof(impls[0]); ++i) {
+        double sec = run(impls[i], num_items, num_producers, capacity, batch);
+        printf("%-22s %8.3f s  %10.0f items/s\n", impl_name(impls[i]), sec, num_items / sec);
     }
-    pthread_join(consumer_thread, NULL);
 
     printf("All threads finished.\n");
     return 0;
-}
\ No newline at end of file
+}
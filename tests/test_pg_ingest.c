@@ -0,0 +1,122 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <arpa/inet.h>
+
+#include "pg_ingest.h"
+
+static uint32_t be32_at(const char *p) {
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return ntohl(v);
+}
+
+int main() {
+    // int4[] バイナリ表現のエンコード
+    Int4ArrayParam param = {NULL, 0, 0};
+    uint32_t ids[] = {362335691, 362335692, 362335693};
+    int n = sizeof(ids) / sizeof(ids[0]);
+    assert(encode_int4_array_param(&param, ids, n) == 0);
+    assert(param.length == 20 + n * 8);
+    assert(be32_at(param.data) == 1);           // ndim
+    assert(be32_at(param.data + 4) == 0);       // has_null
+    assert(be32_at(param.data + 8) == 23);      // int4
+    assert(be32_at(param.data + 12) == (uint32_t)n);
+    assert(be32_at(param.data + 16) == 1);
+    for (int i = 0; i < n; ++i) {
+        assert(be32_at(param.data + 20 + i * 8) == 4);
+        assert(be32_at(param.data + 24 + i * 8) == ids[i]);
+    }
+    printf("int4[] encode test passed\n");
+
+    // バッファの拡張と再利用
+    enum { LARGE = 4096 };
+    static uint32_t large[LARGE];
+    for (int i = 0; i < LARGE; ++i) {
+        large[i] = 500000000u + i;
+    }
+    assert(encode_int4_array_param(&param, large, LARGE) == 0);
+    assert(param.length == 20 + LARGE * 8);
+    assert(be32_at(param.data + 24 + (LARGE - 1) * 8) == large[LARGE - 1]);
+    char *reused = param.data;
+    assert(encode_int4_array_param(&param, ids, n) == 0);
+    assert(param.data == reused);
+    printf("int4[] buffer reuse test passed\n");
+    free_int4_array_param(&param);
+
+    assert(parse_ingest_mode(NULL) == INGEST_MODE_EXEC);
+    assert(parse_ingest_mode("copy") == INGEST_MODE_COPY);
+    assert(parse_ingest_mode("rows") == INGEST_MODE_ROWS);
+    assert(parse_ingest_mode("bogus") == -1);
+
+    // チャンク順への並べ替え (4行 x 4列, チャンク 2x2)
+    PQdataMatrix *m = alloc_pqdata_matrix(4, 4, 0);
+    for (int i = 0; i < 16; ++i) {
+        m->data[i] = i;
+    }
+    assert(layout_chunk_order(m, 2, 2) == 0);
+    assert(!m->chunk_order);        // 列番号がなければ揃っているか分からない
+    m->columns = alloc_column_range(2, 4);
+    assert(pqdata_matrix_chunk_aligned(m, 2, 2));
+    assert(!pqdata_matrix_chunk_aligned(m, 3, 2));
+    assert(layout_chunk_order(m, 2, 2) == 0);
+    assert(m->chunk_order);
+    const int expected[16] = {0, 1, 4, 5, 2, 3, 6, 7, 8, 9, 12, 13, 10, 11, 14, 15};
+    assert(memcmp(m->data, expected, sizeof(expected)) == 0);
+    free_pqdata_matrix(m);
+
+    m = alloc_pqdata_matrix(2, 2, 0);
+    m->columns = alloc_column_range(1, 2);
+    assert(layout_chunk_order(m, 2, 2) == 0);
+    assert(!m->chunk_order);        // 列がチャンク境界から始まっていない
+    free_pqdata_matrix(m);
+    printf("chunk layout test passed\n");
+
+    // 圧縮で縮んだ分は予算に返し、解放で残りを返す
+    ByteBudget budget;
+    init_byte_budget(&budget, 1 << 20);
+    size_t matrix_bytes = 16 * 16 * sizeof(int);
+    byte_budget_acquire(&budget, matrix_bytes);
+    m = alloc_pqdata_matrix(16, 16, 0);
+    m->budget = &budget;
+    m->budget_bytes = matrix_bytes;
+    m->columns = alloc_column_range(0, 16);
+    assert(layout_chunk_order(m, 8, 8) == 0);
+    assert(compress_pqdata_chunks(m, 8, 8, CHUNK_CODEC_DEFLATE, DEFAULT_CHUNK_DEFLATE_LEVEL) == 0);
+    assert(m->budget_bytes < matrix_bytes);
+    assert(atomic_load(&budget.in_flight) == m->budget_bytes);
+    free_pqdata_matrix(m);
+    assert(atomic_load(&budget.in_flight) == 0);
+    printf("memory budget test passed\n");
+
+    // 全 producer が途中で終了したら、残ったメッシュリストと終端の NULL を取り除く
+    FIFOQueue meshlist_queue;
+    init_queue(&meshlist_queue);
+    for (int i = 0; i < 3; ++i) {
+        MeshidList *ml = (MeshidList *)calloc(1, sizeof(MeshidList));
+        ml->meshid_list = (uint32_t *)malloc(sizeof(uint32_t));
+        ml->meshid_number = 1;
+        enqueue(&meshlist_queue, ml);
+    }
+    enqueue(&meshlist_queue, NULL);
+    enqueue(&meshlist_queue, NULL);
+    ProducerObject producers[2] = {0};
+    producers[0].failed = true;
+    producers[1].failed = true;
+    assert(drain_meshlist_queue(&meshlist_queue, producers, 2) == 2);
+    assert(queue_length(&meshlist_queue) == 0);
+
+    // 終端まで受け取った producer の分は取り除かない
+    enqueue(&meshlist_queue, NULL);
+    producers[0].failed = false;
+    producers[0].reached_end = true;
+    assert(drain_meshlist_queue(&meshlist_queue, producers, 2) == 1);
+    assert(queue_length(&meshlist_queue) == 0);
+    destroy_queue(&meshlist_queue);
+    printf("meshlist drain test passed\n");
+
+    printf("All tests passed!\n");
+    return 0;
+}
@@ -0,0 +1,114 @@
+//
+// 問い合わせの形によって population_data と population_snapshot を読み分けることを確認する
+//
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "hdf5_ops.h"
+#include "population_reader.h"
+#include "snapshot_dataset.h"
+#include "test_fixture.h"
+
+#define ROWS 96
+#define COLS 8192
+#define TIME_CHUNK 48
+#define MESH_CHUNK 16
+
+static int value_at(hsize_t t, hsize_t j) {
+    return (int)(t * 100000 + j);
+}
+
+static int fixture_value(hsize_t t, hsize_t j, const void *ctx) {
+    (void)ctx;
+    return value_at(t, j);
+}
+
+static void make_file(const char *path, bool with_snapshot) {
+    // メッシュIDは列の逆順に振る
+    uint32_t *ids = (uint32_t *)malloc(sizeof(uint32_t) * COLS);
+    for (uint32_t j = 0; j < COLS; ++j) {
+        ids[j] = FIXTURE_MESHID_BASE + (COLS - 1 - j);
+    }
+    FixtureFile f = {.rows = ROWS, .cols = COLS, .time_chunk = TIME_CHUNK, .mesh_chunk = MESH_CHUNK,
+                     .codec = CHUNK_CODEC_NONE, .level = 0, .meshids = ids, .value_at = fixture_value};
+    hid_t file_id = make_fixture_file(path, &f);
+    free(ids);
+
+    // 後半の1日は写していないことにする
+    if (with_snapshot) {
+        assert(build_snapshot_dataset(file_id, ROWS - 24, 2) == 0);
+    }
+    H5Fclose(file_id);
+}
+
+int main() {
+    const char *path = "example_reader.h5";
+    make_file(path, true);
+    PopulationReader *r = open_population_reader(path);
+    assert(r != NULL);
+    assert(r->rows == ROWS && r->cols == COLS && r->snapshot_rows == ROWS - 24);
+    assert(population_reader_column(r, FIXTURE_MESHID_BASE) == COLS - 1);
+    assert(population_reader_column(r, FIXTURE_MESHID_BASE + COLS) == -1);
+
+    // 全メッシュのある時刻は population_snapshot から読む
+    int *out = (int *)malloc(sizeof(int) * ROWS * COLS);
+    PopulationLayout used;
+    assert(read_population_snapshot(r, 30, out, &used) >= 0);
+    assert(used == POPULATION_LAYOUT_SNAPSHOT);
+    for (hsize_t j = 0; j < COLS; ++j) {
+        assert(out[j] == value_at(30, j));
+    }
+
+    // 写していない時刻は population_data から読む
+    assert(read_population_snapshot(r, ROWS - 1, out, &used) >= 0);
+    assert(used == POPULATION_LAYOUT_SERIES);
+    assert(out[COLS - 1] == value_at(ROWS - 1, COLS - 1));
+
+    // 少ないメッシュの長い時系列は population_data から読む
+    hsize_t cols[3] = {5, 6, 4000};
+    assert(population_read_cost(r, POPULATION_LAYOUT_SERIES, 0, 72, cols, 3) == 2 * 2 * TIME_CHUNK * MESH_CHUNK);
+    assert(population_read_cost(r, POPULATION_LAYOUT_SNAPSHOT, 0, 72, cols, 3) ==
+           3ull * SNAPSHOT_TIME_CHUNK * SNAPSHOT_MESH_CHUNK);
+    assert(population_read_cost(r, POPULATION_LAYOUT_SNAPSHOT, 0, ROWS, cols, 3) == UINT64_MAX);
+    assert(read_population(r, 0, 72, cols, 3, out, &used) >= 0);
+    assert(used == POPULATION_LAYOUT_SERIES);
+    for (hsize_t t = 0; t < 72; ++t) {
+        for (int j = 0; j < 3; ++j) {
+            assert(out[t * 3 + j] == value_at(t, cols[j]));
+        }
+    }
+
+    // 多くのメッシュの1日分は population_snapshot の方が展開する量が少ない
+    hsize_t *many = (hsize_t *)malloc(sizeof(hsize_t) * COLS / 2);
+    for (int j = 0; j < COLS / 2; ++j) {
+        many[j] = (hsize_t)j * 2;
+    }
+    assert(choose_population_layout(r, 24, 24, many, COLS / 2) == POPULATION_LAYOUT_SNAPSHOT);
+    assert(read_population(r, 24, 24, many, COLS / 2, out, &used) >= 0 && used == POPULATION_LAYOUT_SNAPSHOT);
+    for (hsize_t t = 0; t < 24; ++t) {
+        for (int j = 0; j < COLS / 2; ++j) {
+            assert(out[t * (COLS / 2) + j] == value_at(24 + t, many[j]));
+        }
+    }
+    free(many);
+
+    // 範囲外は読まない
+    assert(read_population(r, ROWS - 1, 2, cols, 3, out, &used) < 0);
+    close_population_reader(r);
+    printf("routing test passed\n");
+
+    // population_snapshot がなければいつも population_data
+    make_file(path, false);
+    r = open_population_reader(path);
+    assert(r->dataset_id[POPULATION_LAYOUT_SNAPSHOT] == H5I_INVALID_HID);
+    assert(read_population_snapshot(r, 30, out, &used) >= 0 && used == POPULATION_LAYOUT_SERIES);
+    assert(out[7] == value_at(30, 7));
+    close_population_reader(r);
+    free(out);
+    remove(path);
+    printf("series-only test passed\n");
+
+    printf("All tests passed!\n");
+    return 0;
+}
@@ -0,0 +1,345 @@
+//
+// 集計のカーネル、区間の暦、ロールアップの作成と追記、一番粗い集計から組み立てる問い合わせを確かめる
+//
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "hdf5_ops.h"
+#include "mesh_summary.h"
+#include "rollup.h"
+#include "test_fixture.h"
+
+#define ROWS 9000           // 2017-01-11 まで。2016 年はうるう年で 8784 時間
+#define FIRST_ROWS 5000
+#define TIME_CHUNK 240
+#define MESH_CHUNK 8
+
+static uint32_t meshes[4096];
+static hsize_t num_meshes;
+
+// 1次メッシュ 5339 の 2次メッシュ 4 つ分と 5340 の一部。海のように抜けたメッシュを混ぜる
+static void make_meshes(void) {
+    num_meshes = 0;
+    for (int v = 0; v < 4; ++v) {
+        for (int rw = 0; rw < 100; ++rw) {
+            for (int s = 1; s <= 4; ++s) {
+                if ((v * 400 + rw * 4 + s) % 3 != 0) {
+                    meshes[num_meshes++] = FIXTURE_MESHID_BASE + v * 1000 + rw * 10 + s;
+                }
+            }
+        }
+    }
+    for (int s = 1; s <= 4; ++s) {
+        meshes[num_meshes++] = 534012340u + s;
+    }
+}
+
+static int value_at(hsize_t t, hsize_t c, int generation) {
+    int base = (int)((t * 31 + c * 17) % 500) + (t % 24 >= 8 && t % 24 < 18 ? 200 : 0);
+    return base + (t >= FIRST_ROWS ? generation * 7 : 0);
+}
+
+// ctx は世代 (int)
+static int fixture_value(hsize_t t, hsize_t c, const void *ctx) {
+    return value_at(t, c, *(const int *)ctx);
+}
+
+static FixtureFile fixture(ChunkCodec codec, int level, const int *generation) {
+    return (FixtureFile){.rows = ROWS, .cols = num_meshes, .time_chunk = TIME_CHUNK, .mesh_chunk = MESH_CHUNK,
+                         .codec = codec, .level = level, .meshids = meshes, .value_at = fixture_value,
+                         .ctx = generation};
+}
+
+static void write_population(hid_t dataset_id, int generation) {
+    FixtureFile f = fixture(CHUNK_CODEC_NONE, 0, &generation);
+    write_fixture_population(dataset_id, &f);
+}
+
+static hid_t make_file(const char *path, ChunkCodec codec, int level) {
+    const int generation = 0;
+    FixtureFile f = fixture(codec, level, &generation);
+    return make_fixture_file(path, &f);
+}
+
+// 区域ごとの時間の合計を数え上げる
+typedef struct {
+    hsize_t regions;
+    uint32_t codes[4096];
+    int64_t *hourly;    // ROWS x regions
+} Expected;
+
+static void expect_area(Expected *e, RollupArea area, int generation) {
+    uint32_t divisor = rollup_area_divisor(area);
+    e->regions = 0;
+    hsize_t region_of[4096];
+    for (hsize_t c = 0; c < num_meshes; ++c) {
+        uint32_t code = meshes[c] / divisor;
+        if (e->regions == 0 || e->codes[e->regions - 1] != code) {
+            e->codes[e->regions++] = code;
+        }
+        region_of[c] = e->regions - 1;
+    }
+    e->hourly = (int64_t *)calloc(ROWS * e->regions, sizeof(int64_t));
+    for (hsize_t t = 0; t < ROWS; ++t) {
+        for (hsize_t c = 0; c < num_meshes; ++c) {
+            e->hourly[t * e->regions + region_of[c]] += value_at(t, c, generation);
+        }
+    }
+}
+
+static void expect_range(const Expected *e, hsize_t region, hsize_t t0, hsize_t t1, int64_t *sum, int64_t *max) {
+    *sum = 0;
+    *max = 0;
+    for (hsize_t t = t0; t < t1; ++t) {
+        int64_t v = e->hourly[t * e->regions + region];
+        *sum += v;
+        *max = v > *max ? v : *max;
+    }
+}
+
+static void check_dataset(hid_t file_id, const Expected *e, RollupArea area, RollupPeriod period, hsize_t rows) {
+    hsize_t buckets = rollup_bucket_of(period, rows - 1) + 1;
+    for (int stat = ROLLUP_STAT_SUM; stat <= ROLLUP_STAT_MAX; ++stat) {
+        if (period == ROLLUP_PERIOD_HOUR && stat == ROLLUP_STAT_MAX) {
+            continue;
+        }
+        char name[64];
+        rollup_dataset_name(name, sizeof(name), area, period, (RollupStat)stat);
+        hid_t dataset_id = H5Dopen(file_id, name, H5P_DEFAULT);
+        assert(dataset_id >= 0);
+        hid_t space_id = H5Dget_space(dataset_id);
+        hsize_t dims[2];
+        H5Sget_simple_extent_dims(space_id, dims, NULL);
+        H5Sclose(space_id);
+        assert(dims[0] >= buckets && dims[1] == e->regions);
+        int64_t *out = (int64_t *)malloc(sizeof(int64_t) * dims[0] * dims[1]);
+        assert(H5Dread(dataset_id, H5T_NATIVE_INT64, H5S_ALL, H5S_ALL, H5P_DEFAULT, out) >= 0);
+        H5Dclose(dataset_id);
+        for (hsize_t b = 0; b < buckets; ++b) {
+            hsize_t t0 = rollup_bucket_start(period, b);
+            hsize_t t1 = rollup_bucket_start(period, b + 1);
+            for (hsize_t r = 0; r < e->regions; ++r) {
+                int64_t sum, max;
+                expect_range(e, r, t0, t1 < rows ? t1 : rows, &sum, &max);
+                assert(out[b * e->regions + r] == (stat == ROLLUP_STAT_SUM ? sum : max));
+            }
+        }
+        free(out);
+    }
+}
+
+static void check_rollups(hid_t file_id, hsize_t rows, int generation) {
+    assert(read_rollup_rows(file_id) == rows);
+    for (int area = 0; area < NUM_ROLLUP_AREAS; ++area) {
+        Expected e;
+        expect_area(&e, (RollupArea)area, generation);
+        for (int period = area == ROLLUP_AREA_MESH ? ROLLUP_PERIOD_DAY : ROLLUP_PERIOD_HOUR;
+             period < NUM_ROLLUP_PERIODS; ++period) {
+            check_dataset(file_id, &e, (RollupArea)area, (RollupPeriod)period, rows);
+        }
+        free(e.hourly);
+    }
+}
+
+static void test_kernels(void) {
+    const size_t nrows = 31, width = 37, stride = 40;
+    int32_t src[nrows * stride];
+    int64_t sums[nrows * stride];
+    for (size_t i = 0; i < nrows * stride; ++i) {
+        src[i] = (int32_t)((i * 2654435761u) % 100000) - (i % 7 == 0 ? 2000 : 0);
+        sums[i] = (int64_t)src[i] * 100000;
+    }
+    int64_t expect_sum[width], expect_sums[width];
+    int32_t expect_max[width], expect_maxes[width];
+    assert(rollup_use_isa(ROLLUP_ISA_SCALAR) == 0);
+    rollup_reduce_rows(src, stride, nrows, width, expect_sum, expect_max);
+    rollup_reduce_sums(sums, src, stride, nrows, width, expect_sums, expect_maxes);
+    for (size_t j = 0; j < width; ++j) {
+        int64_t s = 0;
+        int32_t m = src[j];
+        for (size_t t = 0; t < nrows; ++t) {
+            s += src[t * stride + j];
+            m = src[t * stride + j] > m ? src[t * stride + j] : m;
+        }
+        assert(expect_sum[j] == s && expect_max[j] == m && expect_sums[j] == s * 100000 && expect_maxes[j] == m);
+    }
+    for (RollupIsa isa = ROLLUP_ISA_AVX2; isa <= ROLLUP_ISA_AVX512; ++isa) {
+        if (rollup_use_isa(isa) != 0) {
+            printf("%s is not supported on this CPU\n", rollup_isa_name(isa));
+            continue;
+        }
+        int64_t sum[width];
+        int32_t max[width];
+        rollup_reduce_rows(src, stride, nrows, width, sum, max);
+        assert(memcmp(sum, expect_sum, sizeof(sum)) == 0 && memcmp(max, expect_max, sizeof(max)) == 0);
+        rollup_reduce_sums(sums, src, stride, nrows, width, sum, max);
+        assert(memcmp(sum, expect_sums, sizeof(sum)) == 0 && memcmp(max, expect_maxes, sizeof(max)) == 0);
+        rollup_reduce_rows(src, stride, 0, width, sum, max);
+        assert(sum[0] == 0 && max[width - 1] == 0);
+    }
+
+    // rollup_reduce_stats は負でない値を取る。0 は最小と個数に数えず、列 3 はすべて 0
+    int32_t counts[nrows * stride];
+    for (size_t i = 0; i < nrows * stride; ++i) {
+        counts[i] = i % 5 == 0 || i % stride == 3 ? 0 : (int32_t)((i * 2654435761u) % 100000);
+    }
+    int64_t stat_sum[width];
+    int32_t stat_min[width], stat_max[width], stat_count[width];
+    assert(rollup_use_isa(ROLLUP_ISA_SCALAR) == 0);
+    rollup_reduce_stats(counts, stride, nrows, width, stat_sum, stat_min, stat_max, stat_count);
+    for (size_t j = 0; j < width; ++j) {
+        int64_t s = 0;
+        int32_t lo = 0, hi = 0, n = 0;
+        for (size_t t = 0; t < nrows; ++t) {
+            int32_t v = counts[t * stride + j];
+            s += v;
+            hi = v > hi ? v : hi;
+            if (v != 0) {
+                lo = n == 0 || v < lo ? v : lo;
+                n++;
+            }
+        }
+        assert(stat_sum[j] == s && stat_min[j] == lo && stat_max[j] == hi && stat_count[j] == n);
+    }
+    assert(stat_count[3] == 0 && stat_min[3] == 0);
+    for (RollupIsa isa = ROLLUP_ISA_AVX2; isa <= ROLLUP_ISA_AVX512; ++isa) {
+        if (rollup_use_isa(isa) != 0) {
+            continue;
+        }
+        int64_t sum[width];
+        int32_t min[width], max[width], count[width];
+        rollup_reduce_stats(counts, stride, nrows, width, sum, min, max, count);
+        assert(memcmp(sum, stat_sum, sizeof(sum)) == 0 && memcmp(min, stat_min, sizeof(min)) == 0 &&
+               memcmp(max, stat_max, sizeof(max)) == 0 && memcmp(count, stat_count, sizeof(count)) == 0);
+        rollup_reduce_stats(counts, stride, 0, width, sum, min, max, count);
+        assert(sum[0] == 0 && min[0] == 0 && max[width - 1] == 0 && count[width - 1] == 0);
+    }
+    rollup_use_isa(ROLLUP_ISA_AUTO);
+    printf("kernel test passed (%s)\n", rollup_isa_name(rollup_active_isa()));
+}
+
+static void test_calendar(void) {
+    // 区間は REFERENCE_MOBAKU_DATETIME (2016-01-01 00:00) から数える
+    assert(rollup_bucket_start(ROLLUP_PERIOD_MONTH, 0) == 0 && rollup_bucket_start(ROLLUP_PERIOD_YEAR, 0) == 0);
+    assert(rollup_bucket_start(ROLLUP_PERIOD_DAY, 3) == 72);
+    assert(rollup_bucket_start(ROLLUP_PERIOD_MONTH, 1) == 31 * 24);
+    assert(rollup_bucket_start(ROLLUP_PERIOD_MONTH, 2) == 60 * 24);     // 2016-02 は 29 日
+    assert(rollup_bucket_start(ROLLUP_PERIOD_MONTH, 14) == (366 + 31 + 28) * 24);
+    assert(rollup_bucket_start(ROLLUP_PERIOD_YEAR, 1) == 366 * 24);
+    assert(rollup_bucket_start(ROLLUP_PERIOD_YEAR, 5) == (366 * 2 + 365 * 3) * 24);
+    assert(rollup_bucket_of(ROLLUP_PERIOD_MONTH, 60 * 24 - 1) == 1);
+    assert(rollup_bucket_of(ROLLUP_PERIOD_MONTH, 60 * 24) == 2);
+    assert(rollup_bucket_of(ROLLUP_PERIOD_YEAR, 366 * 24 - 1) == 0);
+    assert(rollup_bucket_of(ROLLUP_PERIOD_YEAR, 74159) == 8);           // 2024-06-17
+    for (hsize_t m = 0; m < 120; ++m) {
+        hsize_t start = rollup_bucket_start(ROLLUP_PERIOD_MONTH, m);
+        assert(rollup_bucket_of(ROLLUP_PERIOD_MONTH, start) == m);
+        assert(rollup_bucket_of(ROLLUP_PERIOD_MONTH, start + 24 * 28 - 1) == m);
+    }
+    printf("calendar test passed\n");
+}
+
+static void test_queries(hid_t file_id) {
+    const hsize_t ranges[][2] = {
+        {0, ROWS},              // 2016 年は年、残りは日と時間
+        {0, 24},                // 1 日ちょうど
+        {5, 7},
+        {100, 8784 + 7 * 24 + 5},   // 月の途中から 2017-01-08 05:00 まで
+        {1000, 1000},
+        {744, 1440},            // 2016-02 ちょうど
+    };
+    for (int area = 0; area < NUM_ROLLUP_AREAS; ++area) {
+        Expected e;
+        expect_area(&e, (RollupArea)area, 1);
+        hsize_t region = e.regions / 2;
+        assert(rollup_region(file_id, (RollupArea)area, e.codes[region]) == (long long)region);
+        assert(rollup_region(file_id, (RollupArea)area, e.codes[e.regions - 1] + 1) == -1);
+        for (size_t i = 0; i < sizeof(ranges) / sizeof(ranges[0]); ++i) {
+            RollupValue v;
+            assert(rollup_aggregate(file_id, (RollupArea)area, region, ranges[i][0], ranges[i][1], &v) == 0);
+            int64_t sum, max;
+            expect_range(&e, region, ranges[i][0], ranges[i][1], &sum, &max);
+            assert(v.sum == sum && v.max == max && v.hours == ranges[i][1] - ranges[i][0]);
+            int reads = 0;
+            for (int p = 0; p < NUM_ROLLUP_PERIODS; ++p) {
+                reads += v.reads[p];
+            }
+            assert(reads <= 2 * NUM_ROLLUP_PERIODS - 1);
+        }
+        free(e.hourly);
+    }
+    // 丸ごと入る一番粗い区間を使う
+    RollupValue v;
+    assert(rollup_aggregate(file_id, ROLLUP_AREA_MESH1, 0, 0, ROWS, &v) == 0);
+    assert(v.reads[ROLLUP_PERIOD_YEAR] == 1 && v.reads[ROLLUP_PERIOD_MONTH] == 0 && v.reads[ROLLUP_PERIOD_DAY] == 1 &&
+           v.reads[ROLLUP_PERIOD_HOUR] == 0);
+    assert(rollup_aggregate(file_id, ROLLUP_AREA_MESH2, 0, 744, 1440, &v) == 0);
+    assert(v.reads[ROLLUP_PERIOD_MONTH] == 1 && v.reads[ROLLUP_PERIOD_DAY] == 0);
+    assert(rollup_aggregate(file_id, ROLLUP_AREA_MESH, 0, 0, ROWS + 1, &v) != 0);
+    printf("query test passed\n");
+}
+
+int main() {
+    make_meshes();
+    test_kernels();
+    test_calendar();
+
+    // 途中まで集計してから、追記された行だけを集計し直す
+    const char *path = "example_rollup.h5";
+    hid_t file_id = make_file(path, CHUNK_CODEC_DEFLATE, 4);
+    assert(build_rollups(file_id, FIRST_ROWS, 3) == 0);
+    check_rollups(file_id, FIRST_ROWS, 0);
+    hid_t dataset_id = H5Dopen(file_id, "population_data", H5P_DEFAULT);
+    write_population(dataset_id, 1);
+    H5Dclose(dataset_id);
+    assert(build_rollups(file_id, ROWS, 2) == 0);
+    check_rollups(file_id, ROWS, 1);
+    printf("incremental build test passed\n");
+    test_queries(file_id);
+
+    // 集計し終えた行が書き直されたら、済んだ行数を下げて集計し直す
+    dataset_id = H5Dopen(file_id, "population_data", H5P_DEFAULT);
+    write_population(dataset_id, 2);
+    H5Dclose(dataset_id);
+    assert(lower_rollup_rows(file_id, ROWS) == 0 && read_rollup_rows(file_id) == ROWS);
+    assert(lower_rollup_rows(file_id, 0) == 0 && read_rollup_rows(file_id) == 0);
+    assert(build_rollups(file_id, ROWS, 2) == 0);
+    check_rollups(file_id, ROWS, 2);
+    printf("lowered rows test passed\n");
+    H5Fclose(file_id);
+
+    // 取り込み時の集計が mesh の段を書いていれば、build_rollups の前から mesh を問い合わせられ、
+    // build_rollups は区域の段だけを足す
+    file_id = make_file(path, CHUNK_CODEC_DEFLATE, 4);
+    assert(build_mesh_summaries(file_id, ROWS, 2) == 0);
+    assert(read_rollup_rows(file_id) == 0 && read_summary_rows(file_id) == ROWS);
+    Expected e;
+    expect_area(&e, ROLLUP_AREA_MESH, 0);
+    for (int period = ROLLUP_PERIOD_DAY; period < NUM_ROLLUP_PERIODS; ++period) {
+        check_dataset(file_id, &e, ROLLUP_AREA_MESH, (RollupPeriod)period, ROWS);
+    }
+    RollupValue v;
+    int64_t sum, max;
+    assert(rollup_aggregate(file_id, ROLLUP_AREA_MESH, 3, 0, ROWS, &v) == 0);
+    expect_range(&e, 3, 0, ROWS, &sum, &max);
+    assert(v.sum == sum && v.max == max && v.reads[ROLLUP_PERIOD_YEAR] == 1);
+    free(e.hourly);
+    assert(rollup_aggregate(file_id, ROLLUP_AREA_MESH1, 0, 0, 24, &v) != 0);
+    assert(build_rollups(file_id, ROWS, 3) == 0);
+    check_rollups(file_id, ROWS, 0);
+    H5Fclose(file_id);
+    printf("fused summary test passed\n");
+
+    // HDF5 のフィルタで読む経路
+    file_id = make_file(path, CHUNK_CODEC_SCALEOFFSET, 0);
+    assert(build_rollups(file_id, ROWS, 4) == 0);
+    check_rollups(file_id, ROWS, 0);
+    H5Fclose(file_id);
+    remove(path);
+    printf("hyperslab build test passed\n");
+
+    printf("All tests passed!\n");
+    return 0;
+}
@@ -0,0 +1,176 @@
+//
+// population_snapshot を生のチャンクの並列コピーと HDF5 のフィルタの両方で作り、元と同じ値になることを確認する
+//
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "hdf5_ops.h"
+#include "snapshot_dataset.h"
+
+static int value_at(hsize_t t, hsize_t j, int generation) {
+    return (int)((j * 7 + t) % 1000) + (t % 24 < 8 ? 0 : 300) + generation * 10000 * (t >= 70);
+}
+
+static void write_population(hid_t dataset_id, hsize_t rows, hsize_t cols, int generation) {
+    int *data = (int *)malloc(sizeof(int) * rows * cols);
+    for (hsize_t t = 0; t < rows; ++t) {
+        for (hsize_t j = 0; j < cols; ++j) {
+            data[t * cols + j] = value_at(t, j, generation);
+        }
+    }
+    assert(H5Dwrite(dataset_id, H5T_NATIVE_INT, H5S_ALL, H5S_ALL, H5P_DEFAULT, data) >= 0);
+    free(data);
+}
+
+// population_snapshot の先頭 rows 行が generation の値と一致する
+static void check_snapshot(hid_t file_id, hsize_t rows, hsize_t cols, int generation) {
+    hid_t dataset_id = H5Dopen(file_id, SNAPSHOT_DATASET, H5P_DEFAULT);
+    assert(dataset_id >= 0);
+    assert(read_snapshot_rows(dataset_id) == rows);
+    hid_t plist_id = H5Dget_create_plist(dataset_id);
+    hsize_t chunk[2];
+    assert(H5Pget_chunk(plist_id, 2, chunk) == 2);
+    assert(chunk[0] == SNAPSHOT_TIME_CHUNK && chunk[1] == (cols < SNAPSHOT_MESH_CHUNK ? cols : SNAPSHOT_MESH_CHUNK));
+    H5Pclose(plist_id);
+
+    hid_t space_id = H5Dget_space(dataset_id);
+    hsize_t start[2] = {0, 0};
+    hsize_t count[2] = {rows, cols};
+    H5Sselect_hyperslab(space_id, H5S_SELECT_SET, start, NULL, count, NULL);
+    hid_t mem_space = H5Screate_simple(2, count, NULL);
+    int *out = (int *)malloc(sizeof(int) * rows * cols);
+    assert(H5Dread(dataset_id, H5T_NATIVE_INT, mem_space, space_id, H5P_DEFAULT, out) >= 0);
+    for (hsize_t t = 0; t < rows; ++t) {
+        for (hsize_t j = 0; j < cols; ++j) {
+            assert(out[t * cols + j] == value_at(t, j, generation));
+        }
+    }
+    free(out);
+    H5Sclose(mem_space);
+    H5Sclose(space_id);
+    H5Dclose(dataset_id);
+}
+
+static void test_codec(const char *path, ChunkCodec codec, int level, hsize_t cols, hsize_t mesh_chunk) {
+    const hsize_t rows = 100;
+    hid_t file_id = H5Fcreate(path, H5F_ACC_TRUNC, H5P_DEFAULT, H5P_DEFAULT);
+    hid_t dataset_id = create_population_dataset(file_id, "population_data", rows, cols, 48, mesh_chunk, codec, level);
+    assert(dataset_id >= 0);
+    write_population(dataset_id, rows, cols, 0);
+
+    // 途中の時刻まで写す
+    assert(build_snapshot_dataset(file_id, 70, 3) == 0);
+    check_snapshot(file_id, 70, cols, 0);
+
+    // 追記で後ろの行が書かれたら、そこから先だけを写し直す
+    write_population(dataset_id, rows, cols, 1);
+    H5Dclose(dataset_id);
+    assert(build_snapshot_dataset(file_id, rows, 2) == 0);
+    check_snapshot(file_id, rows, cols, 1);
+
+    // 同じ圧縮で作られる
+    dataset_id = H5Dopen(file_id, SNAPSHOT_DATASET, H5P_DEFAULT);
+    ChunkCodec snapshot_codec;
+    int snapshot_level;
+    assert(get_population_codec(dataset_id, &snapshot_codec, &snapshot_level) == 0);
+    assert(snapshot_codec == codec && snapshot_level == level);
+    H5Dclose(dataset_id);
+    H5Fclose(file_id);
+    remove(path);
+}
+
+// 圧縮で縮まなかったチャンクは HDF5 がフィルタを飛ばして保存する (filter_mask が 0 でない)。
+// そのようなチャンクが混ざっていても生のチャンクの経路で写せる
+static void test_skipped_filter(const char *path) {
+    const hsize_t rows = 100;
+    const hsize_t cols = 40;
+    const hsize_t time_chunk = 48;
+    const hsize_t mesh_chunk = 8;
+    hid_t file_id = H5Fcreate(path, H5F_ACC_TRUNC, H5P_DEFAULT, H5P_DEFAULT);
+    hid_t dataset_id = create_population_dataset(file_id, "population_data", rows, cols, time_chunk, mesh_chunk,
+                                                 CHUNK_CODEC_DEFLATE, 4);
+    assert(dataset_id >= 0);
+    write_population(dataset_id, rows, cols, 0);
+
+    int chunk[48 * 8];
+    hsize_t offset[2] = {time_chunk, mesh_chunk};
+    for (hsize_t t = 0; t < time_chunk; ++t) {
+        for (hsize_t j = 0; j < mesh_chunk; ++j) {
+            chunk[t * mesh_chunk + j] = value_at(offset[0] + t, offset[1] + j, 0);
+        }
+    }
+    // shuffle と deflate の両方を飛ばした生の値
+    assert(H5Dwrite_chunk(dataset_id, H5P_DEFAULT, 0x3, offset, sizeof(chunk), chunk) >= 0);
+    unsigned filter_mask = 0;
+    haddr_t address;
+    hsize_t stored;
+    assert(H5Dget_chunk_info_by_coord(dataset_id, offset, &filter_mask, &address, &stored) >= 0);
+    assert(filter_mask == 0x3 && stored == sizeof(chunk));
+    H5Dclose(dataset_id);
+
+    assert(build_snapshot_dataset(file_id, rows, 2) == 0);
+    check_snapshot(file_id, rows, cols, 0);
+    H5Fclose(file_id);
+    remove(path);
+}
+
+// 抜けたバッチを --resume で埋めたときと同じく、写し終えた行が書き直されたら済んだ行数を下げて写し直す
+static void test_lowered_rows(const char *path) {
+    const hsize_t rows = 100;
+    const hsize_t cols = 40;
+    hid_t file_id = H5Fcreate(path, H5F_ACC_TRUNC, H5P_DEFAULT, H5P_DEFAULT);
+    hid_t dataset_id = create_population_dataset(file_id, "population_data", rows, cols, 48, 8,
+                                                 CHUNK_CODEC_DEFLATE, 4);
+    assert(dataset_id >= 0);
+    assert(lower_snapshot_rows(file_id, 0) == 0);
+
+    // 値がまだない (0 の) 行を写し終えてから、全体が書かれる
+    assert(build_snapshot_dataset(file_id, rows, 2) == 0);
+    write_population(dataset_id, rows, cols, 0);
+    H5Dclose(dataset_id);
+    assert(build_snapshot_dataset(file_id, rows, 2) == 0);
+    hid_t snapshot_id = H5Dopen(file_id, SNAPSHOT_DATASET, H5P_DEFAULT);
+    int first;
+    hsize_t one[2] = {1, 1};
+    hsize_t origin[2] = {0, 1};
+    hid_t space_id = H5Dget_space(snapshot_id);
+    H5Sselect_hyperslab(space_id, H5S_SELECT_SET, origin, NULL, one, NULL);
+    hid_t mem_space = H5Screate_simple(2, one, NULL);
+    assert(H5Dread(snapshot_id, H5T_NATIVE_INT, mem_space, space_id, H5P_DEFAULT, &first) >= 0);
+    assert(first == 0);
+    H5Sclose(mem_space);
+    H5Sclose(space_id);
+    H5Dclose(snapshot_id);
+
+    assert(lower_snapshot_rows(file_id, 0) == 0);
+    assert(build_snapshot_dataset(file_id, rows, 2) == 0);
+    check_snapshot(file_id, rows, cols, 0);
+    H5Fclose(file_id);
+    remove(path);
+}
+
+int main() {
+    // 生のチャンクを読み書きする経路 (写し先のチャンク幅が元のチャンク幅で割り切れる)
+    test_codec("example_snapshot.h5", CHUNK_CODEC_DEFLATE, 4, 40, 8);
+    test_codec("example_snapshot.h5", CHUNK_CODEC_NONE, 0, 40, 8);
+    printf("raw chunk copy test passed\n");
+
+    test_skipped_filter("example_snapshot.h5");
+    printf("skipped filter test passed\n");
+
+    test_lowered_rows("example_snapshot.h5");
+    printf("lowered rows test passed\n");
+
+    // 右端のスラブは SNAPSHOT_MESH_CHUNK より狭い
+    test_codec("example_snapshot.h5", CHUNK_CODEC_DELTA_BITPACK, 1, SNAPSHOT_MESH_CHUNK + 16, 16);
+    printf("partial slab test passed\n");
+
+    // HDF5 のフィルタに任せる経路
+    test_codec("example_snapshot.h5", CHUNK_CODEC_SCALEOFFSET, 0, 40, 8);
+    test_codec("example_snapshot.h5", CHUNK_CODEC_DEFLATE, 1, 44, 8);
+    printf("hyperslab copy test passed\n");
+
+    printf("All tests passed!\n");
+    return 0;
+}
@@ -0,0 +1,93 @@
+//
+// 書き込み内容の用意 (plan_pqdata_write) と I/O スレッドでの書き込みを確認する
+//
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "write_behind.h"
+
+static PQdataMatrix *make_matrix(int rows, int cols, int base) {
+    PQdataMatrix *m = alloc_pqdata_matrix(rows, cols, 0);
+    for (int i = 0; i < rows * cols; ++i) {
+        m->data[i] = base + i;
+    }
+    m->last_time_index = rows - 1;
+    return m;
+}
+
+int main() {
+    // 連続する列はまとめ、時間軸を超える行は切り詰める
+    PQdataMatrix *m = make_matrix(6, 5, 0);
+    int columns[5] = {0, 1, 4, 5, 6};
+    m->columns = (int *)malloc(sizeof(columns));
+    for (int j = 0; j < 5; ++j) {
+        m->columns[j] = columns[j];
+    }
+    PQdataWrite w;
+    assert(plan_pqdata_write(&w, m, 0, 4) == 0);
+    assert(w.rows == 4 && !w.chunked);
+    assert(w.num_runs == 2);
+    assert(w.runs[0][0] == 0 && w.runs[0][1] == 2);
+    assert(w.runs[1][0] == 4 && w.runs[1][1] == 3);
+    free_pqdata_write(&w);
+
+    m = make_matrix(2, 2, 0);
+    m->time_start = 4;
+    assert(plan_pqdata_write(&w, m, 3, 4) == 0);
+    assert(w.rows == 0);
+    free_pqdata_write(&w);
+    printf("write plan test passed\n");
+
+    // I/O スレッドで書き、完了したバッチを記録する
+    hid_t file_id = H5Fcreate("example_write_behind.h5", H5F_ACC_TRUNC, H5P_DEFAULT, H5P_DEFAULT);
+    hid_t dataset_id = create_population_dataset(file_id, "population_data", 4, 8, 2, 2, CHUNK_CODEC_NONE, 0);
+    BatchCheckpoint *cp = create_batch_checkpoint(file_id, 4, 0, 2);
+    WriteBehind writer;
+    assert(start_write_behind(&writer, file_id, dataset_id, 2, 2, cp, 0, NULL, -1, -1) == 0);
+    assert(writer.max_hour == 3);
+    for (int b = 0; b < 4; ++b) {
+        // 時間方向に1行はみ出した行列
+        PQdataMatrix *bm = make_matrix(5, 2, b * 100);
+        bm->batch_index = b;
+        PQdataWrite *bw = (PQdataWrite *)malloc(sizeof(PQdataWrite));
+        assert(plan_pqdata_write(bw, bm, (hsize_t)b * 2, 4) == 0);
+        submit_pqdata_write(&writer, bw);
+    }
+    finish_write_behind(&writer);
+    assert(writer.writes == 4 && writer.failures == 0);
+    assert(writer.last_ingested_hour == 3);
+    assert(flush_batch_checkpoint(cp) >= 0);
+    assert(count_completed_batches(cp) == 4);
+    close_batch_checkpoint(cp);
+
+    int out[4 * 8];
+    assert(H5Dread(dataset_id, H5T_NATIVE_INT, H5S_ALL, H5S_ALL, H5P_DEFAULT, out) >= 0);
+    for (int t = 0; t < 4; ++t) {
+        for (int j = 0; j < 8; ++j) {
+            assert(out[t * 8 + j] == (j / 2) * 100 + t * 2 + j % 2);
+        }
+    }
+    report_write_behind(&writer, 0, 0);
+    printf("write-behind test passed\n");
+
+    // 失敗したバッチがあれば、他のバッチを書けても最終時刻は進めない
+    assert(start_write_behind(&writer, file_id, dataset_id, 2, 2, NULL, 0, NULL, 1, -1) == 0);
+    for (int b = 0; b < 2; ++b) {
+        PQdataMatrix *bm = make_matrix(4, 2, 0);
+        PQdataWrite *bw = (PQdataWrite *)malloc(sizeof(PQdataWrite));
+        // 2つ目はデータセットの列をはみ出すので書けない
+        assert(plan_pqdata_write(bw, bm, b == 0 ? 0 : 7, 4) == 0);
+        submit_pqdata_write(&writer, bw);
+    }
+    finish_write_behind(&writer);
+    assert(writer.writes == 1 && writer.failures == 1);
+    assert(writer.written_hour == 3);
+    assert(writer.last_ingested_hour == 1);
+    H5Dclose(dataset_id);
+    H5Fclose(file_id);
+    printf("write-behind failure test passed\n");
+
+    printf("All tests passed!\n");
+    return 0;
+}